@@ -0,0 +1,647 @@
+#include <argp.h>
+#include <assert.h>
+#include <errno.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "../include/raft.h"
+#include "../include/raft/uv.h"
+
+static char doc[] =
+    "Benchmark commit throughput and latency of a local raft cluster";
+
+/* Maximum number of servers in the cluster. */
+#define MAX_SERVERS 9
+
+/* Maximum number of distinct entry sizes in the mix. */
+#define MAX_SIZES 16
+
+/* How often to check for a leader and submit rate-limited entries. */
+#define TICK_INTERVAL 1 /* milliseconds */
+
+/* How long to wait for a leader to be elected before giving up. */
+#define ELECTION_DEADLINE 30000 /* milliseconds */
+
+/* Order of fields: {NAME, KEY, ARG, FLAGS, DOC, GROUP}.*/
+static struct argp_option options[] = {
+    {"dir", 'd', "DIR", 0, "Directory to use for temp files (default /tmp)", 0},
+    {"servers", 'n', "N", 0, "Number of servers in the cluster (default 3)", 0},
+    {"size", 's', "SIZES", 0,
+     "Comma-separated entry sizes, cycled through (default 128)", 0},
+    {"concurrency", 'c', "N", 0, "Maximum in-flight entries (default 64)", 0},
+    {"rate", 'r', "N", 0, "Entries submitted per second (default no limit)",
+     0},
+    {"time", 't', "SECS", 0, "How long to run the benchmark (default 10)", 0},
+    {"entries", 'e', "N", 0, "Stop after this many entries (default none)", 0},
+    {"port", 'p', "PORT", 0, "Port of the first server (default 9100)", 0},
+    {0}};
+
+struct arguments
+{
+    char *dir;
+    unsigned n_servers;
+    unsigned sizes[MAX_SIZES];
+    unsigned n_sizes;
+    unsigned concurrency;
+    unsigned rate;
+    unsigned time;
+    unsigned long entries;
+    unsigned port;
+};
+
+/* Parse a comma-separated list of entry sizes. */
+static int parseSizes(struct arguments *arguments, char *arg)
+{
+    char *token;
+    char *saveptr;
+
+    arguments->n_sizes = 0;
+    for (token = strtok_r(arg, ",", &saveptr); token != NULL;
+         token = strtok_r(NULL, ",", &saveptr)) {
+        int size = atoi(token);
+        if (size <= 0 || arguments->n_sizes == MAX_SIZES) {
+            return -1;
+        }
+        arguments->sizes[arguments->n_sizes] = (unsigned)size;
+        arguments->n_sizes++;
+    }
+    return arguments->n_sizes > 0 ? 0 : -1;
+}
+
+static error_t argumentsParse(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+    switch (key) {
+        case 'd':
+            arguments->dir = arg;
+            break;
+        case 'n':
+            arguments->n_servers = (unsigned)atoi(arg);
+            if (arguments->n_servers == 0 ||
+                arguments->n_servers > MAX_SERVERS) {
+                argp_error(state, "servers must be between 1 and %d",
+                           MAX_SERVERS);
+            }
+            break;
+        case 's':
+            if (parseSizes(arguments, arg) != 0) {
+                argp_error(state, "invalid entry sizes");
+            }
+            break;
+        case 'c':
+            arguments->concurrency = (unsigned)atoi(arg);
+            if (arguments->concurrency == 0) {
+                argp_error(state, "concurrency must be positive");
+            }
+            break;
+        case 'r':
+            arguments->rate = (unsigned)atoi(arg);
+            break;
+        case 't':
+            arguments->time = (unsigned)atoi(arg);
+            break;
+        case 'e':
+            arguments->entries = strtoul(arg, NULL, 10);
+            break;
+        case 'p':
+            arguments->port = (unsigned)atoi(arg);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/********************************************************************
+ *
+ * FSM that just counts the bytes it applies.
+ *
+ ********************************************************************/
+
+static int fsmApply(struct raft_fsm *fsm,
+                    const struct raft_buffer *buf,
+                    void **result)
+{
+    uint64_t *count = fsm->data;
+    *count += buf->len;
+    *result = NULL;
+    return 0;
+}
+
+static int fsmSnapshot(struct raft_fsm *fsm,
+                       struct raft_buffer *bufs[],
+                       unsigned *n_bufs)
+{
+    uint64_t *count = fsm->data;
+    *bufs = raft_malloc(sizeof **bufs);
+    if (*bufs == NULL) {
+        return RAFT_NOMEM;
+    }
+    (*bufs)[0].len = sizeof *count;
+    (*bufs)[0].base = raft_malloc((*bufs)[0].len);
+    if ((*bufs)[0].base == NULL) {
+        raft_free(*bufs);
+        return RAFT_NOMEM;
+    }
+    memcpy((*bufs)[0].base, count, sizeof *count);
+    *n_bufs = 1;
+    return 0;
+}
+
+static int fsmRestore(struct raft_fsm *fsm, struct raft_buffer *buf)
+{
+    uint64_t *count = fsm->data;
+    if (buf->len != sizeof *count) {
+        return RAFT_MALFORMED;
+    }
+    memcpy(count, buf->base, sizeof *count);
+    raft_free(buf->base);
+    return 0;
+}
+
+/********************************************************************
+ *
+ * Cluster of servers sharing the same loop.
+ *
+ ********************************************************************/
+
+struct server
+{
+    struct benchmark *benchmark;
+    char dir[1024];
+    char address[64];
+    struct raft_uv_transport transport;
+    struct raft_io io;
+    struct raft_fsm fsm;
+    uint64_t count;
+    struct raft raft;
+};
+
+/* Slot holding a single in-flight apply request. */
+struct slot
+{
+    struct benchmark *benchmark;
+    struct raft_apply req;
+    size_t size;    /* Size of the entry */
+    uint64_t start; /* uv_hrtime() at submission */
+};
+
+struct benchmark
+{
+    struct arguments *arguments;
+    struct uv_loop_s loop;
+    struct uv_timer_s timer;
+    char dir[1024];
+    struct server servers[MAX_SERVERS];
+    struct slot *slots;
+    unsigned *free;     /* Stack of indexes of free slots */
+    unsigned n_free;    /* Number of free slots */
+    struct raft *leader;
+    bool running;
+    bool stopped;
+    uint64_t waiting;   /* uv_now() when we started waiting for a leader */
+    uint64_t start;     /* uv_hrtime() when the first entry was submitted */
+    uint64_t end;       /* uv_hrtime() when the benchmark stopped */
+    unsigned long submitted;
+    unsigned long committed;
+    unsigned long failed;
+    uint64_t bytes;     /* Bytes of committed entries */
+    uint64_t *latencies; /* Commit latency of each entry, in microseconds */
+    unsigned long n_latencies;
+    unsigned long cap_latencies;
+    int rv;
+};
+
+static int serverInit(struct benchmark *b, unsigned i)
+{
+    struct arguments *arguments = b->arguments;
+    struct server *s = &b->servers[i];
+    raft_id id = i + 1;
+    int rv;
+
+    s->benchmark = b;
+    sprintf(s->dir, "%s/%u", b->dir, (unsigned)id);
+    sprintf(s->address, "127.0.0.1:%u", arguments->port + i);
+
+    rv = mkdir(s->dir, 0700);
+    if (rv != 0) {
+        fprintf(stderr, "mkdir '%s': %s\n", s->dir, strerror(errno));
+        return -1;
+    }
+
+    rv = raft_uv_tcp_init(&s->transport, &b->loop);
+    if (rv != 0) {
+        fprintf(stderr, "raft_uv_tcp_init(): %s\n", raft_strerror(rv));
+        return -1;
+    }
+
+    rv = raft_uv_init(&s->io, &b->loop, s->dir, &s->transport);
+    if (rv != 0) {
+        fprintf(stderr, "raft_uv_init(): %s\n", s->io.errmsg);
+        return -1;
+    }
+
+    s->count = 0;
+    s->fsm.version = 1;
+    s->fsm.data = &s->count;
+    s->fsm.apply = fsmApply;
+    s->fsm.snapshot = fsmSnapshot;
+    s->fsm.restore = fsmRestore;
+
+    rv = raft_init(&s->raft, &s->io, &s->fsm, id, s->address);
+    if (rv != 0) {
+        fprintf(stderr, "raft_init(): %s\n", raft_errmsg(&s->raft));
+        return -1;
+    }
+    s->raft.data = s;
+
+    return 0;
+}
+
+static int serverBootstrap(struct benchmark *b, struct server *s)
+{
+    struct raft_configuration configuration;
+    unsigned i;
+    int rv;
+
+    raft_configuration_init(&configuration);
+    for (i = 0; i < b->arguments->n_servers; i++) {
+        struct server *other = &b->servers[i];
+        rv = raft_configuration_add(&configuration, other->raft.id,
+                                    other->address, RAFT_VOTER);
+        if (rv != 0) {
+            goto out;
+        }
+    }
+    rv = raft_bootstrap(&s->raft, &configuration);
+    if (rv != 0) {
+        fprintf(stderr, "raft_bootstrap(): %s\n", raft_errmsg(&s->raft));
+        goto out;
+    }
+    rv = raft_start(&s->raft);
+    if (rv != 0) {
+        fprintf(stderr, "raft_start(): %s\n", raft_errmsg(&s->raft));
+    }
+
+out:
+    raft_configuration_close(&configuration);
+    return rv;
+}
+
+static void serverCloseCb(struct raft *r)
+{
+    struct server *s = r->data;
+    raft_uv_close(&s->io);
+    raft_uv_tcp_close(&s->transport);
+}
+
+/********************************************************************
+ *
+ * Load generation.
+ *
+ ********************************************************************/
+
+static void recordLatency(struct benchmark *b, uint64_t latency)
+{
+    if (b->n_latencies == b->cap_latencies) {
+        b->cap_latencies = b->cap_latencies == 0 ? 4096 : b->cap_latencies * 2;
+        b->latencies = realloc(b->latencies,
+                               b->cap_latencies * sizeof *b->latencies);
+        assert(b->latencies != NULL);
+    }
+    b->latencies[b->n_latencies] = latency;
+    b->n_latencies++;
+}
+
+static bool submitMore(struct benchmark *b);
+static void stop(struct benchmark *b);
+
+static void applyCb(struct raft_apply *req, int status, void *result)
+{
+    struct slot *slot = req->data;
+    struct benchmark *b = slot->benchmark;
+    (void)result;
+
+    b->free[b->n_free] = (unsigned)(slot - b->slots);
+    b->n_free++;
+
+    if (b->stopped) {
+        return;
+    }
+
+    if (status != 0) {
+        b->failed++;
+        b->leader = NULL;
+        return;
+    }
+
+    b->committed++;
+    b->bytes += slot->size;
+    recordLatency(b, (uv_hrtime() - slot->start) / 1000);
+
+    /* Without a rate limit, keep the pipeline full without waiting for the
+     * next tick. */
+    if (b->arguments->rate == 0) {
+        submitMore(b);
+    }
+}
+
+/* Submit a single entry to the leader using the given slot. */
+static int submit(struct benchmark *b, unsigned i)
+{
+    struct arguments *arguments = b->arguments;
+    struct slot *slot = &b->slots[i];
+    struct raft_buffer buf;
+    int rv;
+
+    buf.len = arguments->sizes[b->submitted % arguments->n_sizes];
+    buf.base = raft_malloc(buf.len);
+    assert(buf.base != NULL);
+    memset(buf.base, (int)(b->submitted & 0xff), buf.len);
+
+    slot->req.data = slot;
+    slot->size = buf.len;
+    slot->start = uv_hrtime();
+    rv = raft_apply(b->leader, &slot->req, &buf, 1, applyCb);
+    if (rv != 0) {
+        raft_free(buf.base);
+        return rv;
+    }
+
+    b->submitted++;
+    return 0;
+}
+
+/* Submit as many entries as the concurrency, rate and entries limits allow.
+ * Return false if the benchmark is over. */
+static bool submitMore(struct benchmark *b)
+{
+    struct arguments *arguments = b->arguments;
+    uint64_t elapsed = uv_hrtime() - b->start;
+    unsigned long allowed = ULONG_MAX;
+
+    if (elapsed >= (uint64_t)arguments->time * 1000000000) {
+        return false;
+    }
+    if (arguments->entries != 0) {
+        if (b->committed >= arguments->entries) {
+            return false;
+        }
+        allowed = arguments->entries;
+    }
+    if (arguments->rate != 0) {
+        unsigned long due = (unsigned long)(elapsed * arguments->rate /
+                                            1000000000) + 1;
+        if (due < allowed) {
+            allowed = due;
+        }
+    }
+
+    while (b->n_free > 0 && b->submitted < allowed) {
+        if (b->leader == NULL || b->leader->state != RAFT_LEADER) {
+            b->leader = NULL;
+            break;
+        }
+        if (submit(b, b->free[b->n_free - 1]) != 0) {
+            b->leader = NULL;
+            break;
+        }
+        b->n_free--;
+    }
+
+    return true;
+}
+
+/* Find the current leader, if any. */
+static struct raft *findLeader(struct benchmark *b)
+{
+    unsigned i;
+    for (i = 0; i < b->arguments->n_servers; i++) {
+        struct raft *r = &b->servers[i].raft;
+        if (r->state == RAFT_LEADER) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+static void tickCb(uv_timer_t *timer)
+{
+    struct benchmark *b = timer->data;
+
+    if (b->stopped) {
+        return;
+    }
+
+    if (b->leader == NULL) {
+        b->leader = findLeader(b);
+    }
+
+    if (!b->running) {
+        if (b->leader == NULL) {
+            if (uv_now(&b->loop) - b->waiting > ELECTION_DEADLINE) {
+                fprintf(stderr, "no leader elected\n");
+                b->rv = -1;
+                stop(b);
+            }
+            return;
+        }
+        b->running = true;
+        b->start = uv_hrtime();
+    }
+
+    if (!submitMore(b)) {
+        stop(b);
+    }
+}
+
+static void timerCloseCb(uv_handle_t *handle)
+{
+    struct benchmark *b = handle->data;
+    unsigned i;
+    for (i = 0; i < b->arguments->n_servers; i++) {
+        raft_close(&b->servers[i].raft, serverCloseCb);
+    }
+}
+
+/* Stop submitting entries and shutdown the cluster. Entries still in flight
+ * are not counted. */
+static void stop(struct benchmark *b)
+{
+    b->stopped = true;
+    b->end = uv_hrtime();
+    uv_timer_stop(&b->timer);
+    uv_close((uv_handle_t *)&b->timer, timerCloseCb);
+}
+
+/********************************************************************
+ *
+ * Report.
+ *
+ ********************************************************************/
+
+static int compareLatency(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Return the given percentile of the sorted latencies. */
+static uint64_t percentile(struct benchmark *b, double percentage)
+{
+    unsigned long rank;
+    if (b->n_latencies == 0) {
+        return 0;
+    }
+    rank = (unsigned long)((double)b->n_latencies * percentage / 100.0);
+    if (rank >= b->n_latencies) {
+        rank = b->n_latencies - 1;
+    }
+    return b->latencies[rank];
+}
+
+static void report(struct benchmark *b)
+{
+    struct arguments *arguments = b->arguments;
+    double secs = (double)(b->end - b->start) / 1e9;
+    uint64_t sum = 0;
+    unsigned long i;
+
+    qsort(b->latencies, b->n_latencies, sizeof *b->latencies,
+          compareLatency);
+    for (i = 0; i < b->n_latencies; i++) {
+        sum += b->latencies[i];
+    }
+
+    printf("{\n");
+    printf("  \"servers\": %u,\n", arguments->n_servers);
+    printf("  \"entry_sizes\": [");
+    for (i = 0; i < arguments->n_sizes; i++) {
+        printf("%s%u", i > 0 ? ", " : "", arguments->sizes[i]);
+    }
+    printf("],\n");
+    printf("  \"concurrency\": %u,\n", arguments->concurrency);
+    printf("  \"rate\": %u,\n", arguments->rate);
+    printf("  \"duration_s\": %.3f,\n", secs);
+    printf("  \"submitted\": %lu,\n", b->submitted);
+    printf("  \"commits\": %lu,\n", b->committed);
+    printf("  \"errors\": %lu,\n", b->failed);
+    printf("  \"commits_per_sec\": %.1f,\n",
+           secs > 0 ? (double)b->committed / secs : 0);
+    printf("  \"bytes_per_sec\": %.1f,\n",
+           secs > 0 ? (double)b->bytes / secs : 0);
+    printf("  \"latency_us\": {\n");
+    printf("    \"mean\": %.1f,\n",
+           b->n_latencies > 0 ? (double)sum / (double)b->n_latencies : 0);
+    printf("    \"p50\": %" PRIu64 ",\n", percentile(b, 50));
+    printf("    \"p99\": %" PRIu64 ",\n", percentile(b, 99));
+    printf("    \"p999\": %" PRIu64 ",\n", percentile(b, 99.9));
+    printf("    \"max\": %" PRIu64 "\n",
+           b->n_latencies > 0 ? b->latencies[b->n_latencies - 1] : 0);
+    printf("  }\n");
+    printf("}\n");
+}
+
+static int removeCb(const char *path,
+                    const struct stat *sb,
+                    int type,
+                    struct FTW *ftw)
+{
+    (void)sb;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+int main(int argc, char *argv[])
+{
+    struct argp argp = {options, argumentsParse, NULL, doc, 0, 0, 0};
+    struct arguments arguments;
+    struct benchmark *b;
+    unsigned i;
+    int rv;
+
+    arguments.dir = "/tmp";
+    arguments.n_servers = 3;
+    arguments.sizes[0] = 128;
+    arguments.n_sizes = 1;
+    arguments.concurrency = 64;
+    arguments.rate = 0;
+    arguments.time = 10;
+    arguments.entries = 0;
+    arguments.port = 9100;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    /* Ignore SIGPIPE, see https://github.com/joyent/libuv/issues/1254 */
+    signal(SIGPIPE, SIG_IGN);
+
+    b = calloc(1, sizeof *b);
+    assert(b != NULL);
+    b->arguments = &arguments;
+
+    b->slots = calloc(arguments.concurrency, sizeof *b->slots);
+    b->free = calloc(arguments.concurrency, sizeof *b->free);
+    assert(b->slots != NULL && b->free != NULL);
+    for (i = 0; i < arguments.concurrency; i++) {
+        b->slots[i].benchmark = b;
+        b->free[i] = arguments.concurrency - 1 - i;
+    }
+    b->n_free = arguments.concurrency;
+
+    sprintf(b->dir, "%s/raft-cluster-XXXXXX", arguments.dir);
+    if (mkdtemp(b->dir) == NULL) {
+        fprintf(stderr, "mkdtemp '%s': %s\n", b->dir, strerror(errno));
+        return 1;
+    }
+
+    rv = uv_loop_init(&b->loop);
+    assert(rv == 0);
+
+    for (i = 0; i < arguments.n_servers; i++) {
+        rv = serverInit(b, i);
+        if (rv != 0) {
+            return 1;
+        }
+    }
+    for (i = 0; i < arguments.n_servers; i++) {
+        rv = serverBootstrap(b, &b->servers[i]);
+        if (rv != 0) {
+            return 1;
+        }
+    }
+
+    rv = uv_timer_init(&b->loop, &b->timer);
+    assert(rv == 0);
+    b->timer.data = b;
+    b->waiting = uv_now(&b->loop);
+    rv = uv_timer_start(&b->timer, tickCb, 0, TICK_INTERVAL);
+    assert(rv == 0);
+
+    uv_run(&b->loop, UV_RUN_DEFAULT);
+    uv_loop_close(&b->loop);
+
+    nftw(b->dir, removeCb, 16, FTW_DEPTH | FTW_PHYS);
+
+    if (b->rv == 0) {
+        report(b);
+    }
+    rv = b->rv;
+
+    free(b->latencies);
+    free(b->free);
+    free(b->slots);
+    free(b);
+
+    return rv == 0 ? 0 : 1;
+}
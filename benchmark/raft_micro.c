@@ -0,0 +1,706 @@
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "../include/raft.h"
+#include "../include/raft/uv.h"
+#include "../src/assert.h"
+#include "../src/byte.h"
+#include "../src/entry.h"
+#include "../src/log.h"
+#include "../src/uv.h"
+#include "../src/uv_encoding.h"
+
+static char doc[] =
+    "Benchmark the log, message codec and segment code paths of libraft";
+
+/* Size of the preamble of a message, containing its type and length. */
+#define PREAMBLE_SIZE (sizeof(uint64_t) * 2)
+
+/* Number of entries in each batch written to the segments of the load
+ * benchmark. */
+#define LOAD_BATCH 16
+
+/* Size of the entries of the log and load benchmarks. */
+#define ENTRY_SIZE 64
+
+/* Order of fields: {NAME, KEY, ARG, FLAGS, DOC, GROUP}.*/
+static struct argp_option options[] = {
+    {"dir", 'd', "DIR", 0, "Directory to use for temp files (default /tmp)", 0},
+    {"time", 't', "MSECS", 0, "Minimum time to run each case (default 1000)",
+     0},
+    {"filter", 'f', "PREFIX", 0, "Only run cases starting with PREFIX", 0},
+    {"baseline", 'b', "FILE", 0, "Compare against results saved in FILE", 0},
+    {0}};
+
+struct arguments
+{
+    char *dir;
+    unsigned time;
+    char *filter;
+    char *baseline;
+};
+
+static error_t argumentsParse(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+    switch (key) {
+        case 'd':
+            arguments->dir = arg;
+            break;
+        case 't':
+            arguments->time = (unsigned)atoi(arg);
+            break;
+        case 'f':
+            arguments->filter = arg;
+            break;
+        case 'b':
+            arguments->baseline = arg;
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/********************************************************************
+ *
+ * Allocator counting the number of allocations.
+ *
+ ********************************************************************/
+
+static unsigned long allocs;
+
+static void *countingMalloc(void *data, size_t size)
+{
+    (void)data;
+    allocs++;
+    return malloc(size);
+}
+
+static void countingFree(void *data, void *ptr)
+{
+    (void)data;
+    free(ptr);
+}
+
+static void *countingCalloc(void *data, size_t nmemb, size_t size)
+{
+    (void)data;
+    allocs++;
+    return calloc(nmemb, size);
+}
+
+static void *countingRealloc(void *data, void *ptr, size_t size)
+{
+    (void)data;
+    allocs++;
+    return realloc(ptr, size);
+}
+
+static void *countingAlignedAlloc(void *data, size_t alignment, size_t size)
+{
+    (void)data;
+    allocs++;
+    return aligned_alloc(alignment, size);
+}
+
+static void countingAlignedFree(void *data, size_t alignment, void *ptr)
+{
+    (void)data;
+    (void)alignment;
+    free(ptr);
+}
+
+static struct raft_heap countingHeap = {
+    NULL,           countingMalloc,       countingFree,       countingCalloc,
+    countingRealloc, countingAlignedAlloc, countingAlignedFree};
+
+/********************************************************************
+ *
+ * Benchmark driver.
+ *
+ ********************************************************************/
+
+/* State of a single run of a benchmark case. Each case performs its own setup,
+ * then runs its operation n times between benchStart() and benchStop(). */
+struct bench
+{
+    unsigned long n;      /* Number of operations to run */
+    const char *dir;      /* Directory for temp files */
+    unsigned long allocs; /* Allocations performed by the timed loop */
+    uint64_t elapsed;     /* Duration of the timed loop, in nanoseconds */
+    struct timespec start;
+};
+
+static void benchStart(struct bench *b)
+{
+    allocs = 0;
+    clock_gettime(CLOCK_MONOTONIC, &b->start);
+}
+
+static void benchStop(struct bench *b)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    b->allocs = allocs;
+    b->elapsed = (uint64_t)(now.tv_sec - b->start.tv_sec) * 1000000000 +
+                 (uint64_t)now.tv_nsec - (uint64_t)b->start.tv_nsec;
+}
+
+struct benchCase
+{
+    const char *name;
+    void (*fn)(struct bench *b, unsigned x, unsigned y);
+    unsigned x;
+    unsigned y;
+};
+
+/* Allocate a buffer of the given size, filled with a pattern. */
+static void makeBuf(struct raft_buffer *buf, size_t size)
+{
+    buf->len = size;
+    buf->base = raft_malloc(size);
+    assert(buf->base != NULL);
+    memset(buf->base, 'x', size);
+}
+
+/* Allocate n command entries of the given size. */
+static struct raft_entry *makeEntries(unsigned n, size_t size)
+{
+    struct raft_entry *entries = raft_calloc(n, sizeof *entries);
+    unsigned i;
+    assert(entries != NULL);
+    for (i = 0; i < n; i++) {
+        entries[i].term = 1;
+        entries[i].type = RAFT_COMMAND;
+        makeBuf(&entries[i].buf, size);
+    }
+    return entries;
+}
+
+static void freeEntries(struct raft_entry *entries, unsigned n)
+{
+    unsigned i;
+    for (i = 0; i < n; i++) {
+        raft_free(entries[i].buf.base);
+    }
+    raft_free(entries);
+}
+
+/* Fill the log with the given number of entries. */
+static void fillLog(struct raft_log *l, unsigned n)
+{
+    unsigned i;
+    for (i = 0; i < n; i++) {
+        struct raft_buffer buf;
+        int rv;
+        makeBuf(&buf, ENTRY_SIZE);
+        rv = logAppend(l, 1, RAFT_COMMAND, &buf, NULL);
+        assert(rv == 0);
+    }
+}
+
+/********************************************************************
+ *
+ * Log cases.
+ *
+ ********************************************************************/
+
+/* Append entries to a log holding between size and twice size entries, taking
+ * a snapshot each time it reaches twice its size. The allocation of the entry
+ * payload is included. */
+static void benchLogAppend(struct bench *b, unsigned size, unsigned unused)
+{
+    struct raft_log log;
+    unsigned long i;
+    (void)unused;
+
+    logInit(&log);
+    fillLog(&log, size);
+
+    benchStart(b);
+    for (i = 0; i < b->n; i++) {
+        struct raft_buffer buf;
+        int rv;
+        makeBuf(&buf, ENTRY_SIZE);
+        rv = logAppend(&log, 1, RAFT_COMMAND, &buf, NULL);
+        assert(rv == 0);
+        if (logNumEntries(&log) == 2 * (size_t)size) {
+            logSnapshot(&log, logLastIndex(&log), size);
+        }
+    }
+    benchStop(b);
+
+    logClose(&log);
+}
+
+/* Index of the first entry of the j'th range held by benchLogAcquire(). */
+static raft_index heldIndex(struct raft_log *l, unsigned j)
+{
+    return logLastIndex(l) - j % 64;
+}
+
+/* Acquire and release the last 8 entries of a log of the given size, while
+ * the given number of other ranges of entries ending at the last entry are
+ * held, as happens with in-flight appends and sends. */
+static void benchLogAcquire(struct bench *b, unsigned size, unsigned held)
+{
+    struct raft_log log;
+    struct raft_entry **ranges;
+    unsigned *n_ranges;
+    raft_index index;
+    unsigned long i;
+    unsigned j;
+    int rv;
+
+    logInit(&log);
+    fillLog(&log, size);
+
+    ranges = calloc(held, sizeof *ranges);
+    n_ranges = calloc(held, sizeof *n_ranges);
+    assert(held == 0 || (ranges != NULL && n_ranges != NULL));
+    index = logLastIndex(&log) - 7;
+    for (j = 0; j < held; j++) {
+        rv = logAcquire(&log, heldIndex(&log, j), &ranges[j], &n_ranges[j]);
+        assert(rv == 0);
+    }
+
+    benchStart(b);
+    for (i = 0; i < b->n; i++) {
+        struct raft_entry *entries;
+        unsigned n;
+        rv = logAcquire(&log, index, &entries, &n);
+        assert(rv == 0);
+        logRelease(&log, index, entries, n);
+    }
+    benchStop(b);
+
+    for (j = 0; j < held; j++) {
+        logRelease(&log, heldIndex(&log, j), ranges[j], n_ranges[j]);
+    }
+    free(n_ranges);
+    free(ranges);
+    logClose(&log);
+}
+
+/********************************************************************
+ *
+ * Codec cases.
+ *
+ ********************************************************************/
+
+static void makeAppendEntries(struct raft_message *message,
+                              unsigned n,
+                              size_t size)
+{
+    memset(message, 0, sizeof *message);
+    message->type = RAFT_IO_APPEND_ENTRIES;
+    message->server_id = 2;
+    message->server_address = "2";
+    message->append_entries.term = 1;
+    message->append_entries.prev_log_index = 1;
+    message->append_entries.prev_log_term = 1;
+    message->append_entries.leader_commit = 1;
+    message->append_entries.entries = makeEntries(n, size);
+    message->append_entries.n_entries = n;
+}
+
+/* Encode an AppendEntries message with n entries of the given size, in the
+ * regular or compact format. */
+static void benchEncode(struct bench *b, unsigned n, unsigned compact)
+{
+    struct raft_message message;
+    unsigned long i;
+
+    makeAppendEntries(&message, n, ENTRY_SIZE);
+
+    benchStart(b);
+    for (i = 0; i < b->n; i++) {
+        uv_buf_t *bufs;
+        unsigned n_bufs;
+        int rv;
+        rv = uvEncodeMessage(&message, NULL, NULL, false, compact != 0, 0,
+                             &bufs, &n_bufs);
+        assert(rv == 0);
+        raft_free(bufs[0].base);
+        raft_free(bufs);
+    }
+    benchStop(b);
+
+    freeEntries(message.append_entries.entries, n);
+}
+
+/* Decode the header of an AppendEntries message with n entries. */
+static void benchDecode(struct bench *b, unsigned n, unsigned unused)
+{
+    struct raft_message message;
+    uv_buf_t *bufs;
+    unsigned n_bufs;
+    uv_buf_t header;
+    unsigned long i;
+    int rv;
+    (void)unused;
+
+    makeAppendEntries(&message, n, ENTRY_SIZE);
+    rv = uvEncodeMessage(&message, NULL, NULL, false, false, 0, &bufs,
+                         &n_bufs);
+    assert(rv == 0);
+    header.base = bufs[0].base + PREAMBLE_SIZE;
+    header.len = bufs[0].len - PREAMBLE_SIZE;
+
+    benchStart(b);
+    for (i = 0; i < b->n; i++) {
+        struct raft_message decoded;
+        size_t payload_len;
+        rv = uvDecodeMessage(RAFT_IO_APPEND_ENTRIES, &header, &decoded,
+                             &payload_len);
+        assert(rv == 0);
+        raft_free(decoded.append_entries.entries);
+    }
+    benchStop(b);
+
+    raft_free(bufs[0].base);
+    raft_free(bufs);
+    freeEntries(message.append_entries.entries, n);
+}
+
+/********************************************************************
+ *
+ * Segment cases.
+ *
+ ********************************************************************/
+
+/* Encode a batch of n entries of the given size into a segment buffer,
+ * including the checksums of the batch. */
+static void benchSegmentAppend(struct bench *b, unsigned n, unsigned size)
+{
+    struct uvSegmentBuffer buf;
+    struct raft_entry *entries;
+    unsigned long i;
+
+    entries = makeEntries(n, size);
+    uvSegmentBufferInit(&buf, 4096);
+
+    benchStart(b);
+    for (i = 0; i < b->n; i++) {
+        int rv;
+        rv = uvSegmentBufferAppend(&buf, entries, n, NULL);
+        assert(rv == 0);
+        uvSegmentBufferReset(&buf, 0);
+    }
+    benchStop(b);
+
+    uvSegmentBufferClose(&buf);
+    freeEntries(entries, n);
+}
+
+/* Checksum a buffer of the given size. */
+static void benchCrc32(struct bench *b, unsigned size, unsigned unused)
+{
+    struct raft_buffer buf;
+    volatile unsigned crc = 0;
+    unsigned long i;
+    (void)unused;
+
+    buf.len = size;
+    buf.base = malloc(size);
+    assert(buf.base != NULL);
+    memset(buf.base, 'x', size);
+
+    benchStart(b);
+    for (i = 0; i < b->n; i++) {
+        crc = byteCrc32(buf.base, buf.len, crc);
+    }
+    benchStop(b);
+
+    free(buf.base);
+}
+
+/* Write a closed segment holding n entries starting at the given index. */
+static void writeSegment(const char *dir,
+                         struct uvSegmentInfo *info,
+                         raft_index first_index,
+                         unsigned n)
+{
+    struct uvSegmentBuffer buf;
+    struct raft_entry *entries;
+    char path[2048];
+    uv_buf_t out;
+    unsigned i;
+    int fd;
+    int rv;
+
+    info->is_open = false;
+    info->first_index = first_index;
+    info->end_index = first_index + n - 1;
+    sprintf(info->filename, UV__CLOSED_TEMPLATE, info->first_index,
+            info->end_index);
+
+    entries = makeEntries(LOAD_BATCH, ENTRY_SIZE);
+    uvSegmentBufferInit(&buf, 4096);
+    rv = uvSegmentBufferFormat(&buf);
+    assert(rv == 0);
+    for (i = 0; i < n; i += LOAD_BATCH) {
+        unsigned n_batch = n - i < LOAD_BATCH ? n - i : LOAD_BATCH;
+        rv = uvSegmentBufferAppend(&buf, entries, n_batch, NULL);
+        assert(rv == 0);
+    }
+    uvSegmentBufferFinalize(&buf, &out);
+
+    sprintf(path, "%s/%s", dir, info->filename);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    assert(fd != -1);
+    /* Closed segments are truncated to the end of their last batch. */
+    rv = (int)write(fd, out.base, buf.n);
+    assert(rv == (int)buf.n);
+    close(fd);
+
+    uvSegmentBufferClose(&buf);
+    freeEntries(entries, LOAD_BATCH);
+}
+
+static int removeCb(const char *path,
+                    const struct stat *sb,
+                    int type,
+                    struct FTW *ftw)
+{
+    (void)sb;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+/* Load all entries of the given number of closed segments, each holding the
+ * given number of entries. */
+static void benchSegmentLoadAll(struct bench *b, unsigned n, unsigned size)
+{
+    struct uv_loop_s loop;
+    struct raft_uv_transport transport;
+    struct raft_io io;
+    struct uv *uv;
+    struct uvSegmentInfo *infos;
+    char dir[1024];
+    unsigned long i;
+    unsigned j;
+    int rv;
+
+    sprintf(dir, "%s/raft-micro-XXXXXX", b->dir);
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "mkdtemp '%s': %s\n", dir, strerror(errno));
+        exit(1);
+    }
+
+    infos = calloc(n, sizeof *infos);
+    assert(infos != NULL);
+    for (j = 0; j < n; j++) {
+        writeSegment(dir, &infos[j], (raft_index)j * size + 1, size);
+    }
+
+    rv = uv_loop_init(&loop);
+    assert(rv == 0);
+    rv = raft_uv_tcp_init(&transport, &loop);
+    assert(rv == 0);
+    rv = raft_uv_init(&io, &loop, dir, &transport);
+    assert(rv == 0);
+    uv = io.impl;
+
+    benchStart(b);
+    for (i = 0; i < b->n; i++) {
+        struct raft_entry *entries;
+        size_t n_entries;
+        rv = uvSegmentLoadAll(uv, 1, infos, n, &entries, &n_entries);
+        if (rv != 0) {
+            fprintf(stderr, "load segments: %s\n", io.errmsg);
+            exit(1);
+        }
+        assert(n_entries == (size_t)n * size);
+        entryBatchesDestroy(entries, n_entries);
+    }
+    benchStop(b);
+
+    raft_uv_close(&io);
+    raft_uv_tcp_close(&transport);
+    uv_loop_close(&loop);
+    free(infos);
+    nftw(dir, removeCb, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static struct benchCase cases[] = {
+    {"log/append/1024", benchLogAppend, 1024, 0},
+    {"log/append/65536", benchLogAppend, 65536, 0},
+    {"log/acquire/1024", benchLogAcquire, 1024, 0},
+    {"log/acquire/65536", benchLogAcquire, 65536, 0},
+    {"log/acquire/1024/held=256", benchLogAcquire, 1024, 256},
+    {"log/acquire/65536/held=4096", benchLogAcquire, 65536, 4096},
+    {"codec/encode/1", benchEncode, 1, 0},
+    {"codec/encode/64", benchEncode, 64, 0},
+    {"codec/encode-compact/1", benchEncode, 1, 1},
+    {"codec/encode-compact/64", benchEncode, 64, 1},
+    {"codec/decode/1", benchDecode, 1, 0},
+    {"codec/decode/64", benchDecode, 64, 0},
+    {"segment/append/1x64", benchSegmentAppend, 1, 64},
+    {"segment/append/16x256", benchSegmentAppend, 16, 256},
+    {"segment/append/64x4096", benchSegmentAppend, 64, 4096},
+    {"segment/crc32/64", benchCrc32, 64, 0},
+    {"segment/crc32/4096", benchCrc32, 4096, 0},
+    {"segment/crc32/65536", benchCrc32, 65536, 0},
+    {"segment/load-all/1x1024", benchSegmentLoadAll, 1, 1024},
+    {"segment/load-all/16x1024", benchSegmentLoadAll, 16, 1024},
+    {NULL, NULL, 0, 0}};
+
+/* Run the given case with an increasing number of operations, until it takes
+ * at least the given number of milliseconds. */
+static void runCase(struct benchCase *c, struct bench *b, unsigned msecs)
+{
+    uint64_t target = (uint64_t)msecs * 1000000;
+
+    b->n = 1;
+    for (;;) {
+        uint64_t n;
+        c->fn(b, c->x, c->y);
+        if (b->elapsed >= target || b->n >= 1000000000) {
+            break;
+        }
+        /* Aim 20% past the target, growing at most 100x per round. */
+        if (b->elapsed == 0) {
+            n = b->n * 100;
+        } else {
+            n = b->n * target / b->elapsed * 6 / 5;
+        }
+        if (n > b->n * 100) {
+            n = b->n * 100;
+        }
+        if (n <= b->n) {
+            n = b->n + 1;
+        }
+        b->n = (unsigned long)n;
+    }
+}
+
+/********************************************************************
+ *
+ * Baseline comparison.
+ *
+ ********************************************************************/
+
+struct result
+{
+    char name[64];
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+/* Load the results of a previous run, as printed by this program. */
+static struct result *loadBaseline(const char *path, unsigned *n)
+{
+    struct result *results = NULL;
+    char line[256];
+    FILE *f;
+
+    *n = 0;
+    f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "open '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+    while (fgets(line, sizeof line, f) != NULL) {
+        struct result r;
+        if (sscanf(line,
+                   "{\"name\": \"%63[^\"]\", \"ns_per_op\": %lf, "
+                   "\"allocs_per_op\": %lf",
+                   r.name, &r.ns_per_op, &r.allocs_per_op) != 3) {
+            continue;
+        }
+        results = realloc(results, (*n + 1) * sizeof *results);
+        assert(results != NULL);
+        results[*n] = r;
+        (*n)++;
+    }
+    fclose(f);
+    return results;
+}
+
+static struct result *findBaseline(struct result *results,
+                                   unsigned n,
+                                   const char *name)
+{
+    unsigned i;
+    for (i = 0; i < n; i++) {
+        if (strcmp(results[i].name, name) == 0) {
+            return &results[i];
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    struct argp argp = {options, argumentsParse, NULL, doc, 0, 0, 0};
+    struct arguments arguments;
+    struct result *baseline = NULL;
+    unsigned n_baseline = 0;
+    struct benchCase *c;
+
+    arguments.dir = "/tmp";
+    arguments.time = 1000;
+    arguments.filter = NULL;
+    arguments.baseline = NULL;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.baseline != NULL) {
+        baseline = loadBaseline(arguments.baseline, &n_baseline);
+    }
+
+    raft_heap_set(&countingHeap);
+
+    /* Print one JSON object per line, so the output of a run can be used as
+     * the baseline of another. */
+    for (c = cases; c->name != NULL; c++) {
+        struct bench b;
+        struct result *base;
+        double ns_per_op;
+        double allocs_per_op;
+
+        if (arguments.filter != NULL &&
+            strncmp(c->name, arguments.filter, strlen(arguments.filter)) !=
+                0) {
+            continue;
+        }
+
+        b.dir = arguments.dir;
+        runCase(c, &b, arguments.time);
+        ns_per_op = (double)b.elapsed / (double)b.n;
+        allocs_per_op = (double)b.allocs / (double)b.n;
+
+        printf("{\"name\": \"%s\", \"ns_per_op\": %.1f, "
+               "\"allocs_per_op\": %.2f",
+               c->name, ns_per_op, allocs_per_op);
+        base = findBaseline(baseline, n_baseline, c->name);
+        if (base != NULL) {
+            printf(", \"baseline_ns_per_op\": %.1f, "
+                   "\"baseline_allocs_per_op\": %.2f, \"delta_pct\": %+.1f",
+                   base->ns_per_op, base->allocs_per_op,
+                   base->ns_per_op > 0
+                       ? (ns_per_op / base->ns_per_op - 1) * 100
+                       : 0);
+        }
+        printf(", \"ops\": %lu}\n", b.n);
+        fflush(stdout);
+    }
+
+    raft_heap_set_default();
+    free(baseline);
+
+    return 0;
+}
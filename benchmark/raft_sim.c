@@ -0,0 +1,450 @@
+#include <argp.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/raft.h"
+#include "../include/raft/fixture.h"
+#include "../src/assert.h"
+
+static char doc[] =
+    "Benchmark commit throughput and latency of a simulated raft cluster";
+
+/* Maximum number of distinct entry sizes in the mix. */
+#define MAX_SIZES 16
+
+/* Give up if no entry gets committed for this long. */
+#define PROGRESS_TIMEOUT 60000 /* milliseconds */
+
+/* Order of fields: {NAME, KEY, ARG, FLAGS, DOC, GROUP}.*/
+static struct argp_option options[] = {
+    {"voters", 'v', "N", 0, "Number of voters (default 3)", 0},
+    {"standbys", 's', "N", 0, "Number of standbys (default 0)", 0},
+    {"size", 'z', "SIZES", 0,
+     "Comma-separated entry sizes, cycled through (default 128)", 0},
+    {"concurrency", 'c', "N", 0, "Maximum in-flight entries (default 64)", 0},
+    {"entries", 'e', "N", 0, "Number of entries to commit (default 10000)", 0},
+    {"latency", 'l', "MSECS", 0, "Network latency (default 1)", 0},
+    {"bandwidth", 'b', "BYTES", 0,
+     "Outgoing bandwidth of each server per second (default no limit)", 0},
+    {"message-cost", 'm', "USECS", 0,
+     "CPU time to process a message (default 0)", 0},
+    {"disk-latency", 'd', "MSECS", 0, "Disk write latency (default 1)", 0},
+    {"fsync-cost", 'f', "USECS", 0, "Time to sync an append (default 0)", 0},
+    {"snapshot-threshold", 't', "N", 0,
+     "Entries between snapshots (default 1024)", 0},
+    {0}};
+
+struct arguments
+{
+    unsigned voters;
+    unsigned standbys;
+    unsigned sizes[MAX_SIZES];
+    unsigned n_sizes;
+    unsigned concurrency;
+    unsigned long entries;
+    unsigned latency;
+    uint64_t bandwidth;
+    unsigned message_cost;
+    unsigned disk_latency;
+    unsigned fsync_cost;
+    unsigned snapshot_threshold;
+};
+
+/* Parse a comma-separated list of entry sizes. */
+static int parseSizes(struct arguments *arguments, char *arg)
+{
+    char *token;
+    char *saveptr;
+
+    arguments->n_sizes = 0;
+    for (token = strtok_r(arg, ",", &saveptr); token != NULL;
+         token = strtok_r(NULL, ",", &saveptr)) {
+        int size = atoi(token);
+        if (size <= 0 || arguments->n_sizes == MAX_SIZES) {
+            return -1;
+        }
+        arguments->sizes[arguments->n_sizes] = (unsigned)size;
+        arguments->n_sizes++;
+    }
+    return arguments->n_sizes > 0 ? 0 : -1;
+}
+
+static error_t argumentsParse(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+    switch (key) {
+        case 'v':
+            arguments->voters = (unsigned)atoi(arg);
+            break;
+        case 's':
+            arguments->standbys = (unsigned)atoi(arg);
+            break;
+        case 'z':
+            if (parseSizes(arguments, arg) != 0) {
+                argp_error(state, "invalid entry sizes");
+            }
+            break;
+        case 'c':
+            arguments->concurrency = (unsigned)atoi(arg);
+            if (arguments->concurrency == 0) {
+                argp_error(state, "concurrency must be positive");
+            }
+            break;
+        case 'e':
+            arguments->entries = strtoul(arg, NULL, 10);
+            break;
+        case 'l':
+            arguments->latency = (unsigned)atoi(arg);
+            break;
+        case 'b':
+            arguments->bandwidth = strtoull(arg, NULL, 10);
+            break;
+        case 'm':
+            arguments->message_cost = (unsigned)atoi(arg);
+            break;
+        case 'd':
+            arguments->disk_latency = (unsigned)atoi(arg);
+            break;
+        case 'f':
+            arguments->fsync_cost = (unsigned)atoi(arg);
+            break;
+        case 't':
+            arguments->snapshot_threshold = (unsigned)atoi(arg);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/********************************************************************
+ *
+ * FSM that just counts the bytes it applies.
+ *
+ ********************************************************************/
+
+static int fsmApply(struct raft_fsm *fsm,
+                    const struct raft_buffer *buf,
+                    void **result)
+{
+    uint64_t *count = fsm->data;
+    *count += buf->len;
+    *result = NULL;
+    return 0;
+}
+
+static int fsmSnapshot(struct raft_fsm *fsm,
+                       struct raft_buffer *bufs[],
+                       unsigned *n_bufs)
+{
+    uint64_t *count = fsm->data;
+    *bufs = raft_malloc(sizeof **bufs);
+    if (*bufs == NULL) {
+        return RAFT_NOMEM;
+    }
+    (*bufs)[0].len = sizeof *count;
+    (*bufs)[0].base = raft_malloc((*bufs)[0].len);
+    if ((*bufs)[0].base == NULL) {
+        raft_free(*bufs);
+        return RAFT_NOMEM;
+    }
+    memcpy((*bufs)[0].base, count, sizeof *count);
+    *n_bufs = 1;
+    return 0;
+}
+
+static int fsmRestore(struct raft_fsm *fsm, struct raft_buffer *buf)
+{
+    uint64_t *count = fsm->data;
+    if (buf->len != sizeof *count) {
+        return RAFT_MALFORMED;
+    }
+    memcpy(count, buf->base, sizeof *count);
+    raft_free(buf->base);
+    return 0;
+}
+
+/********************************************************************
+ *
+ * Load generation.
+ *
+ ********************************************************************/
+
+/* Slot holding a single in-flight apply request. */
+struct slot
+{
+    struct benchmark *benchmark;
+    struct raft_apply req;
+    size_t size; /* Size of the entry */
+};
+
+struct benchmark
+{
+    struct arguments *arguments;
+    struct raft_fixture fixture;
+    struct raft_fsm fsms[RAFT_FIXTURE_MAX_SERVERS];
+    uint64_t counts[RAFT_FIXTURE_MAX_SERVERS];
+    struct slot *slots;
+    unsigned *free;     /* Stack of indexes of free slots */
+    unsigned n_free;    /* Number of free slots */
+    raft_time start;    /* Simulated time when the first entry was submitted */
+    raft_time progress; /* Simulated time when an entry was last committed */
+    unsigned long submitted;
+    unsigned long committed;
+    unsigned long failed;
+    uint64_t bytes;     /* Bytes of committed entries */
+    raft_time *latencies; /* Commit latency of each entry, in microseconds */
+    unsigned long steps;
+};
+
+static void applyCb(struct raft_apply *req, int status, void *result)
+{
+    struct slot *slot = req->data;
+    struct benchmark *b = slot->benchmark;
+    (void)result;
+
+    b->free[b->n_free] = (unsigned)(slot - b->slots);
+    b->n_free++;
+
+    if (status != 0) {
+        b->failed++;
+        return;
+    }
+
+    b->progress = raft_fixture_time(&b->fixture);
+    b->latencies[b->committed] = req->times.applied - req->times.submitted;
+    b->committed++;
+    b->bytes += slot->size;
+}
+
+/* Submit entries to the leader until the concurrency limit is reached. */
+static void submitMore(struct benchmark *b)
+{
+    struct arguments *arguments = b->arguments;
+    unsigned i = raft_fixture_leader_index(&b->fixture);
+    struct raft *leader;
+
+    if (i == raft_fixture_n(&b->fixture)) {
+        return;
+    }
+    leader = raft_fixture_get(&b->fixture, i);
+
+    while (b->n_free > 0 && b->submitted < arguments->entries) {
+        struct slot *slot = &b->slots[b->free[b->n_free - 1]];
+        struct raft_buffer buf;
+        int rv;
+
+        buf.len = arguments->sizes[b->submitted % arguments->n_sizes];
+        buf.base = raft_malloc(buf.len);
+        assert(buf.base != NULL);
+        memset(buf.base, (int)(b->submitted & 0xff), buf.len);
+
+        slot->req.data = slot;
+        slot->size = buf.len;
+        rv = raft_apply(leader, &slot->req, &buf, 1, applyCb);
+        if (rv != 0) {
+            raft_free(buf.base);
+            return;
+        }
+        b->n_free--;
+        b->submitted++;
+    }
+}
+
+static void setUp(struct benchmark *b)
+{
+    struct arguments *arguments = b->arguments;
+    struct raft_configuration configuration;
+    unsigned n = arguments->voters + arguments->standbys;
+    unsigned i;
+    int rv;
+
+    for (i = 0; i < n; i++) {
+        struct raft_fsm *fsm = &b->fsms[i];
+        fsm->version = 1;
+        fsm->data = &b->counts[i];
+        fsm->apply = fsmApply;
+        fsm->snapshot = fsmSnapshot;
+        fsm->restore = fsmRestore;
+    }
+
+    rv = raft_fixture_init(&b->fixture, n, b->fsms);
+    assert(rv == 0);
+
+    for (i = 0; i < n; i++) {
+        struct raft *r = raft_fixture_get(&b->fixture, i);
+        raft_fixture_set_network_latency(&b->fixture, i, arguments->latency);
+        raft_fixture_set_network_bandwidth(&b->fixture, i,
+                                           arguments->bandwidth);
+        raft_fixture_set_message_cost(&b->fixture, i, arguments->message_cost);
+        raft_fixture_set_disk_latency(&b->fixture, i, arguments->disk_latency);
+        raft_fixture_set_fsync_cost(&b->fixture, i, arguments->fsync_cost);
+        raft_set_snapshot_threshold(r, arguments->snapshot_threshold);
+        raft_set_snapshot_trailing(r, arguments->snapshot_threshold / 2);
+    }
+
+    rv = raft_fixture_configuration(&b->fixture, arguments->voters,
+                                    &configuration);
+    assert(rv == 0);
+    rv = raft_fixture_bootstrap(&b->fixture, &configuration);
+    assert(rv == 0);
+    raft_configuration_close(&configuration);
+    rv = raft_fixture_start(&b->fixture);
+    assert(rv == 0);
+
+    raft_fixture_elect(&b->fixture, 0);
+}
+
+/********************************************************************
+ *
+ * Report.
+ *
+ ********************************************************************/
+
+static int compareLatency(const void *a, const void *b)
+{
+    raft_time x = *(const raft_time *)a;
+    raft_time y = *(const raft_time *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Return the given percentile of the sorted latencies. */
+static raft_time percentile(struct benchmark *b, double percentage)
+{
+    unsigned long rank;
+    if (b->committed == 0) {
+        return 0;
+    }
+    rank = (unsigned long)((double)b->committed * percentage / 100.0);
+    if (rank >= b->committed) {
+        rank = b->committed - 1;
+    }
+    return b->latencies[rank];
+}
+
+static void report(struct benchmark *b, double wall)
+{
+    struct arguments *arguments = b->arguments;
+    raft_time elapsed = raft_fixture_time(&b->fixture) - b->start;
+    double secs = (double)elapsed / 1000;
+    uint64_t sum = 0;
+    unsigned long i;
+
+    qsort(b->latencies, b->committed, sizeof *b->latencies, compareLatency);
+    for (i = 0; i < b->committed; i++) {
+        sum += b->latencies[i];
+    }
+
+    printf("{\n");
+    printf("  \"voters\": %u,\n", arguments->voters);
+    printf("  \"standbys\": %u,\n", arguments->standbys);
+    printf("  \"entry_sizes\": [");
+    for (i = 0; i < arguments->n_sizes; i++) {
+        printf("%s%u", i > 0 ? ", " : "", arguments->sizes[i]);
+    }
+    printf("],\n");
+    printf("  \"concurrency\": %u,\n", arguments->concurrency);
+    printf("  \"network_latency_ms\": %u,\n", arguments->latency);
+    printf("  \"bandwidth\": %" PRIu64 ",\n", arguments->bandwidth);
+    printf("  \"message_cost_us\": %u,\n", arguments->message_cost);
+    printf("  \"disk_latency_ms\": %u,\n", arguments->disk_latency);
+    printf("  \"fsync_cost_us\": %u,\n", arguments->fsync_cost);
+    printf("  \"simulated_s\": %.3f,\n", secs);
+    printf("  \"wall_s\": %.3f,\n", wall);
+    printf("  \"steps\": %lu,\n", b->steps);
+    printf("  \"commits\": %lu,\n", b->committed);
+    printf("  \"errors\": %lu,\n", b->failed);
+    printf("  \"commits_per_sec\": %.1f,\n",
+           secs > 0 ? (double)b->committed / secs : 0);
+    printf("  \"bytes_per_sec\": %.1f,\n",
+           secs > 0 ? (double)b->bytes / secs : 0);
+    printf("  \"latency_us\": {\n");
+    printf("    \"mean\": %.1f,\n",
+           b->committed > 0 ? (double)sum / (double)b->committed : 0);
+    printf("    \"p50\": %llu,\n", percentile(b, 50));
+    printf("    \"p99\": %llu,\n", percentile(b, 99));
+    printf("    \"p999\": %llu,\n", percentile(b, 99.9));
+    printf("    \"max\": %llu\n",
+           b->committed > 0 ? b->latencies[b->committed - 1] : 0);
+    printf("  }\n");
+    printf("}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    struct argp argp = {options, argumentsParse, NULL, doc, 0, 0, 0};
+    struct arguments arguments;
+    struct benchmark *b;
+    struct timespec start;
+    struct timespec end;
+    unsigned i;
+    int rv = 0;
+
+    arguments.voters = 3;
+    arguments.standbys = 0;
+    arguments.sizes[0] = 128;
+    arguments.n_sizes = 1;
+    arguments.concurrency = 64;
+    arguments.entries = 10000;
+    arguments.latency = 1;
+    arguments.bandwidth = 0;
+    arguments.message_cost = 0;
+    arguments.disk_latency = 1;
+    arguments.fsync_cost = 0;
+    arguments.snapshot_threshold = 1024;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.voters == 0 ||
+        arguments.voters + arguments.standbys > RAFT_FIXTURE_MAX_SERVERS) {
+        fprintf(stderr, "the cluster must have between 1 and %d servers\n",
+                RAFT_FIXTURE_MAX_SERVERS);
+        return 1;
+    }
+
+    b = calloc(1, sizeof *b);
+    assert(b != NULL);
+    b->arguments = &arguments;
+
+    b->slots = calloc(arguments.concurrency, sizeof *b->slots);
+    b->free = calloc(arguments.concurrency, sizeof *b->free);
+    b->latencies = calloc(arguments.entries + 1, sizeof *b->latencies);
+    assert(b->slots != NULL && b->free != NULL && b->latencies != NULL);
+    for (i = 0; i < arguments.concurrency; i++) {
+        b->slots[i].benchmark = b;
+        b->free[i] = arguments.concurrency - 1 - i;
+    }
+    b->n_free = arguments.concurrency;
+
+    setUp(b);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    b->start = raft_fixture_time(&b->fixture);
+    b->progress = b->start;
+    while (b->committed + b->failed < arguments.entries) {
+        if (raft_fixture_time(&b->fixture) - b->progress > PROGRESS_TIMEOUT) {
+            fprintf(stderr, "no progress for %d msecs\n", PROGRESS_TIMEOUT);
+            rv = 1;
+            break;
+        }
+        submitMore(b);
+        raft_fixture_step(&b->fixture);
+        b->steps++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    report(b, (double)(end.tv_sec - start.tv_sec) +
+                  (double)(end.tv_nsec - start.tv_nsec) / 1e9);
+
+    raft_fixture_close(&b->fixture);
+    free(b->latencies);
+    free(b->free);
+    free(b->slots);
+    free(b);
+
+    return rv;
+}
@@ -0,0 +1,640 @@
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "../include/raft.h"
+#include "../include/raft/uv.h"
+#include "../src/assert.h"
+#include "../src/byte.h"
+#include "../src/entry.h"
+#include "../src/snapshot.h"
+#include "../src/uv.h"
+#include "../src/uv_encoding.h"
+
+static char doc[] =
+    "Benchmark the startup of a server on a synthetic data directory";
+
+/* Term of all entries and snapshots. The metadata files record a later term,
+ * as if the server had voted in an election that was never won. */
+#define TERM 2
+
+/* ID of the server being started, within a configuration of three voters. */
+#define SERVER_ID 1
+
+/* Order of fields: {NAME, KEY, ARG, FLAGS, DOC, GROUP}.*/
+static struct argp_option options[] = {
+    {"dir", 'd', "DIR", 0, "Directory to use for temp files (default /tmp)", 0},
+    {"entries", 'e', "N", 0, "Number of entries on disk (default 100000)", 0},
+    {"size", 'z', "BYTES", 0, "Size of each entry (default 256)", 0},
+    {"batch", 'b', "N", 0, "Entries per written batch (default 16)", 0},
+    {"segment-size", 'S', "BYTES", 0,
+     "Size of segment files (default 8388608)", 0},
+    {"open", 'o', "N", 0,
+     "Entries in the open segment, before its torn tail (default 1000)", 0},
+    {"snapshots", 's', "N", 0, "Number of snapshots (default 2)", 0},
+    {"snapshot-size", 'k', "BYTES", 0,
+     "Size of each snapshot (default 1048576)", 0},
+    {"snapshot-interval", 'i', "N", 0,
+     "Entries between snapshots (default 1024)", 0},
+    {"runs", 'r', "N", 0, "Number of runs to average (default 5)", 0},
+    {"port", 'p', "PORT", 0, "Port to listen to (default 9200)", 0},
+    {0}};
+
+struct arguments
+{
+    char *dir;
+    unsigned entries;
+    unsigned size;
+    unsigned batch;
+    unsigned segment_size;
+    unsigned open;
+    unsigned snapshots;
+    unsigned snapshot_size;
+    unsigned snapshot_interval;
+    unsigned runs;
+    unsigned port;
+};
+
+static error_t argumentsParse(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+    switch (key) {
+        case 'd':
+            arguments->dir = arg;
+            break;
+        case 'e':
+            arguments->entries = (unsigned)atoi(arg);
+            break;
+        case 'z':
+            arguments->size = (unsigned)atoi(arg);
+            break;
+        case 'b':
+            arguments->batch = (unsigned)atoi(arg);
+            break;
+        case 'S':
+            arguments->segment_size = (unsigned)atoi(arg);
+            break;
+        case 'o':
+            arguments->open = (unsigned)atoi(arg);
+            break;
+        case 's':
+            arguments->snapshots = (unsigned)atoi(arg);
+            break;
+        case 'k':
+            arguments->snapshot_size = (unsigned)atoi(arg);
+            break;
+        case 'i':
+            arguments->snapshot_interval = (unsigned)atoi(arg);
+            break;
+        case 'r':
+            arguments->runs = (unsigned)atoi(arg);
+            break;
+        case 'p':
+            arguments->port = (unsigned)atoi(arg);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/********************************************************************
+ *
+ * Generation of the data directory.
+ *
+ ********************************************************************/
+
+/* Summary of a generated data directory. */
+struct layout
+{
+    raft_index first_index;   /* First entry in the closed segments */
+    raft_index open_index;    /* First entry in the open segment */
+    raft_index last_index;    /* Last entry that survives a load */
+    raft_index snapshot;      /* Index of the most recent snapshot */
+    unsigned closed_segments; /* Number of closed segments */
+    uint64_t bytes;           /* Total size of the files */
+};
+
+/* Write @len bytes of @buf into a new file, padded with zeros up to @size
+ * bytes. */
+static void writeFile(const char *dir,
+                      const char *filename,
+                      const void *buf,
+                      size_t len,
+                      size_t size,
+                      struct layout *layout)
+{
+    char path[2048];
+    ssize_t rv;
+    int fd;
+
+    sprintf(path, "%s/%s", dir, filename);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+        fprintf(stderr, "open '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+    rv = write(fd, buf, len);
+    if (rv != (ssize_t)len) {
+        fprintf(stderr, "write '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+    if (size > len && ftruncate(fd, (off_t)size) != 0) {
+        fprintf(stderr, "truncate '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+    close(fd);
+    layout->bytes += size > len ? size : len;
+}
+
+/* Write both metadata files, the second being the most recent one. */
+static void writeMetadata(const char *dir, struct layout *layout)
+{
+    uint8_t content[8 * 4];
+    unsigned short n;
+
+    for (n = 1; n <= 2; n++) {
+        char filename[16];
+        void *cursor = content;
+        bytePut64(&cursor, UV__DISK_FORMAT);
+        bytePut64(&cursor, n);                      /* Version */
+        bytePut64(&cursor, TERM + n - 1);           /* Term */
+        bytePut64(&cursor, n == 2 ? SERVER_ID : 0); /* Vote */
+        sprintf(filename, "metadata%d", n);
+        writeFile(dir, filename, content, sizeof content, 0, layout);
+    }
+}
+
+static void makeConfiguration(struct raft_configuration *conf, unsigned port)
+{
+    raft_id id;
+    int rv;
+
+    raft_configuration_init(conf);
+    for (id = 1; id <= 3; id++) {
+        char address[64];
+        sprintf(address, "127.0.0.1:%u", port + (unsigned)id - 1);
+        rv = raft_configuration_add(conf, id, address, RAFT_VOTER);
+        assert(rv == 0);
+    }
+}
+
+/* Write a snapshot with the given last index, along with its metadata. */
+static void writeSnapshot(const char *dir,
+                          const struct raft_configuration *conf,
+                          raft_index index,
+                          unsigned long long timestamp,
+                          size_t size,
+                          struct layout *layout)
+{
+    char filename[UV__FILENAME_LEN];
+    struct raft_buffer meta;
+    uint8_t *data;
+    size_t i;
+    int rv;
+
+    rv = uvEncodeSnapshotMeta(conf, 1, &meta);
+    assert(rv == 0);
+    sprintf(filename, UV__SNAPSHOT_META_TEMPLATE, (raft_term)TERM, index,
+            timestamp);
+    writeFile(dir, filename, meta.base, meta.len, 0, layout);
+    raft_free(meta.base);
+
+    data = malloc(size);
+    assert(data != NULL);
+    for (i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i * 31 + index);
+    }
+    sprintf(filename, UV__SNAPSHOT_TEMPLATE, (raft_term)TERM, index,
+            timestamp);
+    writeFile(dir, filename, data, size, 0, layout);
+    free(data);
+}
+
+/* Encode batches of the given entries into the given segment buffer,
+ * until either @n entries were encoded or the buffer would exceed @max
+ * bytes. Return the number of encoded entries. */
+static unsigned appendBatches(struct uvSegmentBuffer *buf,
+                              struct raft_entry *entries,
+                              unsigned batch,
+                              unsigned n,
+                              size_t max)
+{
+    unsigned i = 0;
+    while (i < n) {
+        unsigned n_batch = n - i < batch ? n - i : batch;
+        size_t size = sizeof(uint32_t) * 2 + uvSizeofBatchHeader(n_batch) +
+                      n_batch * entries[0].buf.len;
+        int rv;
+        if (i > 0 && buf->n + size > max) {
+            break;
+        }
+        rv = uvSegmentBufferAppend(buf, entries, n_batch, NULL);
+        assert(rv == 0);
+        i += n_batch;
+    }
+    return i;
+}
+
+/* Populate @dir with a data directory laid out as a server that crashed
+ * while appending entries would leave it. */
+static void generate(const char *dir,
+                     const struct arguments *args,
+                     struct layout *layout)
+{
+    struct raft_configuration conf;
+    struct raft_entry *entries;
+    struct uvSegmentBuffer buf;
+    char filename[UV__FILENAME_LEN];
+    uv_buf_t out;
+    raft_index index;
+    unsigned closed = args->entries - args->open;
+    unsigned i;
+    int rv;
+
+    memset(layout, 0, sizeof *layout);
+    makeConfiguration(&conf, args->port);
+    writeMetadata(dir, layout);
+
+    /* When there are snapshots, pretend that the entries before the log on
+     * disk were compacted away, and take snapshots at regular intervals
+     * within the closed segments. */
+    layout->first_index = args->snapshots > 0 ? args->entries + 1 : 1;
+    layout->open_index = layout->first_index + closed;
+    for (i = 0; i < args->snapshots; i++) {
+        raft_index distance;
+        distance = (raft_index)(args->snapshots - 1 - i) *
+                   args->snapshot_interval;
+        index = layout->open_index - 1;
+        if (distance < closed) {
+            index -= distance;
+        } else {
+            index = layout->first_index;
+        }
+        writeSnapshot(dir, &conf, index, 1000 + i, args->snapshot_size,
+                      layout);
+        layout->snapshot = index;
+    }
+    raft_configuration_close(&conf);
+
+    /* All entries share the same payload. */
+    entries = malloc(args->batch * sizeof *entries);
+    assert(entries != NULL);
+    for (i = 0; i < args->batch; i++) {
+        entries[i].term = TERM;
+        entries[i].type = RAFT_COMMAND;
+        entries[i].buf.base = malloc(args->size);
+        entries[i].buf.len = args->size;
+        entries[i].batch = NULL;
+        assert(entries[i].buf.base != NULL);
+        memset(entries[i].buf.base, (int)i + 1, args->size);
+    }
+
+    /* Closed segments are truncated to the end of their last batch. */
+    index = layout->first_index;
+    while (index < layout->open_index) {
+        unsigned n;
+        uvSegmentBufferInit(&buf, 4096);
+        rv = uvSegmentBufferFormat(&buf);
+        assert(rv == 0);
+        n = appendBatches(&buf, entries, args->batch,
+                          (unsigned)(layout->open_index - index),
+                          args->segment_size);
+        uvSegmentBufferFinalize(&buf, &out);
+        sprintf(filename, UV__CLOSED_TEMPLATE, index, index + n - 1);
+        writeFile(dir, filename, out.base, buf.n, 0, layout);
+        uvSegmentBufferClose(&buf);
+        layout->closed_segments++;
+        index += n;
+    }
+
+    /* The open segment was preallocated, so its unwritten tail is zeroed. Its
+     * last batch is torn: the header made it to disk, but only half of the
+     * data did. */
+    uvSegmentBufferInit(&buf, 4096);
+    rv = uvSegmentBufferFormat(&buf);
+    assert(rv == 0);
+    appendBatches(&buf, entries, args->batch, args->open, SIZE_MAX);
+    rv = uvSegmentBufferAppend(&buf, entries, args->batch, NULL);
+    assert(rv == 0);
+    memset(buf.arena.base + buf.n - args->batch * args->size / 2, 0,
+           args->batch * args->size / 2);
+    sprintf(filename, UV__OPEN_TEMPLATE, 1ULL);
+    writeFile(dir, filename, buf.arena.base, buf.n, args->segment_size,
+              layout);
+    uvSegmentBufferClose(&buf);
+    layout->last_index = layout->open_index + args->open - 1;
+
+    for (i = 0; i < args->batch; i++) {
+        free(entries[i].buf.base);
+    }
+    free(entries);
+}
+
+static int removeCb(const char *path,
+                    const struct stat *sb,
+                    int type,
+                    struct FTW *ftw)
+{
+    (void)sb;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+/* Create a fresh directory under @parent and generate a data directory in
+ * it. */
+static void setUp(const char *parent,
+                  char *dir,
+                  const struct arguments *args,
+                  struct layout *layout)
+{
+    sprintf(dir, "%s/raft-startup-XXXXXX", parent);
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "mkdtemp '%s': %s\n", dir, strerror(errno));
+        exit(1);
+    }
+    generate(dir, args, layout);
+}
+
+static void tearDown(const char *dir)
+{
+    nftw(dir, removeCb, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/********************************************************************
+ *
+ * Measurements.
+ *
+ ********************************************************************/
+
+/* Accumulated durations of a phase across runs, in nanoseconds. */
+struct timing
+{
+    uint64_t sum;
+    uint64_t min;
+};
+
+enum {
+    LOAD_METADATA = 0,
+    LOAD_LIST,
+    LOAD_SNAPSHOT,
+    LOAD_SEGMENTS,
+    LOAD_READ,
+    LOAD_CRC,
+    LOAD_DECODE,
+    LOAD_TOTAL,
+    START_INIT,
+    START_START,
+    START_LOAD,
+    START_TOTAL,
+    N_STATS
+};
+
+static const char *timingNames[N_STATS] = {
+    "metadata", "list",  "snapshot", "segments", "read", "crc",
+    "decode",   "total", "init",     "start",    "load", "total"};
+
+static void timingAdd(struct timing *timing, uint64_t value)
+{
+    if (timing->sum == 0 || value < timing->min) {
+        timing->min = value;
+    }
+    timing->sum += value;
+}
+
+static void addLoadTimes(struct timing *stats,
+                         const struct raft_uv_load_times *load)
+{
+    timingAdd(&stats[LOAD_METADATA], load->metadata);
+    timingAdd(&stats[LOAD_LIST], load->list);
+    timingAdd(&stats[LOAD_SNAPSHOT], load->snapshot);
+    timingAdd(&stats[LOAD_SEGMENTS], load->segments);
+    timingAdd(&stats[LOAD_READ], load->read);
+    timingAdd(&stats[LOAD_CRC], load->crc);
+    timingAdd(&stats[LOAD_DECODE], load->decode);
+    timingAdd(&stats[LOAD_TOTAL], load->total);
+}
+
+/* Initialize a raft_io instance on @dir and load its content, the way
+ * raft_start() does. */
+static void runLoad(const char *dir,
+                    const struct arguments *args,
+                    const struct layout *layout,
+                    struct timing *stats)
+{
+    struct uv_loop_s loop;
+    struct raft_uv_transport transport;
+    struct raft_io io;
+    struct raft_uv_metrics metrics;
+    struct raft_snapshot *snapshot;
+    struct raft_entry *entries;
+    raft_index start_index;
+    raft_term term;
+    raft_id voted_for;
+    size_t n;
+    char address[64];
+    int rv;
+
+    sprintf(address, "127.0.0.1:%u", args->port);
+    rv = uv_loop_init(&loop);
+    assert(rv == 0);
+    rv = raft_uv_tcp_init(&transport, &loop);
+    assert(rv == 0);
+    rv = raft_uv_init(&io, &loop, dir, &transport);
+    assert(rv == 0);
+
+    rv = io.init(&io, SERVER_ID, address);
+    if (rv != 0) {
+        fprintf(stderr, "init: %s\n", io.errmsg);
+        exit(1);
+    }
+    rv = io.load(&io, &term, &voted_for, &snapshot, &start_index, &entries,
+                 &n);
+    if (rv != 0) {
+        fprintf(stderr, "load: %s\n", io.errmsg);
+        exit(1);
+    }
+    assert(start_index + n - 1 == layout->last_index);
+    assert(snapshot == NULL || snapshot->index == layout->snapshot);
+
+    raft_uv_get_metrics(&io, &metrics);
+    addLoadTimes(stats, &metrics.load);
+
+    if (snapshot != NULL) {
+        snapshotDestroy(snapshot);
+    }
+    entryBatchesDestroy(entries, n);
+
+    io.close(&io, NULL);
+    uv_run(&loop, UV_RUN_DEFAULT);
+    raft_uv_close(&io);
+    raft_uv_tcp_close(&transport);
+    uv_loop_close(&loop);
+}
+
+static int fsmApply(struct raft_fsm *fsm,
+                    const struct raft_buffer *buf,
+                    void **result)
+{
+    (void)fsm;
+    (void)buf;
+    *result = NULL;
+    return 0;
+}
+
+static int fsmRestore(struct raft_fsm *fsm, struct raft_buffer *buf)
+{
+    (void)fsm;
+    raft_free(buf->base);
+    return 0;
+}
+
+static void raftCloseCb(struct raft *r)
+{
+    (void)r;
+}
+
+/* Start a raft server on @dir, from its initialization until it's ready to
+ * handle messages. */
+static void runStart(const char *dir,
+                     const struct arguments *args,
+                     struct timing *stats)
+{
+    struct uv_loop_s loop;
+    struct raft_uv_transport transport;
+    struct raft_io io;
+    struct raft_fsm fsm;
+    struct raft raft;
+    struct raft_uv_metrics metrics;
+    uint64_t t0;
+    uint64_t t1;
+    uint64_t t2;
+    char address[64];
+    int rv;
+
+    sprintf(address, "127.0.0.1:%u", args->port);
+    rv = uv_loop_init(&loop);
+    assert(rv == 0);
+    rv = raft_uv_tcp_init(&transport, &loop);
+    assert(rv == 0);
+    rv = raft_uv_init(&io, &loop, dir, &transport);
+    assert(rv == 0);
+    memset(&fsm, 0, sizeof fsm);
+    fsm.version = 1;
+    fsm.apply = fsmApply;
+    fsm.restore = fsmRestore;
+
+    t0 = uv_hrtime();
+    rv = raft_init(&raft, &io, &fsm, SERVER_ID, address);
+    if (rv != 0) {
+        fprintf(stderr, "raft_init: %s\n", raft_errmsg(&raft));
+        exit(1);
+    }
+    t1 = uv_hrtime();
+    rv = raft_start(&raft);
+    if (rv != 0) {
+        fprintf(stderr, "raft_start: %s\n", raft_errmsg(&raft));
+        exit(1);
+    }
+    t2 = uv_hrtime();
+
+    raft_uv_get_metrics(&io, &metrics);
+    timingAdd(&stats[START_INIT], t1 - t0);
+    timingAdd(&stats[START_START], t2 - t1);
+    timingAdd(&stats[START_LOAD], metrics.load.total - metrics.load.metadata);
+    timingAdd(&stats[START_TOTAL], t2 - t0);
+
+    raft_close(&raft, raftCloseCb);
+    uv_run(&loop, UV_RUN_DEFAULT);
+    raft_uv_close(&io);
+    raft_uv_tcp_close(&transport);
+    uv_loop_close(&loop);
+}
+
+static void printStats(const char *name,
+                       const struct timing *stats,
+                       unsigned first,
+                       unsigned last,
+                       unsigned runs)
+{
+    unsigned i;
+    printf("  \"%s\": {\n", name);
+    for (i = first; i <= last; i++) {
+        printf("    \"%s\": {\"mean\": %.3f, \"min\": %.3f}%s\n",
+               timingNames[i], (double)stats[i].sum / runs / 1e6,
+               (double)stats[i].min / 1e6, i < last ? "," : "");
+    }
+    printf("  }");
+}
+
+int main(int argc, char *argv[])
+{
+    struct argp argp = {options, argumentsParse, NULL, doc, 0, 0, 0};
+    struct arguments arguments;
+    struct timing stats[N_STATS];
+    struct layout layout;
+    char dir[1024];
+    unsigned i;
+
+    arguments.dir = "/tmp";
+    arguments.entries = 100000;
+    arguments.size = 256;
+    arguments.batch = 16;
+    arguments.segment_size = UV__MAX_SEGMENT_SIZE;
+    arguments.open = 1000;
+    arguments.snapshots = 2;
+    arguments.snapshot_size = 1024 * 1024;
+    arguments.snapshot_interval = 1024;
+    arguments.runs = 5;
+    arguments.port = 9200;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.size == 0 || arguments.batch == 0 || arguments.runs == 0 ||
+        arguments.open == 0 || arguments.open >= arguments.entries ||
+        arguments.segment_size > UV__MAX_SEGMENT_SIZE ||
+        strlen(arguments.dir) > 512) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    memset(stats, 0, sizeof stats);
+
+    /* Loading closes the open segment, so each run uses a fresh copy of the
+     * data directory. */
+    for (i = 0; i < arguments.runs; i++) {
+        setUp(arguments.dir, dir, &arguments, &layout);
+        runLoad(dir, &arguments, &layout, stats);
+        tearDown(dir);
+
+        setUp(arguments.dir, dir, &arguments, &layout);
+        runStart(dir, &arguments, stats);
+        tearDown(dir);
+    }
+
+    printf("{\n");
+    printf("  \"entries\": %u,\n", arguments.entries);
+    printf("  \"entry_size\": %u,\n", arguments.size);
+    printf("  \"batch\": %u,\n", arguments.batch);
+    printf("  \"closed_segments\": %u,\n", layout.closed_segments);
+    printf("  \"snapshots\": %u,\n", arguments.snapshots);
+    printf("  \"snapshot_size\": %u,\n", arguments.snapshot_size);
+    printf("  \"bytes\": %llu,\n", (unsigned long long)layout.bytes);
+    printf("  \"runs\": %u,\n", arguments.runs);
+    printStats("load_ms", stats, LOAD_METADATA, LOAD_TOTAL, arguments.runs);
+    printf(",\n");
+    printStats("start_ms", stats, START_INIT, START_TOTAL, arguments.runs);
+    printf("\n}\n");
+
+    return 0;
+}
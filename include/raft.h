@@ -4,6 +4,7 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #define RAFT_API __attribute__((visibility("default")))
@@ -220,11 +221,15 @@ struct raft_entry_ref
 struct raft_log
 {
     struct raft_entry *entries;  /* Circular buffer of log entries. */
+    size_t *ends;                /* Running total of payload sizes, by slot. */
     size_t size;                 /* Number of available slots in the buffer. */
     size_t front, back;          /* Indexes of used slots [front, back). */
     raft_index offset;           /* Index of first entry is offset+1. */
     struct raft_entry_ref *refs; /* Log entries reference counts hash table. */
     size_t refs_size;            /* Size of the reference counts hash table. */
+    size_t bytes;                /* Total size of the entries payloads. */
+    size_t shared;               /* Payloads also referenced by pending I/O. */
+    size_t pinned;               /* Payloads of removed, referenced entries. */
     struct                       /* Information about last snapshot, or zero. */
     {
         raft_index last_index; /* Snapshot replaces all entries up to here. */
@@ -270,6 +275,7 @@ struct raft_append_entries
     raft_index leader_commit;   /* Leader's commit index. */
     struct raft_entry *entries; /* Log entries to append. */
     unsigned n_entries;         /* Size of the log entries array. */
+    bool quiesce;               /* Leader is idle, lengthen election timer. */
 };
 
 /**
@@ -280,6 +286,7 @@ struct raft_append_entries_result
     raft_term term;            /* Receiver's current_term. */
     raft_index rejected;       /* If non-zero, the index that was rejected. */
     raft_index last_log_index; /* Receiver's last log entry index, as hint. */
+    raft_index snapshot_index; /* Receiver's last snapshot index, or 0. */
 };
 
 /**
@@ -293,6 +300,7 @@ struct raft_install_snapshot
     struct raft_configuration conf; /* Config as of last_index. */
     raft_index conf_index;          /* Commit index of conf. */
     struct raft_buffer data;        /* Raw snapshot data. */
+    raft_id leader_id;              /* Leader's ID, if sent on its behalf. */
 };
 
 /**
@@ -308,6 +316,18 @@ struct raft_timeout_now
     raft_index last_log_term;  /* Term of log entry at last_log_index. */
 };
 
+/**
+ * Hold the arguments of a DelegateSnapshot RPC.
+ *
+ * The DelegateSnapshot RPC is invoked by leaders to ask an up-to-date follower
+ * to send its own latest snapshot to another server, on the leader's behalf.
+ */
+struct raft_delegate_snapshot
+{
+    raft_term term;    /* Leader's term. */
+    raft_id server_id; /* ID of the server to send the snapshot to. */
+};
+
 /**
  * Type codes for RPC messages.
  */
@@ -317,7 +337,8 @@ enum {
     RAFT_IO_REQUEST_VOTE,
     RAFT_IO_REQUEST_VOTE_RESULT,
     RAFT_IO_INSTALL_SNAPSHOT,
-    RAFT_IO_TIMEOUT_NOW
+    RAFT_IO_TIMEOUT_NOW,
+    RAFT_IO_DELEGATE_SNAPSHOT
 };
 
 /**
@@ -335,6 +356,7 @@ struct raft_message
         struct raft_append_entries_result append_entries_result;
         struct raft_install_snapshot install_snapshot;
         struct raft_timeout_now timeout_now;
+        struct raft_delegate_snapshot delegate_snapshot;
     };
 };
 
@@ -426,6 +448,69 @@ struct raft_tracer
                  const char *message);
 };
 
+/**
+ * Structured binary tracing.
+ *
+ * A trace ring is a circular buffer of fixed-size binary records, each holding
+ * the ID of an event known at compile time, the time at which it happened and
+ * up to #RAFT_TRACE_FIELDS integer fields whose meaning depends on the event.
+ * A raft instance with a trace ring set records its main events into it as it
+ * runs, which costs a handful of stores per event and nothing at all when no
+ * ring is set, so tracing can be left on in production.
+ *
+ * The ring is a self-describing block of memory made of a header followed by
+ * its records. It's written by the thread running the raft instance, and can
+ * be decoded concurrently by any other thread. The block can also be mapped
+ * from a file with mmap() and MAP_SHARED, so the latest events survive a crash
+ * and can be decoded offline with the raft-trace tool (see --enable-tools).
+ */
+#define RAFT_TRACE_RING_MAGIC 0x676e697274666172ULL /* "raftring" */
+#define RAFT_TRACE_RING_VERSION 1
+#define RAFT_TRACE_FIELDS 4
+
+struct raft_trace_record
+{
+    uint64_t seq;                       /* Sequence number, 0 if invalid */
+    uint64_t time;                      /* Time of the event, in msecs */
+    uint32_t event;                     /* Event ID */
+    uint32_t reserved;                  /* Must be zero */
+    uint64_t fields[RAFT_TRACE_FIELDS]; /* Event-specific fields */
+};
+
+struct raft_trace_ring
+{
+    uint64_t magic;    /* Must be RAFT_TRACE_RING_MAGIC */
+    uint32_t version;  /* Format version, RAFT_TRACE_RING_VERSION */
+    uint32_t capacity; /* Number of records, a power of two */
+    uint64_t id;       /* ID of the traced server */
+    uint64_t head;     /* Sequence number of the last record written */
+    /* The capacity records follow. */
+};
+
+/**
+ * Return the number of bytes needed by a trace ring with the given capacity.
+ */
+RAFT_API size_t raft_trace_ring_size(unsigned capacity);
+
+/**
+ * Format the given memory block, which must be at least
+ * raft_trace_ring_size(capacity) bytes long, as an empty trace ring.
+ *
+ * Return #RAFT_INVALID if @capacity is not a power of two.
+ */
+RAFT_API int raft_trace_ring_init(struct raft_trace_ring *ring,
+                                  unsigned capacity);
+
+/**
+ * Write a line of text to @f for each valid record of the trace ring contained
+ * in the given memory block of @size bytes, from the oldest to the newest.
+ *
+ * Return #RAFT_MALFORMED if the block doesn't contain a valid trace ring.
+ */
+RAFT_API int raft_trace_ring_decode(const struct raft_trace_ring *ring,
+                                    size_t size,
+                                    FILE *f);
+
 struct raft_io; /* Forward declaration. */
 
 /**
@@ -483,6 +568,10 @@ struct raft_io
                         raft_io_snapshot_get_cb cb);
     raft_time (*time)(struct raft_io *io);
     int (*random)(struct raft_io *io, int min, int max);
+    /* Fields below are added in version 2. */
+    bool (*send_backlogged)(struct raft_io *io, raft_id id);
+    /* Fields below are added in version 3. */
+    uint64_t (*time_us)(struct raft_io *io);
 };
 
 struct raft_fsm
@@ -503,6 +592,58 @@ struct raft_fsm
  */
 enum { RAFT_UNAVAILABLE, RAFT_FOLLOWER, RAFT_CANDIDATE, RAFT_LEADER };
 
+/**
+ * Latency histogram.
+ *
+ * Values 0 to 3 have a bucket each. Above that, the values between each power
+ * of two and the next one are split into 4 buckets of equal width, so the
+ * bucket of a value is at most 25% wider than the value itself. Values larger
+ * than the upper bound of the last bucket are counted in the last bucket.
+ */
+#define RAFT_HISTOGRAM_BUCKETS 128
+
+struct raft_histogram
+{
+    uint64_t count;                            /* Number of samples */
+    uint64_t sum;                              /* Sum of all samples */
+    uint64_t max;                              /* Largest sample */
+    uint64_t buckets[RAFT_HISTOGRAM_BUCKETS]; /* Samples in each bucket */
+};
+
+/**
+ * Return an upper bound of the value below which the given percentage of the
+ * samples of @h fall, or 0 if @h is empty. For example, passing 99 returns the
+ * 99th percentile.
+ */
+RAFT_API uint64_t raft_histogram_percentile(const struct raft_histogram *h,
+                                            double percentage);
+
+/**
+ * Counters and latency histograms of a raft instance, accumulated since it was
+ * initialized. Latencies are in microseconds, as returned by the time_us()
+ * method of the I/O backend, or by its time() method multiplied by 1000 if it
+ * doesn't implement time_us().
+ */
+struct raft_metrics
+{
+    uint64_t entries_appended;    /* Entries submitted to the local log */
+    uint64_t bytes_appended;      /* Payload bytes of the entries above */
+    uint64_t entries_sent;        /* Entries sent to other servers */
+    uint64_t bytes_sent;          /* Payload bytes of the entries above */
+    uint64_t entries_applied;     /* Entries applied */
+    uint64_t bytes_applied;       /* Payload bytes of the entries above */
+    uint64_t elections;           /* Elections started, even pre-vote ones */
+    uint64_t snapshots_taken;     /* Snapshots taken */
+    uint64_t snapshots_installed; /* Snapshots received from the leader */
+
+    /* Time between the submission of each #raft_apply request to the leader
+     * and the commit of all its entries, and between its submission and the
+     * application of its first command, computed from the times recorded in
+     * the request. */
+    struct raft_histogram commit_latency;
+    struct raft_histogram apply_latency;
+};
+
 /**
  * Used by leaders to keep track of replication progress for each server.
  */
@@ -514,6 +655,13 @@ struct raft_progress
     raft_index snapshot_index; /* Last index of most recent snapshot sent. */
     raft_time last_send;       /* Timestamp of last AppendEntries RPC. */
     bool recent_recv;          /* A msg was received within election timeout. */
+    raft_id delegate_id;       /* Server sending a snapshot on our behalf. */
+    raft_time last_recv;       /* Timestamp of last AppendEntries result. */
+    uint64_t snapshot_size;    /* Size of the snapshot being sent. */
+    raft_index ack_index;      /* Last entry of the sampled AppendEntries. */
+    raft_time ack_send;        /* Time the sampled AppendEntries was sent. */
+    struct raft_histogram ack_latency; /* Send to ack latency, in msecs. */
+    raft_index last_snapshot;  /* Last snapshot index reported by the server. */
 };
 
 struct raft; /* Forward declaration. */
@@ -642,6 +790,7 @@ struct raft
                 raft_id id;
                 char *address;
             } current_leader;
+            bool quiescent; /* Election timer lengthened by the leader. */
         } follower_state;
         struct
         {
@@ -659,6 +808,7 @@ struct raft
             raft_index round_index;         /* Target of the current round. */
             raft_time round_start;          /* Start of current round. */
             void *requests[2];              /* Outstanding client requests. */
+            bool quiescent;                 /* Idle, sending keepalives only. */
         } leader_state;
     };
 
@@ -682,6 +832,15 @@ struct raft
     {
         unsigned threshold;              /* N. of entries before snapshot */
         unsigned trailing;               /* N. of trailing entries to retain */
+        size_t threshold_bytes;          /* N. of bytes before snapshot */
+        size_t bytes;                    /* Bytes applied since last snapshot */
+        size_t pending_bytes;            /* Bytes included in pending one */
+        bool adaptive;                   /* Whether to use adaptive policy */
+        bool delegate;                   /* Let followers send snapshots */
+        raft_time started;               /* Start time of pending snapshot */
+        raft_time finished;              /* Completion time of last snapshot */
+        raft_time cost;                  /* Duration of last snapshot */
+        size_t sending;                  /* Bytes of snapshots being sent */
         struct raft_snapshot pending;    /* In progress snapshot */
         struct raft_io_snapshot_put put; /* Store snapshot request */
     } snapshot;
@@ -701,6 +860,15 @@ struct raft
      * current leader, as described in 4.2.3 and 9.6. */
     bool pre_vote;
 
+    /* Whether leaders stop sending heartbeats while the cluster is idle. */
+    bool quiescence;
+
+    /* Binary trace ring to record events into, if any. */
+    struct raft_trace_ring *trace_ring;
+
+    /* Performance metrics. */
+    struct raft_metrics metrics;
+
     /* Limit how long to wait for a stand-by to catch-up with the log when its
      * being promoted to voter. */
     unsigned max_catch_up_rounds;
@@ -784,11 +952,158 @@ RAFT_API void raft_set_install_snapshot_timeout(struct raft *r, unsigned msecs);
  */
 RAFT_API void raft_set_snapshot_threshold(struct raft *r, unsigned n);
 
+/**
+ * Number of bytes of log entries payloads applied since the last snapshot
+ * before starting a new snapshot. A new snapshot is taken as soon as either
+ * this threshold or the one set with @raft_set_snapshot_threshold is
+ * reached. The default is 0, meaning that only the number of entries is
+ * considered.
+ */
+RAFT_API void raft_set_snapshot_threshold_bytes(struct raft *r, size_t n);
+
+/**
+ * Enable or disable the adaptive snapshot policy. It's turned off by default.
+ *
+ * When enabled, the thresholds set with @raft_set_snapshot_threshold and
+ * @raft_set_snapshot_threshold_bytes become soft limits: a new snapshot is
+ * postponed if the time spent taking the last one was significant compared to
+ * the time elapsed since then, unless the log has grown past twice either
+ * limit, or the payloads of the entries kept in memory have grown past twice
+ * the bytes threshold. Also, the number of trailing entries set with
+ * @raft_set_snapshot_trailing is reduced as needed in order to keep the size of
+ * the retained entries within the bytes threshold.
+ */
+RAFT_API void raft_set_snapshot_adaptive(struct raft *r, bool enabled);
+
+/**
+ * Enable or disable snapshot delegation. It's turned off by default.
+ *
+ * When enabled, a leader that needs to send a snapshot to a server that has
+ * fallen behind asks an up-to-date follower, whose latest snapshot is at least
+ * as recent as the leader's one, to send it instead, using the DelegateSnapshot
+ * RPC. Followers report the index of their latest snapshot in their
+ * AppendEntries results. Log replication then resumes from
+ * the leader as usual. If the delegated attempt doesn't succeed within the
+ * install snapshot timeout, the leader sends the snapshot itself.
+ *
+ * All servers in the cluster must support the DelegateSnapshot RPC before
+ * this option is enabled.
+ */
+RAFT_API void raft_set_snapshot_delegate(struct raft *r, bool enabled);
+
 /**
  * Enable or disable pre-vote support. Pre-vote is turned off by default.
  */
 RAFT_API void raft_set_pre_vote(struct raft *r, bool enabled);
 
+/**
+ * Enable or disable quiescence. It's turned off by default.
+ *
+ * When enabled, a leader whose log is fully committed, applied and replicated
+ * to all followers, which it heard from recently, sends a last round of
+ * heartbeats telling them that the cluster is idle. From then on it sends
+ * heartbeats and checks that it can still reach a majority of the cluster ten
+ * times less often, and followers wait ten election timeouts without hearing
+ * from it before starting an election. It resumes as soon as new entries get
+ * appended, a follower rejects its entries or another server requests a vote.
+ */
+RAFT_API void raft_set_quiescence(struct raft *r, bool enabled);
+
+/**
+ * Record the events of this raft instance into the given trace ring, or stop
+ * recording them if @ring is NULL. The ring must have been formatted with
+ * raft_trace_ring_init(), and must not be shared with other instances.
+ */
+RAFT_API void raft_set_trace_ring(struct raft *r, struct raft_trace_ring *ring);
+
+/**
+ * Fill @metrics with a copy of the current metrics of this raft instance. This
+ * is cheap enough to be called periodically from the thread running it.
+ */
+RAFT_API void raft_get_metrics(struct raft *r, struct raft_metrics *metrics);
+
+/**
+ * Memory held by a raft instance, in bytes.
+ *
+ * Entries acquired by in-flight sends and appends stay in memory until those
+ * requests complete, even after being deleted from the log by a snapshot or a
+ * truncation: a slow follower can pin a large part of the log this way.
+ */
+struct raft_memory
+{
+    uint64_t log_entries; /* Payloads of the entries in the in-memory log */
+    uint64_t log_shared;  /* Part of the above also held by in-flight I/O */
+    uint64_t log_pinned;  /* Deleted entries still held by in-flight I/O */
+    uint64_t log_index;   /* Entries array and reference count table */
+    uint64_t snapshots;   /* Snapshots being taken, installed or sent */
+};
+
+/**
+ * Fill @memory with the current memory usage of this raft instance. This is
+ * cheap enough to be called periodically from the thread running it.
+ */
+RAFT_API void raft_get_memory(struct raft *r, struct raft_memory *memory);
+
+/**
+ * Fill @latency with the histogram of the time elapsed between sending new
+ * entries to the server with the given ID and receiving its acknowledgement,
+ * accumulated since this instance became leader or the server was added.
+ *
+ * Return #RAFT_NOTLEADER if this instance is not the leader, or #RAFT_BADID if
+ * there's no server with the given ID in the configuration.
+ */
+RAFT_API int raft_get_ack_latency(struct raft *r,
+                                  raft_id id,
+                                  struct raft_histogram *latency);
+
+/**
+ * Replication modes of a server, as seen by the leader.
+ */
+enum {
+    RAFT_REPLICATION_PROBE,    /* Looking for the last matching entry */
+    RAFT_REPLICATION_PIPELINE, /* Streaming new entries */
+    RAFT_REPLICATION_SNAPSHOT  /* Catching up with a snapshot */
+};
+
+/**
+ * Replication status of a server, as seen by the leader. Byte counts only
+ * include the payloads of the entries.
+ */
+struct raft_replication_status
+{
+    raft_id id;                /* Server ID */
+    int mode;                  /* One of the RAFT_REPLICATION_* values */
+    raft_index match_index;    /* Last entry known to be replicated */
+    raft_index next_index;     /* Next entry to send */
+    raft_index lag;            /* Entries not known to be replicated */
+    uint64_t lag_bytes;        /* Size of those entries */
+    uint64_t inflight_bytes;   /* Size of the entries sent but not acked */
+    raft_index margin;         /* Compacted entries that force a snapshot */
+    raft_time last_ack_age;    /* Msecs since the last AppendEntries result */
+    raft_index snapshot_index; /* Snapshot being sent, 0 if none */
+    raft_id snapshot_delegate; /* Server sending it on our behalf, if any */
+    uint64_t snapshot_size;    /* Its size, 0 while still being loaded */
+    raft_time snapshot_age;    /* Msecs since the snapshot started */
+};
+
+/**
+ * Fill @status with the replication status of the server with the given ID.
+ *
+ * The @margin is one more than the number of entries in our log that precede
+ * @next_index, so the server needs a snapshot as soon as that many entries get
+ * compacted away. A @margin of 0 means that the entries the server needs are
+ * not in our log anymore and it must be sent a snapshot. A small margin
+ * compared to the snapshot trailing amount means that it will need one after
+ * our next snapshot. The @lag of the leader itself is the number of entries not yet
+ * written to its own disk.
+ *
+ * Return #RAFT_NOTLEADER if this instance is not the leader, or #RAFT_BADID if
+ * there's no server with the given ID in the configuration.
+ */
+RAFT_API int raft_replication_status(struct raft *r,
+                                     raft_id id,
+                                     struct raft_replication_status *status);
+
 /**
  * Number of outstanding log entries to keep in the log after a snapshot has
  * been taken. This avoids sending snapshots when a follower is behind by just a
@@ -842,6 +1157,26 @@ RAFT_API raft_index raft_last_applied(struct raft *r);
     raft_index index; \
     void *queue[2]
 
+/**
+ * Times at which an apply request went through each stage of its lifecycle, in
+ * microseconds, as returned by the time_us() method of the I/O backend, or by
+ * its time() method multiplied by 1000 if it doesn't implement time_us(). A
+ * stage that was not reached is set to 0.
+ *
+ * Comparing consecutive stages tells where the latency of a request comes from:
+ * the local disk (appended to persisted), the network and the disks of the
+ * followers (persisted to committed, if greater than 0) or the FSM (committed
+ * to applied).
+ */
+struct raft_apply_times
+{
+    uint64_t submitted; /* The request was accepted by raft_apply() */
+    uint64_t appended;  /* All its entries were submitted to the local disk */
+    uint64_t persisted; /* All its entries were written to the local disk */
+    uint64_t committed; /* All its entries were stored by a quorum */
+    uint64_t applied;   /* Its first command was applied to the FSM */
+};
+
 /**
  * Asynchronous request to append a new command entry to the log and apply it to
  * the FSM when a quorum is reached.
@@ -852,6 +1187,8 @@ struct raft_apply
 {
     RAFT__REQUEST;
     raft_apply_cb cb;
+    unsigned n;                    /* Number of commands, set by raft_apply() */
+    struct raft_apply_times times; /* Filled in as the request progresses */
 };
 
 /**
@@ -8,7 +8,7 @@
 
 #include "../raft.h"
 
-#define RAFT_FIXTURE_MAX_SERVERS 8
+#define RAFT_FIXTURE_MAX_SERVERS 32
 
 /**
  * Fixture step event types.
@@ -324,7 +324,8 @@ RAFT_API void raft_fixture_reconnect(struct raft_fixture *f,
 
 /**
  * Saturate the connection between the @i'th and the @j'th servers, so messages
- * sent by @i to @j will be silently dropped.
+ * sent by @i to @j will be silently dropped, and the I/O backend of @i will
+ * report that its messages to @j are backlogged.
  */
 RAFT_API void raft_fixture_saturate(struct raft_fixture *f,
                                     unsigned i,
@@ -360,8 +361,8 @@ RAFT_API int raft_fixture_grow(struct raft_fixture *f, struct raft_fsm *fsm);
 /**
  * Set the value that will be returned to the @i'th raft instance when it asks
  * the underlying #raft_io implementation for a randomized election timeout
- * value. The default value is 1000 + @i * 100, meaning that the election timer
- * of server 0 will expire first.
+ * value. The default value is 1000 + (@i * 100) % 1000, meaning that the
+ * election timer of server 0 will expire first.
  */
 RAFT_API void raft_fixture_set_randomized_election_timeout(
     struct raft_fixture *f,
@@ -385,6 +386,36 @@ RAFT_API void raft_fixture_set_disk_latency(struct raft_fixture *f,
                                             unsigned i,
                                             unsigned msecs);
 
+/**
+ * Limit the outgoing network bandwidth of the @i'th server to @bytes per
+ * second. Messages sent by the server are transmitted one after the other, and
+ * each of them is delayed by the time it takes to transmit the messages sent
+ * before it. The size of a message is approximated by its payload plus a fixed
+ * amount for its header. The default value is 0, meaning no limit.
+ */
+RAFT_API void raft_fixture_set_network_bandwidth(struct raft_fixture *f,
+                                                 unsigned i,
+                                                 uint64_t bytes);
+
+/**
+ * Set the CPU time in microseconds that the @i'th server spends to process each
+ * message it receives. Messages are processed one at a time, so a message is
+ * delivered only after the ones that were sent to the server before it have
+ * been processed. The default value is 0.
+ */
+RAFT_API void raft_fixture_set_message_cost(struct raft_fixture *f,
+                                            unsigned i,
+                                            unsigned usecs);
+
+/**
+ * Set the time in microseconds that the disk of the @i'th server is busy
+ * syncing each append request, after the disk latency has elapsed. Syncs are
+ * performed one at a time. The default value is 0.
+ */
+RAFT_API void raft_fixture_set_fsync_cost(struct raft_fixture *f,
+                                          unsigned i,
+                                          unsigned usecs);
+
 /**
  * Set the persisted term of the @i'th server.
  */
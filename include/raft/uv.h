@@ -113,16 +113,276 @@ RAFT_API void raft_uv_set_segment_size(struct raft_io *io, size_t size);
  */
 RAFT_API void raft_uv_set_connect_retry_delay(struct raft_io *io, unsigned msecs);
 
+/**
+ * Include the checksums of each batch of entries in AppendEntries messages,
+ * computed in the same way as for segment files. Receivers validate them and
+ * write the batch to disk without computing them again, while receivers running
+ * older versions simply ignore them.
+ *
+ * The default is false.
+ */
+RAFT_API void raft_uv_set_wire_checksums(struct raft_io *io, bool enabled);
+
+/**
+ * Send messages to each other server over separate connections, one for each
+ * logical channel (see #RAFT_UV_CHANNEL_CONTROL and friends), so that large
+ * InstallSnapshot and AppendEntries messages don't delay votes and results.
+ *
+ * Connections for channels other than the control one use a newer handshake,
+ * so this should be enabled only once all servers in the cluster support it.
+ *
+ * The default is false, meaning that a single connection is used.
+ */
+RAFT_API void raft_uv_set_channels(struct raft_io *io, bool enabled);
+
+/**
+ * Compress the entries data of AppendEntries messages and the snapshot data of
+ * InstallSnapshot messages using LZ4, if it's at least @threshold bytes long.
+ *
+ * Payloads are compressed only for servers that have told us, in their
+ * AppendEntries results, that they are able to decompress them. Data that
+ * doesn't shrink when compressed is sent as it is.
+ *
+ * Return #RAFT_INVALID if @enabled is true but the library was built without
+ * LZ4 support.
+ *
+ * The default is false.
+ */
+RAFT_API int raft_uv_set_wire_compression(struct raft_io *io,
+                                          bool enabled,
+                                          size_t threshold);
+
+/**
+ * Encode the headers of messages using variable-length integers, which makes
+ * heartbeats and AppendEntries messages carrying small entries much shorter.
+ *
+ * Compact headers are used only for servers that have told us, in the messages
+ * they sent us, that they are able to decode them. Servers are always able to
+ * decode them, whatever this setting.
+ *
+ * The default is false.
+ */
+RAFT_API void raft_uv_set_wire_compact(struct raft_io *io, bool enabled);
+
+/**
+ * Set the limits of the messages towards a single server that have been
+ * submitted but not yet written out. Once either the number of such messages
+ * reaches @max_messages or their total size reaches @max_bytes, the server is
+ * reported as backlogged via raft_io->send_backlogged(), and the leader stops
+ * sending it new entries until the backlog drains, falling back to heartbeats.
+ *
+ * While no connection to the server is available, at most @max_pending messages
+ * are kept and it's reported as backlogged once that many are queued. Each time
+ * a connection attempt fails, older messages are failed with RAFT_NOCONNECTION
+ * and counted in the sends_evicted field of #raft_uv_metrics.
+ *
+ * The defaults are 1024 messages, 64 megabytes and 3 pending messages.
+ */
+RAFT_API void raft_uv_set_send_limits(struct raft_io *io,
+                                      unsigned max_messages,
+                                      size_t max_bytes,
+                                      unsigned max_pending);
+
 /**
  * Emit low-level debug messages using the given tracer.
  */
 RAFT_API void raft_uv_set_tracer(struct raft_io *io,
                                  struct raft_tracer *tracer);
 
+/**
+ * Time spent in each phase of loading the data directory at startup, in
+ * nanoseconds. The @segments phase includes @read, @crc and @decode, which
+ * also grow when a closed segment is read again to truncate the log.
+ */
+struct raft_uv_load_times
+{
+    uint64_t metadata; /* Reading the metadata files, in raft_io->init() */
+    uint64_t list;     /* Listing snapshot and segment files */
+    uint64_t snapshot; /* Reading the most recent snapshot */
+    uint64_t segments; /* Loading all entries from segments */
+    uint64_t read;     /* Reading segment files */
+    uint64_t crc;      /* Verifying the checksums of entry batches */
+    uint64_t decode;   /* Decoding entry batches */
+    uint64_t total;    /* Metadata phase plus the whole of raft_io->load() */
+};
+
+/**
+ * Counters and latency histograms of the I/O of a @raft_io instance,
+ * accumulated since it was initialized. Latencies are in microseconds.
+ */
+struct raft_uv_metrics
+{
+    uint64_t writes;        /* Writes of entries into open segments */
+    uint64_t bytes_written; /* Bytes written into open segments */
+    uint64_t sends_evicted; /* Messages evicted, the server being unreachable */
+
+    /* Time between the submission of an append request and the moment its
+     * entries are durable. */
+    struct raft_histogram append_latency;
+
+    /* Time between the submission of a write into an open segment and its
+     * completion. Unless the instance is part of a host with group commit
+     * enabled, segments are opened with O_DSYNC and this includes the time
+     * taken for the data to reach durable storage. */
+    struct raft_histogram write_latency;
+
+    /* Time a completed write waited for the flush performed by the group
+     * commit of its host. Only recorded when group commit is enabled. */
+    struct raft_histogram fsync_latency;
+
+    /* Time spent in the threadpool creating a new open segment, allocating
+     * its space and syncing the data directory. */
+    struct raft_histogram prepare_latency;
+
+    /* Time spent in the threadpool closing an open segment, truncating and
+     * renaming it and syncing the data directory. */
+    struct raft_histogram finalize_latency;
+
+    /* Time taken to durably store the term and vote in a metadata file. */
+    struct raft_histogram metadata_latency;
+
+    /* Breakdown of the time taken to load the data directory. */
+    struct raft_uv_load_times load;
+
+    /* Number of requests queued at the time the metrics are read. */
+    unsigned appends_pending;   /* Append requests waiting to be written */
+    unsigned appends_writing;   /* Append requests in the write in flight */
+    unsigned prepares_pending;  /* Requests waiting for a prepared segment */
+    unsigned finalizes_pending; /* Open segments waiting to be closed */
+};
+
+/**
+ * Fill @metrics with a copy of the current disk I/O metrics of the given
+ * @raft_io instance, along with the current depth of its queues. This is cheap
+ * enough to be called periodically from the loop thread.
+ */
+RAFT_API void raft_uv_get_metrics(struct raft_io *io,
+                                  struct raft_uv_metrics *metrics);
+
+/**
+ * Memory held by the buffers of a @raft_io instance, in bytes.
+ *
+ * The payloads of entries and snapshots being sent are owned by raft, and
+ * reported by raft_get_memory() as well.
+ */
+struct raft_uv_memory
+{
+    uint64_t send_queue;      /* Messages not yet written, including payloads */
+    uint64_t recv_buffers;    /* Read buffers and payloads being received */
+    uint64_t segment_buffers; /* Write buffers of open segments */
+};
+
+/**
+ * Fill @memory with the current memory usage of the given @raft_io instance.
+ * This is cheap enough to be called periodically from the loop thread.
+ */
+RAFT_API void raft_uv_get_memory(struct raft_io *io,
+                                 struct raft_uv_memory *memory);
+
+/**
+ * A host runs many raft groups in the same process, for example one for each
+ * shard of a keyspace. Each group has its own @raft_io instance, created with
+ * raft_uv_init_group() and backed by its own data directory, but all of them
+ * share the host's event loop and transport, a single tick timer, and a single
+ * connection (per channel) towards each other host. Messages sent over such a
+ * connection are tagged with the ID of the group they belong to.
+ *
+ * The server of a group running on a host is identified by the ID and address
+ * of the host, so each host runs at most one server of each group, and groups
+ * on a host can only exchange messages with groups on other hosts.
+ */
+struct raft_uv_host
+{
+    /**
+     * User defined data.
+     */
+    void *data;
+
+    /**
+     * Implementation-defined state.
+     */
+    void *impl;
+
+    /**
+     * Human-readable message providing diagnostic information about the last
+     * error occurred.
+     */
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+};
+
+/**
+ * Callback invoked once a host has been closed.
+ */
+typedef void (*raft_uv_host_close_cb)(struct raft_uv_host *host);
+
+/**
+ * Initialize a host with the given ID and address, which will use the given
+ * transport to connect to other hosts and accept connections from them.
+ *
+ * The transport gets initialized with the host's identity, and must not be used
+ * by any other @raft_io instance.
+ */
+RAFT_API int raft_uv_host_init(struct raft_uv_host *host,
+                               struct uv_loop_s *loop,
+                               struct raft_uv_transport *transport,
+                               raft_id id,
+                               const char *address);
+
+/**
+ * Start accepting connections from other hosts.
+ */
+RAFT_API int raft_uv_host_start(struct raft_uv_host *host);
+
+/**
+ * Make the appends of all the groups of the host durable with a shared group
+ * commit, instead of having each group flush its own writes. Default is false.
+ *
+ * Group instances then write their open segments without O_DSYNC, and a write
+ * completes only after the next flush of the host, which issues a single
+ * syncfs() for each file system holding the data directories of the groups
+ * whose writes completed since the previous flush. Every group still keeps its
+ * own segments, so truncation, snapshots and recovery work as usual.
+ *
+ * Since syncfs() flushes all the dirty data of a file system, the data
+ * directories should live on a file system dedicated to them. This function
+ * must be called before initializing any of the groups of the host.
+ */
+RAFT_API void raft_uv_host_set_group_commit(struct raft_uv_host *host,
+                                            bool enabled);
+
+/**
+ * Close the host's connections and transport, then invoke @cb. All the group
+ * instances of the host must have been closed and released with raft_uv_close()
+ * beforehand.
+ */
+RAFT_API void raft_uv_host_close(struct raft_uv_host *host,
+                                 raft_uv_host_close_cb cb);
+
+/**
+ * Configure the given @raft_io instance to run the raft group with the given
+ * non-zero ID on the given host, as raft_uv_init() does for standalone servers.
+ *
+ * The instance must be initialized with the ID and address of the host. Its
+ * tick callback is fired by the timer of the host, whose period is the smallest
+ * interval requested by the started groups. Network settings like
+ * raft_uv_set_wire_checksums() apply to the host's connections, so they affect
+ * all of its groups.
+ *
+ * Return #RAFT_DUPLICATEID if the host already has a group with the same ID.
+ */
+RAFT_API int raft_uv_init_group(struct raft_io *io,
+                                struct raft_uv_host *host,
+                                const char *dir,
+                                uint64_t group);
+
 /**
  * Callback invoked by the transport implementation when a new incoming
  * connection has been established.
  *
+ * The @channel argument is the logical channel that the connecting server set
+ * in its connect request (see #raft_uv_connect), or #RAFT_UV_CHANNEL_CONTROL if
+ * the connecting server is not aware of channels.
+ *
  * No references to @address must be kept after this function returns.
  *
  * Ownership of @stream is transferred to user code, which is responsible of
@@ -131,6 +391,7 @@ RAFT_API void raft_uv_set_tracer(struct raft_io *io,
 typedef void (*raft_uv_accept_cb)(struct raft_uv_transport *t,
                                   raft_id id,
                                   const char *address,
+                                  unsigned channel,
                                   struct uv_stream_s *stream);
 
 /**
@@ -143,6 +404,16 @@ typedef void (*raft_uv_connect_cb)(struct raft_uv_connect *req,
                                    struct uv_stream_s *stream,
                                    int status);
 
+/**
+ * Logical channels that messages to another server can be sent over.
+ */
+enum {
+    RAFT_UV_CHANNEL_CONTROL = 0, /* Votes, results and other small messages */
+    RAFT_UV_CHANNEL_LOG,         /* AppendEntries messages */
+    RAFT_UV_CHANNEL_SNAPSHOT,    /* InstallSnapshot messages */
+    RAFT_UV_N_CHANNELS
+};
+
 /**
  * Handle to a connect request.
  */
@@ -150,6 +421,7 @@ struct raft_uv_connect
 {
     void *data;            /* User data */
     raft_uv_connect_cb cb; /* Callback */
+    unsigned channel;      /* Logical channel the connection is for */
 };
 
 /**
@@ -200,6 +472,9 @@ struct raft_uv_transport
      * The @cb callback must be invoked when the connection has been established
      * or the connection attempt has failed. The memory pointed by @req can be
      * released only after @cb has fired.
+     *
+     * The @req->channel field is set by the caller, and implementations should
+     * convey it to the accepting server as part of the connection handshake.
      */
     int (*connect)(struct raft_uv_transport *t,
                    struct raft_uv_connect *req,
@@ -234,4 +509,141 @@ RAFT_API int raft_uv_tcp_init(struct raft_uv_transport *t,
  */
 RAFT_API void raft_uv_tcp_close(struct raft_uv_transport *t);
 
+/**
+ * Init a transport interface that uses Unix domain sockets. Server addresses
+ * are paths of socket files, which are removed when the transport is closed.
+ *
+ * When a server starts listening, a socket file left behind at its path by a
+ * previous run is replaced. If another server is listening on it, or if the
+ * path exists and is not a socket, listening fails with #RAFT_DUPLICATEADDRESS.
+ */
+RAFT_API int raft_uv_unix_init(struct raft_uv_transport *t,
+                               struct uv_loop_s *loop);
+
+/**
+ * Release any memory allocated internally.
+ */
+RAFT_API void raft_uv_unix_close(struct raft_uv_transport *t);
+
+/**
+ * Init a transport interface that connects servers running in the same process
+ * and on the same event loop, typically for testing. Server addresses are
+ * arbitrary strings, and connections are pairs of connected sockets, created
+ * without going through the network stack or performing any handshake.
+ */
+RAFT_API int raft_uv_loopback_init(struct raft_uv_transport *t,
+                                   struct uv_loop_s *loop);
+
+/**
+ * Release any memory allocated internally.
+ */
+RAFT_API void raft_uv_loopback_close(struct raft_uv_transport *t);
+
+/**
+ * Queue of commands to be proposed to a raft instance, which can be submitted
+ * from any thread, for example the threads handling client requests, while the
+ * raft instance itself keeps running on the thread of its event loop.
+ *
+ * Submitting a command only pushes it onto a lock-free list and, if the list
+ * was empty, wakes up the loop. Once woken up, the loop takes all the commands
+ * submitted so far and proposes them in a single batch, so they get appended
+ * and replicated together.
+ */
+struct raft_uv_apply_queue
+{
+    /**
+     * User defined data.
+     */
+    void *data;
+
+    /**
+     * Implementation-defined state.
+     */
+    void *impl;
+};
+
+/**
+ * Asynchronous request to propose a command through a queue.
+ */
+struct raft_apply_async;
+typedef void (*raft_apply_async_cb)(struct raft_apply_async *req,
+                                    int status,
+                                    void *result);
+struct raft_apply_async
+{
+    void *data; /* User data */
+
+    /* Fields below are private and must not be touched by the user. */
+    struct raft_apply apply;       /* Request submitted to raft */
+    struct raft_buffer buf;        /* Command payload */
+    raft_apply_async_cb cb;        /* Completion callback */
+    int status;                    /* Result, when delivered by polling */
+    void *result;                  /* FSM result, when delivered by polling */
+    struct raft_apply_async *next; /* Next request in the same list */
+};
+
+/**
+ * Callback invoked on the loop thread when completed requests are available to
+ * raft_uv_apply_queue_poll().
+ */
+typedef void (*raft_uv_apply_queue_notify_cb)(struct raft_uv_apply_queue *q);
+
+/**
+ * Callback invoked once a queue has been closed.
+ */
+typedef void (*raft_uv_apply_queue_close_cb)(struct raft_uv_apply_queue *q);
+
+/**
+ * Initialize a queue proposing commands to the given raft instance, which must
+ * be running on the given loop.
+ */
+RAFT_API int raft_uv_apply_queue_init(struct raft_uv_apply_queue *q,
+                                      struct uv_loop_s *loop,
+                                      struct raft *r);
+
+/**
+ * Select how the callbacks of completed requests are delivered.
+ *
+ * By default they fire on the loop thread as soon as each command is applied
+ * or fails. If @cb is not NULL, completed requests are instead queued, @cb is
+ * invoked on the loop thread whenever the completion queue becomes non-empty,
+ * and the callbacks fire on whichever thread calls raft_uv_apply_queue_poll().
+ * Must be called before submitting any request.
+ */
+RAFT_API void raft_uv_apply_queue_set_notify(struct raft_uv_apply_queue *q,
+                                             raft_uv_apply_queue_notify_cb cb);
+
+/**
+ * Propose the given command through the queue. Safe to call from any thread.
+ *
+ * The queue takes ownership of the buffer, which is released by raft as usual
+ * once the command is applied, or by the queue if the command can't be
+ * proposed. The callback fires with #RAFT_NOTLEADER if the raft instance is not
+ * the leader when the command is taken from the queue, and with #RAFT_CANCELED
+ * if the queue gets closed before that.
+ *
+ * No thread may call this function once raft_uv_apply_queue_close() has been
+ * invoked.
+ */
+RAFT_API int raft_apply_async(struct raft_uv_apply_queue *q,
+                              struct raft_apply_async *req,
+                              const struct raft_buffer *buf,
+                              raft_apply_async_cb cb);
+
+/**
+ * Fire the callbacks of the requests that completed since the last call, on the
+ * calling thread, and return their number. Safe to call from any thread, when
+ * a notify callback has been set.
+ */
+RAFT_API unsigned raft_uv_apply_queue_poll(struct raft_uv_apply_queue *q);
+
+/**
+ * Close the queue, cancelling the requests that have not been proposed yet,
+ * and invoke @cb once all the requests that were proposed have completed too.
+ * Completed requests that were not polled yet have their callbacks fired on the
+ * loop thread before @cb. Must be called on the loop thread.
+ */
+RAFT_API void raft_uv_apply_queue_close(struct raft_uv_apply_queue *q,
+                                        raft_uv_apply_queue_close_cb cb);
+
 #endif /* RAFT_UV_H */
@@ -3,6 +3,7 @@
 #ifndef BYTE_H_
 #define BYTE_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
@@ -163,6 +164,61 @@ BYTE__INLINE const char *byteGetString(const void **cursor, size_t max_len)
     return value;
 }
 
+/* Return the number of bytes needed to encode the given value as a varint,
+ * i.e. in groups of 7 bits, least significant first, with the high bit of each
+ * byte set if more bytes follow. */
+BYTE__INLINE size_t byteSizeofVarint(uint64_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+BYTE__INLINE void bytePutVarint(void **cursor, uint64_t value)
+{
+    while (value >= 0x80) {
+        bytePut8(cursor, (uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    bytePut8(cursor, (uint8_t)value);
+}
+
+/* Decode a varint without reading past @end. Return false if the varint is
+ * truncated or longer than 64 bits. */
+BYTE__INLINE bool byteGetVarint(const void **cursor,
+                                const void *end,
+                                uint64_t *value)
+{
+    const uint8_t **p = (const uint8_t **)cursor;
+    unsigned shift = 0;
+    *value = 0;
+    while (*p < (const uint8_t *)end && shift < 64) {
+        uint8_t byte = **p;
+        *p += 1;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+        shift += 7;
+    }
+    return false;
+}
+
+/* Map signed values to unsigned ones, so that numbers with a small absolute
+ * value have a short varint encoding. */
+BYTE__INLINE uint64_t byteZigZag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+BYTE__INLINE int64_t byteUnZigZag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
 /* Add padding to size if it's not a multiple of 8. */
 BYTE__INLINE size_t bytePad64(size_t size)
 {
@@ -1,9 +1,13 @@
-#include "../include/raft.h"
+#include "client.h"
+
+#include <string.h>
+
 #include "assert.h"
 #include "configuration.h"
 #include "err.h"
 #include "log.h"
 #include "membership.h"
+#include "metrics.h"
 #include "progress.h"
 #include "queue.h"
 #include "replication.h"
@@ -17,6 +21,13 @@
 #define tracef(...)
 #endif
 
+/* Reset the lifecycle timestamps of an apply request being submitted. */
+static void clientInitTimes(struct raft_apply *req, uint64_t now)
+{
+    memset(&req->times, 0, sizeof req->times);
+    req->times.submitted = now;
+}
+
 int raft_apply(struct raft *r,
                struct raft_apply *req,
                const struct raft_buffer bufs[],
@@ -41,7 +52,9 @@ int raft_apply(struct raft *r,
     tracef("%u commands starting at %lld", n, index);
     req->type = RAFT_COMMAND;
     req->index = index;
+    req->n = n;
     req->cb = cb;
+    clientInitTimes(req, metricsTimeUs(r));
 
     /* Append the new entries to the log. */
     rv = logAppendCommands(&r->log, r->current_term, bufs, n);
@@ -66,6 +79,66 @@ err:
     return rv;
 }
 
+int clientApplyBatch(struct raft *r,
+                     struct raft_apply *reqs[],
+                     const struct raft_buffer bufs[],
+                     unsigned n)
+{
+    raft_index index;
+    uint64_t now;
+    unsigned i;
+    int rv;
+
+    assert(r != NULL);
+    assert(reqs != NULL);
+    assert(bufs != NULL);
+    assert(n > 0);
+
+    if (r->state != RAFT_LEADER || r->transfer != NULL) {
+        rv = RAFT_NOTLEADER;
+        ErrMsgFromCode(r->errmsg, rv);
+        goto err;
+    }
+
+    /* Index of the first entry being appended. */
+    index = logLastIndex(&r->log) + 1;
+    tracef("batch of %u commands starting at %lld", n, index);
+
+    rv = logAppendCommands(&r->log, r->current_term, bufs, n);
+    if (rv != 0) {
+        goto err_after_log_append;
+    }
+
+    now = metricsTimeUs(r);
+    for (i = 0; i < n; i++) {
+        reqs[i]->type = RAFT_COMMAND;
+        reqs[i]->index = index + i;
+        reqs[i]->n = 1;
+        clientInitTimes(reqs[i], now);
+        QUEUE_PUSH(&r->leader_state.requests, &reqs[i]->queue);
+    }
+
+    rv = replicationTrigger(r, index);
+    if (rv != 0) {
+        goto err_after_push;
+    }
+
+    return 0;
+
+err_after_push:
+    for (i = 0; i < n; i++) {
+        QUEUE_REMOVE(&reqs[i]->queue);
+    }
+err_after_log_append:
+    /* Also discard the entries that were appended before a failure. */
+    if (logLastIndex(&r->log) >= index) {
+        logDiscard(&r->log, index);
+    }
+err:
+    assert(rv != 0);
+    return rv;
+}
+
 int raft_barrier(struct raft *r, struct raft_barrier *req, raft_barrier_cb cb)
 {
     raft_index index;
@@ -0,0 +1,18 @@
+/* Client API helpers shared with other modules. */
+
+#ifndef CLIENT_H_
+#define CLIENT_H_
+
+#include "../include/raft.h"
+
+/* Propose @n commands to be appended to the log, one for each of the given
+ * apply requests, whose callbacks must already be set. Unlike raft_apply(),
+ * which tracks all its commands with a single request, the callback of each
+ * request fires when its own command gets applied. The entries are appended
+ * to the log and replicated in a single batch. */
+int clientApplyBatch(struct raft *r,
+                     struct raft_apply *reqs[],
+                     const struct raft_buffer bufs[],
+                     unsigned n);
+
+#endif /* CLIENT_H_ */
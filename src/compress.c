@@ -0,0 +1,183 @@
+#include "compress.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef LZ4_AVAILABLE
+#include <lz4frame.h>
+#endif
+
+#include "assert.h"
+
+#ifdef LZ4_AVAILABLE
+
+/* Preferences used for all compressed frames. The content size is included in
+ * the frame header, so the decompressor can check it. */
+static void compressPreferences(LZ4F_preferences_t *prefs, size_t len)
+{
+    memset(prefs, 0, sizeof *prefs);
+    prefs->frameInfo.contentSize = len;
+}
+
+/* Return the total size of the given buffers. */
+static size_t compressTotalLen(const struct raft_buffer bufs[], unsigned n_bufs)
+{
+    size_t len = 0;
+    unsigned i;
+    for (i = 0; i < n_bufs; i++) {
+        len += bufs[i].len;
+    }
+    return len;
+}
+
+size_t CompressBound(const struct raft_buffer bufs[], unsigned n_bufs)
+{
+    LZ4F_preferences_t prefs;
+    size_t len = compressTotalLen(bufs, n_bufs);
+    compressPreferences(&prefs, len);
+    return LZ4F_compressFrameBound(len, &prefs);
+}
+
+int Compress(const struct raft_buffer bufs[],
+             unsigned n_bufs,
+             void *dst,
+             size_t dst_len,
+             size_t *len)
+{
+    LZ4F_compressionContext_t ctx;
+    LZ4F_preferences_t prefs;
+    uint8_t *cursor = dst;
+    size_t n;
+    unsigned i;
+    int rv;
+
+    n = LZ4F_createCompressionContext(&ctx, LZ4F_VERSION);
+    if (LZ4F_isError(n)) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+
+    compressPreferences(&prefs, compressTotalLen(bufs, n_bufs));
+
+    n = LZ4F_compressBegin(ctx, cursor, dst_len, &prefs);
+    if (LZ4F_isError(n)) {
+        rv = RAFT_IOERR;
+        goto err_after_ctx_alloc;
+    }
+    cursor += n;
+    dst_len -= n;
+
+    /* Buffers smaller than a block get buffered by the compression context,
+     * so small entries are compressed together. */
+    for (i = 0; i < n_bufs; i++) {
+        n = LZ4F_compressUpdate(ctx, cursor, dst_len, bufs[i].base,
+                                bufs[i].len, NULL);
+        if (LZ4F_isError(n)) {
+            rv = RAFT_IOERR;
+            goto err_after_ctx_alloc;
+        }
+        cursor += n;
+        dst_len -= n;
+    }
+
+    n = LZ4F_compressEnd(ctx, cursor, dst_len, NULL);
+    if (LZ4F_isError(n)) {
+        rv = RAFT_IOERR;
+        goto err_after_ctx_alloc;
+    }
+    cursor += n;
+
+    LZ4F_freeCompressionContext(ctx);
+    *len = (size_t)(cursor - (uint8_t *)dst);
+    return 0;
+
+err_after_ctx_alloc:
+    LZ4F_freeCompressionContext(ctx);
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+int Decompress(const void *src, size_t src_len, void *dst, size_t dst_len)
+{
+    LZ4F_decompressionContext_t ctx;
+    const uint8_t *src_cursor = src;
+    uint8_t *dst_cursor = dst;
+    size_t n;
+    int rv;
+
+    n = LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION);
+    if (LZ4F_isError(n)) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+
+    /* Keep going until the end of the frame is reached, which is signaled by
+     * a return value of 0. */
+    do {
+        size_t src_n = src_len;
+        size_t dst_n = dst_len;
+        n = LZ4F_decompress(ctx, dst_cursor, &dst_n, src_cursor, &src_n, NULL);
+        if (LZ4F_isError(n)) {
+            rv = RAFT_MALFORMED;
+            goto err_after_ctx_alloc;
+        }
+        src_cursor += src_n;
+        src_len -= src_n;
+        dst_cursor += dst_n;
+        dst_len -= dst_n;
+        /* The frame is truncated if no progress can be made. */
+        if (n != 0 && src_n == 0 && dst_n == 0) {
+            rv = RAFT_MALFORMED;
+            goto err_after_ctx_alloc;
+        }
+    } while (n != 0);
+
+    if (src_len != 0 || dst_len != 0) {
+        rv = RAFT_MALFORMED;
+        goto err_after_ctx_alloc;
+    }
+
+    LZ4F_freeDecompressionContext(ctx);
+    return 0;
+
+err_after_ctx_alloc:
+    LZ4F_freeDecompressionContext(ctx);
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+#else
+
+size_t CompressBound(const struct raft_buffer bufs[], unsigned n_bufs)
+{
+    (void)bufs;
+    (void)n_bufs;
+    return 0;
+}
+
+int Compress(const struct raft_buffer bufs[],
+             unsigned n_bufs,
+             void *dst,
+             size_t dst_len,
+             size_t *len)
+{
+    (void)bufs;
+    (void)n_bufs;
+    (void)dst;
+    (void)dst_len;
+    (void)len;
+    return RAFT_INVALID;
+}
+
+int Decompress(const void *src, size_t src_len, void *dst, size_t dst_len)
+{
+    (void)src;
+    (void)src_len;
+    (void)dst;
+    (void)dst_len;
+    return RAFT_INVALID;
+}
+
+#endif /* LZ4_AVAILABLE */
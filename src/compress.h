@@ -0,0 +1,26 @@
+/* Compression of message payloads sent over the network. */
+
+#ifndef COMPRESS_H_
+#define COMPRESS_H_
+
+#include "../include/raft.h"
+
+/* Return the maximum size of the compressed form of the concatenation of the
+ * given buffers, or 0 if compression is not supported. */
+size_t CompressBound(const struct raft_buffer bufs[], unsigned n_bufs);
+
+/* Compress the concatenation of the given buffers into @dst, which must be at
+ * least CompressBound() bytes long, and set @len to the size of the compressed
+ * data. Return RAFT_INVALID if compression is not supported. */
+int Compress(const struct raft_buffer bufs[],
+             unsigned n_bufs,
+             void *dst,
+             size_t dst_len,
+             size_t *len);
+
+/* Decompress the data in @src into @dst, whose size must match the one of the
+ * original data. Return RAFT_MALFORMED if the data can't be decompressed or
+ * its size doesn't match, and RAFT_INVALID if compression is not supported. */
+int Decompress(const void *src, size_t src_len, void *dst, size_t dst_len);
+
+#endif /* COMPRESS_H_ */
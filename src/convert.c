@@ -8,6 +8,7 @@
 #include "progress.h"
 #include "queue.h"
 #include "request.h"
+#include "trace.h"
 
 /* Set to 1 to enable tracing. */
 #if 0
@@ -32,6 +33,7 @@ static void convertSetState(struct raft *r, unsigned short new_state)
            (r->state == RAFT_CANDIDATE && new_state == RAFT_UNAVAILABLE) ||
            (r->state == RAFT_LEADER && new_state == RAFT_UNAVAILABLE));
     r->state = new_state;
+    Trace(r, TRACE_STATE, new_state, r->current_term, 0, 0);
 }
 
 /* Clear follower state. */
@@ -136,6 +138,7 @@ void convertToFollower(struct raft *r)
 
     r->follower_state.current_leader.id = 0;
     r->follower_state.current_leader.address = NULL;
+    r->follower_state.quiescent = false;
 }
 
 int convertToCandidate(struct raft *r, bool disrupt_leader)
@@ -206,6 +209,8 @@ int convertToLeader(struct raft *r)
     r->leader_state.round_index = 0;
     r->leader_state.round_start = 0;
 
+    r->leader_state.quiescent = false;
+
     return 0;
 }
 
@@ -4,6 +4,8 @@
 #include "configuration.h"
 #include "heap.h"
 #include "log.h"
+#include "metrics.h"
+#include "trace.h"
 #include "tracing.h"
 
 /* Set to 1 to enable tracing. */
@@ -157,6 +159,12 @@ int electionStart(struct raft *r)
     /* Reset election timer. */
     electionResetTimer(r);
 
+    r->metrics.elections++;
+    Trace(r, TRACE_ELECTION,
+          r->current_term + (r->candidate_state.in_pre_vote ? 1 : 0),
+          logLastIndex(&r->log), logLastTerm(&r->log),
+          r->candidate_state.in_pre_vote);
+
     assert(r->candidate_state.votes != NULL);
 
     /* Initialize the votes array and send vote requests. */
@@ -27,12 +27,17 @@
 #define NETWORK_LATENCY 15
 #define DISK_LATENCY 10
 
+/* Approximate size of the header of a message on the wire, and of the
+ * additional header of each entry of an AppendEntries message. */
+#define MESSAGE_HEADER_SIZE 64
+#define ENTRY_HEADER_SIZE 16
+
 /* To keep in sync with raft.h */
-#define N_MESSAGE_TYPES 5
+#define N_MESSAGE_TYPES 7
 
 /* Maximum number of peer stub instances connected to a certain stub
- * instance. This should be enough for testing purposes. */
-#define MAX_PEERS 8
+ * instance. */
+#define MAX_PEERS RAFT_FIXTURE_MAX_SERVERS
 
 /* Fields common across all request types. */
 #define REQUEST                                                            \
@@ -136,6 +141,15 @@ struct io
     unsigned randomized_election_timeout; /* Value returned by io->random() */
     unsigned network_latency;             /* Milliseconds to deliver RPCs */
     unsigned disk_latency;                /* Milliseconds to perform disk I/O */
+    uint64_t network_bandwidth;           /* Outgoing bytes per second */
+    unsigned message_cost;                /* Microseconds to handle a message */
+    unsigned fsync_cost;                  /* Microseconds to sync an append */
+
+    /* Times at which the network link, the CPU and the disk become idle, in
+     * microseconds. Each of them serves one request at a time. */
+    uint64_t network_busy;
+    uint64_t cpu_busy;
+    uint64_t disk_busy;
 
     struct
     {
@@ -188,6 +202,66 @@ static bool ioFaultTick(struct io *io)
     return false;
 }
 
+/* Reserve a resource which serves one request at a time and is busy until
+ * @busy, for @cost microseconds starting no earlier than @start. Return the
+ * time at which the request is served, in microseconds. */
+static uint64_t ioReserve(uint64_t *busy, uint64_t start, uint64_t cost)
+{
+    if (cost == 0) {
+        return start;
+    }
+    if (*busy > start) {
+        start = *busy;
+    }
+    *busy = start + cost;
+    return *busy;
+}
+
+/* Convert a time in microseconds to milliseconds, rounding up. */
+static raft_time ioUsecsToTime(uint64_t usecs)
+{
+    return (raft_time)((usecs + 999) / 1000);
+}
+
+/* Return the approximate size of the given message on the wire. */
+static uint64_t ioMessageSize(const struct raft_message *message)
+{
+    uint64_t size = MESSAGE_HEADER_SIZE;
+    unsigned i;
+    switch (message->type) {
+        case RAFT_IO_APPEND_ENTRIES:
+            for (i = 0; i < message->append_entries.n_entries; i++) {
+                size += ENTRY_HEADER_SIZE;
+                size += message->append_entries.entries[i].buf.len;
+            }
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT:
+            size += message->install_snapshot.data.len;
+            break;
+    }
+    return size;
+}
+
+/* Return the time at which the given message sent by @io gets processed by
+ * @dst. The message first waits for the outgoing link of @io to transmit the
+ * messages sent before it, then travels for the network latency, and finally
+ * waits for the CPU of @dst to process the messages received before it. */
+static raft_time ioTransmitTime(struct io *io,
+                                struct io *dst,
+                                const struct raft_message *message)
+{
+    uint64_t now = *io->time * 1000;
+    uint64_t t = now;
+    if (io->network_bandwidth > 0) {
+        t = ioReserve(&io->network_busy, t,
+                      ioMessageSize(message) * 1000000 /
+                          io->network_bandwidth);
+    }
+    t += (uint64_t)io->network_latency * 1000;
+    t = ioReserve(&dst->cpu_busy, t, dst->message_cost);
+    return ioUsecsToTime(t);
+}
+
 static int ioMethodInit(struct raft_io *raft_io,
                         raft_id id,
                         const char *address)
@@ -338,7 +412,7 @@ static void ioFlushSend(struct io *io, struct send *send)
     assert(transmit != NULL);
 
     transmit->type = TRANSMIT;
-    transmit->completion_time = *io->time + io->network_latency;
+    transmit->completion_time = ioTransmitTime(io, peer->io, &send->message);
 
     src = &send->message;
     dst = &transmit->message;
@@ -357,7 +431,7 @@ static void ioFlushSend(struct io *io, struct send *send)
     }
 
     /* tracef("io: flush: %s", describeMessage(&send->message)); */
-    io->n_send[send->message.type]++;
+    io->n_send[send->message.type - 1]++;
     status = 0;
 
 out:
@@ -568,7 +642,9 @@ static int ioMethodAppend(struct raft_io *raft_io,
     assert(r != NULL);
 
     r->type = APPEND;
-    r->completion_time = *io->time + io->disk_latency;
+    r->completion_time = ioUsecsToTime(
+        ioReserve(&io->disk_busy, (*io->time + io->disk_latency) * 1000,
+                  io->fsync_cost));
     r->req = req;
     r->entries = entries;
     r->n = n;
@@ -725,7 +801,7 @@ static void ioReceive(struct io *io, struct raft_message *message)
     /* tracef("io: recv: %s from server %d", describeMessage(message),
        message->server_id); */
     io->recv_cb(io->io, message);
-    io->n_recv[message->type]++;
+    io->n_recv[message->type - 1]++;
 }
 
 static void ioDeliverTransmit(struct io *io, struct transmit *transmit)
@@ -780,6 +856,16 @@ static bool ioSaturated(struct raft_io *raft_io, struct raft_io *other)
     return peer != NULL && peer->saturated;
 }
 
+/* Implementation of raft_io->send_backlogged(): a saturated connection is
+ * reported as backlogged. */
+static bool ioMethodSendBacklogged(struct raft_io *raft_io, raft_id id)
+{
+    struct io *io = raft_io->impl;
+    struct peer *peer;
+    peer = ioGetPeer(io, id);
+    return peer != NULL && peer->connected && peer->saturated;
+}
+
 /* Disconnect @raft_io and @other, causing calls to @io->send() to fail
  * asynchronously when sending messages to @other. */
 static void ioDisconnect(struct raft_io *raft_io, struct raft_io *other)
@@ -850,9 +936,17 @@ static int ioInit(struct raft_io *raft_io, unsigned index, raft_time *time)
     io->n = 0;
     QUEUE_INIT(&io->requests);
     io->n_peers = 0;
-    io->randomized_election_timeout = ELECTION_TIMEOUT + index * 100;
+    /* Stay within the [timeout, 2 * timeout) range in large clusters. */
+    io->randomized_election_timeout =
+        ELECTION_TIMEOUT + (index * 100) % ELECTION_TIMEOUT;
     io->network_latency = NETWORK_LATENCY;
     io->disk_latency = DISK_LATENCY;
+    io->network_bandwidth = 0;
+    io->message_cost = 0;
+    io->fsync_cost = 0;
+    io->network_busy = 0;
+    io->cpu_busy = 0;
+    io->disk_busy = 0;
     io->fault.countdown = -1;
     io->fault.n = -1;
     memset(io->drop, 0, sizeof io->drop);
@@ -860,6 +954,7 @@ static int ioInit(struct raft_io *raft_io, unsigned index, raft_time *time)
     memset(io->n_recv, 0, sizeof io->n_recv);
     io->n_append = 0;
 
+    raft_io->version = 2;
     raft_io->impl = io;
     raft_io->init = ioMethodInit;
     raft_io->close = ioMethodClose;
@@ -876,6 +971,7 @@ static int ioInit(struct raft_io *raft_io, unsigned index, raft_time *time)
     raft_io->snapshot_get = ioMethodSnapshotGet;
     raft_io->time = ioMethodTime;
     raft_io->random = ioMethodRandom;
+    raft_io->send_backlogged = ioMethodSendBacklogged;
 
     return 0;
 }
@@ -1832,6 +1928,30 @@ void raft_fixture_set_disk_latency(struct raft_fixture *f,
     io->disk_latency = msecs;
 }
 
+void raft_fixture_set_network_bandwidth(struct raft_fixture *f,
+                                        unsigned i,
+                                        uint64_t bytes)
+{
+    struct io *io = f->servers[i].io.impl;
+    io->network_bandwidth = bytes;
+}
+
+void raft_fixture_set_message_cost(struct raft_fixture *f,
+                                   unsigned i,
+                                   unsigned usecs)
+{
+    struct io *io = f->servers[i].io.impl;
+    io->message_cost = usecs;
+}
+
+void raft_fixture_set_fsync_cost(struct raft_fixture *f,
+                                 unsigned i,
+                                 unsigned usecs)
+{
+    struct io *io = f->servers[i].io.impl;
+    io->fsync_cost = usecs;
+}
+
 void raft_fixture_set_term(struct raft_fixture *f, unsigned i, raft_term term)
 {
     struct io *io = f->servers[i].io.impl;
@@ -1872,13 +1992,13 @@ void raft_fixture_io_fault(struct raft_fixture *f,
 unsigned raft_fixture_n_send(struct raft_fixture *f, unsigned i, int type)
 {
     struct io *io = f->servers[i].io.impl;
-    return io->n_send[type];
+    return io->n_send[type - 1];
 }
 
 unsigned raft_fixture_n_recv(struct raft_fixture *f, unsigned i, int type)
 {
     struct io *io = f->servers[i].io.impl;
-    return io->n_recv[type];
+    return io->n_recv[type - 1];
 }
 
 #undef tracef
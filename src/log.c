@@ -251,10 +251,11 @@ static int refsInit(struct raft_log *l,
     return RAFT_NOMEM;
 }
 
-/* Increment the refcount of the entry with the given term and index. */
-static void refsIncr(struct raft_log *l,
-                     const raft_term term,
-                     const raft_index index)
+/* Increment the refcount of the entry with the given term and index, and
+ * return the new refcount. */
+static unsigned short refsIncr(struct raft_log *l,
+                               const raft_term term,
+                               const raft_index index)
 {
     size_t key;                  /* Hash table key for the given index. */
     struct raft_entry_ref *slot; /* Slot for the given term/index */
@@ -279,13 +280,15 @@ static void refsIncr(struct raft_log *l,
     assert(slot != NULL);
 
     slot->count++;
+
+    return slot->count;
 }
 
-/* Decrement the refcount of the entry with the given index. Return a boolean
- * indicating whether the entry has now zero references. */
-static bool refsDecr(struct raft_log *l,
-                     const raft_term term,
-                     const raft_index index)
+/* Decrement the refcount of the entry with the given index, and return the
+ * number of references left. */
+static unsigned short refsDecr(struct raft_log *l,
+                               const raft_term term,
+                               const raft_index index)
 {
     size_t key;                       /* Hash table key for the given index. */
     struct raft_entry_ref *slot;      /* Slot for the given term/index */
@@ -315,7 +318,7 @@ static bool refsDecr(struct raft_log *l,
 
     if (slot->count > 0) {
         /* The entry is still referenced. */
-        return false;
+        return slot->count;
     }
 
     /* If the refcount has dropped to zero, delete the slot. */
@@ -332,18 +335,22 @@ static bool refsDecr(struct raft_log *l,
         raft_free(second_slot);
     }
 
-    return true;
+    return 0;
 }
 
 void logInit(struct raft_log *l)
 {
     assert(l != NULL);
     l->entries = NULL;
+    l->ends = NULL;
     l->size = 0;
     l->front = l->back = 0;
     l->offset = 0;
     l->refs = NULL;
     l->refs_size = 0;
+    l->bytes = 0;
+    l->shared = 0;
+    l->pinned = 0;
     l->snapshot.last_index = 0;
     l->snapshot.last_term = 0;
 }
@@ -431,6 +438,7 @@ void logStart(struct raft_log *l,
 static int ensureCapacity(struct raft_log *l)
 {
     struct raft_entry *entries; /* New entries array */
+    size_t *ends;               /* New running totals array */
     size_t n;                   /* Current number of entries */
     size_t size;                /* Size of the new array */
     size_t i;
@@ -445,15 +453,19 @@ static int ensureCapacity(struct raft_log *l)
      * entry). Over-allocating now avoids smaller allocations later. */
     size = (l->size + 1) * 2;
 
-    entries = raft_calloc(size, sizeof *entries);
+    /* The running totals live in the same allocation, right after the
+     * entries. */
+    entries = raft_calloc(size, sizeof *entries + sizeof *ends);
     if (entries == NULL) {
         return RAFT_NOMEM;
     }
+    ends = (size_t *)&entries[size];
 
     /* Copy all active old entries to the beginning of the newly allocated
      * array. */
     for (i = 0; i < n; i++) {
         memcpy(&entries[i], entryAt(l, i), sizeof *entries);
+        ends[i] = l->ends[positionAt(l, i)];
     }
 
     /* Release the old entries array. */
@@ -462,6 +474,7 @@ static int ensureCapacity(struct raft_log *l)
     }
 
     l->entries = entries;
+    l->ends = ends;
     l->size = size;
     l->front = 0;
     l->back = n;
@@ -478,6 +491,7 @@ int logAppend(struct raft_log *l,
     int rv;
     struct raft_entry *entry;
     raft_index index;
+    size_t end;
 
     assert(l != NULL);
     assert(term > 0);
@@ -491,6 +505,13 @@ int logAppend(struct raft_log *l,
 
     index = logLastIndex(l) + 1;
 
+    /* The running total only matters relative to the other entries, so it
+     * can start from zero whenever the log is empty. */
+    end = 0;
+    if (logNumEntries(l) > 0) {
+        end = l->ends[(l->back + l->size - 1) % l->size];
+    }
+
     rv = refsInit(l, term, index);
     if (rv != 0) {
         return rv;
@@ -502,6 +523,9 @@ int logAppend(struct raft_log *l,
     entry->buf = *buf;
     entry->batch = batch;
 
+    l->ends[l->back] = end + buf->len;
+    l->bytes += buf->len;
+
     l->back += 1;
     l->back = l->back % l->size;
 
@@ -578,6 +602,11 @@ size_t logNumEntries(struct raft_log *l)
     return l->size - l->front + l->back;
 }
 
+size_t logNumBytes(struct raft_log *l)
+{
+    return l->bytes;
+}
+
 raft_index logLastIndex(struct raft_log *l)
 {
     /* If there are no entries in the log, but there is a snapshot available
@@ -606,6 +635,21 @@ static size_t locateEntry(struct raft_log *l, const raft_index index)
     return positionAt(l, (size_t)((index - 1) - l->offset));
 }
 
+size_t logNumBytesBetween(struct raft_log *l, raft_index from, raft_index to)
+{
+    size_t first;
+    size_t last;
+
+    assert(from <= to);
+
+    first = locateEntry(l, from);
+    last = locateEntry(l, to);
+    assert(first != l->size);
+    assert(last != l->size);
+
+    return l->ends[last] - l->ends[first] + l->entries[first].buf.len;
+}
+
 raft_term logTermOf(struct raft_log *l, const raft_index index)
 {
     size_t i;
@@ -706,7 +750,12 @@ int logAcquire(struct raft_log *l,
         size_t k = (i + j) % l->size;
         struct raft_entry *entry = &(*entries)[j];
         *entry = l->entries[k];
-        refsIncr(l, entry->term, index + j);
+
+        /* The first reference held outside of the log makes the entry
+         * shared. */
+        if (refsIncr(l, entry->term, index + j) == 2) {
+            l->shared += entry->buf.len;
+        }
     }
 
     return 0;
@@ -744,9 +793,25 @@ void logRelease(struct raft_log *l,
 
     for (i = 0; i < n; i++) {
         struct raft_entry *entry = &entries[i];
+        unsigned short count;
+        size_t k;
         bool unref;
 
-        unref = refsDecr(l, entry->term, index + i);
+        count = refsDecr(l, entry->term, index + i);
+        unref = count == 0;
+
+        /* Stop accounting for the entry as shared if only the log references
+         * it now, or as pinned if it was deleted from the log meanwhile. */
+        k = locateEntry(l, index + i);
+        if (k != l->size && l->entries[k].term == entry->term) {
+            if (count == 1) {
+                assert(l->shared >= entry->buf.len);
+                l->shared -= entry->buf.len;
+            }
+        } else if (unref) {
+            assert(l->pinned >= entry->buf.len);
+            l->pinned -= entry->buf.len;
+        }
 
         /* If there are no outstanding references to this entry, free its
          * payload if it's not part of a batch, or check if we can free the
@@ -780,6 +845,7 @@ static void clearIfEmpty(struct raft_log *l)
     }
     raft_free(l->entries);
     l->entries = NULL;
+    l->ends = NULL;
     l->size = 0;
     l->front = 0;
     l->back = 0;
@@ -799,6 +865,23 @@ static void destroyEntry(struct raft_log *l, struct raft_entry *entry)
     }
 }
 
+/* Drop the log's reference to an entry being removed from it. Return true if
+ * the entry is not referenced anymore, otherwise the entry stays pinned in
+ * memory until pending I/O releases it. */
+static bool unrefRemoved(struct raft_log *l,
+                         struct raft_entry *entry,
+                         raft_index index)
+{
+    l->bytes -= entry->buf.len;
+    if (refsDecr(l, entry->term, index) == 0) {
+        return true;
+    }
+    assert(l->shared >= entry->buf.len);
+    l->shared -= entry->buf.len;
+    l->pinned += entry->buf.len;
+    return false;
+}
+
 /* Core logic of @logTruncate and @logDiscard, removing all log entries from
  * @index onward. If @destroy is true, also destroy the removed entries. */
 static void removeSuffix(struct raft_log *l,
@@ -827,7 +910,7 @@ static void removeSuffix(struct raft_log *l,
         }
 
         entry = &l->entries[l->back];
-        unref = refsDecr(l, entry->term, start + n - i - 1);
+        unref = unrefRemoved(l, entry, start + n - i - 1);
 
         if (unref && destroy) {
             destroyEntry(l, entry);
@@ -876,7 +959,7 @@ static void removePrefix(struct raft_log *l, const raft_index index)
         }
         l->offset++;
 
-        unref = refsDecr(l, entry->term, l->offset);
+        unref = unrefRemoved(l, entry, l->offset);
 
         if (unref) {
             destroyEntry(l, entry);
@@ -25,6 +25,14 @@ void logStart(struct raft_log *l,
 /* Get the number of entries the log currently contains. */
 size_t logNumEntries(struct raft_log *l);
 
+/* Get the total size of the payloads of the entries the log currently
+ * contains. */
+size_t logNumBytes(struct raft_log *l);
+
+/* Get the total size of the payloads of the entries from index @from to index
+ * @to, both included, which must be in the log. This takes constant time. */
+size_t logNumBytesBetween(struct raft_log *l, raft_index from, raft_index to);
+
 /* Get the index of the last entry in the log. Return #0 if the log is empty. */
 raft_index logLastIndex(struct raft_log *l);
 
@@ -0,0 +1,144 @@
+#include "metrics.h"
+
+#include "assert.h"
+#include "configuration.h"
+#include "replication.h"
+
+/* Number of buckets each power of two is split into, as a power of two. */
+#define SUB_BUCKET_BITS 2
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+
+/* Return the index of the bucket that counts the given value. */
+static unsigned histogramBucket(uint64_t value)
+{
+    unsigned msb;
+    unsigned i;
+
+    if (value < SUB_BUCKETS) {
+        return (unsigned)value;
+    }
+
+    /* Position of the most significant bit, followed by the next
+     * SUB_BUCKET_BITS bits of the value. */
+    msb = 63 - (unsigned)__builtin_clzll(value);
+    i = (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS +
+        (unsigned)((value >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+
+    if (i >= RAFT_HISTOGRAM_BUCKETS) {
+        i = RAFT_HISTOGRAM_BUCKETS - 1;
+    }
+    return i;
+}
+
+/* Return the largest value counted by the bucket with the given index. */
+static uint64_t histogramBucketMax(unsigned i)
+{
+    unsigned shift;
+
+    if (i < SUB_BUCKETS) {
+        return i;
+    }
+
+    shift = i / SUB_BUCKETS - 1;
+    return (((uint64_t)(SUB_BUCKETS + i % SUB_BUCKETS + 1)) << shift) - 1;
+}
+
+void metricsRecord(struct raft_histogram *h, uint64_t value)
+{
+    h->count++;
+    h->sum += value;
+    if (value > h->max) {
+        h->max = value;
+    }
+    h->buckets[histogramBucket(value)]++;
+}
+
+uint64_t raft_histogram_percentile(const struct raft_histogram *h,
+                                   double percentage)
+{
+    uint64_t rank;
+    uint64_t seen = 0;
+    uint64_t value;
+    unsigned i;
+
+    if (h->count == 0) {
+        return 0;
+    }
+    if (percentage <= 0) {
+        percentage = 0;
+    }
+    if (percentage >= 100) {
+        return h->max;
+    }
+
+    /* Rank of the sample we're looking for, starting from 1. */
+    rank = (uint64_t)((double)h->count * percentage / 100.0);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (i = 0; i < RAFT_HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    value = histogramBucketMax(i);
+    return value < h->max ? value : h->max;
+}
+
+void metricsCountEntries(uint64_t *n,
+                         uint64_t *bytes,
+                         const struct raft_entry entries[],
+                         unsigned n_entries)
+{
+    unsigned i;
+    *n += n_entries;
+    for (i = 0; i < n_entries; i++) {
+        *bytes += entries[i].buf.len;
+    }
+}
+
+uint64_t metricsTimeUs(struct raft *r)
+{
+    if (r->io->version < 3 || r->io->time_us == NULL) {
+        return (uint64_t)r->io->time(r->io) * 1000;
+    }
+    return r->io->time_us(r->io);
+}
+
+void raft_get_metrics(struct raft *r, struct raft_metrics *metrics)
+{
+    *metrics = r->metrics;
+}
+
+void raft_get_memory(struct raft *r, struct raft_memory *memory)
+{
+    struct raft_log *l = &r->log;
+    memory->log_entries = l->bytes;
+    memory->log_shared = l->shared;
+    memory->log_pinned = l->pinned;
+    memory->log_index = l->size * (sizeof *l->entries + sizeof *l->ends) +
+                        l->refs_size * sizeof *l->refs;
+    memory->snapshots = replicationSnapshotBytes(r);
+}
+
+int raft_get_ack_latency(struct raft *r,
+                         raft_id id,
+                         struct raft_histogram *latency)
+{
+    unsigned i;
+
+    if (r->state != RAFT_LEADER) {
+        return RAFT_NOTLEADER;
+    }
+
+    i = configurationIndexOf(&r->configuration, id);
+    if (i == r->configuration.n) {
+        return RAFT_BADID;
+    }
+
+    *latency = r->leader_state.progress[i].ack_latency;
+    return 0;
+}
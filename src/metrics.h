@@ -0,0 +1,21 @@
+/* Performance counters and latency histograms. */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include "../include/raft.h"
+
+/* Add a sample to the given histogram. */
+void metricsRecord(struct raft_histogram *h, uint64_t value);
+
+/* Add the number of the given entries to @n and their size to @bytes. */
+void metricsCountEntries(uint64_t *n,
+                         uint64_t *bytes,
+                         const struct raft_entry entries[],
+                         unsigned n_entries);
+
+/* Return the current time in microseconds, using the time_us() method of the
+ * I/O backend if it implements it, or its time() method otherwise. */
+uint64_t metricsTimeUs(struct raft *r);
+
+#endif /* METRICS_H_ */
@@ -1,8 +1,11 @@
 #include "progress.h"
 
+#include <string.h>
+
 #include "assert.h"
 #include "configuration.h"
 #include "log.h"
+#include "metrics.h"
 #include "tracing.h"
 
 /* Set to 1 to enable tracing. */
@@ -21,13 +24,22 @@
 #endif
 
 /* Initialize a single progress object. */
-static void initProgress(struct raft_progress *p, raft_index last_index)
+static void initProgress(struct raft_progress *p,
+                         raft_index last_index,
+                         raft_time now)
 {
     p->next_index = last_index + 1;
     p->match_index = 0;
     p->snapshot_index = 0;
     p->last_send = 0;
     p->recent_recv = false;
+    p->delegate_id = 0;
+    p->last_recv = now;
+    p->snapshot_size = 0;
+    p->ack_index = 0;
+    p->ack_send = 0;
+    memset(&p->ack_latency, 0, sizeof p->ack_latency);
+    p->last_snapshot = 0;
     p->state = PROGRESS__PROBE;
 }
 
@@ -36,12 +48,13 @@ int progressBuildArray(struct raft *r)
     struct raft_progress *progress;
     unsigned i;
     raft_index last_index = logLastIndex(&r->log);
+    raft_time now = r->io->time(r->io);
     progress = raft_malloc(r->configuration.n * sizeof *progress);
     if (progress == NULL) {
         return RAFT_NOMEM;
     }
     for (i = 0; i < r->configuration.n; i++) {
-        initProgress(&progress[i], last_index);
+        initProgress(&progress[i], last_index, now);
         if (r->configuration.servers[i].id == r->id) {
             progress[i].match_index = r->last_stored;
         }
@@ -89,7 +102,7 @@ int progressRebuildArray(struct raft *r,
             continue;
         }
         assert(j == r->configuration.n);
-        initProgress(&progress[i], last_index);
+        initProgress(&progress[i], last_index, r->io->time(r->io));
     }
 
     raft_free(r->leader_state.progress);
@@ -105,6 +118,15 @@ bool progressIsUpToDate(struct raft *r, unsigned i)
     return p->next_index == last_index + 1;
 }
 
+bool progressIsBacklogged(struct raft *r, unsigned i)
+{
+    struct raft_server *server = &r->configuration.servers[i];
+    if (r->io->version < 2 || r->io->send_backlogged == NULL) {
+        return false;
+    }
+    return r->io->send_backlogged(r->io, server->id);
+}
+
 bool progressShouldReplicate(struct raft *r, unsigned i)
 {
     struct raft_progress *p = &r->leader_state.progress[i];
@@ -132,8 +154,10 @@ bool progressShouldReplicate(struct raft *r, unsigned i)
             break;
         case PROGRESS__PIPELINE:
             /* In replication mode we send empty append entries messages only if
-             * haven't sent anything in the last heartbeat interval. */
-            result = !progressIsUpToDate(r, i) || needs_heartbeat;
+             * haven't sent anything in the last heartbeat interval, and we hold
+             * back new entries while the I/O backend is backlogged. */
+            result = needs_heartbeat ||
+                     (!progressIsUpToDate(r, i) && !progressIsBacklogged(r, i));
             break;
     }
     return result;
@@ -154,6 +178,36 @@ void progressUpdateLastSend(struct raft *r, unsigned i)
     r->leader_state.progress[i].last_send = r->io->time(r->io);
 }
 
+void progressSampleSend(struct raft *r, unsigned i, raft_index last_index)
+{
+    struct raft_progress *p = &r->leader_state.progress[i];
+    if (p->ack_index != 0) {
+        return;
+    }
+    p->ack_index = last_index;
+    p->ack_send = r->io->time(r->io);
+}
+
+void progressSampleAck(struct raft *r,
+                       unsigned i,
+                       raft_index rejected,
+                       raft_index last_index)
+{
+    struct raft_progress *p = &r->leader_state.progress[i];
+    if (p->ack_index == 0) {
+        return;
+    }
+    if (rejected > 0) {
+        p->ack_index = 0;
+        return;
+    }
+    if (last_index < p->ack_index) {
+        return;
+    }
+    metricsRecord(&p->ack_latency, r->io->time(r->io) - p->ack_send);
+    p->ack_index = 0;
+}
+
 bool progressResetRecentRecv(struct raft *r, const unsigned i)
 {
     bool prev = r->leader_state.progress[i].recent_recv;
@@ -164,6 +218,14 @@ bool progressResetRecentRecv(struct raft *r, const unsigned i)
 void progressMarkRecentRecv(struct raft *r, const unsigned i)
 {
     r->leader_state.progress[i].recent_recv = true;
+    r->leader_state.progress[i].last_recv = r->io->time(r->io);
+}
+
+void progressUpdateLastSnapshot(struct raft *r,
+                                const unsigned i,
+                                raft_index index)
+{
+    r->leader_state.progress[i].last_snapshot = index;
 }
 
 void progressToSnapshot(struct raft *r, unsigned i)
@@ -171,6 +233,27 @@ void progressToSnapshot(struct raft *r, unsigned i)
     struct raft_progress *p = &r->leader_state.progress[i];
     p->state = PROGRESS__SNAPSHOT;
     p->snapshot_index = logSnapshotIndex(&r->log);
+    p->delegate_id = 0;
+    p->snapshot_size = 0;
+}
+
+void progressSnapshotLoaded(struct raft *r, unsigned i, uint64_t size)
+{
+    r->leader_state.progress[i].snapshot_size = size;
+}
+
+void progressDelegateSnapshot(struct raft *r, unsigned i, unsigned j)
+{
+    struct raft_progress *p = &r->leader_state.progress[i];
+    struct raft_progress *delegate = &r->leader_state.progress[j];
+
+    /* The delegate will send a snapshot at least as recent as the last one it
+     * told us about. */
+    assert(delegate->last_snapshot > 0);
+    p->state = PROGRESS__SNAPSHOT;
+    p->snapshot_index = delegate->last_snapshot;
+    p->delegate_id = r->configuration.servers[j].id;
+    p->snapshot_size = 0;
 }
 
 void progressAbortSnapshot(struct raft *r, const unsigned i)
@@ -266,6 +349,7 @@ void progressToProbe(struct raft *r, const unsigned i)
         assert(p->snapshot_index > 0);
         p->next_index = max(p->match_index + 1, p->snapshot_index);
         p->snapshot_index = 0;
+        p->delegate_id = 0;
     } else {
         p->next_index = p->match_index + 1;
     }
@@ -285,4 +369,73 @@ bool progressSnapshotDone(struct raft *r, const unsigned i)
     return p->match_index >= p->snapshot_index;
 }
 
+int raft_replication_status(struct raft *r,
+                            raft_id id,
+                            struct raft_replication_status *status)
+{
+    struct raft_progress *p;
+    raft_index last_index;
+    raft_index first_index;
+    raft_index index;
+    raft_time now;
+    unsigned i;
+
+    if (r->state != RAFT_LEADER) {
+        return RAFT_NOTLEADER;
+    }
+    i = configurationIndexOf(&r->configuration, id);
+    if (i == r->configuration.n) {
+        return RAFT_BADID;
+    }
+
+    p = &r->leader_state.progress[i];
+    last_index = logLastIndex(&r->log);
+    first_index = last_index - logNumEntries(&r->log) + 1;
+    now = r->io->time(r->io);
+
+    memset(status, 0, sizeof *status);
+    status->id = id;
+    switch (p->state) {
+        case PROGRESS__PIPELINE:
+            status->mode = RAFT_REPLICATION_PIPELINE;
+            break;
+        case PROGRESS__SNAPSHOT:
+            status->mode = RAFT_REPLICATION_SNAPSHOT;
+            break;
+        default:
+            status->mode = RAFT_REPLICATION_PROBE;
+            break;
+    }
+    status->match_index = p->match_index;
+    status->next_index = p->next_index;
+    status->lag = last_index - min(p->match_index, last_index);
+
+    /* Entries older than the first one in our log were compacted, so their
+     * size is unknown. */
+    index = max(p->match_index + 1, first_index);
+    if (index <= last_index) {
+        status->lag_bytes = logNumBytesBetween(&r->log, index, last_index);
+    }
+    if (index < p->next_index && index <= last_index) {
+        status->inflight_bytes = logNumBytesBetween(
+            &r->log, index, min(p->next_index - 1, last_index));
+    }
+
+    if (p->next_index >= first_index) {
+        status->margin = p->next_index - first_index + 1;
+    }
+    if (id != r->id) {
+        status->last_ack_age = now - p->last_recv;
+    }
+
+    if (p->state == PROGRESS__SNAPSHOT) {
+        status->snapshot_index = p->snapshot_index;
+        status->snapshot_delegate = p->delegate_id;
+        status->snapshot_size = p->snapshot_size;
+        status->snapshot_age = now - p->last_send;
+    }
+
+    return 0;
+}
+
 #undef tracef
@@ -31,6 +31,10 @@ int progressRebuildArray(struct raft *r,
  * ours. */
 bool progressIsUpToDate(struct raft *r, unsigned i);
 
+/* Whether the I/O backend has so many messages queued for the i'th server that
+ * no more entries should be sent to it until some of them are written out. */
+bool progressIsBacklogged(struct raft *r, unsigned i);
+
 /* Whether a new AppendEntries or InstallSnapshot message should be sent to the
  * i'th server at this time.
  *
@@ -49,20 +53,45 @@ raft_index progressMatchIndex(struct raft *r, unsigned i);
  * sent. */
 void progressUpdateLastSend(struct raft *r, unsigned i);
 
+/* Start sampling the acknowledgement latency of the server at the given index,
+ * after AppendEntries request carrying entries up to @last_index has been sent,
+ * unless another request is being sampled. */
+void progressSampleSend(struct raft *r, unsigned i, raft_index last_index);
+
+/* Record the acknowledgement latency of the sampled request, if the given
+ * AppendEntries response acknowledges it. A rejection cancels the sample. */
+void progressSampleAck(struct raft *r,
+                       unsigned i,
+                       raft_index rejected,
+                       raft_index last_index);
+
 /* Reset to false the recent_recv flag of the server at the given index,
  * returning the previous value.
  *
  * To be called once every election_timeout milliseconds. */
 bool progressResetRecentRecv(struct raft *r, unsigned i);
 
-/* Set to true the recent_recv flag of the server at the given index.
+/* Set to true the recent_recv flag of the server at the given index, and
+ * update its last_recv timestamp.
  *
  * To be called whenever we receive an AppendEntries RPC result */
 void progressMarkRecentRecv(struct raft *r, unsigned i);
 
+/* Record the index of the last snapshot taken or installed by the i'th server,
+ * as reported in its last AppendEntries result. */
+void progressUpdateLastSnapshot(struct raft *r, unsigned i, raft_index index);
+
 /* Convert to the i'th server to snapshot mode. */
 void progressToSnapshot(struct raft *r, unsigned i);
 
+/* Record the size of the snapshot that is about to be sent to the i'th
+ * server. */
+void progressSnapshotLoaded(struct raft *r, unsigned i, uint64_t size);
+
+/* Convert to the i'th server to snapshot mode, with the j'th server sending its
+ * last snapshot on our behalf. */
+void progressDelegateSnapshot(struct raft *r, unsigned i, unsigned j);
+
 /* Convert to probe mode. */
 void progressToProbe(struct raft *r, unsigned i);
 
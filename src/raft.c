@@ -11,6 +11,7 @@
 #include "heap.h"
 #include "log.h"
 #include "membership.h"
+#include "replication.h"
 #include "tracing.h"
 
 #define DEFAULT_ELECTION_TIMEOUT 1000 /* One second */
@@ -61,10 +62,22 @@ int raft_init(struct raft *r,
     r->snapshot.pending.term = 0;
     r->snapshot.threshold = DEFAULT_SNAPSHOT_THRESHOLD;
     r->snapshot.trailing = DEFAULT_SNAPSHOT_TRAILING;
+    r->snapshot.threshold_bytes = 0;
+    r->snapshot.bytes = 0;
+    r->snapshot.pending_bytes = 0;
+    r->snapshot.adaptive = false;
+    r->snapshot.delegate = false;
+    r->snapshot.started = 0;
+    r->snapshot.finished = 0;
+    r->snapshot.sending = 0;
+    r->snapshot.cost = 0;
     r->snapshot.put.data = NULL;
     r->close_cb = NULL;
     memset(r->errmsg, 0, sizeof r->errmsg);
     r->pre_vote = false;
+    r->quiescence = false;
+    r->trace_ring = NULL;
+    memset(&r->metrics, 0, sizeof r->metrics);
     r->max_catch_up_rounds = DEFAULT_MAX_CATCH_UP_ROUNDS;
     r->max_catch_up_round_duration = DEFAULT_MAX_CATCH_UP_ROUND_DURATION;
     rv = r->io->init(r->io, r->id, r->address);
@@ -127,6 +140,21 @@ void raft_set_snapshot_trailing(struct raft *r, unsigned n)
     r->snapshot.trailing = n;
 }
 
+void raft_set_snapshot_threshold_bytes(struct raft *r, size_t n)
+{
+    r->snapshot.threshold_bytes = n;
+}
+
+void raft_set_snapshot_adaptive(struct raft *r, bool enabled)
+{
+    r->snapshot.adaptive = enabled;
+}
+
+void raft_set_snapshot_delegate(struct raft *r, bool enabled)
+{
+    r->snapshot.delegate = enabled;
+}
+
 void raft_set_max_catch_up_rounds(struct raft *r, unsigned n)
 {
     r->max_catch_up_rounds = n;
@@ -142,6 +170,25 @@ void raft_set_pre_vote(struct raft *r, bool enabled)
     r->pre_vote = enabled;
 }
 
+void raft_set_quiescence(struct raft *r, bool enabled)
+{
+    r->quiescence = enabled;
+    if (enabled) {
+        return;
+    }
+    switch (r->state) {
+        case RAFT_FOLLOWER:
+            if (r->follower_state.quiescent) {
+                r->follower_state.quiescent = false;
+                r->election_timer_start = r->io->time(r->io);
+            }
+            break;
+        case RAFT_LEADER:
+            replicationUnquiesce(r);
+            break;
+    }
+}
+
 const char *raft_errmsg(struct raft *r)
 {
     return r->errmsg;
@@ -8,6 +8,7 @@
 #include "membership.h"
 #include "recv_append_entries.h"
 #include "recv_append_entries_result.h"
+#include "recv_delegate_snapshot.h"
 #include "recv_install_snapshot.h"
 #include "recv_request_vote.h"
 #include "recv_request_vote_result.h"
@@ -28,7 +29,7 @@ static int recvMessage(struct raft *r, struct raft_message *message)
     int rv = 0;
 
     if (message->type < RAFT_IO_APPEND_ENTRIES ||
-        message->type > RAFT_IO_TIMEOUT_NOW) {
+        message->type > RAFT_IO_DELEGATE_SNAPSHOT) {
         tracef("received unknown message type type: %d", message->type);
         return 0;
     }
@@ -75,6 +76,11 @@ static int recvMessage(struct raft *r, struct raft_message *message)
             rv = recvTimeoutNow(r, message->server_id, message->server_address,
                                 &message->timeout_now);
             break;
+        case RAFT_IO_DELEGATE_SNAPSHOT:
+            rv = recvDelegateSnapshot(r, message->server_id,
+                                      message->server_address,
+                                      &message->delegate_snapshot);
+            break;
     };
 
     if (rv != 0 && rv != RAFT_NOCONNECTION) {
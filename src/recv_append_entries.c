@@ -7,6 +7,7 @@
 #include "log.h"
 #include "recv.h"
 #include "replication.h"
+#include "trace.h"
 #include "tracing.h"
 
 /* Set to 1 to enable tracing. */
@@ -39,6 +40,9 @@ int recvAppendEntries(struct raft *r,
     assert(args != NULL);
     assert(address != NULL);
 
+    Trace(r, TRACE_RECV_APPEND, id, args->term, args->prev_log_index,
+          args->n_entries);
+
     result->rejected = args->prev_log_index;
     result->last_log_index = logLastIndex(&r->log);
 
@@ -118,6 +122,8 @@ int recvAppendEntries(struct raft *r,
         return 0;
     }
 
+    r->follower_state.quiescent = false;
+
     rv = replicationAppend(r, args, &result->rejected, &async);
     if (rv != 0) {
         return rv;
@@ -127,11 +133,16 @@ int recvAppendEntries(struct raft *r,
         return 0;
     }
 
+    /* If the leader is idle and our log matches its own, lengthen our election
+     * timer, since the leader will only send us keepalive heartbeats. */
+    r->follower_state.quiescent = args->quiesce && result->rejected == 0;
+
     /* Echo back to the leader the point that we reached. */
     result->last_log_index = r->last_stored;
 
 reply:
     result->term = r->current_term;
+    result->snapshot_index = logSnapshotIndex(&r->log);
 
     /* Free the entries batch, if any. */
     if (args->n_entries > 0 && args->entries[0].batch != NULL) {
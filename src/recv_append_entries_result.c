@@ -4,6 +4,7 @@
 #include "tracing.h"
 #include "recv.h"
 #include "replication.h"
+#include "trace.h"
 
 /* Set to 1 to enable tracing. */
 #if 0
@@ -26,6 +27,9 @@ int recvAppendEntriesResult(struct raft *r,
     assert(address != NULL);
     assert(result != NULL);
 
+    Trace(r, TRACE_RECV_RESULT, id, result->rejected, result->last_log_index,
+          0);
+
     if (r->state != RAFT_LEADER) {
         tracef("local server is not leader -> ignore");
         return 0;
@@ -0,0 +1,57 @@
+#include "recv_delegate_snapshot.h"
+
+#include "assert.h"
+#include "convert.h"
+#include "recv.h"
+#include "replication.h"
+#include "tracing.h"
+
+/* Set to 1 to enable tracing. */
+#if 0
+#define tracef(...) Tracef(r->tracer, __VA_ARGS__)
+#else
+#define tracef(...)
+#endif
+
+int recvDelegateSnapshot(struct raft *r,
+                         const raft_id id,
+                         const char *address,
+                         const struct raft_delegate_snapshot *args)
+{
+    int match;
+    int rv;
+
+    assert(r != NULL);
+    assert(id > 0);
+    assert(address != NULL);
+    assert(args != NULL);
+
+    rv = recvEnsureMatchingTerms(r, args->term, &match);
+    if (rv != 0) {
+        return rv;
+    }
+
+    /* The request comes from a stale leader, just ignore it. */
+    if (match < 0) {
+        tracef("local term is higher -> ignore ");
+        return 0;
+    }
+
+    assert(r->state == RAFT_FOLLOWER || r->state == RAFT_CANDIDATE);
+    assert(r->current_term == args->term);
+    if (r->state == RAFT_CANDIDATE) {
+        assert(match == 0);
+        tracef("discovered leader -> step down ");
+        convertToFollower(r);
+    }
+
+    rv = recvUpdateLeader(r, id, address);
+    if (rv != 0) {
+        return rv;
+    }
+    r->election_timer_start = r->io->time(r->io);
+
+    return replicationDelegateSnapshot(r, args);
+}
+
+#undef tracef
@@ -0,0 +1,14 @@
+/* Receive a DelegateSnapshot message. */
+
+#ifndef RECV_DELEGATE_SNAPSHOT_H_
+#define RECV_DELEGATE_SNAPSHOT_H_
+
+#include "../include/raft.h"
+
+/* Process a DelegateSnapshot RPC from the given server. */
+int recvDelegateSnapshot(struct raft *r,
+                         raft_id id,
+                         const char *address,
+                         const struct raft_delegate_snapshot *args);
+
+#endif /* RECV_DELEGATE_SNAPSHOT_H_ */
@@ -1,6 +1,7 @@
 #include "recv_install_snapshot.h"
 
 #include "assert.h"
+#include "configuration.h"
 #include "convert.h"
 #include "log.h"
 #include "recv.h"
@@ -21,13 +22,14 @@ static void installSnapshotSendCb(struct raft_io_send *req, int status)
 }
 
 int recvInstallSnapshot(struct raft *r,
-                        const raft_id id,
+                        raft_id id,
                         const char *address,
                         struct raft_install_snapshot *args)
 {
     struct raft_io_send *req;
     struct raft_message message;
     struct raft_append_entries_result *result = &message.append_entries_result;
+    const struct raft_server *leader;
     int rv;
     int match;
     bool async;
@@ -56,9 +58,32 @@ int recvInstallSnapshot(struct raft *r,
         convertToFollower(r);
     }
 
-    rv = recvUpdateLeader(r, id, address);
-    if (rv != 0) {
-        return rv;
+    /* If the snapshot was sent by a follower on behalf of the leader, then
+     * the leader is the server with the given leader ID, and our reply should
+     * be sent to it. We look its address up in our configuration or in the
+     * snapshot one, since we might be a brand new server. */
+    if (args->leader_id != 0 && args->leader_id != id) {
+        leader = configurationGet(&r->configuration, args->leader_id);
+        if (leader == NULL) {
+            leader = configurationGet(&args->conf, args->leader_id);
+        }
+        if (leader == NULL) {
+            tracef("unknown leader %llu -> ignore", args->leader_id);
+            raft_configuration_close(&args->conf);
+            raft_free(args->data.base);
+            return 0;
+        }
+        rv = recvUpdateLeader(r, leader->id, leader->address);
+        if (rv != 0) {
+            return rv;
+        }
+        id = r->follower_state.current_leader.id;
+        address = r->follower_state.current_leader.address;
+    } else {
+        rv = recvUpdateLeader(r, id, address);
+        if (rv != 0) {
+            return rv;
+        }
     }
     r->election_timer_start = r->io->time(r->io);
 
@@ -78,6 +103,7 @@ int recvInstallSnapshot(struct raft *r,
 
 reply:
     result->term = r->current_term;
+    result->snapshot_index = logSnapshotIndex(&r->log);
 
     /* Free the snapshot data. */
     raft_configuration_close(&args->conf);
@@ -3,6 +3,8 @@
 #include "assert.h"
 #include "election.h"
 #include "recv.h"
+#include "replication.h"
+#include "trace.h"
 #include "tracing.h"
 
 /* Set to 1 to enable tracing. */
@@ -60,6 +62,11 @@ int recvRequestVote(struct raft *r,
         (r->state == RAFT_FOLLOWER && r->follower_state.current_leader.id != 0);
     if (has_leader && !args->disrupt_leader) {
         tracef("local server has a leader -> reject ");
+        /* The candidate didn't hear from us, resume sending heartbeats if we
+         * were quiescent. */
+        if (r->state == RAFT_LEADER) {
+            replicationUnquiesce(r);
+        }
         goto reply;
     }
 
@@ -99,6 +106,8 @@ int recvRequestVote(struct raft *r,
 
 reply:
     result->term = r->current_term;
+    Trace(r, TRACE_VOTE, args->candidate_id, args->term, result->vote_granted,
+          0);
 
     message.type = RAFT_IO_REQUEST_VOTE_RESULT;
     message.server_id = id;
@@ -11,11 +11,13 @@
 #include "heap.h"
 #include "log.h"
 #include "membership.h"
+#include "metrics.h"
 #include "progress.h"
 #include "queue.h"
 #include "replication.h"
 #include "request.h"
 #include "snapshot.h"
+#include "trace.h"
 #include "tracing.h"
 
 /* Set to 1 to enable tracing. */
@@ -84,10 +86,16 @@ static int sendAppendEntries(struct raft *r,
     args->prev_log_index = prev_index;
     args->prev_log_term = prev_term;
 
-    /* TODO: implement a limit to the total size of the entries being sent */
-    rv = logAcquire(&r->log, next_index, &args->entries, &args->n_entries);
-    if (rv != 0) {
-        goto err;
+    /* If the I/O backend already has plenty of data queued for this server,
+     * just send a heartbeat, without acquiring and encoding more entries. */
+    if (progressIsBacklogged(r, i)) {
+        args->entries = NULL;
+        args->n_entries = 0;
+    } else {
+        rv = logAcquire(&r->log, next_index, &args->entries, &args->n_entries);
+        if (rv != 0) {
+            goto err;
+        }
     }
 
     /* From Section 3.5:
@@ -99,6 +107,7 @@ static int sendAppendEntries(struct raft *r,
      *   its local state machine (in log order)
      */
     args->leader_commit = r->commit_index;
+    args->quiesce = r->leader_state.quiescent;
 
     tracef("send %u entries starting at %llu to server %u (last index %llu)",
            args->n_entries, args->prev_log_index, server->id,
@@ -131,6 +140,11 @@ static int sendAppendEntries(struct raft *r,
     }
 
     progressUpdateLastSend(r, i);
+    if (req->n > 0) {
+        metricsCountEntries(&r->metrics.entries_sent, &r->metrics.bytes_sent,
+                            req->entries, req->n);
+        progressSampleSend(r, i, req->index + req->n - 1);
+    }
     return 0;
 
 err_after_req_alloc:
@@ -151,8 +165,21 @@ struct sendInstallSnapshot
     struct raft_io_send send;        /* Underlying I/O send request. */
     struct raft_snapshot *snapshot;  /* Snapshot to send. */
     raft_id server_id;               /* Destination server. */
+    raft_term term;                  /* Leader's term, when delegated. */
+    raft_id leader_id;               /* Leader's ID, when delegated. */
 };
 
+/* Release the snapshot that was sent and the request itself. */
+static void sendInstallSnapshotDone(struct sendInstallSnapshot *req)
+{
+    struct raft *r = req->raft;
+    assert(r->snapshot.sending >= req->snapshot->bufs[0].len);
+    r->snapshot.sending -= req->snapshot->bufs[0].len;
+    snapshotClose(req->snapshot);
+    raft_free(req->snapshot);
+    raft_free(req);
+}
+
 static void sendInstallSnapshotCb(struct raft_io_send *send, int status)
 {
     struct sendInstallSnapshot *req = send->data;
@@ -170,9 +197,7 @@ static void sendInstallSnapshotCb(struct raft_io_send *send, int status)
         }
     }
 
-    snapshotClose(req->snapshot);
-    raft_free(req->snapshot);
-    raft_free(req);
+    sendInstallSnapshotDone(req);
 }
 
 static void sendSnapshotGetCb(struct raft_io_snapshot_get *get,
@@ -212,6 +237,7 @@ static void sendSnapshotGetCb(struct raft_io_snapshot_get *get,
     }
 
     assert(snapshot->n_bufs == 1);
+    progressSnapshotLoaded(r, i, snapshot->bufs[0].len);
 
     message.type = RAFT_IO_INSTALL_SNAPSHOT;
     message.server_id = server->id;
@@ -223,6 +249,7 @@ static void sendSnapshotGetCb(struct raft_io_snapshot_get *get,
     args->conf_index = snapshot->configuration_index;
     args->conf = snapshot->configuration;
     args->data = snapshot->bufs[0];
+    args->leader_id = 0;
 
     req->snapshot = snapshot;
     req->send.data = req;
@@ -230,8 +257,10 @@ static void sendSnapshotGetCb(struct raft_io_snapshot_get *get,
     tracef("sending snapshot with last index %llu to %u", snapshot->index,
            server->id);
 
+    r->snapshot.sending += snapshot->bufs[0].len;
     rv = r->io->send(r->io, &req->send, &message, sendInstallSnapshotCb);
     if (rv != 0) {
+        r->snapshot.sending -= snapshot->bufs[0].len;
         goto abort_with_snapshot;
     }
 
@@ -250,13 +279,142 @@ out:
     return;
 }
 
+/* Context of a RAFT_IO_DELEGATE_SNAPSHOT request that was submitted with
+ * raft_io_>send(). */
+struct sendDelegateSnapshot
+{
+    struct raft *raft;        /* Instance sending the request. */
+    struct raft_io_send send; /* Underlying I/O send request. */
+    raft_id server_id;        /* Server that should receive the snapshot. */
+};
+
+static void sendDelegateSnapshotCb(struct raft_io_send *send, int status)
+{
+    struct sendDelegateSnapshot *req = send->data;
+    struct raft *r = req->raft;
+    raft_id server_id = req->server_id;
+    const struct raft_server *server;
+    unsigned i;
+
+    raft_free(req);
+
+    if (status == 0 || r->state != RAFT_LEADER) {
+        return;
+    }
+
+    tracef("send delegate snapshot: %s", raft_strerror(status));
+    server = configurationGet(&r->configuration, server_id);
+    if (server == NULL) {
+        return;
+    }
+    i = configurationIndexOf(&r->configuration, server_id);
+    if (progressState(r, i) == PROGRESS__SNAPSHOT &&
+        r->leader_state.progress[i].delegate_id != 0) {
+        progressAbortSnapshot(r, i);
+    }
+}
+
+/* Return the index of a follower that can send its own latest snapshot to the
+ * i'th server on our behalf, or the number of servers in the configuration if
+ * there's none.
+ *
+ * We pick the voter or stand-by follower which is replicating in pipeline mode,
+ * has recently been in touch with us and has the highest match index, provided
+ * that it's at least as recent as the last configuration (so the delegate knows
+ * the address of the i'th server) and that its last snapshot is at least as
+ * recent as our own (so the i'th server can resume replication from our log
+ * after installing it). */
+static unsigned pickSnapshotDelegate(struct raft *r, const unsigned i)
+{
+    raft_index conf_index =
+        max(r->configuration_index, r->configuration_uncommitted_index);
+    raft_index snapshot_index = logSnapshotIndex(&r->log);
+    raft_index match_index = 0;
+    unsigned delegate = r->configuration.n;
+    unsigned j;
+
+    for (j = 0; j < r->configuration.n; j++) {
+        struct raft_server *server = &r->configuration.servers[j];
+        struct raft_progress *p = &r->leader_state.progress[j];
+        if (j == i || server->id == r->id || server->role == RAFT_SPARE) {
+            continue;
+        }
+        if (p->state != PROGRESS__PIPELINE || !p->recent_recv) {
+            continue;
+        }
+        if (p->match_index < conf_index || p->last_snapshot == 0 ||
+            p->last_snapshot < snapshot_index) {
+            continue;
+        }
+        if (p->match_index > match_index) {
+            delegate = j;
+            match_index = p->match_index;
+        }
+    }
+
+    return delegate;
+}
+
+/* Ask the j'th server to send its latest snapshot to the i'th server. */
+static int sendDelegateSnapshot(struct raft *r,
+                                const unsigned i,
+                                const unsigned j)
+{
+    struct raft_server *server = &r->configuration.servers[i];
+    struct raft_server *delegate = &r->configuration.servers[j];
+    struct raft_message message;
+    struct sendDelegateSnapshot *req;
+    int rv;
+
+    message.type = RAFT_IO_DELEGATE_SNAPSHOT;
+    message.server_id = delegate->id;
+    message.server_address = delegate->address;
+    message.delegate_snapshot.term = r->current_term;
+    message.delegate_snapshot.server_id = server->id;
+
+    req = raft_malloc(sizeof *req);
+    if (req == NULL) {
+        return RAFT_NOMEM;
+    }
+    req->raft = r;
+    req->send.data = req;
+    req->server_id = server->id;
+
+    tracef("delegate sending snapshot to %llu to %llu", server->id,
+           delegate->id);
+
+    progressDelegateSnapshot(r, i, j);
+
+    rv = r->io->send(r->io, &req->send, &message, sendDelegateSnapshotCb);
+    if (rv != 0) {
+        progressAbortSnapshot(r, i);
+        raft_free(req);
+        return rv;
+    }
+
+    progressUpdateLastSend(r, i);
+    return 0;
+}
+
 /* Send the latest snapshot to the i'th server */
 static int sendSnapshot(struct raft *r, const unsigned i)
 {
     struct raft_server *server = &r->configuration.servers[i];
     struct sendInstallSnapshot *request;
+    unsigned j;
     int rv;
 
+    /* If delegation is enabled, try to let a follower send the snapshot,
+     * unless the last attempt was a delegated one, in which case we fall back
+     * to send the snapshot ourselves. */
+    if (r->snapshot.delegate &&
+        r->leader_state.progress[i].delegate_id == 0) {
+        j = pickSnapshotDelegate(r, i);
+        if (j < r->configuration.n) {
+            return sendDelegateSnapshot(r, i, j);
+        }
+    }
+
     progressToSnapshot(r, i);
 
     request = raft_malloc(sizeof *request);
@@ -266,6 +424,8 @@ static int sendSnapshot(struct raft *r, const unsigned i)
     }
     request->raft = r;
     request->server_id = server->id;
+    request->term = 0;
+    request->leader_id = 0;
     request->get.data = request;
 
     /* TODO: make sure that the I/O implementation really returns the latest
@@ -385,6 +545,117 @@ int replicationHeartbeat(struct raft *r)
     return triggerAll(r);
 }
 
+/* Return true if the leader and all its followers are idle. */
+static bool isIdle(struct raft *r)
+{
+    raft_index last_index = logLastIndex(&r->log);
+    unsigned i;
+
+    if (r->commit_index != last_index || r->last_applied != last_index ||
+        r->last_stored != last_index) {
+        return false;
+    }
+    if (r->leader_state.change != NULL || r->leader_state.promotee_id != 0 ||
+        r->transfer != NULL) {
+        return false;
+    }
+
+    for (i = 0; i < r->configuration.n; i++) {
+        struct raft_server *server = &r->configuration.servers[i];
+        struct raft_progress *p = &r->leader_state.progress[i];
+        if (server->id == r->id || server->role == RAFT_SPARE) {
+            continue;
+        }
+        if (p->state != PROGRESS__PIPELINE || p->match_index != last_index ||
+            !p->recent_recv) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool replicationQuiesce(struct raft *r)
+{
+    raft_index last_index = logLastIndex(&r->log);
+    raft_term last_term = logLastTerm(&r->log);
+    unsigned i;
+    int rv;
+
+    assert(r->state == RAFT_LEADER);
+
+    if (r->leader_state.quiescent) {
+        return true;
+    }
+    if (!r->quiescence || !isIdle(r)) {
+        return false;
+    }
+
+    tracef("cluster is idle -> quiesce");
+    r->leader_state.quiescent = true;
+
+    /* Send the heartbeats right away, regardless of when the last message was
+     * sent, since they might be the last ones for a long time. */
+    for (i = 0; i < r->configuration.n; i++) {
+        struct raft_server *server = &r->configuration.servers[i];
+        if (server->id == r->id || server->role == RAFT_SPARE) {
+            continue;
+        }
+        rv = sendAppendEntries(r, i, last_index, last_term);
+        if (rv != 0) {
+            /* The follower will time out and request a vote, which resumes
+             * heartbeats. */
+            tracef("failed to send quiesce heartbeat to server %u: %s",
+                   server->id, raft_strerror(rv));
+        }
+    }
+
+    return true;
+}
+
+void replicationUnquiesce(struct raft *r)
+{
+    assert(r->state == RAFT_LEADER);
+    if (!r->leader_state.quiescent) {
+        return;
+    }
+    tracef("resume heartbeats");
+    r->leader_state.quiescent = false;
+
+    /* Give followers a full election timeout to answer before checking that
+     * we still reach a majority of the cluster. */
+    r->election_timer_start = r->io->time(r->io);
+}
+
+void replicationKeepalive(struct raft *r)
+{
+    raft_time now = r->io->time(r->io);
+    raft_index last_index = logLastIndex(&r->log);
+    raft_term last_term = logLastTerm(&r->log);
+    unsigned i;
+    int rv;
+
+    assert(r->state == RAFT_LEADER);
+    assert(r->leader_state.quiescent);
+
+    for (i = 0; i < r->configuration.n; i++) {
+        struct raft_server *server = &r->configuration.servers[i];
+        struct raft_progress *p = &r->leader_state.progress[i];
+        if (server->id == r->id || server->role == RAFT_SPARE) {
+            continue;
+        }
+        if (now - p->last_send <
+            REPLICATION__QUIESCENT_FACTOR * r->heartbeat_timeout) {
+            continue;
+        }
+        rv = sendAppendEntries(r, i, last_index, last_term);
+        if (rv != 0) {
+            tracef("failed to send keepalive heartbeat to server %u: %s",
+                   server->id, raft_strerror(rv));
+        }
+    }
+}
+
 /* Context for a write log entries request that was submitted by a leader. */
 struct appendLeader
 {
@@ -450,6 +721,85 @@ static struct request *getRequest(struct raft *r,
     return NULL;
 }
 
+/* Stages of the lifecycle of an apply request recorded by the leader. */
+enum { STAGE_APPENDED, STAGE_PERSISTED, STAGE_COMMITTED };
+
+/* Record the given time as the time at which the given apply request reached
+ * the given stage, along with its commit latency once it gets committed. */
+static void stampApplyRequest(struct raft *r,
+                              struct raft_apply *req,
+                              int stage,
+                              uint64_t now)
+{
+    switch (stage) {
+        case STAGE_APPENDED:
+            req->times.appended = now;
+            break;
+        case STAGE_PERSISTED:
+            req->times.persisted = now;
+            break;
+        case STAGE_COMMITTED:
+            req->times.committed = now;
+            metricsRecord(&r->metrics.commit_latency,
+                          now - req->times.submitted);
+            break;
+    }
+}
+
+/* Record the current time as the time at which the apply requests whose last
+ * entry has index between @first and @last reached the given stage.
+ *
+ * Requests are queued in index order. Committed entries are the oldest ones of
+ * requests not yet applied, so they are looked for from the head of the queue,
+ * while appended and persisted entries are the newest ones, so they are looked
+ * for from the tail. */
+static void stampApplyRequests(struct raft *r,
+                               raft_index first,
+                               raft_index last,
+                               int stage)
+{
+    uint64_t now = metricsTimeUs(r);
+    struct raft_apply *req;
+    raft_index req_last;
+    queue *head;
+
+    if (stage == STAGE_COMMITTED) {
+        QUEUE_FOREACH(head, &r->leader_state.requests)
+        {
+            req = QUEUE_DATA(head, struct raft_apply, queue);
+            if (req->index > last) {
+                break;
+            }
+            if (req->type != RAFT_COMMAND) {
+                continue;
+            }
+            req_last = req->index + req->n - 1;
+            if (req_last >= first && req_last <= last) {
+                stampApplyRequest(r, req, stage, now);
+            }
+        }
+        return;
+    }
+
+    for (head = QUEUE_TAIL(&r->leader_state.requests);
+         head != &r->leader_state.requests; head = QUEUE_PREV(head)) {
+        req = QUEUE_DATA(head, struct raft_apply, queue);
+        if (req->type != RAFT_COMMAND) {
+            if (req->index < first) {
+                break;
+            }
+            continue;
+        }
+        req_last = req->index + req->n - 1;
+        if (req_last < first) {
+            break;
+        }
+        if (req_last <= last) {
+            stampApplyRequest(r, req, stage, now);
+        }
+    }
+}
+
 /* Invoked once a disk write request for new entries has been completed. */
 static void appendLeaderCb(struct raft_io_append *req, int status)
 {
@@ -460,6 +810,8 @@ static void appendLeaderCb(struct raft_io_append *req, int status)
 
     tracef("leader: written %u entries starting at %lld: status %d", request->n,
            request->index, status);
+    Trace(r, TRACE_APPEND_DONE, request->index, request->n, (unsigned)status,
+          0);
 
     /* In case of a failed disk write, if we were the leader creating these
      * entries in the first place, truncate our log too (since we have appended
@@ -485,6 +837,9 @@ static void appendLeaderCb(struct raft_io_append *req, int status)
         goto out;
     }
 
+    stampApplyRequests(r, request->index, request->index + request->n - 1,
+                       STAGE_PERSISTED);
+
     /* If Check if we have reached a quorum. */
     server_index = configurationIndexOf(&r->configuration, r->id);
 
@@ -562,6 +917,10 @@ static int appendLeader(struct raft *r, raft_index index)
         ErrMsgTransfer(r->io->errmsg, r->errmsg, "io");
         goto err_after_request_alloc;
     }
+    Trace(r, TRACE_APPEND, index, n, 0, 0);
+    metricsCountEntries(&r->metrics.entries_appended,
+                        &r->metrics.bytes_appended, entries, n);
+    stampApplyRequests(r, index, index + n - 1, STAGE_APPENDED);
 
     return 0;
 
@@ -578,6 +937,8 @@ int replicationTrigger(struct raft *r, raft_index index)
 {
     int rv;
 
+    replicationUnquiesce(r);
+
     rv = appendLeader(r, index);
     if (rv != 0) {
         return rv;
@@ -661,6 +1022,8 @@ int replicationUpdate(struct raft *r,
     assert(i < r->configuration.n);
 
     progressMarkRecentRecv(r, i);
+    progressUpdateLastSnapshot(r, i, result->snapshot_index);
+    progressSampleAck(r, i, result->rejected, result->last_log_index);
 
     /* If the RPC failed because of a log mismatch, retry.
      *
@@ -673,6 +1036,7 @@ int replicationUpdate(struct raft *r,
      */
     if (result->rejected > 0) {
         bool retry;
+        replicationUnquiesce(r);
         retry = progressMaybeDecrement(r, i, result->rejected,
                                        result->last_log_index);
         if (retry) {
@@ -787,6 +1151,7 @@ static void sendAppendEntriesResult(
     message.server_id = r->follower_state.current_leader.id;
     message.server_address = r->follower_state.current_leader.address;
     message.append_entries_result = *result;
+    message.append_entries_result.snapshot_index = logSnapshotIndex(&r->log);
 
     req = raft_malloc(sizeof *req);
     if (req == NULL) {
@@ -820,6 +1185,8 @@ static void appendFollowerCb(struct raft_io_append *req, int status)
     int rv;
 
     tracef("I/O completed on follower: status %d", status);
+    Trace(r, TRACE_APPEND_DONE, request->index, args->n_entries,
+          (unsigned)status, 0);
 
     assert(args->entries != NULL);
     assert(args->n_entries > 0);
@@ -873,6 +1240,7 @@ static void appendFollowerCb(struct raft_io_append *req, int status)
      */
     if (args->leader_commit > r->commit_index) {
         r->commit_index = min(args->leader_commit, r->last_stored);
+        Trace(r, TRACE_COMMIT, r->commit_index, 0, 0, 0);
         rv = replicationApply(r);
         if (rv != 0) {
             goto out;
@@ -994,6 +1362,7 @@ static int deleteConflictingEntries(struct raft *r,
                 return rv;
             }
             logTruncate(&r->log, entry_index);
+            Trace(r, TRACE_TRUNCATE, entry_index, 0, 0, 0);
 
             /* Drop information about previously stored entries that have just
              * been discarded. */
@@ -1067,6 +1436,7 @@ int replicationAppend(struct raft *r,
     if (n == 0) {
         if (args->leader_commit > r->commit_index) {
             r->commit_index = min(args->leader_commit, logLastIndex(&r->log));
+            Trace(r, TRACE_COMMIT, r->commit_index, 0, 0, 0);
             rv = replicationApply(r);
             if (rv != 0) {
                 return rv;
@@ -1127,6 +1497,10 @@ int replicationAppend(struct raft *r,
         ErrMsgTransfer(r->io->errmsg, r->errmsg, "io");
         goto err_after_acquire_entries;
     }
+    Trace(r, TRACE_APPEND, request->index, n, 0, 0);
+    metricsCountEntries(&r->metrics.entries_appended,
+                        &r->metrics.bytes_appended, request->args.entries,
+                        request->args.n_entries);
 
     entryBatchesDestroy(args->entries, args->n_entries);
     return 0;
@@ -1175,6 +1549,9 @@ static void installSnapshotCb(struct raft_io_snapshot_put *req, int status)
         goto discard;
     }
 
+    Trace(r, TRACE_INSTALL, snapshot->index, snapshot->term, (unsigned)status,
+          0);
+
     if (status != 0) {
         result.rejected = snapshot->index;
         tracef("save snapshot %llu: %s", snapshot->index,
@@ -1197,6 +1574,7 @@ static void installSnapshotCb(struct raft_io_snapshot_put *req, int status)
     }
 
     tracef("restored snapshot with last index %llu", snapshot->index);
+    r->metrics.snapshots_installed++;
 
     result.rejected = 0;
 
@@ -1302,6 +1680,146 @@ err:
     return rv;
 }
 
+size_t replicationSnapshotBytes(struct raft *r)
+{
+    size_t bytes = r->snapshot.sending;
+    unsigned i;
+
+    /* Snapshot being taken. */
+    if (r->snapshot.pending.term != 0) {
+        for (i = 0; i < r->snapshot.pending.n_bufs; i++) {
+            bytes += r->snapshot.pending.bufs[i].len;
+        }
+    }
+
+    /* Snapshot received from the leader, being installed. */
+    if (r->snapshot.put.data != NULL && r->snapshot.put.data != r) {
+        struct recvInstallSnapshot *request = r->snapshot.put.data;
+        bytes += request->snapshot.bufs[0].len;
+    }
+
+    return bytes;
+}
+
+/* A snapshot sent on behalf of the leader has been delivered. The leader is in
+ * charge of the progress of the destination server and notices failures by
+ * itself, and we might even have become leader in the meantime, so there's
+ * nothing to update. */
+static void delegateInstallSnapshotCb(struct raft_io_send *send, int status)
+{
+    struct sendInstallSnapshot *req = send->data;
+
+    if (status != 0) {
+        tracef("send delegated install snapshot: %s", raft_strerror(status));
+    }
+
+    sendInstallSnapshotDone(req);
+}
+
+/* The snapshot requested by a DelegateSnapshot RPC has been loaded, send it to
+ * the destination server. */
+static void delegateSnapshotGetCb(struct raft_io_snapshot_get *get,
+                                  struct raft_snapshot *snapshot,
+                                  int status)
+{
+    struct sendInstallSnapshot *req = get->data;
+    struct raft *r = req->raft;
+    struct raft_message message;
+    struct raft_install_snapshot *args = &message.install_snapshot;
+    const struct raft_server *server;
+    int rv;
+
+    if (status != 0) {
+        tracef("get snapshot %s", raft_strerror(status));
+        goto abort;
+    }
+
+    /* Check that the leader that asked us to send the snapshot is still the
+     * current one. */
+    if (r->state != RAFT_FOLLOWER || r->current_term != req->term ||
+        r->follower_state.current_leader.id != req->leader_id) {
+        goto abort_with_snapshot;
+    }
+
+    server = configurationGet(&r->configuration, req->server_id);
+    if (server == NULL) {
+        goto abort_with_snapshot;
+    }
+
+    assert(snapshot->n_bufs == 1);
+
+    message.type = RAFT_IO_INSTALL_SNAPSHOT;
+    message.server_id = server->id;
+    message.server_address = server->address;
+
+    args->term = req->term;
+    args->last_index = snapshot->index;
+    args->last_term = snapshot->term;
+    args->conf_index = snapshot->configuration_index;
+    args->conf = snapshot->configuration;
+    args->data = snapshot->bufs[0];
+    args->leader_id = req->leader_id;
+
+    req->snapshot = snapshot;
+    req->send.data = req;
+
+    tracef("sending snapshot with last index %llu to %llu on behalf of %llu",
+           snapshot->index, server->id, req->leader_id);
+
+    r->snapshot.sending += snapshot->bufs[0].len;
+    rv = r->io->send(r->io, &req->send, &message, delegateInstallSnapshotCb);
+    if (rv != 0) {
+        r->snapshot.sending -= snapshot->bufs[0].len;
+        goto abort_with_snapshot;
+    }
+
+    return;
+
+abort_with_snapshot:
+    snapshotClose(snapshot);
+    raft_free(snapshot);
+abort:
+    raft_free(req);
+}
+
+int replicationDelegateSnapshot(struct raft *r,
+                                const struct raft_delegate_snapshot *args)
+{
+    struct sendInstallSnapshot *req;
+    int rv;
+
+    assert(r->state == RAFT_FOLLOWER);
+
+    if (logSnapshotIndex(&r->log) == 0) {
+        tracef("no snapshot to send to %llu", args->server_id);
+        return 0;
+    }
+
+    if (configurationGet(&r->configuration, args->server_id) == NULL) {
+        tracef("unknown server %llu", args->server_id);
+        return 0;
+    }
+
+    req = raft_malloc(sizeof *req);
+    if (req == NULL) {
+        return RAFT_NOMEM;
+    }
+    req->raft = r;
+    req->server_id = args->server_id;
+    req->term = args->term;
+    req->leader_id = r->follower_state.current_leader.id;
+    req->get.data = req;
+
+    rv = r->io->snapshot_get(r->io, &req->get, delegateSnapshotGetCb);
+    if (rv != 0) {
+        /* The leader will eventually send the snapshot itself. */
+        tracef("get snapshot: %s", raft_strerror(rv));
+        raft_free(req);
+    }
+
+    return 0;
+}
+
 /* Apply a RAFT_COMMAND entry that has been committed. */
 static int applyCommand(struct raft *r,
                         const raft_index index,
@@ -1315,7 +1833,13 @@ static int applyCommand(struct raft *r,
         return rv;
     }
     req = (struct raft_apply *)getRequest(r, index, RAFT_COMMAND);
-    if (req != NULL && req->cb != NULL) {
+    if (req == NULL) {
+        return 0;
+    }
+    req->times.applied = metricsTimeUs(r);
+    metricsRecord(&r->metrics.apply_latency,
+                  req->times.applied - req->times.submitted);
+    if (req->cb != NULL) {
         req->cb(req, 0, result);
     }
     return 0;
@@ -1372,8 +1896,33 @@ static void applyChange(struct raft *r, const raft_index index)
     }
 }
 
+/* When the adaptive snapshot policy is enabled, don't start a new snapshot if
+ * the time elapsed since the last one completed is less than this many times
+ * the time it took to take it. */
+#define SNAPSHOT_ADAPTIVE_COST_RATIO 10
+
+/* Return true if the number of entries or the number of bytes applied since
+ * the last snapshot is at least @factor times the configured thresholds. */
+static bool snapshotThresholdReached(struct raft *r, unsigned factor)
+{
+    raft_index n = r->last_applied - r->log.snapshot.last_index;
+
+    if (n >= (raft_index)r->snapshot.threshold * factor) {
+        return true;
+    }
+
+    if (r->snapshot.threshold_bytes > 0 &&
+        r->snapshot.bytes >= r->snapshot.threshold_bytes * factor) {
+        return true;
+    }
+
+    return false;
+}
+
 static bool shouldTakeSnapshot(struct raft *r)
 {
+    raft_time elapsed;
+
     /* If we are shutting down, let's not do anything. */
     if (r->state == RAFT_UNAVAILABLE) {
         return false;
@@ -1386,20 +1935,76 @@ static bool shouldTakeSnapshot(struct raft *r)
     };
 
     /* If we didn't reach the threshold yet, do nothing. */
-    if (r->last_applied - r->log.snapshot.last_index < r->snapshot.threshold) {
+    if (!snapshotThresholdReached(r, 1)) {
+        return false;
+    }
+
+    if (!r->snapshot.adaptive) {
+        return true;
+    }
+
+    /* With the adaptive policy, bound the amount of replay work and memory
+     * needed for the log by taking a snapshot anyway if it grew past twice the
+     * thresholds, or if the entries held in memory did. */
+    if (snapshotThresholdReached(r, 2)) {
+        return true;
+    }
+    if (r->snapshot.threshold_bytes > 0 &&
+        logNumBytes(&r->log) >= r->snapshot.threshold_bytes * 2) {
+        return true;
+    }
+
+    /* Otherwise, amortize the cost of the last snapshot. */
+    elapsed = r->io->time(r->io) - r->snapshot.finished;
+    if (elapsed < r->snapshot.cost * SNAPSHOT_ADAPTIVE_COST_RATIO) {
+        tracef("postpone snapshot: last took %llu msecs", r->snapshot.cost);
         return false;
     }
 
     return true;
 }
 
+/* Return the number of entries to retain in the log after taking a snapshot
+ * whose last index is @index.
+ *
+ * With the adaptive policy and a bytes threshold, the configured number of
+ * trailing entries is reduced if their total size would exceed the bytes
+ * threshold, since a follower lagging behind by that much data is probably
+ * better served by a snapshot. */
+static unsigned snapshotTrailing(struct raft *r, raft_index index)
+{
+    const struct raft_entry *entry;
+    size_t bytes = 0;
+    unsigned n;
+
+    if (!r->snapshot.adaptive || r->snapshot.threshold_bytes == 0) {
+        return r->snapshot.trailing;
+    }
+
+    for (n = 0; n < r->snapshot.trailing && n < index; n++) {
+        entry = logGet(&r->log, index - n);
+        if (entry == NULL) {
+            break;
+        }
+        bytes += entry->buf.len;
+        if (bytes > r->snapshot.threshold_bytes) {
+            break;
+        }
+    }
+
+    return n;
+}
+
 static void takeSnapshotCb(struct raft_io_snapshot_put *req, int status)
 {
     struct raft *r = req->data;
     struct raft_snapshot *snapshot;
+    raft_time now;
 
     r->snapshot.put.data = NULL;
     snapshot = &r->snapshot.pending;
+    Trace(r, TRACE_SNAPSHOT, snapshot->index, snapshot->term, (unsigned)status,
+          0);
 
     if (status != 0) {
         tracef("snapshot %lld at term %lld: %s", snapshot->index,
@@ -1407,7 +2012,18 @@ static void takeSnapshotCb(struct raft_io_snapshot_put *req, int status)
         goto out;
     }
 
-    logSnapshot(&r->log, snapshot->index, r->snapshot.trailing);
+    now = r->io->time(r->io);
+    r->snapshot.cost = now - r->snapshot.started;
+    r->snapshot.finished = now;
+    r->metrics.snapshots_taken++;
+
+    /* Discount the entries included in this snapshot from the number of bytes
+     * applied since the last one. No snapshot can be installed while this one
+     * is pending, so the counter hasn't been reset in the meantime. */
+    assert(r->snapshot.bytes >= r->snapshot.pending_bytes);
+    r->snapshot.bytes -= r->snapshot.pending_bytes;
+
+    logSnapshot(&r->log, snapshot->index, snapshotTrailing(r, snapshot->index));
 
 out:
     snapshotClose(&r->snapshot.pending);
@@ -1425,6 +2041,8 @@ static int takeSnapshot(struct raft *r)
     snapshot = &r->snapshot.pending;
     snapshot->index = r->last_applied;
     snapshot->term = logTermOf(&r->log, r->last_applied);
+    r->snapshot.started = r->io->time(r->io);
+    r->snapshot.pending_bytes = r->snapshot.bytes;
 
     rv = configurationCopy(&r->configuration, &snapshot->configuration);
     if (rv != 0) {
@@ -1444,8 +2062,8 @@ static int takeSnapshot(struct raft *r)
 
     assert(r->snapshot.put.data == NULL);
     r->snapshot.put.data = r;
-    rv = r->io->snapshot_put(r->io, r->snapshot.trailing, &r->snapshot.put,
-                             snapshot, takeSnapshotCb);
+    rv = r->io->snapshot_put(r->io, snapshotTrailing(r, snapshot->index),
+                             &r->snapshot.put, snapshot, takeSnapshotCb);
     if (rv != 0) {
         goto abort_after_fsm_snapshot;
     }
@@ -1479,6 +2097,7 @@ int replicationApply(struct raft *r)
 
     for (index = r->last_applied + 1; index <= r->commit_index; index++) {
         const struct raft_entry *entry = logGet(&r->log, index);
+        size_t len = entry->buf.len;
 
         assert(entry->type == RAFT_COMMAND || entry->type == RAFT_BARRIER ||
                entry->type == RAFT_CHANGE);
@@ -1505,8 +2124,13 @@ int replicationApply(struct raft *r)
         }
 
         r->last_applied = index;
+        r->snapshot.bytes += len;
+        r->metrics.entries_applied++;
+        r->metrics.bytes_applied += len;
     }
 
+    Trace(r, TRACE_APPLY, r->last_applied, 0, 0, 0);
+
     if (shouldTakeSnapshot(r)) {
         rv = takeSnapshot(r);
     }
@@ -1544,8 +2168,10 @@ void replicationQuorum(struct raft *r, const raft_index index)
     }
 
     if (votes > configurationVoterCount(&r->configuration) / 2) {
+        stampApplyRequests(r, r->commit_index + 1, index, STAGE_COMMITTED);
         r->commit_index = index;
         tracef("new commit index %llu", r->commit_index);
+        Trace(r, TRACE_COMMIT, r->commit_index, 0, 0, 0);
     }
 
     return;
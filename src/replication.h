@@ -5,10 +5,40 @@
 
 #include "../include/raft.h"
 
+/* While the cluster is quiescent, the leader sends keepalive heartbeats and
+ * checks that it reaches a majority of the cluster this many times less often
+ * than usual, and followers wait this many election timeouts before assuming
+ * that the leader has failed. */
+#define REPLICATION__QUIESCENT_FACTOR 10
+
 /* Send AppendEntries RPC messages to all followers to which no AppendEntries
  * was sent in the last heartbeat interval. */
 int replicationHeartbeat(struct raft *r);
 
+/* If quiescence is enabled and the cluster is idle, enter quiescent state and
+ * send all followers a last round of heartbeats telling them to lengthen their
+ * election timers. Return true if the leader is now quiescent.
+ *
+ * The cluster is idle if all entries in our log are committed and applied, all
+ * followers have acknowledged them and we heard from them recently, and no
+ * membership change or leadership transfer is in progress.
+ *
+ * It must be called only by leaders. */
+bool replicationQuiesce(struct raft *r);
+
+/* Leave quiescent state, if we are in it, so that heartbeats are sent again
+ * starting from the next tick.
+ *
+ * It must be called only by leaders. */
+void replicationUnquiesce(struct raft *r);
+
+/* Send a keepalive heartbeat to all followers of a quiescent leader to which no
+ * AppendEntries was sent in the last quiescent heartbeat interval, so they know
+ * that the leader is still alive.
+ *
+ * It must be called only by quiescent leaders. */
+void replicationKeepalive(struct raft *r);
+
 /* Start a local disk write for entries from the given index onwards, and
  * trigger replication against all followers, typically sending AppendEntries
  * RPC messages with outstanding log entries. */
@@ -76,6 +106,21 @@ int replicationInstallSnapshot(struct raft *r,
                                raft_index *rejected,
                                bool *async);
 
+/* Send our latest snapshot to the server requested by the leader with the
+ * given DelegateSnapshot RPC.
+ *
+ * If we don't have any snapshot or we don't know about the requested server,
+ * this is a no-op and the leader will eventually fall back to send the snapshot
+ * itself.
+ *
+ * It must be called only by followers. */
+int replicationDelegateSnapshot(struct raft *r,
+                                const struct raft_delegate_snapshot *args);
+
+/* Return the size of the snapshots that are being taken, installed or sent by
+ * this server. */
+size_t replicationSnapshotBytes(struct raft *r);
+
 /* Apply any committed entry that was not applied yet.
  *
  * It must be called by leaders or followers. */
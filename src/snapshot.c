@@ -52,6 +52,7 @@ int snapshotRestore(struct raft *r, struct raft_snapshot *snapshot)
     r->commit_index = snapshot->index;
     r->last_applied = snapshot->index;
     r->last_stored = snapshot->index;
+    r->snapshot.bytes = 0;
 
     /* Don't free the snapshot data buffer, as ownership has been transferred to
      * the fsm. */
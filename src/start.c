@@ -177,6 +177,7 @@ int raft_start(struct raft *r)
          * the first entry to be the same on all servers. */
         r->commit_index = 1;
         r->last_applied = 1;
+        r->snapshot.bytes = entries[0].buf.len;
     }
 
     /* Append the entries to the log, possibly restoring the last
@@ -32,6 +32,20 @@ static int tickFollower(struct raft *r)
         return 0;
     }
 
+    /* If the leader told us that the cluster is idle, it only sends us a
+     * keepalive heartbeat once in a while, so wait for a much longer election
+     * timeout before assuming that it has failed. */
+    if (r->follower_state.quiescent) {
+        raft_time now = r->io->time(r->io);
+        if (now - r->election_timer_start <
+            REPLICATION__QUIESCENT_FACTOR *
+                r->follower_state.randomized_election_timeout) {
+            return 0;
+        }
+        tracef("no keepalive from quiescent leader -> resume election timer");
+        r->follower_state.quiescent = false;
+    }
+
     /* Check if we need to start an election.
      *
      * From Section 3.3:
@@ -112,6 +126,23 @@ static int tickLeader(struct raft *r)
     raft_time now = r->io->time(r->io);
     assert(r->state == RAFT_LEADER);
 
+    /* While the cluster is idle, followers wait for a much longer election
+     * timeout, so just send them keepalive heartbeats and check that we still
+     * reach a majority of the cluster at a slower pace. */
+    if (r->leader_state.quiescent) {
+        if (now - r->election_timer_start >=
+            REPLICATION__QUIESCENT_FACTOR * r->election_timeout) {
+            if (!checkContactQuorum(r)) {
+                tracef("unable to contact majority of cluster -> step down");
+                convertToFollower(r);
+                return 0;
+            }
+            r->election_timer_start = now;
+        }
+        replicationKeepalive(r);
+        return 0;
+    }
+
     /* Check if we still can reach a majority of servers.
      *
      * From Section 6.2:
@@ -135,7 +166,13 @@ static int tickLeader(struct raft *r)
      *
      *   Send empty AppendEntries RPC during idle periods to prevent election
      *   timeouts.
+     *
+     * Unless the cluster is idle and quiescence is enabled, in which case we
+     * send a last round of heartbeats and then stop.
      */
+    if (replicationQuiesce(r)) {
+        return 0;
+    }
     replicationHeartbeat(r);
 
     /* If a server is being promoted, increment the timer of the current
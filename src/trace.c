@@ -0,0 +1,246 @@
+#include "trace.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "assert.h"
+
+/* Each record is written by the thread running the raft instance, and can be
+ * read concurrently by other threads, using the sequence number of the record
+ * as a sequence lock:
+ *
+ * - The writer first invalidates the record by zeroing its sequence number,
+ *   then fills the other fields and finally stores the new sequence number of
+ *   the record and the head of the ring, with release semantics.
+ *
+ * - A reader loads the sequence number with acquire semantics, copies the
+ *   record, and loads the sequence number again. The copy is valid only if
+ *   both loads returned the sequence number that the record is expected to
+ *   have, given its position in the ring. */
+
+/* Type of a field of a traced event, for decoding. */
+enum { TRACE_U64 = 1, TRACE_BOOL, TRACE_ROLE, TRACE_STATUS };
+
+struct traceField
+{
+    const char *name;
+    int type;
+};
+
+struct traceEvent
+{
+    const char *name;
+    struct traceField fields[RAFT_TRACE_FIELDS];
+};
+
+/* Description of the traced events, indexed by event ID. */
+static const struct traceEvent traceEvents[TRACE_N_EVENTS] = {
+    [TRACE_STATE] = {"state", {{"state", TRACE_ROLE}, {"term", TRACE_U64}}},
+    [TRACE_ELECTION] = {"election",
+                        {{"term", TRACE_U64},
+                         {"last_index", TRACE_U64},
+                         {"last_term", TRACE_U64},
+                         {"pre_vote", TRACE_BOOL}}},
+    [TRACE_VOTE] = {"vote",
+                    {{"candidate", TRACE_U64},
+                     {"term", TRACE_U64},
+                     {"granted", TRACE_BOOL}}},
+    [TRACE_APPEND] = {"append", {{"index", TRACE_U64}, {"n", TRACE_U64}}},
+    [TRACE_APPEND_DONE] = {"append_done",
+                           {{"index", TRACE_U64},
+                            {"n", TRACE_U64},
+                            {"status", TRACE_STATUS}}},
+    [TRACE_RECV_APPEND] = {"recv_append",
+                           {{"leader", TRACE_U64},
+                            {"term", TRACE_U64},
+                            {"prev_index", TRACE_U64},
+                            {"n", TRACE_U64}}},
+    [TRACE_RECV_RESULT] = {"recv_result",
+                           {{"server", TRACE_U64},
+                            {"rejected", TRACE_U64},
+                            {"last_index", TRACE_U64}}},
+    [TRACE_COMMIT] = {"commit", {{"index", TRACE_U64}}},
+    [TRACE_APPLY] = {"apply", {{"index", TRACE_U64}}},
+    [TRACE_SNAPSHOT] = {"snapshot",
+                        {{"index", TRACE_U64},
+                         {"term", TRACE_U64},
+                         {"status", TRACE_STATUS}}},
+    [TRACE_INSTALL] = {"install",
+                       {{"index", TRACE_U64},
+                        {"term", TRACE_U64},
+                        {"status", TRACE_STATUS}}},
+    [TRACE_TRUNCATE] = {"truncate", {{"index", TRACE_U64}}},
+};
+
+static const char *traceRoles[] = {"unavailable", "follower", "candidate",
+                                   "leader"};
+
+/* Return the record of the ring that holds the given sequence number. */
+static struct raft_trace_record *traceRecord(struct raft_trace_ring *ring,
+                                             uint64_t seq)
+{
+    struct raft_trace_record *records = (void *)(ring + 1);
+    return &records[seq & (ring->capacity - 1)];
+}
+
+static const struct raft_trace_record *traceRecordConst(
+    const struct raft_trace_ring *ring,
+    uint64_t seq)
+{
+    const struct raft_trace_record *records = (const void *)(ring + 1);
+    return &records[seq & (ring->capacity - 1)];
+}
+
+size_t raft_trace_ring_size(unsigned capacity)
+{
+    return sizeof(struct raft_trace_ring) +
+           capacity * sizeof(struct raft_trace_record);
+}
+
+int raft_trace_ring_init(struct raft_trace_ring *ring, unsigned capacity)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return RAFT_INVALID;
+    }
+    memset(ring, 0, raft_trace_ring_size(capacity));
+    ring->magic = RAFT_TRACE_RING_MAGIC;
+    ring->version = RAFT_TRACE_RING_VERSION;
+    ring->capacity = capacity;
+    return 0;
+}
+
+void raft_set_trace_ring(struct raft *r, struct raft_trace_ring *ring)
+{
+    if (ring != NULL) {
+        assert(ring->magic == RAFT_TRACE_RING_MAGIC);
+        ring->id = r->id;
+    }
+    r->trace_ring = ring;
+}
+
+void TraceRecord(struct raft *r,
+                 unsigned event,
+                 uint64_t a,
+                 uint64_t b,
+                 uint64_t c,
+                 uint64_t d)
+{
+    struct raft_trace_ring *ring = r->trace_ring;
+    struct raft_trace_record *record;
+    uint64_t seq = ring->head + 1;
+
+    assert(event > 0 && event < TRACE_N_EVENTS);
+
+    record = traceRecord(ring, seq);
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->time = r->io->time(r->io);
+    record->event = event;
+    record->reserved = 0;
+    record->fields[0] = a;
+    record->fields[1] = b;
+    record->fields[2] = c;
+    record->fields[3] = d;
+    __atomic_store_n(&record->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, seq, __ATOMIC_RELEASE);
+}
+
+/* Copy the record that should have the given sequence number, returning false
+ * if it has been overwritten or is being written. */
+static bool traceRead(const struct raft_trace_ring *ring,
+                      uint64_t seq,
+                      struct raft_trace_record *copy)
+{
+    const struct raft_trace_record *record = traceRecordConst(ring, seq);
+    if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != seq) {
+        return false;
+    }
+    memcpy(copy, record, sizeof *copy);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&record->seq, __ATOMIC_RELAXED) == seq &&
+           copy->seq == seq;
+}
+
+static void traceDecodeRecord(const struct raft_trace_ring *ring,
+                              const struct raft_trace_record *record,
+                              FILE *f)
+{
+    const struct traceEvent *event = NULL;
+    unsigned i;
+
+    if (record->event > 0 && record->event < TRACE_N_EVENTS) {
+        event = &traceEvents[record->event];
+    }
+
+    fprintf(f, "%" PRIu64 " %" PRIu64 " %" PRIu64 " ", record->seq,
+            record->time, ring->id);
+    if (event == NULL) {
+        /* An event added by a newer version, print the raw fields. */
+        fprintf(f, "event%" PRIu32, record->event);
+        for (i = 0; i < RAFT_TRACE_FIELDS; i++) {
+            fprintf(f, " %" PRIu64, record->fields[i]);
+        }
+        fprintf(f, "\n");
+        return;
+    }
+
+    fprintf(f, "%s", event->name);
+    for (i = 0; i < RAFT_TRACE_FIELDS; i++) {
+        const struct traceField *field = &event->fields[i];
+        uint64_t value = record->fields[i];
+        if (field->name == NULL) {
+            break;
+        }
+        fprintf(f, " %s=", field->name);
+        switch (field->type) {
+            case TRACE_BOOL:
+                fprintf(f, "%s", value != 0 ? "true" : "false");
+                break;
+            case TRACE_ROLE:
+                if (value < sizeof traceRoles / sizeof *traceRoles) {
+                    fprintf(f, "%s", traceRoles[value]);
+                } else {
+                    fprintf(f, "%" PRIu64, value);
+                }
+                break;
+            case TRACE_STATUS:
+                if (value == 0) {
+                    fprintf(f, "ok");
+                } else {
+                    fprintf(f, "\"%s\"", raft_strerror((int)value));
+                }
+                break;
+            default:
+                fprintf(f, "%" PRIu64, value);
+                break;
+        }
+    }
+    fprintf(f, "\n");
+}
+
+int raft_trace_ring_decode(const struct raft_trace_ring *ring,
+                           size_t size,
+                           FILE *f)
+{
+    struct raft_trace_record record;
+    uint64_t head;
+    uint64_t seq;
+
+    if (size < sizeof *ring || ring->magic != RAFT_TRACE_RING_MAGIC ||
+        ring->version != RAFT_TRACE_RING_VERSION || ring->capacity == 0 ||
+        (ring->capacity & (ring->capacity - 1)) != 0 ||
+        size < raft_trace_ring_size(ring->capacity)) {
+        return RAFT_MALFORMED;
+    }
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    seq = head > ring->capacity ? head - ring->capacity + 1 : 1;
+    for (; seq <= head; seq++) {
+        if (!traceRead(ring, seq, &record)) {
+            continue;
+        }
+        traceDecodeRecord(ring, &record, f);
+    }
+
+    return 0;
+}
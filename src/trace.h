@@ -0,0 +1,46 @@
+/* Structured binary tracing into a trace ring. */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "../include/raft.h"
+
+/* IDs of the traced events. They are part of the format of trace rings, so
+ * existing IDs must never change: new events must be added at the end, and
+ * described in the table of trace.c. */
+enum {
+    TRACE_STATE = 1,   /* New state: state, term */
+    TRACE_ELECTION,    /* Election started: term, last_index, last_term, pre */
+    TRACE_VOTE,        /* Vote requested: candidate, term, granted */
+    TRACE_APPEND,      /* Entries submitted to disk: index, n */
+    TRACE_APPEND_DONE, /* Entries written to disk: index, n, status */
+    TRACE_RECV_APPEND, /* AppendEntries received: leader, term, prev, n */
+    TRACE_RECV_RESULT, /* AppendEntries result received: server, reject, last */
+    TRACE_COMMIT,      /* Commit index advanced: index */
+    TRACE_APPLY,       /* Entries applied: index */
+    TRACE_SNAPSHOT,    /* Snapshot taken: index, term, status */
+    TRACE_INSTALL,     /* Snapshot installed: index, term, status */
+    TRACE_TRUNCATE,    /* Log truncated: index */
+    TRACE_N_EVENTS
+};
+
+/* Record an event with the given fields into the trace ring of @r. Use the
+ * Trace() macro instead, which skips the call when no ring is set. */
+void TraceRecord(struct raft *r,
+                 unsigned event,
+                 uint64_t a,
+                 uint64_t b,
+                 uint64_t c,
+                 uint64_t d);
+
+/* Record an event with up to four fields, passing 0 for unused ones. The
+ * fields are not evaluated at all if @R has no trace ring. */
+#define Trace(R, EVENT, A, B, C, D)                                     \
+    do {                                                                \
+        if ((R)->trace_ring != NULL) {                                  \
+            TraceRecord(R, EVENT, (uint64_t)(A), (uint64_t)(B),         \
+                        (uint64_t)(C), (uint64_t)(D));                  \
+        }                                                               \
+    } while (0)
+
+#endif /* TRACE_H_ */
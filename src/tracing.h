@@ -8,12 +8,15 @@
 /* Default no-op tracer. */
 extern struct raft_tracer NoopTracer;
 
-/* Emit a debug message with the given tracer. */
-#define Tracef(TRACER, ...)                             \
-    do {                                                \
-        char _msg[1024];                                \
-        snprintf(_msg, sizeof _msg, __VA_ARGS__);       \
-        TRACER->emit(TRACER, __FILE__, __LINE__, _msg); \
+/* Emit a debug message with the given tracer. The message is not formatted at
+ * all if the tracer is the default no-op one. */
+#define Tracef(TRACER, ...)                                 \
+    do {                                                    \
+        if (TRACER != &NoopTracer) {                        \
+            char _msg[1024];                                \
+            snprintf(_msg, sizeof _msg, __VA_ARGS__);       \
+            TRACER->emit(TRACER, __FILE__, __LINE__, _msg); \
+        }                                                   \
     } while (0)
 
 #endif /* TRACING_H_ */
@@ -37,6 +37,7 @@ static int uvInit(struct raft_io *io, raft_id id, const char *address)
     struct uv *uv;
     size_t direct_io;
     struct uvMetadata metadata;
+    uint64_t start;
     int rv;
     uv = io->impl;
     uv->id = id;
@@ -54,11 +55,26 @@ static int uvInit(struct raft_io *io, raft_id id, const char *address)
     uv->direct_io = direct_io != 0;
     uv->block_size = direct_io != 0 ? direct_io : 4096;
 
+    start = uv_hrtime();
     rv = uvMetadataLoad(uv->dir, &metadata, io->errmsg);
     if (rv != 0) {
         return rv;
     }
     uv->metadata = metadata;
+    uv->metrics.load.metadata = uv_hrtime() - start;
+
+    /* Hosted instances use the transport and the timer of their host, which
+     * identifies them towards other hosts. */
+    if (uv->group != 0) {
+        if (id != uv->host->carrier->id) {
+            ErrMsgPrintf(io->errmsg,
+                         "server ID %llu doesn't match host ID %llu",
+                         (unsigned long long)id,
+                         (unsigned long long)uv->host->carrier->id);
+            return RAFT_INVALID;
+        }
+        return 0;
+    }
 
     rv = uv->transport->init(uv->transport, id, address);
     if (rv != 0) {
@@ -96,6 +112,10 @@ static int uvStart(struct raft_io *io,
     uv->state = UV__ACTIVE;
     uv->tick_cb = tick_cb;
     uv->recv_cb = recv_cb;
+    if (uv->group != 0) {
+        UvHostStart(uv->host, uv, msecs);
+        return 0;
+    }
     rv = UvRecvStart(uv);
     if (rv != 0) {
         return rv;
@@ -111,7 +131,10 @@ void uvMaybeFireCloseCb(struct uv *uv)
         return;
     }
 
-    if (uv->transport->data != NULL) {
+    if (uv->transport != NULL && uv->transport->data != NULL) {
+        return;
+    }
+    if (uv->n_sends > 0) {
         return;
     }
     if (uv->timer.data != NULL) {
@@ -176,7 +199,8 @@ static void uvClose(struct raft_io *io, raft_io_close_cb cb)
     UvSendClose(uv);
     UvRecvClose(uv);
     uvAppendClose(uv);
-    if (uv->transport->data != NULL) {
+    UvBatchClose(uv);
+    if (uv->transport != NULL && uv->transport->data != NULL) {
         uv->transport->close(uv->transport, uvTransportCloseCb);
     }
     if (uv->timer.data != NULL) {
@@ -294,6 +318,7 @@ static int uvLoadSnapshotAndEntries(struct uv *uv,
     struct uvSegmentInfo *segments;
     size_t n_snapshots;
     size_t n_segments;
+    uint64_t start;
     int rv;
 
     *snapshot = NULL;
@@ -302,15 +327,18 @@ static int uvLoadSnapshotAndEntries(struct uv *uv,
     *n = 0;
 
     /* List available snapshots and segments. */
+    start = uv_hrtime();
     rv = UvList(uv, &snapshots, &n_snapshots, &segments, &n_segments,
                 uv->io->errmsg);
     if (rv != 0) {
         goto err;
     }
+    uv->metrics.load.list = uv_hrtime() - start;
 
     /* Load the most recent snapshot, if any. */
     if (snapshots != NULL) {
         char snapshot_filename[UV__FILENAME_LEN];
+        start = uv_hrtime();
         *snapshot = HeapMalloc(sizeof **snapshot);
         if (*snapshot == NULL) {
             rv = RAFT_NOMEM;
@@ -323,6 +351,7 @@ static int uvLoadSnapshotAndEntries(struct uv *uv,
             *snapshot = NULL;
             goto err;
         }
+        uv->metrics.load.snapshot = uv_hrtime() - start;
         uvSnapshotFilenameOf(&snapshots[n_snapshots - 1], snapshot_filename);
         tracef("most recent snapshot at %lld", (*snapshot)->index);
         HeapFree(snapshots);
@@ -351,11 +380,13 @@ static int uvLoadSnapshotAndEntries(struct uv *uv,
     /* Read data from segments, closing any open segments. */
     if (segments != NULL) {
         raft_index last_index;
+        start = uv_hrtime();
         rv = uvSegmentLoadAll(uv, *start_index, segments, n_segments, entries,
                               n);
         if (rv != 0) {
             goto err;
         }
+        uv->metrics.load.segments = uv_hrtime() - start;
 
         /* Check if all entries that we loaded are actually behind the last
          * snapshot. This can happen if the last closed segment was behind the
@@ -408,6 +439,7 @@ static int uvLoad(struct raft_io *io,
 {
     struct uv *uv;
     raft_index last_index;
+    uint64_t start;
     int rv;
     uv = io->impl;
 
@@ -415,11 +447,13 @@ static int uvLoad(struct raft_io *io,
     *voted_for = uv->metadata.voted_for;
     *snapshot = NULL;
 
+    start = uv_hrtime();
     rv =
         uvLoadSnapshotAndEntries(uv, snapshot, start_index, entries, n_entries);
     if (rv != 0) {
         return rv;
     }
+    uv->metrics.load.total = uv->metrics.load.metadata + uv_hrtime() - start;
     tracef("start index %lld, %zu entries", *start_index, *n_entries);
     if (*snapshot == NULL) {
         tracef("no snapshot");
@@ -539,6 +573,13 @@ static raft_time uvTime(struct raft_io *io)
     return uv_now(uv->loop);
 }
 
+/* Implementation of raft_io->time_us. */
+static uint64_t uvTimeUs(struct raft_io *io)
+{
+    (void)io;
+    return uv_hrtime() / 1000;
+}
+
 /* Implementation of raft_io->random. */
 static int uvRandom(struct raft_io *io, int min, int max)
 {
@@ -546,20 +587,17 @@ static int uvRandom(struct raft_io *io, int min, int max)
     return min + (abs(rand()) % (max - min));
 }
 
-int raft_uv_init(struct raft_io *io,
-                 struct uv_loop_s *loop,
-                 const char *dir,
-                 struct raft_uv_transport *transport)
+/* Allocate and initialize the implementation object of the given raft_io
+ * instance, which uses @transport if it's not NULL. */
+static int uvSetUp(struct raft_io *io,
+                   struct uv_loop_s *loop,
+                   const char *dir,
+                   struct raft_uv_transport *transport)
 {
     struct uv *uv;
     void *data;
     int rv;
 
-    assert(io != NULL);
-    assert(loop != NULL);
-    assert(dir != NULL);
-    assert(transport != NULL);
-
     data = io->data;
     memset(io, 0, sizeof *io);
     io->data = data;
@@ -582,9 +620,13 @@ int raft_uv_init(struct raft_io *io,
     uv->loop = loop;
     strcpy(uv->dir, dir);
     uv->transport = transport;
-    uv->transport->data = NULL;
+    if (transport != NULL) {
+        uv->transport->data = NULL;
+    }
     uv->tracer = &NoopTracer;
     uv->id = 0; /* Set by raft_io->config() */
+    uv->host = NULL;
+    uv->group = 0;
     uv->state = UV__PRISTINE;
     uv->errored = false;
     uv->direct_io = false;
@@ -593,6 +635,17 @@ int raft_uv_init(struct raft_io *io,
     uv->block_size = 0;
     QUEUE_INIT(&uv->clients);
     QUEUE_INIT(&uv->servers);
+    QUEUE_INIT(&uv->batches);
+    uv->recv_batch = NULL;
+    uv->wire_checksums = false;
+    uv->channels = false;
+    uv->compact = false;
+    uv->compression = false;
+    uv->compression_threshold = 0;
+    uv->send_max_messages = UV__SEND_MAX_MESSAGES;
+    uv->send_max_bytes = UV__SEND_MAX_BYTES;
+    uv->send_max_pending = UV__SEND_MAX_PENDING;
+    uv->n_backlogged = 0;
     uv->connect_retry_delay = CONNECT_RETRY_DELAY;
     uv->prepare_inflight = NULL;
     QUEUE_INIT(&uv->prepare_reqs);
@@ -608,15 +661,20 @@ int raft_uv_init(struct raft_io *io,
     uv->truncate_work.data = NULL;
     QUEUE_INIT(&uv->snapshot_get_reqs);
     uv->snapshot_put_work.data = NULL;
+    uv->n_sends = 0;
+    uv->send_bytes = 0;
     uv->timer.data = NULL;
+    uv->tick_msecs = 0;
+    uv->tick_last = 0;
     uv->tick_cb = NULL; /* Set by raft_io->start() */
     uv->recv_cb = NULL; /* Set by raft_io->start() */
     QUEUE_INIT(&uv->aborting);
     uv->closing = false;
     uv->close_cb = NULL;
+    memset(&uv->metrics, 0, sizeof uv->metrics);
 
     /* Set the raft_io implementation. */
-    io->version = 1; /* future-proof'ing */
+    io->version = 3; /* future-proof'ing */
     io->impl = uv;
     io->init = uvInit;
     io->close = uvClose;
@@ -633,6 +691,8 @@ int raft_uv_init(struct raft_io *io,
     io->snapshot_get = UvSnapshotGet;
     io->time = uvTime;
     io->random = uvRandom;
+    io->send_backlogged = UvSendBacklogged;
+    io->time_us = uvTimeUs;
 
     return 0;
 
@@ -644,10 +704,70 @@ err:
     return rv;
 }
 
+int raft_uv_init(struct raft_io *io,
+                 struct uv_loop_s *loop,
+                 const char *dir,
+                 struct raft_uv_transport *transport)
+{
+    assert(io != NULL);
+    assert(loop != NULL);
+    assert(dir != NULL);
+    assert(transport != NULL);
+    return uvSetUp(io, loop, dir, transport);
+}
+
+int raft_uv_init_group(struct raft_io *io,
+                       struct raft_uv_host *host,
+                       const char *dir,
+                       uint64_t group)
+{
+    struct uvHost *h;
+    struct uv *uv;
+    int rv;
+
+    assert(io != NULL);
+    assert(host != NULL);
+    assert(dir != NULL);
+
+    h = host->impl;
+    assert(!h->closing);
+
+    if (group == 0) {
+        ErrMsgPrintf(io->errmsg, "group ID must not be zero");
+        return RAFT_INVALID;
+    }
+
+    rv = uvSetUp(io, h->carrier->loop, dir, NULL);
+    if (rv != 0) {
+        return rv;
+    }
+    uv = io->impl;
+    uv->host = h;
+    uv->group = group;
+
+    rv = UvHostAdd(h, uv);
+    if (rv != 0) {
+        if (rv == RAFT_DUPLICATEID) {
+            ErrMsgPrintf(io->errmsg, "group %llu already exists",
+                         (unsigned long long)group);
+        } else {
+            ErrMsgOom(io->errmsg);
+        }
+        raft_free(uv);
+        io->impl = NULL;
+        return rv;
+    }
+
+    return 0;
+}
+
 void raft_uv_close(struct raft_io *io)
 {
     struct uv *uv;
     uv = io->impl;
+    if (uv->group != 0) {
+        UvHostRemove(uv->host, uv);
+    }
     raft_free(uv);
 }
 
@@ -668,10 +788,59 @@ void raft_uv_set_block_size(struct raft_io *io, size_t size)
 void raft_uv_set_connect_retry_delay(struct raft_io *io, unsigned msecs)
 {
     struct uv *uv;
-    uv = io->impl;
+    uv = UvNet(io->impl);
     uv->connect_retry_delay = msecs;
 }
 
+void raft_uv_set_wire_checksums(struct raft_io *io, bool enabled)
+{
+    struct uv *uv;
+    uv = UvNet(io->impl);
+    uv->wire_checksums = enabled;
+}
+
+void raft_uv_set_channels(struct raft_io *io, bool enabled)
+{
+    struct uv *uv;
+    uv = UvNet(io->impl);
+    uv->channels = enabled;
+}
+
+void raft_uv_set_wire_compact(struct raft_io *io, bool enabled)
+{
+    struct uv *uv;
+    uv = UvNet(io->impl);
+    uv->compact = enabled;
+}
+
+int raft_uv_set_wire_compression(struct raft_io *io,
+                                 bool enabled,
+                                 size_t threshold)
+{
+    struct uv *uv;
+    uv = UvNet(io->impl);
+#ifndef LZ4_AVAILABLE
+    if (enabled) {
+        return RAFT_INVALID;
+    }
+#endif
+    uv->compression = enabled;
+    uv->compression_threshold = threshold;
+    return 0;
+}
+
+void raft_uv_set_send_limits(struct raft_io *io,
+                             unsigned max_messages,
+                             size_t max_bytes,
+                             unsigned max_pending)
+{
+    struct uv *uv;
+    uv = UvNet(io->impl);
+    uv->send_max_messages = max_messages;
+    uv->send_max_bytes = max_bytes;
+    uv->send_max_pending = max_pending;
+}
+
 void raft_uv_set_tracer(struct raft_io *io, struct raft_tracer *tracer)
 {
     struct uv *uv;
@@ -679,4 +848,36 @@ void raft_uv_set_tracer(struct raft_io *io, struct raft_tracer *tracer)
     uv->tracer = tracer;
 }
 
+/* Return the number of items in the given queue. */
+static unsigned uvQueueLength(queue *q)
+{
+    queue *head;
+    unsigned n = 0;
+    QUEUE_FOREACH(head, q) { n++; }
+    return n;
+}
+
+void raft_uv_get_metrics(struct raft_io *io, struct raft_uv_metrics *metrics)
+{
+    struct uv *uv;
+    uv = io->impl;
+    *metrics = uv->metrics;
+    metrics->appends_pending = uvQueueLength(&uv->append_pending_reqs);
+    metrics->appends_writing = uvQueueLength(&uv->append_writing_reqs);
+    metrics->prepares_pending = uvQueueLength(&uv->prepare_reqs);
+    metrics->finalizes_pending = uvQueueLength(&uv->finalize_reqs);
+    if (uv->finalize_work.data != NULL) {
+        metrics->finalizes_pending++;
+    }
+}
+
+void raft_uv_get_memory(struct raft_io *io, struct raft_uv_memory *memory)
+{
+    struct uv *uv;
+    uv = io->impl;
+    memory->send_queue = uv->send_bytes;
+    memory->recv_buffers = UvRecvBufferSize(uv);
+    memory->segment_buffers = uvAppendBufferSize(uv);
+}
+
 #undef tracef
@@ -4,6 +4,7 @@
 #define UV_H_
 
 #include "../include/raft.h"
+#include "../include/raft/uv.h"
 #include "err.h"
 #include "queue.h"
 #include "tracing.h"
@@ -13,6 +14,17 @@
 /* 8 Megabytes */
 #define UV__MAX_SEGMENT_SIZE (8 * 1024 * 1024)
 
+/* Default limits of outstanding send requests towards a single server, above
+ * which the server is reported as backlogged. */
+#define UV__SEND_MAX_MESSAGES 1024
+#define UV__SEND_MAX_BYTES (64 * 1024 * 1024)
+#define UV__SEND_MAX_PENDING 3
+
+/* Maximum length of the header of an incoming message, above which the message
+ * is considered malformed. It's enough for the batch header of millions of
+ * entries. */
+#define UV__MAX_HEADER_SIZE (64 * 1024 * 1024)
+
 /* Template string for closed segment filenames: start index (inclusive), end
  * index (inclusive). */
 #define UV__CLOSED_TEMPLATE "%016llu-%016llu"
@@ -49,6 +61,8 @@ struct uvMetadata
     raft_id voted_for;          /* Server ID of last vote, or 0 */
 };
 
+struct uvHost;
+
 /* Hold state of a libuv-based raft_io implementation. */
 struct uv
 {
@@ -58,6 +72,8 @@ struct uv
     struct raft_uv_transport *transport; /* Network transport */
     struct raft_tracer *tracer;          /* Debug tracing */
     raft_id id;                          /* Server ID */
+    struct uvHost *host;                 /* Host sharing our network state */
+    uint64_t group;                      /* Group ID, 0 if not hosted */
     int state;                           /* Current state */
     bool errored;                        /* If a disk I/O error was hit */
     bool direct_io;                      /* Whether direct I/O is supported */
@@ -66,6 +82,17 @@ struct uv
     size_t block_size;                   /* Block size of the data dir */
     queue clients;                       /* Outbound connections */
     queue servers;                       /* Inbound connections */
+    queue batches;                       /* Batches of entries being appended */
+    struct uvBatch *recv_batch;          /* Checksummed batch being received */
+    bool wire_checksums;                 /* Send batch checksums to peers */
+    bool channels;                       /* Connect once per channel */
+    bool compact;                        /* Send compact message headers */
+    bool compression;                    /* Compress message payloads */
+    size_t compression_threshold;        /* Minimum payload size to compress */
+    unsigned send_max_messages;          /* Backlog limit of each server */
+    size_t send_max_bytes;               /* Backlog limit of each server */
+    unsigned send_max_pending;           /* Kept while server is unreachable */
+    unsigned n_backlogged;               /* Clients reaching the limits above */
     unsigned connect_retry_delay;        /* Client connection retry delay */
     void *prepare_inflight;              /* Segment being prepared */
     queue prepare_reqs;                  /* Pending prepare requests. */
@@ -82,12 +109,17 @@ struct uv
     queue snapshot_get_reqs;             /* Inflight get snapshot requests */
     struct uv_work_s snapshot_put_work;  /* Execute snapshot put requests */
     struct uvMetadata metadata;          /* Cache of metadata on disk */
+    unsigned n_sends;                    /* Send requests not completed */
+    size_t send_bytes;                   /* Size of the requests above */
     struct uv_timer_s timer;             /* Timer for periodic ticks */
+    unsigned tick_msecs;                 /* Interval between ticks */
+    uint64_t tick_last;                  /* Time of the last tick, if hosted */
     raft_io_tick_cb tick_cb;             /* Invoked when the timer expires */
     raft_io_recv_cb recv_cb;             /* Invoked when upon RPC messages */
     queue aborting;                      /* Cleanups upon errors or shutdown */
     bool closing;                        /* True if we are closing */
     raft_io_close_cb close_cb;           /* Invoked when finishing closing */
+    struct raft_uv_metrics metrics;      /* Disk I/O metrics */
 };
 
 /* Implementation of raft_io->truncate. */
@@ -102,6 +134,50 @@ int uvMetadataLoad(const char *dir, struct uvMetadata *metadata, char *errmsg);
  * otherwise write metadata2). */
 int uvMetadataStore(struct uv *uv, const struct uvMetadata *metadata);
 
+/* Encoded header of a batch of entries, along with its checksum.
+ *
+ * A batch is created for each append request of new entries, and shared only
+ * with the AppendEntries messages carrying exactly the same entries, i.e.
+ * starting with the same entry data and having the same count. Messages
+ * carrying a suffix, a sub-range or a merge of the entries of one or more
+ * append requests (for example the ones sent to lagging followers) encode a
+ * batch of their own. */
+struct uvBatch
+{
+    unsigned refs;     /* Number of references */
+    unsigned n;        /* Number of entries in the batch */
+    const void *base;  /* Data of the first entry, if shared */
+    uv_buf_t header;   /* Encoded batch header */
+    unsigned crc;      /* Checksum of the batch header */
+    const void *data;  /* Entries data the data checksum refers to, or NULL */
+    unsigned data_crc; /* Checksum of the entries data */
+    queue queue;       /* Link in uv->batches, if shared */
+};
+
+/* Create the batch of the entries of a new append request, along with the
+ * checksum of their data, and share it with the messages that will carry the
+ * same entries, until the last reference to it gets released. */
+int UvBatchCreate(struct uv *uv,
+                  const struct raft_entry entries[],
+                  unsigned n,
+                  struct uvBatch **batch);
+
+/* Get the encoded header of a batch with the given entries, either reusing the
+ * batch of an append request whose first entry has the same data and whose
+ * number of entries is the same, or encoding a new one. The returned object
+ * must be released with UvBatchRelease() when not needed anymore. */
+int UvBatchAcquire(struct uv *uv,
+                   const struct raft_entry entries[],
+                   unsigned n,
+                   struct uvBatch **batch);
+
+/* Release a reference to the given batch, freeing it if it was the last
+ * one. */
+void UvBatchRelease(struct uvBatch *batch);
+
+/* Stop sharing batches. Must be invoked at closing time. */
+void UvBatchClose(struct uv *uv);
+
 /* Metadata about a segment file. */
 struct uvSegmentInfo
 {
@@ -184,10 +260,13 @@ int uvSegmentBufferFormat(struct uvSegmentBuffer *b);
 /* Extend the segment's buffer by encoding the given entries.
  *
  * Previous data in the buffer will be retained, and data for these new entries
- * will be appended. */
+ * will be appended. If @batch is not NULL, it must hold the encoded header of
+ * the given entries, which will be copied instead of being encoded again, and
+ * possibly the checksum of their data. */
 int uvSegmentBufferAppend(struct uvSegmentBuffer *b,
                           const struct raft_entry entries[],
-                          unsigned n_entries);
+                          unsigned n_entries,
+                          const struct uvBatch *batch);
 
 /* After all entries to write have been encoded, finalize the buffer by zeroing
  * the unused memory of the last block. The out parameter will point to the
@@ -348,6 +427,9 @@ void UvUnblock(struct uv *uv);
  * finalized. Must be invoked at closing time. */
 void uvAppendClose(struct uv *uv);
 
+/* Return the memory allocated for the write buffers of open segments. */
+size_t uvAppendBufferSize(struct uv *uv);
+
 /* Submit a request to finalize the open segment with the given counter.
  *
  * Requests are processed one at a time, to avoid ending up closing open segment
@@ -364,17 +446,110 @@ int UvSend(struct raft_io *io,
            const struct raft_message *message,
            raft_io_send_cb cb);
 
+/* Implementation of raft_io->send_backlogged. */
+bool UvSendBacklogged(struct raft_io *io, raft_id id);
+
 /* Stop all clients by closing the outbound stream handles and canceling all
  * pending send requests.  */
 void UvSendClose(struct uv *uv);
 
+/* Update the UV__CAPABILITY_* flags cached by the clients connected to the
+ * server with the given ID. */
+void UvSendSetPeerCapabilities(struct uv *uv,
+                               raft_id id,
+                               uint64_t capabilities);
+
+/* Return the UV__CAPABILITY_* flags that the server with the given ID has
+ * advertised in the messages it sent us. */
+uint64_t UvRecvPeerCapabilities(struct uv *uv, raft_id id);
+
 /* Start receiving messages from new incoming connections. */
 int UvRecvStart(struct uv *uv);
 
+/* Return the memory allocated for reading messages from incoming connections,
+ * including the payloads being received. */
+size_t UvRecvBufferSize(struct uv *uv);
+
 /* Stop all servers by closing the inbound stream handles and aborting all
  * requests being received.  */
 void UvRecvClose(struct uv *uv);
 
 void uvMaybeFireCloseCb(struct uv *uv);
 
+/* State of a host running several raft groups, whose @uv instances share the
+ * event loop, the transport, the connections to other hosts and the tick timer
+ * of the host.
+ *
+ * The network state is held by a carrier instance, which is never started and
+ * is identified by having a host and a group ID of 0. Hosted instances, whose
+ * group ID is not 0, use its clients and servers instead of their own. */
+struct uvHost
+{
+    struct raft_uv_host *host;      /* Public object */
+    struct raft_io io;              /* Carrier instance */
+    struct uv *carrier;             /* Implementation of the carrier */
+    struct uv **groups;             /* Hosted instances, sorted by group ID */
+    unsigned n_groups;              /* Number of hosted instances */
+    unsigned groups_size;           /* Capacity of the groups array */
+    struct uv_timer_s timer;        /* Shared timer for periodic ticks */
+    unsigned tick_msecs;            /* Current period of the timer, or 0 */
+    bool closing;                   /* True after raft_uv_host_close() */
+    raft_uv_host_close_cb close_cb; /* Invoked when finishing closing */
+    bool group_commit;              /* Whether appends share a single flush */
+    queue sync_reqs;                /* Sync requests waiting for a flush */
+    queue sync_inflight;            /* Sync requests being flushed */
+    struct uv_work_s sync_work;     /* Flush the inflight sync requests */
+};
+
+/* Request to make the data written to a file durable as part of the next group
+ * commit of a host. */
+struct uvHostSync;
+
+/* Callback invoked after a sync request has been flushed. */
+typedef void (*uvHostSyncCb)(struct uvHostSync *req, int status);
+
+struct uvHostSync
+{
+    void *data;                        /* User data */
+    uv_file fd;                        /* File whose data must be flushed */
+    uint64_t dev;                      /* Device of the file */
+    bool flushed;                      /* Whether dev was flushed */
+    int status;                        /* Result of the flush */
+    char errmsg[RAFT_ERRMSG_BUF_SIZE]; /* Error of the flush */
+    uvHostSyncCb cb;                   /* Completion callback */
+    queue queue;                       /* Pending or inflight queue */
+};
+
+/* Return the instance whose clients, servers and transport must be used by the
+ * given one: the carrier of its host if it's hosted, or itself. */
+struct uv *UvNet(struct uv *uv);
+
+/* Register a new hosted instance. Return RAFT_DUPLICATEID if the host already
+ * has an instance with the same group ID. */
+int UvHostAdd(struct uvHost *h, struct uv *uv);
+
+/* Unregister a hosted instance. */
+void UvHostRemove(struct uvHost *h, struct uv *uv);
+
+/* Start ticking the given hosted instance every @msecs milliseconds, using the
+ * timer of its host. */
+void UvHostStart(struct uvHost *h, struct uv *uv, unsigned msecs);
+
+/* Return the started and not closing instance of the host that has the given
+ * group ID, or NULL if there's none. */
+struct uv *UvHostGroup(struct uvHost *h, uint64_t group);
+
+/* Return true if the given instance is hosted and its host has group commit
+ * enabled, meaning that its open segments are not opened with O_DSYNC and its
+ * writes must be made durable with UvHostSync(). */
+bool UvHostGroupCommit(struct uv *uv);
+
+/* Arrange for the data written to @fd to be flushed by the next group commit of
+ * the host, along with the data written by its other instances, then invoke
+ * @cb. A group commit starts as soon as the previous one completes. */
+void UvHostSync(struct uvHost *h,
+                struct uvHostSync *req,
+                uv_file fd,
+                uvHostSyncCb cb);
+
 #endif /* UV_H_ */
@@ -1,6 +1,7 @@
 #include "assert.h"
 #include "byte.h"
 #include "heap.h"
+#include "metrics.h"
 #include "queue.h"
 #include "uv.h"
 #include "uv_encoding.h"
@@ -46,6 +47,7 @@ struct uvAliveSegment
     struct uvPrepare prepare;       /* Prepare segment file request */
     struct UvWriter writer;         /* Writer to perform async I/O */
     struct UvWriterReq write;       /* Write request */
+    struct uvHostSync sync;         /* Group commit request, if hosted */
     unsigned long long counter;     /* Open segment counter */
     raft_index first_index;         /* Index of the first entry written */
     raft_index pending_last_index;  /* Index of the last entry written */
@@ -58,6 +60,8 @@ struct uvAliveSegment
     queue queue;                    /* Segment queue */
     struct UvBarrier *barrier;      /* Barrier waiting on this segment */
     bool finalize;                  /* Finalize the segment after writing */
+    uint64_t write_start;           /* Submission time of the write */
+    uint64_t sync_start;            /* Start of the group commit flush */
 };
 
 struct uvAppend
@@ -65,7 +69,9 @@ struct uvAppend
     struct raft_io_append *req;       /* User request */
     const struct raft_entry *entries; /* Entries to write */
     unsigned n;                       /* Number of entries */
+    struct uvBatch *batch;            /* Encoded or received batch */
     struct uvAliveSegment *segment;   /* Segment to write to */
+    uint64_t start;                   /* Submission time, in nanoseconds */
     queue queue;
 };
 
@@ -120,6 +126,13 @@ static void uvAppendFinishRequestsInQueue(struct uv *uv, queue *q, int status)
         append = QUEUE_DATA(head, struct uvAppend, queue);
         QUEUE_REMOVE(head);
         req = append->req;
+        if (status == 0) {
+            metricsRecord(&uv->metrics.append_latency,
+                          (uv_hrtime() - append->start) / 1000);
+        }
+        if (append->batch != NULL) {
+            UvBatchRelease(append->batch);
+        }
         HeapFree(append);
         req->cb(req, status);
     }
@@ -169,7 +182,8 @@ static int uvAliveSegmentEncodeEntriesToWriteBuf(struct uvAliveSegment *segment,
         }
     }
 
-    rv = uvSegmentBufferAppend(&segment->pending, append->entries, append->n);
+    rv = uvSegmentBufferAppend(&segment->pending, append->entries, append->n,
+                               append->batch);
     if (rv != 0) {
         return rv;
     }
@@ -180,12 +194,64 @@ static int uvAliveSegmentEncodeEntriesToWriteBuf(struct uvAliveSegment *segment,
 }
 
 static int uvAppendMaybeStart(struct uv *uv);
+
+/* Fire the callbacks of the requests fulfilled by the last write against the
+ * given segment, once its data is durable, and move on with the next ones. */
+static void uvAliveSegmentWriteFinish(struct uvAliveSegment *s, int status)
+{
+    struct uv *uv = s->uv;
+    int rv;
+
+    /* Fire the callbacks of all requests that were fulfilled with this
+     * write. */
+    uvAppendFinishWritingRequests(uv, status);
+
+    /* During the closing sequence we should have already canceled all pending
+     * request. */
+    if (uv->closing) {
+        assert(QUEUE_IS_EMPTY(&uv->append_pending_reqs));
+        assert(s->finalize);
+        uvAliveSegmentFinalize(s);
+        return;
+    }
+
+    /* Possibly process waiting requests. */
+    if (!QUEUE_IS_EMPTY(&uv->append_pending_reqs)) {
+        rv = uvAppendMaybeStart(uv);
+        if (rv != 0) {
+            uv->errored = true;
+        }
+    } else if (s->finalize) {
+        /* If there are no more append_pending_reqs, this segment
+         * must be finalized here in case we don't receive AppendEntries
+         * RPCs anymore (could happen during a Snapshot install, causing
+         * the BarrierCb to never fire) */
+        uvAliveSegmentFinalize(s);
+    }
+}
+
+static void uvAliveSegmentSyncCb(struct uvHostSync *sync, int status)
+{
+    struct uvAliveSegment *s = sync->data;
+    struct uv *uv = s->uv;
+
+    if (status != 0) {
+        ErrMsgTransfer(sync->errmsg, uv->io->errmsg, "group commit");
+        Tracef(uv->tracer, "sync: %s", uv->io->errmsg);
+        uv->errored = true;
+    } else {
+        metricsRecord(&uv->metrics.fsync_latency,
+                      (uv_hrtime() - s->sync_start) / 1000);
+    }
+
+    uvAliveSegmentWriteFinish(s, status);
+}
+
 static void uvAliveSegmentWriteCb(struct UvWriterReq *write, const int status)
 {
     struct uvAliveSegment *s = write->data;
     struct uv *uv = s->uv;
     unsigned n_blocks;
-    int rv;
 
     assert(uv->state != UV__CLOSED);
 
@@ -201,6 +267,10 @@ static void uvAliveSegmentWriteCb(struct UvWriterReq *write, const int status)
 
     s->written = s->next_block * uv->block_size + s->pending.n;
     s->last_index = s->pending_last_index;
+    uv->metrics.writes++;
+    uv->metrics.bytes_written += s->buf.len;
+    metricsRecord(&uv->metrics.write_latency,
+                  (uv_hrtime() - s->write_start) / 1000);
 
     /* Update our write markers.
      *
@@ -250,33 +320,16 @@ static void uvAliveSegmentWriteCb(struct UvWriterReq *write, const int status)
         }
     }
 
-out:
-    /* Fire the callbacks of all requests that were fulfilled with this
-     * write. */
-    uvAppendFinishWritingRequests(uv, status);
-
-    /* During the closing sequence we should have already canceled all pending
-     * request. */
-    if (uv->closing) {
-        assert(QUEUE_IS_EMPTY(&uv->append_pending_reqs));
-        assert(s->finalize);
-        uvAliveSegmentFinalize(s);
+    /* The segment was not opened with O_DSYNC, so the data is not durable
+     * until the next group commit of our host. */
+    if (UvHostGroupCommit(uv)) {
+        s->sync_start = uv_hrtime();
+        UvHostSync(uv->host, &s->sync, s->writer.fd, uvAliveSegmentSyncCb);
         return;
     }
 
-    /* Possibly process waiting requests. */
-    if (!QUEUE_IS_EMPTY(&uv->append_pending_reqs)) {
-        rv = uvAppendMaybeStart(uv);
-        if (rv != 0) {
-            uv->errored = true;
-        }
-    } else if (s->finalize) {
-        /* If there are no more append_pending_reqs, this segment
-         * must be finalized here in case we don't receive AppendEntries
-         * RPCs anymore (could happen during a Snapshot install, causing
-         * the BarrierCb to never fire) */
-        uvAliveSegmentFinalize(s);
-    }
+out:
+    uvAliveSegmentWriteFinish(s, status);
 }
 
 /* Submit a file write request to append the entries encoded in the write buffer
@@ -287,6 +340,7 @@ static int uvAliveSegmentWrite(struct uvAliveSegment *s)
     assert(s->counter != 0);
     assert(s->pending.n > 0);
     uvSegmentBufferFinalize(&s->pending, &s->buf);
+    s->write_start = uv_hrtime();
     rv = UvWriterSubmit(&s->writer, &s->write, &s->buf, 1,
                         s->next_block * s->uv->block_size,
                         uvAliveSegmentWriteCb);
@@ -470,6 +524,7 @@ static void uvAliveSegmentInit(struct uvAliveSegment *s, struct uv *uv)
     s->prepare.data = s;
     s->writer.data = s;
     s->write.data = s;
+    s->sync.data = s;
     s->counter = 0;
     s->first_index = uv->append_next_index;
     s->pending_last_index = s->first_index - 1;
@@ -568,6 +623,18 @@ static size_t uvAppendSize(struct uvAppend *a)
     return size;
 }
 
+/* Return true if the given entries are exactly the ones contained in the given
+ * batch received from the network. */
+static bool uvBatchIsReceived(const struct uvBatch *batch,
+                              const struct raft_entry entries[],
+                              unsigned n)
+{
+    assert(batch->data != NULL);
+    return n == batch->n && entries[0].batch == batch->data &&
+           entries[0].buf.base == batch->data &&
+           entries[n - 1].batch == batch->data;
+}
+
 /* Enqueue an append entries request, assigning it to the appropriate active
  * open segment. */
 static int uvAppendEnqueueRequest(struct uv *uv, struct uvAppend *append)
@@ -640,8 +707,25 @@ int UvAppend(struct raft_io *io,
     append->req = req;
     append->entries = entries;
     append->n = n;
+    append->batch = NULL;
+    append->start = uv_hrtime();
     req->cb = cb;
 
+    /* If we're appending exactly the entries of the batch that we are
+     * receiving from the leader, grab its already validated checksums.
+     * Otherwise encode a new batch, that the messages sending these entries to
+     * other servers will share. It's held until the request completes. */
+    if (uv->recv_batch != NULL &&
+        uvBatchIsReceived(uv->recv_batch, entries, n)) {
+        append->batch = uv->recv_batch;
+        append->batch->refs++;
+    } else if (n > 0) {
+        rv = UvBatchCreate(uv, entries, n, &append->batch);
+        if (rv != 0) {
+            goto err_after_req_alloc;
+        }
+    }
+
     rv = uvAppendEnqueueRequest(uv, append);
     if (rv != 0) {
         goto err_after_req_alloc;
@@ -659,6 +743,9 @@ int UvAppend(struct raft_io *io,
     return 0;
 
 err_after_req_alloc:
+    if (append->batch != NULL) {
+        UvBatchRelease(append->batch);
+    }
     HeapFree(append);
 err:
     assert(rv != 0);
@@ -705,6 +792,19 @@ static void uvFinalizeCurrentAliveSegmentOnceIdle(struct uv *uv)
     }
 }
 
+size_t uvAppendBufferSize(struct uv *uv)
+{
+    size_t size = 0;
+    queue *head;
+    QUEUE_FOREACH(head, &uv->append_segments)
+    {
+        struct uvAliveSegment *segment;
+        segment = QUEUE_DATA(head, struct uvAliveSegment, queue);
+        size += segment->pending.arena.len;
+    }
+    return size;
+}
+
 bool UvBarrierReady(struct uv *uv)
 {
     if (uv->barrier == NULL) {
@@ -0,0 +1,322 @@
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "../include/raft/uv.h"
+#include "assert.h"
+#include "client.h"
+#include "heap.h"
+
+/* Proposing commands from other threads works as follows:
+ *
+ * - Submitting threads push their requests onto a lock-free stack with a
+ *   compare-and-swap loop. The thread that finds the stack empty wakes up the
+ *   loop with uv_async_send(), the others know that a wake up is pending.
+ *
+ * - On the loop thread, the async callback detaches the whole stack with a
+ *   single atomic exchange, reverses it to restore submission order, and
+ *   proposes all the commands to raft with a single batch.
+ *
+ * - Completed requests either fire their callback right away, or are pushed
+ *   onto a second lock-free stack that is detached with an atomic exchange by
+ *   raft_uv_apply_queue_poll(), possibly on another thread.
+ */
+
+/* Initial capacity of the arrays used to propose a batch. */
+#define UV__APPLY_BATCH_INITIAL_SIZE 16
+
+struct uvApplyQueue
+{
+    struct raft_uv_apply_queue *q;                /* Public object */
+    struct raft *raft;                            /* Raft instance */
+    struct uv_async_s async;                      /* Wake up the loop */
+    _Atomic(struct raft_apply_async *) submitted; /* Submitted requests */
+    _Atomic(struct raft_apply_async *) completed; /* Requests to poll */
+    raft_uv_apply_queue_notify_cb notify;         /* Completions are polled */
+    struct raft_apply **reqs;                     /* Batch requests */
+    struct raft_buffer *bufs;                     /* Batch commands */
+    unsigned size;                                /* Capacity of the arrays */
+    unsigned n_inflight;                          /* Requests in raft */
+    bool closing;                                 /* Close was requested */
+    raft_uv_apply_queue_close_cb close_cb;        /* Close callback */
+};
+
+/* Push a request onto a lock-free stack, returning true if it was empty. */
+static bool uvApplyPush(_Atomic(struct raft_apply_async *) *stack,
+                        struct raft_apply_async *req)
+{
+    struct raft_apply_async *head;
+    head = atomic_load_explicit(stack, memory_order_relaxed);
+    do {
+        req->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+        stack, &head, req, memory_order_release, memory_order_relaxed));
+    return head == NULL;
+}
+
+/* Detach all the requests of a lock-free stack, returning them in the order in
+ * which they were pushed. */
+static struct raft_apply_async *uvApplyTakeAll(
+    _Atomic(struct raft_apply_async *) *stack)
+{
+    struct raft_apply_async *head;
+    struct raft_apply_async *list = NULL;
+    head = atomic_exchange_explicit(stack, NULL, memory_order_acquire);
+    while (head != NULL) {
+        struct raft_apply_async *next = head->next;
+        head->next = list;
+        list = head;
+        head = next;
+    }
+    return list;
+}
+
+/* Fire the callbacks of the given list of completed requests. */
+static unsigned uvApplyFireAll(struct raft_apply_async *list)
+{
+    unsigned n = 0;
+    while (list != NULL) {
+        struct raft_apply_async *req = list;
+        list = req->next;
+        req->cb(req, req->status, req->result);
+        n++;
+    }
+    return n;
+}
+
+static void uvApplyMaybeFireCloseCb(struct uvApplyQueue *a)
+{
+    struct raft_uv_apply_queue *q = a->q;
+    raft_uv_apply_queue_close_cb cb = a->close_cb;
+
+    if (!a->closing || a->async.data != NULL || a->n_inflight > 0) {
+        return;
+    }
+
+    uvApplyFireAll(uvApplyTakeAll(&a->completed));
+    if (a->reqs != NULL) {
+        HeapFree(a->reqs);
+        HeapFree(a->bufs);
+    }
+    HeapFree(a);
+    q->impl = NULL;
+
+    if (cb != NULL) {
+        cb(q);
+    }
+}
+
+/* Deliver the completion of a request with the selected mechanism. */
+static void uvApplyComplete(struct uvApplyQueue *a,
+                            struct raft_apply_async *req,
+                            int status,
+                            void *result)
+{
+    req->status = status;
+    req->result = result;
+    if (a->notify == NULL) {
+        req->cb(req, status, result);
+        return;
+    }
+    if (uvApplyPush(&a->completed, req)) {
+        a->notify(a->q);
+    }
+}
+
+static void uvApplyCb(struct raft_apply *apply, int status, void *result)
+{
+    struct uvApplyQueue *a = apply->data;
+    struct raft_apply_async *req = (struct raft_apply_async *)(void *)(
+        (char *)apply - offsetof(struct raft_apply_async, apply));
+
+    assert(a->n_inflight > 0);
+    a->n_inflight--;
+    uvApplyComplete(a, req, status, result);
+    uvApplyMaybeFireCloseCb(a);
+}
+
+/* Fail all the requests in the given list, releasing their commands. */
+static void uvApplyFailAll(struct uvApplyQueue *a,
+                           struct raft_apply_async *list,
+                           int status)
+{
+    while (list != NULL) {
+        struct raft_apply_async *req = list;
+        list = req->next;
+        raft_free(req->buf.base);
+        uvApplyComplete(a, req, status, NULL);
+    }
+}
+
+/* Make sure the batch arrays can hold @n requests. */
+static int uvApplyEnsureSize(struct uvApplyQueue *a, unsigned n)
+{
+    struct raft_apply **reqs;
+    struct raft_buffer *bufs;
+    unsigned size = a->size == 0 ? UV__APPLY_BATCH_INITIAL_SIZE : a->size;
+
+    if (n <= a->size) {
+        return 0;
+    }
+    while (size < n) {
+        size *= 2;
+    }
+
+    reqs = HeapRealloc(a->reqs, size * sizeof *reqs);
+    if (reqs == NULL) {
+        return RAFT_NOMEM;
+    }
+    a->reqs = reqs;
+    bufs = HeapRealloc(a->bufs, size * sizeof *bufs);
+    if (bufs == NULL) {
+        return RAFT_NOMEM;
+    }
+    a->bufs = bufs;
+    a->size = size;
+
+    return 0;
+}
+
+/* Propose all the requests submitted so far as a single batch. */
+static void uvApplyAsyncCb(uv_async_t *async)
+{
+    struct uvApplyQueue *a = async->data;
+    struct raft_apply_async *list;
+    struct raft_apply_async *req;
+    unsigned n = 0;
+    int rv;
+
+    list = uvApplyTakeAll(&a->submitted);
+    for (req = list; req != NULL; req = req->next) {
+        n++;
+    }
+    if (n == 0) {
+        return;
+    }
+
+    rv = uvApplyEnsureSize(a, n);
+    if (rv != 0) {
+        goto err;
+    }
+
+    n = 0;
+    for (req = list; req != NULL; req = req->next) {
+        req->apply.data = a;
+        req->apply.cb = uvApplyCb;
+        a->reqs[n] = &req->apply;
+        a->bufs[n] = req->buf;
+        n++;
+    }
+
+    rv = clientApplyBatch(a->raft, a->reqs, a->bufs, n);
+    if (rv != 0) {
+        goto err;
+    }
+    a->n_inflight += n;
+
+    return;
+
+err:
+    uvApplyFailAll(a, list, rv);
+}
+
+int raft_uv_apply_queue_init(struct raft_uv_apply_queue *q,
+                             struct uv_loop_s *loop,
+                             struct raft *r)
+{
+    struct uvApplyQueue *a;
+    int rv;
+
+    assert(q != NULL);
+    assert(loop != NULL);
+    assert(r != NULL);
+
+    a = HeapMalloc(sizeof *a);
+    if (a == NULL) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+    a->q = q;
+    a->raft = r;
+    atomic_init(&a->submitted, NULL);
+    atomic_init(&a->completed, NULL);
+    a->notify = NULL;
+    a->reqs = NULL;
+    a->bufs = NULL;
+    a->size = 0;
+    a->n_inflight = 0;
+    a->closing = false;
+    a->close_cb = NULL;
+
+    rv = uv_async_init(loop, &a->async, uvApplyAsyncCb);
+    if (rv != 0) {
+        rv = RAFT_IOERR;
+        goto err_after_alloc;
+    }
+    a->async.data = a;
+
+    q->impl = a;
+    return 0;
+
+err_after_alloc:
+    HeapFree(a);
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+void raft_uv_apply_queue_set_notify(struct raft_uv_apply_queue *q,
+                                    raft_uv_apply_queue_notify_cb cb)
+{
+    struct uvApplyQueue *a = q->impl;
+    a->notify = cb;
+}
+
+int raft_apply_async(struct raft_uv_apply_queue *q,
+                     struct raft_apply_async *req,
+                     const struct raft_buffer *buf,
+                     raft_apply_async_cb cb)
+{
+    struct uvApplyQueue *a = q->impl;
+    int rv;
+
+    assert(buf != NULL);
+    assert(cb != NULL);
+
+    req->buf = *buf;
+    req->cb = cb;
+    req->status = 0;
+    req->result = NULL;
+
+    /* Only the request that finds the queue empty needs to wake up the loop,
+     * the following ones will be taken by the same wake up. */
+    if (uvApplyPush(&a->submitted, req)) {
+        rv = uv_async_send(&a->async);
+        assert(rv == 0); /* This should never fail */
+    }
+
+    return 0;
+}
+
+unsigned raft_uv_apply_queue_poll(struct raft_uv_apply_queue *q)
+{
+    struct uvApplyQueue *a = q->impl;
+    return uvApplyFireAll(uvApplyTakeAll(&a->completed));
+}
+
+static void uvApplyAsyncCloseCb(uv_handle_t *handle)
+{
+    struct uvApplyQueue *a = handle->data;
+    a->async.data = NULL;
+    uvApplyMaybeFireCloseCb(a);
+}
+
+void raft_uv_apply_queue_close(struct raft_uv_apply_queue *q,
+                               raft_uv_apply_queue_close_cb cb)
+{
+    struct uvApplyQueue *a = q->impl;
+    assert(!a->closing);
+    a->closing = true;
+    a->close_cb = cb;
+    uvApplyFailAll(a, uvApplyTakeAll(&a->submitted), RAFT_CANCELED);
+    uv_close((uv_handle_t *)&a->async, uvApplyAsyncCloseCb);
+}
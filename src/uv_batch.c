@@ -0,0 +1,130 @@
+#include <string.h>
+
+#include "assert.h"
+#include "byte.h"
+#include "heap.h"
+#include "uv.h"
+#include "uv_encoding.h"
+
+/* Compute the checksum of the data of the given entries, in the same way it's
+ * done for segment files. */
+static unsigned uvBatchDataCrc(const struct raft_entry entries[], unsigned n)
+{
+    unsigned crc = 0;
+    unsigned i;
+    for (i = 0; i < n; i++) {
+        crc = byteCrc32(entries[i].buf.base, entries[i].buf.len, crc);
+    }
+    return crc;
+}
+
+/* Encode a new batch for the given entries, not shared with anyone. */
+static int uvBatchEncode(const struct raft_entry entries[],
+                         unsigned n,
+                         struct uvBatch **batch)
+{
+    int rv;
+
+    assert(n > 0);
+
+    *batch = HeapMalloc(sizeof **batch);
+    if (*batch == NULL) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+    (*batch)->header.len = uvSizeofBatchHeader(n);
+    (*batch)->header.base = HeapMalloc((*batch)->header.len);
+    if ((*batch)->header.base == NULL) {
+        rv = RAFT_NOMEM;
+        goto err_after_batch_alloc;
+    }
+    uvEncodeBatchHeader(entries, n, (*batch)->header.base);
+    (*batch)->crc = byteCrc32((*batch)->header.base, (*batch)->header.len, 0);
+    (*batch)->refs = 1;
+    (*batch)->n = n;
+    (*batch)->base = NULL;
+    (*batch)->data = NULL;
+    (*batch)->data_crc = 0;
+    QUEUE_INIT(&(*batch)->queue);
+
+    return 0;
+
+err_after_batch_alloc:
+    HeapFree(*batch);
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+int UvBatchCreate(struct uv *uv,
+                  const struct raft_entry entries[],
+                  unsigned n,
+                  struct uvBatch **batch)
+{
+    int rv;
+
+    rv = uvBatchEncode(entries, n, batch);
+    if (rv != 0) {
+        return rv;
+    }
+
+    /* The data checksum is needed both by the disk write and by the messages
+     * sent with wire checksums, compute it only once. */
+    (*batch)->data = entries[0].buf.base;
+    (*batch)->data_crc = uvBatchDataCrc(entries, n);
+
+    /* The data of the first entry identifies the batch: it can't be reused
+     * for other entries as long as a reference to the batch exists, since the
+     * append request or the messages holding it keep the entries alive. */
+    if (entries[0].buf.base != NULL) {
+        (*batch)->base = entries[0].buf.base;
+        QUEUE_PUSH(&uv->batches, &(*batch)->queue);
+    }
+
+    return 0;
+}
+
+int UvBatchAcquire(struct uv *uv,
+                   const struct raft_entry entries[],
+                   unsigned n,
+                   struct uvBatch **batch)
+{
+    queue *head;
+
+    assert(n > 0);
+
+    if (entries[0].buf.base != NULL) {
+        QUEUE_FOREACH(head, &uv->batches)
+        {
+            *batch = QUEUE_DATA(head, struct uvBatch, queue);
+            if ((*batch)->base == entries[0].buf.base && (*batch)->n == n) {
+                (*batch)->refs++;
+                return 0;
+            }
+        }
+    }
+
+    return uvBatchEncode(entries, n, batch);
+}
+
+void UvBatchRelease(struct uvBatch *batch)
+{
+    assert(batch->refs > 0);
+    batch->refs--;
+    if (batch->refs > 0) {
+        return;
+    }
+    QUEUE_REMOVE(&batch->queue);
+    HeapFree(batch->header.base);
+    HeapFree(batch);
+}
+
+void UvBatchClose(struct uv *uv)
+{
+    while (!QUEUE_IS_EMPTY(&uv->batches)) {
+        queue *head;
+        head = QUEUE_HEAD(&uv->batches);
+        QUEUE_REMOVE(head);
+        QUEUE_INIT(head);
+    }
+}
@@ -5,6 +5,7 @@
 #include "../include/raft/uv.h"
 #include "assert.h"
 #include "byte.h"
+#include "compress.h"
 #include "configuration.h"
 
 /**
@@ -33,7 +34,7 @@ static size_t sizeofRequestVoteResult(void)
            sizeof(uint64_t) /* Vote granted. */;
 }
 
-static size_t sizeofAppendEntries(const struct raft_append_entries *p)
+static size_t sizeofAppendEntriesV1(const struct raft_append_entries *p)
 {
     return sizeof(uint64_t) + /* Leader's term. */
            sizeof(uint64_t) + /* Leader ID */
@@ -44,24 +45,66 @@ static size_t sizeofAppendEntries(const struct raft_append_entries *p)
            16 * p->n_entries /* One header per entry */;
 }
 
-static size_t sizeofAppendEntriesResult(void)
+static size_t sizeofAppendEntries(const struct raft_append_entries *p,
+                                  bool compressed)
+{
+    size_t size = sizeofAppendEntriesV1(p) + sizeof(uint64_t) /* Flags */;
+    if (compressed) {
+        size += sizeof(uint64_t); /* Size of compressed data */
+    }
+    return size;
+}
+
+/* Size of the fixed fields of an AppendEntries header that precede the batch
+ * header. */
+static size_t sizeofAppendEntriesFields(void)
+{
+    return sizeof(uint64_t) + /* Leader's term. */
+           sizeof(uint64_t) + /* Previous log entry index */
+           sizeof(uint64_t) + /* Previous log entry term */
+           sizeof(uint64_t) /* Leader's commit index */;
+}
+
+static size_t sizeofAppendEntriesResultV1(void)
 {
     return sizeof(uint64_t) + /* Term. */
            sizeof(uint64_t) + /* Success. */
            sizeof(uint64_t) /* Last log index. */;
 }
 
-static size_t sizeofInstallSnapshot(const struct raft_install_snapshot *p)
+static size_t sizeofAppendEntriesResultV2(void)
+{
+    return sizeofAppendEntriesResultV1() + sizeof(uint64_t) /* Flags */;
+}
+
+static size_t sizeofAppendEntriesResult(void)
+{
+    return sizeofAppendEntriesResultV2() +
+           sizeof(uint64_t) /* Last snapshot index */;
+}
+
+static size_t sizeofInstallSnapshotV1(size_t conf_size)
 {
-    size_t conf_size = configurationEncodedSize(&p->conf);
     return sizeof(uint64_t) + /* Leader's term. */
-           sizeof(uint64_t) + /* Leader ID */
            sizeof(uint64_t) + /* Snapshot's last index */
            sizeof(uint64_t) + /* Term of last index */
            sizeof(uint64_t) + /* Configuration's index */
            sizeof(uint64_t) + /* Length of configuration */
            conf_size +        /* Configuration data */
-           sizeof(uint64_t);  /* Length of snapshot data */
+           sizeof(uint64_t) + /* Length of snapshot data */
+           sizeof(uint64_t);  /* Flags, unused by legacy senders */
+}
+
+static size_t sizeofInstallSnapshot(const struct raft_install_snapshot *p,
+                                    bool compressed)
+{
+    size_t conf_size = configurationEncodedSize(&p->conf);
+    size_t size = sizeofInstallSnapshotV1(conf_size) +
+                  sizeof(uint64_t) /* Leader ID */;
+    if (compressed) {
+        size += sizeof(uint64_t); /* Size of compressed data */
+    }
+    return size;
 }
 
 static size_t sizeofTimeoutNow(void)
@@ -71,12 +114,38 @@ static size_t sizeofTimeoutNow(void)
            sizeof(uint64_t) /* Last log term. */;
 }
 
+static size_t sizeofDelegateSnapshot(void)
+{
+    return sizeof(uint64_t) + /* Term. */
+           sizeof(uint64_t) /* Server ID. */;
+}
+
 size_t uvSizeofBatchHeader(size_t n)
 {
     return 8 + /* Number of entries in the batch, little endian */
            16 * n /* One header per entry */;
 }
 
+uint64_t uvCapabilities(void)
+{
+    uint64_t capabilities = UV__CAPABILITY_COMPACT | UV__CAPABILITY_HEARTBEATS;
+#ifdef LZ4_AVAILABLE
+    capabilities |= UV__CAPABILITY_COMPRESSION;
+#endif
+    return capabilities;
+}
+
+/* Return the flags of an AppendEntries header that don't depend on how its
+ * entries are sent. */
+static uint64_t appendEntriesFlags(const struct raft_append_entries *p)
+{
+    uint64_t flags = uvCapabilities() << UV__APPEND_ENTRIES_CAPABILITIES_SHIFT;
+    if (p->quiesce) {
+        flags |= UV__APPEND_ENTRIES_QUIESCE;
+    }
+    return flags;
+}
+
 static void encodeRequestVote(const struct raft_request_vote *p, void *buf)
 {
     void *cursor = buf;
@@ -105,9 +174,18 @@ static void encodeRequestVoteResult(const struct raft_request_vote_result *p,
     bytePut64(&cursor, p->vote_granted);
 }
 
-static void encodeAppendEntries(const struct raft_append_entries *p, void *buf)
+/* Encode an AppendEntries header. If @with_batch is false, the batch header is
+ * sent in a separate buffer and the fields following it are encoded right after
+ * the fixed fields. If @compressed_len is not zero, the entries data is sent
+ * compressed. */
+static void encodeAppendEntries(const struct raft_append_entries *p,
+                                bool with_batch,
+                                const struct uvBatchChecksums *checksums,
+                                size_t compressed_len,
+                                void *buf)
 {
     void *cursor;
+    uint64_t flags = appendEntriesFlags(p);
 
     cursor = buf;
 
@@ -116,7 +194,28 @@ static void encodeAppendEntries(const struct raft_append_entries *p, void *buf)
     bytePut64(&cursor, p->prev_log_term);  /* Previous term. */
     bytePut64(&cursor, p->leader_commit);  /* Commit index. */
 
-    uvEncodeBatchHeader(p->entries, p->n_entries, cursor);
+    if (with_batch) {
+        uvEncodeBatchHeader(p->entries, p->n_entries, cursor);
+        cursor = (uint8_t *)cursor + uvSizeofBatchHeader(p->n_entries);
+    }
+
+    /* The slot following the batch header is unused by legacy senders, which
+     * is where the batch checksums go, in the same order used by segment
+     * files, followed by the flags, which also advertise our capabilities. */
+    if (checksums != NULL) {
+        bytePut32(&cursor, checksums->header);
+        bytePut32(&cursor, checksums->data);
+        flags |= UV__APPEND_ENTRIES_CHECKSUMS;
+    } else {
+        bytePut64(&cursor, 0);
+    }
+    if (compressed_len > 0) {
+        flags |= UV__APPEND_ENTRIES_COMPRESSED;
+    }
+    bytePut64(&cursor, flags);
+    if (compressed_len > 0) {
+        bytePut64(&cursor, compressed_len);
+    }
 }
 
 static void encodeAppendEntriesResult(
@@ -128,13 +227,23 @@ static void encodeAppendEntriesResult(
     bytePut64(&cursor, p->term);
     bytePut64(&cursor, p->rejected);
     bytePut64(&cursor, p->last_log_index);
+    bytePut64(&cursor, uvCapabilities()); /* Flags. */
+    bytePut64(&cursor, p->snapshot_index);
 }
 
+/* Encode an InstallSnapshot header. If @compressed_len is not zero, the
+ * snapshot data is sent compressed. */
 static void encodeInstallSnapshot(const struct raft_install_snapshot *p,
+                                  size_t compressed_len,
                                   void *buf)
 {
     void *cursor;
     size_t conf_size = configurationEncodedSize(&p->conf);
+    uint64_t flags = 0;
+
+    if (compressed_len > 0) {
+        flags |= UV__INSTALL_SNAPSHOT_COMPRESSED;
+    }
 
     cursor = buf;
 
@@ -145,7 +254,12 @@ static void encodeInstallSnapshot(const struct raft_install_snapshot *p,
     bytePut64(&cursor, conf_size);     /* Configuration length. */
     configurationEncodeToBuf(&p->conf, cursor);
     cursor = (uint8_t *)cursor + conf_size;
-    bytePut64(&cursor, p->data.len); /* Snapshot data size. */
+    bytePut64(&cursor, p->data.len);  /* Snapshot data size. */
+    bytePut64(&cursor, flags);        /* Flags. */
+    bytePut64(&cursor, p->leader_id); /* Leader ID. */
+    if (compressed_len > 0) {
+        bytePut64(&cursor, compressed_len); /* Compressed data size. */
+    }
 }
 
 static void encodeTimeoutNow(const struct raft_timeout_now *p, void *buf)
@@ -157,77 +271,454 @@ static void encodeTimeoutNow(const struct raft_timeout_now *p, void *buf)
     bytePut64(&cursor, p->last_log_term);
 }
 
-int uvEncodeMessage(const struct raft_message *message,
-                    uv_buf_t **bufs,
-                    unsigned *n_bufs)
+static void encodeDelegateSnapshot(const struct raft_delegate_snapshot *p,
+                                   void *buf)
 {
-    uv_buf_t header;
-    void *cursor;
+    void *cursor = buf;
 
-    /* Figure out the length of the header for this request and allocate a
-     * buffer for it. */
-    header.len = RAFT_IO_UV__PREAMBLE_SIZE;
+    bytePut64(&cursor, p->term);
+    bytePut64(&cursor, p->server_id);
+}
+
+/* Encode the header of a regular message. */
+static void encodeMessage(const struct raft_message *message,
+                          bool with_batch,
+                          const struct uvBatchChecksums *checksums,
+                          size_t compressed_len,
+                          void *cursor)
+{
     switch (message->type) {
         case RAFT_IO_REQUEST_VOTE:
-            header.len += sizeofRequestVote();
+            encodeRequestVote(&message->request_vote, cursor);
             break;
         case RAFT_IO_REQUEST_VOTE_RESULT:
-            header.len += sizeofRequestVoteResult();
+            encodeRequestVoteResult(&message->request_vote_result, cursor);
             break;
         case RAFT_IO_APPEND_ENTRIES:
-            header.len += sizeofAppendEntries(&message->append_entries);
+            encodeAppendEntries(&message->append_entries, with_batch,
+                                checksums, compressed_len, cursor);
             break;
         case RAFT_IO_APPEND_ENTRIES_RESULT:
-            header.len += sizeofAppendEntriesResult();
+            encodeAppendEntriesResult(&message->append_entries_result, cursor);
             break;
         case RAFT_IO_INSTALL_SNAPSHOT:
-            header.len += sizeofInstallSnapshot(&message->install_snapshot);
+            encodeInstallSnapshot(&message->install_snapshot, compressed_len,
+                                  cursor);
             break;
         case RAFT_IO_TIMEOUT_NOW:
-            header.len += sizeofTimeoutNow();
+            encodeTimeoutNow(&message->timeout_now, cursor);
+            break;
+        case RAFT_IO_DELEGATE_SNAPSHOT:
+            encodeDelegateSnapshot(&message->delegate_snapshot, cursor);
             break;
-        default:
-            return RAFT_MALFORMED;
     };
+}
 
-    header.base = raft_malloc(header.len);
-    if (header.base == NULL) {
-        goto oom;
+/* Cursor used to encode the header of compact messages. If @cursor is NULL,
+ * nothing gets written and only the length of the header is computed. */
+struct compactEncoder
+{
+    void *cursor;
+    size_t len;
+};
+
+static void compactPut(struct compactEncoder *e, uint64_t value)
+{
+    if (e->cursor != NULL) {
+        bytePutVarint(&e->cursor, value);
     }
+    e->len += byteSizeofVarint(value);
+}
 
-    cursor = header.base;
+/* Checksums don't compress, so they are encoded as 4 little endian bytes. */
+static void compactPut32(struct compactEncoder *e, uint32_t value)
+{
+    unsigned i;
+    if (e->cursor != NULL) {
+        for (i = 0; i < sizeof(uint32_t); i++) {
+            bytePut8(&e->cursor, (uint8_t)(value >> (i * 8)));
+        }
+    }
+    e->len += sizeof(uint32_t);
+}
+
+static void compactPutConf(struct compactEncoder *e,
+                           const struct raft_configuration *conf)
+{
+    size_t conf_size = configurationEncodedSize(conf);
+    compactPut(e, conf_size);
+    if (e->cursor != NULL) {
+        configurationEncodeToBuf(conf, e->cursor);
+        e->cursor = (uint8_t *)e->cursor + conf_size;
+    }
+    e->len += conf_size;
+}
 
-    /* Encode the request preamble, with message type and message size. */
-    bytePut64(&cursor, message->type);
-    bytePut64(&cursor, header.len - RAFT_IO_UV__PREAMBLE_SIZE);
+static void encodeCompactRequestVote(const struct raft_request_vote *p,
+                                     struct compactEncoder *e)
+{
+    uint64_t flags = 0;
 
-    /* Encode the request header. */
+    if (p->disrupt_leader) {
+        flags |= 1 << 0;
+    }
+    if (p->pre_vote) {
+        flags |= 1 << 1;
+    }
+
+    compactPut(e, p->term);
+    compactPut(e, p->candidate_id);
+    compactPut(e, p->last_log_index);
+    compactPut(e, p->last_log_term);
+    compactPut(e, flags);
+}
+
+/* Encode a compact AppendEntries header. The flags come right after the fixed
+ * fields, followed by the entry headers, where the term of each entry is
+ * encoded as its difference from the term of the entry before it, which is
+ * almost always zero. */
+static void encodeCompactAppendEntries(const struct raft_append_entries *p,
+                                       const struct uvBatchChecksums *checksums,
+                                       size_t compressed_len,
+                                       struct compactEncoder *e)
+{
+    uint64_t flags = appendEntriesFlags(p);
+    raft_term term = p->prev_log_term;
+    unsigned i;
+
+    if (checksums != NULL) {
+        flags |= UV__APPEND_ENTRIES_CHECKSUMS;
+    }
+    if (compressed_len > 0) {
+        flags |= UV__APPEND_ENTRIES_COMPRESSED;
+    }
+
+    compactPut(e, p->term);           /* Leader's term. */
+    compactPut(e, p->prev_log_index); /* Previous index. */
+    compactPut(e, p->prev_log_term);  /* Previous term. */
+    compactPut(e, p->leader_commit);  /* Commit index. */
+    compactPut(e, flags);             /* Flags. */
+    compactPut(e, p->n_entries);      /* Number of entries. */
+
+    for (i = 0; i < p->n_entries; i++) {
+        const struct raft_entry *entry = &p->entries[i];
+        compactPut(e, byteZigZag((int64_t)(entry->term - term)));
+        compactPut(e, entry->type);
+        compactPut(e, entry->buf.len);
+        term = entry->term;
+    }
+
+    if (checksums != NULL) {
+        compactPut32(e, checksums->header);
+        compactPut32(e, checksums->data);
+    }
+    if (compressed_len > 0) {
+        compactPut(e, compressed_len);
+    }
+}
+
+static void encodeCompactInstallSnapshot(const struct raft_install_snapshot *p,
+                                         size_t compressed_len,
+                                         struct compactEncoder *e)
+{
+    uint64_t flags = 0;
+
+    if (compressed_len > 0) {
+        flags |= UV__INSTALL_SNAPSHOT_COMPRESSED;
+    }
+
+    compactPut(e, p->term);       /* Leader's term. */
+    compactPut(e, p->last_index); /* Snapshot last index. */
+    compactPut(e, p->last_term);  /* Term of last index. */
+    compactPut(e, p->conf_index); /* Configuration index. */
+    compactPutConf(e, &p->conf);  /* Configuration length and data. */
+    compactPut(e, p->data.len);   /* Snapshot data size. */
+    compactPut(e, flags);         /* Flags. */
+    compactPut(e, p->leader_id);  /* Leader ID. */
+    if (compressed_len > 0) {
+        compactPut(e, compressed_len); /* Compressed data size. */
+    }
+}
+
+/* Encode the header of a compact message, or just compute its length if the
+ * cursor of @e is NULL. */
+static void encodeCompactMessage(const struct raft_message *message,
+                                 const struct uvBatchChecksums *checksums,
+                                 size_t compressed_len,
+                                 struct compactEncoder *e)
+{
     switch (message->type) {
         case RAFT_IO_REQUEST_VOTE:
-            encodeRequestVote(&message->request_vote, cursor);
+            encodeCompactRequestVote(&message->request_vote, e);
             break;
         case RAFT_IO_REQUEST_VOTE_RESULT:
-            encodeRequestVoteResult(&message->request_vote_result, cursor);
+            compactPut(e, message->request_vote_result.term);
+            compactPut(e, message->request_vote_result.vote_granted);
             break;
         case RAFT_IO_APPEND_ENTRIES:
-            encodeAppendEntries(&message->append_entries, cursor);
+            encodeCompactAppendEntries(&message->append_entries, checksums,
+                                       compressed_len, e);
             break;
         case RAFT_IO_APPEND_ENTRIES_RESULT:
-            encodeAppendEntriesResult(&message->append_entries_result, cursor);
+            compactPut(e, message->append_entries_result.term);
+            compactPut(e, message->append_entries_result.rejected);
+            compactPut(e, message->append_entries_result.last_log_index);
+            compactPut(e, uvCapabilities()); /* Flags. */
+            compactPut(e, message->append_entries_result.snapshot_index);
             break;
         case RAFT_IO_INSTALL_SNAPSHOT:
-            encodeInstallSnapshot(&message->install_snapshot, cursor);
+            encodeCompactInstallSnapshot(&message->install_snapshot,
+                                         compressed_len, e);
             break;
         case RAFT_IO_TIMEOUT_NOW:
-            encodeTimeoutNow(&message->timeout_now, cursor);
+            compactPut(e, message->timeout_now.term);
+            compactPut(e, message->timeout_now.last_log_index);
+            compactPut(e, message->timeout_now.last_log_term);
+            break;
+        case RAFT_IO_DELEGATE_SNAPSHOT:
+            compactPut(e, message->delegate_snapshot.term);
+            compactPut(e, message->delegate_snapshot.server_id);
             break;
     };
+}
+
+/* Return the length of the header of the given message, including the
+ * preamble, or 0 if the message type is not valid. */
+static size_t sizeofMessage(const struct raft_message *message,
+                            bool compressed)
+{
+    size_t len = RAFT_IO_UV__PREAMBLE_SIZE;
+    switch (message->type) {
+        case RAFT_IO_REQUEST_VOTE:
+            len += sizeofRequestVote();
+            break;
+        case RAFT_IO_REQUEST_VOTE_RESULT:
+            len += sizeofRequestVoteResult();
+            break;
+        case RAFT_IO_APPEND_ENTRIES:
+            len += sizeofAppendEntries(&message->append_entries, compressed);
+            break;
+        case RAFT_IO_APPEND_ENTRIES_RESULT:
+            len += sizeofAppendEntriesResult();
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT:
+            len += sizeofInstallSnapshot(&message->install_snapshot,
+                                         compressed);
+            break;
+        case RAFT_IO_TIMEOUT_NOW:
+            len += sizeofTimeoutNow();
+            break;
+        case RAFT_IO_DELEGATE_SNAPSHOT:
+            len += sizeofDelegateSnapshot();
+            break;
+        default:
+            return 0;
+    };
+    return len;
+}
+
+/* Return the size of a UV__GROUP_TAG record holding the given group ID. */
+static size_t sizeofGroupTag(uint64_t group)
+{
+    return bytePad64(1 + 1 + byteSizeofVarint(group));
+}
+
+static void encodeGroupTag(uint64_t group, size_t len, void **cursor)
+{
+    size_t padding = len - 2 - byteSizeofVarint(group);
+    bytePut8(cursor, UV__COMPACT_MARKER | UV__GROUP_TAG);
+    bytePutVarint(cursor, len - 2);
+    bytePutVarint(cursor, group);
+    memset(*cursor, 0, padding);
+    *cursor = (uint8_t *)*cursor + padding;
+}
+
+/* Fill @payload with the buffers holding the payload of the given message, if
+ * any. The caller must release the array. */
+static int payloadBufs(const struct raft_message *message,
+                       struct raft_buffer **payload,
+                       unsigned *n)
+{
+    const struct raft_append_entries *args = &message->append_entries;
+    unsigned i;
+
+    *payload = NULL;
+    *n = 0;
+
+    switch (message->type) {
+        case RAFT_IO_APPEND_ENTRIES:
+            if (args->n_entries == 0) {
+                break;
+            }
+            *payload = raft_malloc(args->n_entries * sizeof **payload);
+            if (*payload == NULL) {
+                return RAFT_NOMEM;
+            }
+            for (i = 0; i < args->n_entries; i++) {
+                (*payload)[i] = args->entries[i].buf;
+            }
+            *n = args->n_entries;
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT:
+            *payload = raft_malloc(sizeof **payload);
+            if (*payload == NULL) {
+                return RAFT_NOMEM;
+            }
+            (*payload)[0] = message->install_snapshot.data;
+            *n = 1;
+            break;
+    }
+
+    return 0;
+}
+
+/* Compress the payload of the given message into @compressed, which is left
+ * empty if the message has no payload, if compression is not supported or if it
+ * doesn't make the payload smaller. */
+static int compressPayload(const struct raft_message *message,
+                           struct raft_buffer *compressed)
+{
+    struct raft_buffer *payload;
+    unsigned n_payload;
+    size_t payload_len = 0;
+    size_t bound = 0;
+    unsigned i;
+    int rv;
+
+    compressed->base = NULL;
+    compressed->len = 0;
+
+    rv = payloadBufs(message, &payload, &n_payload);
+    if (rv != 0) {
+        return rv;
+    }
+    for (i = 0; i < n_payload; i++) {
+        payload_len += payload[i].len;
+    }
+    if (payload_len > 0) {
+        bound = CompressBound(payload, n_payload);
+    }
+    if (bound == 0) {
+        goto out;
+    }
+
+    compressed->base = raft_malloc(bound);
+    if (compressed->base == NULL) {
+        rv = RAFT_NOMEM;
+        goto out;
+    }
+    rv = Compress(payload, n_payload, compressed->base, bound,
+                  &compressed->len);
+    if (rv != 0 || compressed->len >= payload_len) {
+        raft_free(compressed->base);
+        compressed->base = NULL;
+        compressed->len = 0;
+        rv = 0;
+    }
+
+out:
+    if (payload != NULL) {
+        raft_free(payload);
+    }
+    return rv;
+}
+
+int uvEncodeMessage(const struct raft_message *message,
+                    const uv_buf_t *batch,
+                    const struct uvBatchChecksums *checksums,
+                    bool compress,
+                    bool compact,
+                    uint64_t group,
+                    uv_buf_t **bufs,
+                    unsigned *n_bufs)
+{
+    uv_buf_t header;
+    size_t batch_len = 0; /* Length of the batch header that we don't encode */
+    size_t tag_len = group != 0 ? sizeofGroupTag(group) : 0;
+    size_t preamble_len;
+    struct raft_buffer compressed = {NULL, 0};
+    struct compactEncoder e = {NULL, 0};
+    void *cursor;
+    unsigned i;
+
+    if (message->type != RAFT_IO_APPEND_ENTRIES) {
+        batch = NULL;
+    }
+    if (batch == NULL && !compact) {
+        checksums = NULL;
+    }
+    if (compact) {
+        batch = NULL;
+    }
+    if (batch != NULL) {
+        assert(batch->len ==
+               uvSizeofBatchHeader(message->append_entries.n_entries));
+        batch_len = batch->len;
+    }
+
+    if (sizeofMessage(message, false) == 0) {
+        return RAFT_MALFORMED;
+    }
+
+    if (compress && compressPayload(message, &compressed) != 0) {
+        goto oom;
+    }
+
+    /* Figure out the length of the header for this request. */
+    if (compact) {
+        encodeCompactMessage(message, checksums, compressed.len, &e);
+        preamble_len = 1 + byteSizeofVarint(e.len);
+        header.len = preamble_len + e.len;
+    } else {
+        preamble_len = RAFT_IO_UV__PREAMBLE_SIZE;
+        header.len = sizeofMessage(message, compressed.len > 0) - batch_len;
+    }
+    header.len += tag_len;
+
+    /* The compressed payload is placed right after the header, in the same
+     * buffer. */
+    header.base = raft_malloc(header.len + compressed.len);
+    if (header.base == NULL) {
+        goto oom_after_compressed_alloc;
+    }
+    if (compressed.base != NULL) {
+        memcpy(header.base + header.len, compressed.base, compressed.len);
+        raft_free(compressed.base);
+    }
+
+    cursor = header.base;
+
+    if (tag_len > 0) {
+        encodeGroupTag(group, tag_len, &cursor);
+    }
+
+    /* Encode the request preamble, with message type and message size, and
+     * the request header. */
+    if (compact) {
+        bytePut8(&cursor, (uint8_t)(UV__COMPACT_MARKER | message->type));
+        bytePutVarint(&cursor, e.len);
+        e.cursor = cursor;
+        e.len = 0;
+        encodeCompactMessage(message, checksums, compressed.len, &e);
+        assert(header.len == tag_len + preamble_len + e.len);
+    } else {
+        bytePut64(&cursor, message->type);
+        bytePut64(&cursor, header.len + batch_len - tag_len - preamble_len);
+        encodeMessage(message, batch == NULL, checksums, compressed.len,
+                      cursor);
+    }
 
     *n_bufs = 1;
 
-    /* For AppendEntries request we also send the entries payload. */
+    /* For AppendEntries request we also send the batch header, if it was
+     * encoded separately, followed by the unused trailing bytes of the message
+     * header, and the entries payload, either as a single compressed buffer or
+     * one buffer per entry. */
+    if (batch != NULL) {
+        *n_bufs += 2;
+    }
     if (message->type == RAFT_IO_APPEND_ENTRIES) {
-        *n_bufs += message->append_entries.n_entries;
+        *n_bufs += compressed.len > 0 ? 1 : message->append_entries.n_entries;
     }
 
     /* For InstallSnapshot request we also send the snapshot payload. */
@@ -243,29 +734,142 @@ int uvEncodeMessage(const struct raft_message *message,
     (*bufs)[0] = header;
 
     if (message->type == RAFT_IO_APPEND_ENTRIES) {
-        unsigned i;
-        for (i = 0; i < message->append_entries.n_entries; i++) {
-            const struct raft_entry *entry =
-                &message->append_entries.entries[i];
-            (*bufs)[i + 1].base = entry->buf.base;
-            (*bufs)[i + 1].len = entry->buf.len;
+        unsigned offset = 1;
+        if (batch != NULL) {
+            size_t prefix_len =
+                tag_len + preamble_len + sizeofAppendEntriesFields();
+            (*bufs)[0].len = prefix_len;
+            (*bufs)[1] = *batch;
+            (*bufs)[2].base = header.base + prefix_len;
+            (*bufs)[2].len = header.len - prefix_len;
+            offset += 2;
+        }
+        if (compressed.len > 0) {
+            (*bufs)[offset].base = header.base + header.len;
+            (*bufs)[offset].len = compressed.len;
+        } else {
+            for (i = 0; i < message->append_entries.n_entries; i++) {
+                const struct raft_entry *entry =
+                    &message->append_entries.entries[i];
+                (*bufs)[i + offset].base = entry->buf.base;
+                (*bufs)[i + offset].len = entry->buf.len;
+            }
         }
     }
 
     if (message->type == RAFT_IO_INSTALL_SNAPSHOT) {
-        (*bufs)[1].base = message->install_snapshot.data.base;
-        (*bufs)[1].len = message->install_snapshot.data.len;
+        if (compressed.len > 0) {
+            (*bufs)[1].base = header.base + header.len;
+            (*bufs)[1].len = compressed.len;
+        } else {
+            (*bufs)[1].base = message->install_snapshot.data.base;
+            (*bufs)[1].len = message->install_snapshot.data.len;
+        }
     }
 
     return 0;
 
 oom_after_header_alloc:
     raft_free(header.base);
+    goto oom;
+
+oom_after_compressed_alloc:
+    if (compressed.base != NULL) {
+        raft_free(compressed.base);
+    }
 
 oom:
     return RAFT_NOMEM;
 }
 
+/* Encode the fields of a heartbeat entry of a UV__HEARTBEATS record, or just
+ * compute their length if the cursor of @e is NULL. */
+static void encodeHeartbeat(const struct raft_append_entries *p,
+                            uint64_t group,
+                            struct compactEncoder *e)
+{
+    compactPut(e, group);                 /* Group ID. */
+    compactPut(e, p->term);               /* Leader's term. */
+    compactPut(e, p->prev_log_index);     /* Previous index. */
+    compactPut(e, p->prev_log_term);      /* Previous term. */
+    compactPut(e, p->leader_commit);      /* Commit index. */
+    compactPut(e, appendEntriesFlags(p)); /* Flags. */
+}
+
+int uvEncodeHeartbeat(const struct raft_message *message,
+                      uint64_t group,
+                      uv_buf_t **bufs,
+                      unsigned *n_bufs)
+{
+    struct compactEncoder e = {NULL, 0};
+    uv_buf_t buf;
+
+    assert(message->type == RAFT_IO_APPEND_ENTRIES);
+    assert(message->append_entries.n_entries == 0);
+    assert(group != 0);
+
+    encodeHeartbeat(&message->append_entries, group, &e);
+    buf.len = e.len;
+    buf.base = raft_malloc(buf.len);
+    if (buf.base == NULL) {
+        return RAFT_NOMEM;
+    }
+    e.cursor = buf.base;
+    e.len = 0;
+    encodeHeartbeat(&message->append_entries, group, &e);
+    assert(e.len == buf.len);
+
+    *bufs = raft_malloc(sizeof **bufs);
+    if (*bufs == NULL) {
+        raft_free(buf.base);
+        return RAFT_NOMEM;
+    }
+    (*bufs)[0] = buf;
+    *n_bufs = 1;
+
+    return 0;
+}
+
+/* Return the size of a UV__HEARTBEATS record holding @n heartbeats whose size
+ * is @len in total, setting @len_size to the size of its length varint. */
+static size_t sizeofHeartbeats(unsigned n, size_t len, size_t *len_size)
+{
+    size_t body = byteSizeofVarint(n) + len;
+    size_t size;
+
+    /* The padding might make the length varint longer. */
+    *len_size = byteSizeofVarint(body);
+    while (true) {
+        size = bytePad64(1 + *len_size + body);
+        if (byteSizeofVarint(size - 1 - *len_size) == *len_size) {
+            break;
+        }
+        (*len_size)++;
+    }
+
+    return size;
+}
+
+size_t uvSizeofHeartbeats(unsigned n, size_t len)
+{
+    size_t len_size;
+    return sizeofHeartbeats(n, len, &len_size);
+}
+
+void *uvEncodeHeartbeats(unsigned n, size_t len, void *buf)
+{
+    size_t len_size;
+    size_t size = sizeofHeartbeats(n, len, &len_size);
+    void *cursor = buf;
+
+    memset(buf, 0, size);
+    bytePut8(&cursor, UV__COMPACT_MARKER | UV__HEARTBEATS);
+    bytePutVarint(&cursor, size - 1 - len_size);
+    bytePutVarint(&cursor, n);
+
+    return cursor;
+}
+
 void uvEncodeBatchHeader(const struct raft_entry *entries,
                          unsigned n,
                          void *buf)
@@ -397,9 +1001,127 @@ static int decodeAppendEntries(const uv_buf_t *buf,
         return rv;
     }
 
+    /* Legacy senders don't include the flags. */
+    args->quiesce = false;
+    if (buf->len >= sizeofAppendEntries(args, false)) {
+        cursor = (const uint8_t *)cursor + uvSizeofBatchHeader(args->n_entries);
+        byteGet64(&cursor); /* Batch checksums */
+        args->quiesce = (byteGet64(&cursor) & UV__APPEND_ENTRIES_QUIESCE) != 0;
+    }
+
     return 0;
 }
 
+static void initMessageInfo(struct uvMessageInfo *info)
+{
+    info->has_checksums = false;
+    info->checksums.header = 0;
+    info->checksums.data = 0;
+    info->batch.base = NULL;
+    info->batch.len = 0;
+    info->compressed_len = 0;
+    info->has_capabilities = false;
+    info->capabilities = 0;
+}
+
+/* Read the fields following the batch header of an AppendEntries message,
+ * which legacy senders don't include. */
+static void decodeAppendEntriesInfo(const uv_buf_t *header,
+                                    struct uvMessageInfo *info)
+{
+    const void *cursor;
+    struct raft_append_entries args;
+    struct uvBatchChecksums checksums;
+    uint64_t flags;
+
+    cursor = (const uint8_t *)header->base + sizeofAppendEntriesFields();
+    args.n_entries = (unsigned)byteGet64(&cursor);
+
+    if (header->len < sizeofAppendEntries(&args, false)) {
+        return;
+    }
+
+    cursor = (const uint8_t *)header->base + sizeofAppendEntriesFields() +
+             uvSizeofBatchHeader(args.n_entries);
+    checksums.header = byteGet32(&cursor);
+    checksums.data = byteGet32(&cursor);
+    flags = byteGet64(&cursor);
+
+    if ((flags & UV__APPEND_ENTRIES_CHECKSUMS) != 0) {
+        info->has_checksums = true;
+        info->checksums = checksums;
+        info->batch.base = header->base + sizeofAppendEntriesFields();
+        info->batch.len = uvSizeofBatchHeader(args.n_entries);
+    }
+    if ((flags & UV__APPEND_ENTRIES_COMPRESSED) != 0 &&
+        header->len >= sizeofAppendEntries(&args, true)) {
+        info->compressed_len = (size_t)byteGet64(&cursor);
+    }
+    info->has_capabilities = true;
+    info->capabilities = flags >> UV__APPEND_ENTRIES_CAPABILITIES_SHIFT;
+}
+
+/* Read the size of the compressed snapshot data of an InstallSnapshot
+ * message. */
+static void decodeInstallSnapshotInfo(const uv_buf_t *header,
+                                      struct uvMessageInfo *info)
+{
+    const void *cursor;
+    size_t conf_len;
+    uint64_t flags;
+
+    cursor = (const uint8_t *)header->base + sizeof(uint64_t) * 4;
+    conf_len = (size_t)byteGet64(&cursor);
+
+    if (header->len < sizeofInstallSnapshotV1(conf_len) +
+                          sizeof(uint64_t) * 2 /* Leader ID, size */) {
+        return;
+    }
+
+    cursor = (const uint8_t *)cursor + conf_len;
+    byteGet64(&cursor); /* Snapshot data size */
+    flags = byteGet64(&cursor);
+    if ((flags & UV__INSTALL_SNAPSHOT_COMPRESSED) == 0) {
+        return;
+    }
+    byteGet64(&cursor); /* Leader ID */
+    info->compressed_len = (size_t)byteGet64(&cursor);
+}
+
+/* Read the flags of an AppendEntriesResult message, which legacy senders don't
+ * include. */
+static void decodeAppendEntriesResultInfo(const uv_buf_t *header,
+                                          struct uvMessageInfo *info)
+{
+    const void *cursor;
+
+    if (header->len < sizeofAppendEntriesResultV2()) {
+        return;
+    }
+
+    cursor = (const uint8_t *)header->base + sizeofAppendEntriesResultV1();
+    info->has_capabilities = true;
+    info->capabilities = byteGet64(&cursor);
+}
+
+void uvDecodeMessageInfo(unsigned long type,
+                         const uv_buf_t *header,
+                         struct uvMessageInfo *info)
+{
+    initMessageInfo(info);
+    switch (type) {
+        case RAFT_IO_APPEND_ENTRIES:
+            decodeAppendEntriesInfo(header, info);
+            break;
+        case RAFT_IO_APPEND_ENTRIES_RESULT:
+            decodeAppendEntriesResultInfo(header, info);
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT:
+            decodeInstallSnapshotInfo(header, info);
+            break;
+    }
+}
+
 static void decodeAppendEntriesResult(const uv_buf_t *buf,
                                       struct raft_append_entries_result *p)
 {
@@ -410,6 +1132,13 @@ static void decodeAppendEntriesResult(const uv_buf_t *buf,
     p->term = byteGet64(&cursor);
     p->rejected = byteGet64(&cursor);
     p->last_log_index = byteGet64(&cursor);
+
+    /* Older senders don't include their last snapshot index. */
+    p->snapshot_index = 0;
+    if (buf->len >= sizeofAppendEntriesResult()) {
+        byteGet64(&cursor); /* Flags */
+        p->snapshot_index = byteGet64(&cursor);
+    }
 }
 
 static int decodeInstallSnapshot(const uv_buf_t *buf,
@@ -438,6 +1167,14 @@ static int decodeInstallSnapshot(const uv_buf_t *buf,
     cursor = (uint8_t *)cursor + conf.len;
     args->data.len = (size_t)byteGet64(&cursor);
 
+    /* Support for legacy install snapshot that doesn't have leader_id. */
+    if (buf->len > sizeofInstallSnapshotV1(conf.len)) {
+        byteGet64(&cursor); /* Flags */
+        args->leader_id = byteGet64(&cursor);
+    } else {
+        args->leader_id = 0;
+    }
+
     return 0;
 }
 
@@ -452,6 +1189,17 @@ static void decodeTimeoutNow(const uv_buf_t *buf, struct raft_timeout_now *p)
     p->last_log_term = byteGet64(&cursor);
 }
 
+static void decodeDelegateSnapshot(const uv_buf_t *buf,
+                                   struct raft_delegate_snapshot *p)
+{
+    const void *cursor;
+
+    cursor = buf->base;
+
+    p->term = byteGet64(&cursor);
+    p->server_id = byteGet64(&cursor);
+}
+
 int uvDecodeMessage(const unsigned long type,
                     const uv_buf_t *header,
                     struct raft_message *message,
@@ -489,6 +1237,9 @@ int uvDecodeMessage(const unsigned long type,
         case RAFT_IO_TIMEOUT_NOW:
             decodeTimeoutNow(header, &message->timeout_now);
             break;
+        case RAFT_IO_DELEGATE_SNAPSHOT:
+            decodeDelegateSnapshot(header, &message->delegate_snapshot);
+            break;
         default:
             rv = RAFT_IOERR;
             break;
@@ -497,6 +1248,326 @@ int uvDecodeMessage(const unsigned long type,
     return rv;
 }
 
+/* Cursor used to decode the header of compact messages. */
+struct compactDecoder
+{
+    const void *cursor;
+    const void *end;
+    bool ok; /* Cleared if the header turns out to be truncated */
+};
+
+static size_t compactRemaining(const struct compactDecoder *d)
+{
+    return (size_t)((const uint8_t *)d->end - (const uint8_t *)d->cursor);
+}
+
+static uint64_t compactGet(struct compactDecoder *d)
+{
+    uint64_t value;
+    if (!d->ok || !byteGetVarint(&d->cursor, d->end, &value)) {
+        d->ok = false;
+        return 0;
+    }
+    return value;
+}
+
+static uint32_t compactGet32(struct compactDecoder *d)
+{
+    uint32_t value = 0;
+    unsigned i;
+    if (!d->ok || compactRemaining(d) < sizeof(uint32_t)) {
+        d->ok = false;
+        return 0;
+    }
+    for (i = 0; i < sizeof(uint32_t); i++) {
+        value |= (uint32_t)byteGet8(&d->cursor) << (i * 8);
+    }
+    return value;
+}
+
+static int decodeCompactRequestVote(struct compactDecoder *d,
+                                    struct raft_request_vote *p)
+{
+    uint64_t flags;
+
+    p->term = compactGet(d);
+    p->candidate_id = compactGet(d);
+    p->last_log_index = compactGet(d);
+    p->last_log_term = compactGet(d);
+    flags = compactGet(d);
+    p->disrupt_leader = (bool)(flags & 1 << 0);
+    p->pre_vote = (bool)(flags & 1 << 1);
+
+    return d->ok ? 0 : RAFT_MALFORMED;
+}
+
+static int decodeCompactAppendEntries(struct compactDecoder *d,
+                                      struct raft_append_entries *args,
+                                      struct uvMessageInfo *info)
+{
+    raft_term term;
+    uint64_t flags;
+    uint64_t n;
+    unsigned i;
+    int rv;
+
+    args->term = compactGet(d);
+    args->prev_log_index = compactGet(d);
+    args->prev_log_term = compactGet(d);
+    args->leader_commit = compactGet(d);
+    flags = compactGet(d);
+    n = compactGet(d);
+
+    /* Each entry header takes at least 3 bytes, which bounds the number of
+     * entries that a valid header can hold. */
+    if (!d->ok || n > compactRemaining(d) / 3) {
+        rv = RAFT_MALFORMED;
+        goto err;
+    }
+    args->n_entries = (unsigned)n;
+
+    if (n == 0) {
+        args->entries = NULL;
+    } else {
+        args->entries = raft_malloc(n * sizeof *args->entries);
+        if (args->entries == NULL) {
+            rv = RAFT_NOMEM;
+            goto err;
+        }
+    }
+
+    term = args->prev_log_term;
+    for (i = 0; i < args->n_entries; i++) {
+        struct raft_entry *entry = &args->entries[i];
+        uint64_t len;
+
+        term += (raft_term)byteUnZigZag(compactGet(d));
+        entry->term = term;
+        entry->type = (unsigned short)compactGet(d);
+        len = compactGet(d);
+
+        if (entry->type != RAFT_COMMAND && entry->type != RAFT_BARRIER &&
+            entry->type != RAFT_CHANGE) {
+            rv = RAFT_MALFORMED;
+            goto err_after_alloc;
+        }
+
+        /* Sizes must fit the batch header of segment files. */
+        if (len > UINT32_MAX) {
+            rv = RAFT_MALFORMED;
+            goto err_after_alloc;
+        }
+        entry->buf.len = (size_t)len;
+    }
+
+    if ((flags & UV__APPEND_ENTRIES_CHECKSUMS) != 0) {
+        info->has_checksums = true;
+        info->checksums.header = compactGet32(d);
+        info->checksums.data = compactGet32(d);
+    }
+    if ((flags & UV__APPEND_ENTRIES_COMPRESSED) != 0) {
+        info->compressed_len = (size_t)compactGet(d);
+    }
+    info->has_capabilities = true;
+    info->capabilities = flags >> UV__APPEND_ENTRIES_CAPABILITIES_SHIFT;
+    args->quiesce = (flags & UV__APPEND_ENTRIES_QUIESCE) != 0;
+
+    if (!d->ok) {
+        rv = RAFT_MALFORMED;
+        goto err_after_alloc;
+    }
+
+    return 0;
+
+err_after_alloc:
+    if (args->entries != NULL) {
+        raft_free(args->entries);
+    }
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+static int decodeCompactInstallSnapshot(struct compactDecoder *d,
+                                        struct raft_install_snapshot *args,
+                                        struct uvMessageInfo *info)
+{
+    struct raft_buffer conf;
+    uint64_t flags;
+    int rv;
+
+    args->term = compactGet(d);
+    args->last_index = compactGet(d);
+    args->last_term = compactGet(d);
+    args->conf_index = compactGet(d);
+    conf.len = (size_t)compactGet(d);
+    if (!d->ok || conf.len > compactRemaining(d)) {
+        return RAFT_MALFORMED;
+    }
+    conf.base = (void *)d->cursor;
+    configurationInit(&args->conf);
+    rv = configurationDecode(&conf, &args->conf);
+    if (rv != 0) {
+        return rv;
+    }
+    d->cursor = (const uint8_t *)d->cursor + conf.len;
+
+    args->data.len = (size_t)compactGet(d);
+    flags = compactGet(d);
+    args->leader_id = compactGet(d);
+    if ((flags & UV__INSTALL_SNAPSHOT_COMPRESSED) != 0) {
+        info->compressed_len = (size_t)compactGet(d);
+    }
+
+    if (!d->ok) {
+        configurationClose(&args->conf);
+        return RAFT_MALFORMED;
+    }
+
+    return 0;
+}
+
+int uvDecodeCompactMessage(unsigned long type,
+                           const uv_buf_t *header,
+                           struct raft_message *message,
+                           size_t *payload_len,
+                           struct uvMessageInfo *info)
+{
+    struct compactDecoder d;
+    unsigned i;
+    int rv = 0;
+
+    d.cursor = header->base;
+    d.end = header->base + header->len;
+    d.ok = true;
+
+    initMessageInfo(info);
+
+    message->type = (unsigned short)type;
+
+    *payload_len = 0;
+
+    switch (type) {
+        case RAFT_IO_REQUEST_VOTE:
+            rv = decodeCompactRequestVote(&d, &message->request_vote);
+            break;
+        case RAFT_IO_REQUEST_VOTE_RESULT:
+            message->request_vote_result.term = compactGet(&d);
+            message->request_vote_result.vote_granted = compactGet(&d);
+            break;
+        case RAFT_IO_APPEND_ENTRIES:
+            rv = decodeCompactAppendEntries(&d, &message->append_entries,
+                                            info);
+            if (rv != 0) {
+                break;
+            }
+            for (i = 0; i < message->append_entries.n_entries; i++) {
+                *payload_len += message->append_entries.entries[i].buf.len;
+            }
+            break;
+        case RAFT_IO_APPEND_ENTRIES_RESULT:
+            message->append_entries_result.term = compactGet(&d);
+            message->append_entries_result.rejected = compactGet(&d);
+            message->append_entries_result.last_log_index = compactGet(&d);
+            info->has_capabilities = true;
+            info->capabilities = compactGet(&d);
+            /* Older senders don't include their last snapshot index. */
+            message->append_entries_result.snapshot_index =
+                compactRemaining(&d) > 0 ? compactGet(&d) : 0;
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT:
+            rv = decodeCompactInstallSnapshot(&d, &message->install_snapshot,
+                                              info);
+            if (rv != 0) {
+                break;
+            }
+            *payload_len += message->install_snapshot.data.len;
+            break;
+        case RAFT_IO_TIMEOUT_NOW:
+            message->timeout_now.term = compactGet(&d);
+            message->timeout_now.last_log_index = compactGet(&d);
+            message->timeout_now.last_log_term = compactGet(&d);
+            break;
+        case RAFT_IO_DELEGATE_SNAPSHOT:
+            message->delegate_snapshot.term = compactGet(&d);
+            message->delegate_snapshot.server_id = compactGet(&d);
+            break;
+        default:
+            rv = RAFT_MALFORMED;
+            break;
+    };
+
+    /* Messages that allocate memory check for truncation themselves. */
+    if (rv == 0 && !d.ok) {
+        rv = RAFT_MALFORMED;
+    }
+
+    return rv;
+}
+
+int uvDecodeGroupTag(const uv_buf_t *header, uint64_t *group)
+{
+    const void *cursor = header->base;
+    const void *end = header->base + header->len;
+    if (!byteGetVarint(&cursor, end, group) || *group == 0) {
+        return RAFT_MALFORMED;
+    }
+    return 0;
+}
+
+int uvDecodeHeartbeats(const uv_buf_t *header,
+                       struct uvHeartbeat **heartbeats,
+                       unsigned *n)
+{
+    struct compactDecoder d;
+    uint64_t count;
+    unsigned i;
+
+    d.cursor = header->base;
+    d.end = header->base + header->len;
+    d.ok = true;
+
+    /* Each heartbeat takes at least 6 bytes, which bounds the number of
+     * heartbeats that a valid record can hold. */
+    count = compactGet(&d);
+    if (!d.ok || count == 0 || count > compactRemaining(&d) / 6) {
+        return RAFT_MALFORMED;
+    }
+
+    *heartbeats = raft_malloc(count * sizeof **heartbeats);
+    if (*heartbeats == NULL) {
+        return RAFT_NOMEM;
+    }
+    *n = (unsigned)count;
+
+    for (i = 0; i < *n; i++) {
+        struct uvHeartbeat *heartbeat = &(*heartbeats)[i];
+        struct raft_append_entries *args = &heartbeat->args;
+        uint64_t flags;
+        heartbeat->group = compactGet(&d);
+        args->term = compactGet(&d);
+        args->prev_log_index = compactGet(&d);
+        args->prev_log_term = compactGet(&d);
+        args->leader_commit = compactGet(&d);
+        args->entries = NULL;
+        args->n_entries = 0;
+        flags = compactGet(&d);
+        args->quiesce = (flags & UV__APPEND_ENTRIES_QUIESCE) != 0;
+        heartbeat->capabilities =
+            flags >> UV__APPEND_ENTRIES_CAPABILITIES_SHIFT;
+        if (heartbeat->group == 0) {
+            d.ok = false;
+        }
+    }
+
+    if (!d.ok) {
+        raft_free(*heartbeats);
+        return RAFT_MALFORMED;
+    }
+
+    return 0;
+}
+
 void uvDecodeEntriesBatch(uint8_t *batch,
                           size_t offset,
                           struct raft_entry *entries,
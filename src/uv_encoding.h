@@ -10,15 +10,156 @@
 /* Current disk format version. */
 #define UV__DISK_FORMAT 1
 
+/* Capabilities that a server advertises to the servers it exchanges messages
+ * with, in AppendEntries and AppendEntriesResult messages. */
+#define UV__CAPABILITY_COMPRESSION (1 << 0) /* Can decompress payloads */
+#define UV__CAPABILITY_COMPACT (1 << 1)     /* Can decode compact headers */
+#define UV__CAPABILITY_HEARTBEATS (1 << 2)  /* Can decode heartbeat records */
+
+/* AppendEntries header flag set when the batch checksums are included. */
+#define UV__APPEND_ENTRIES_CHECKSUMS (1 << 0)
+
+/* AppendEntries header flag set when the entries data is compressed. */
+#define UV__APPEND_ENTRIES_COMPRESSED (1 << 1)
+
+/* AppendEntries header flag set when the leader is quiescent. */
+#define UV__APPEND_ENTRIES_QUIESCE (1 << 2)
+
+/* Offset of the capabilities of the sender within the flags of AppendEntries
+ * headers. */
+#define UV__APPEND_ENTRIES_CAPABILITIES_SHIFT 8
+
+/* InstallSnapshot header flag set when the snapshot data is compressed. */
+#define UV__INSTALL_SNAPSHOT_COMPRESSED (1 << 0)
+
+/* Bit set in the first byte of the preamble of compact messages, which is
+ * followed by the header length as a varint. In the preamble of regular
+ * messages, the first byte is the low byte of the message type. */
+#define UV__COMPACT_MARKER 0x80
+
+/* Maximum size of the preamble of a compact message. */
+#define UV__COMPACT_PREAMBLE_MAX_SIZE (1 + 10)
+
+/* Type of the compact record preceding each message sent over a connection
+ * shared by the raft groups of a host. Its header holds the ID of the group the
+ * message belongs to as a varint, padded with zeros so that the record keeps
+ * the message 8-byte aligned. */
+#define UV__GROUP_TAG 0x7f
+
+/* Type of the compact record coalescing heartbeats sent by the raft groups of
+ * a host to the same server. Its header holds the number of heartbeats as a
+ * varint, followed by the fields of each heartbeat as varints, starting with
+ * the ID of its group, and it's padded like UV__GROUP_TAG records. */
+#define UV__HEARTBEATS 0x7e
+
+/* Checksums of the header and of the data of a batch of entries, as stored in
+ * segment files. */
+struct uvBatchChecksums
+{
+    unsigned header; /* CRC32 of the batch header */
+    unsigned data;   /* CRC32 of the entries data */
+};
+
+/* Details carried by the header of a message besides its content. */
+struct uvMessageInfo
+{
+    bool has_checksums;                /* Whether batch checksums were sent */
+    struct uvBatchChecksums checksums; /* Checksums of the batch, if sent */
+    uv_buf_t batch;         /* Batch header as sent, NULL if not available */
+    size_t compressed_len;  /* Size of the compressed payload, or 0 */
+    bool has_capabilities;  /* Whether the sender advertised capabilities */
+    uint64_t capabilities;  /* UV__CAPABILITY_* flags of the sender */
+};
+
+/* Heartbeat decoded from a UV__HEARTBEATS record. */
+struct uvHeartbeat
+{
+    uint64_t group;                  /* Group the heartbeat belongs to */
+    struct raft_append_entries args; /* AppendEntries without entries */
+    uint64_t capabilities;           /* UV__CAPABILITY_* flags of the sender */
+};
+
+/* Return the capabilities that this server advertises. */
+uint64_t uvCapabilities(void);
+
+/* Encode the given message into an array of buffers. The first buffer holds
+ * the preamble and the header of the message and is owned by the caller, which
+ * must release it along with the array. Further buffers point to payload data
+ * of the message.
+ *
+ * If @batch is not NULL, it must point to the already encoded batch header of
+ * the entries of an AppendEntries message: in that case the batch header is not
+ * encoded again, and @batch gets referenced by the second buffer. In that case
+ * @checksums can also be given, to let the receiver validate the batch and
+ * write it to disk without computing the checksums again.
+ *
+ * If @compress is true, the payload of AppendEntries and InstallSnapshot
+ * messages gets compressed into the first buffer, unless that doesn't make it
+ * smaller.
+ *
+ * If @compact is true, the preamble and header are encoded in the compact
+ * format, where integers are varints and the terms of the entries of an
+ * AppendEntries message are delta-encoded. The @batch header is not used in
+ * that case, but @checksums still apply.
+ *
+ * If @group is not 0, the message is preceded by a UV__GROUP_TAG record. */
 int uvEncodeMessage(const struct raft_message *message,
+                    const uv_buf_t *batch,
+                    const struct uvBatchChecksums *checksums,
+                    bool compress,
+                    bool compact,
+                    uint64_t group,
                     uv_buf_t **bufs,
                     unsigned *n_bufs);
 
+/* Encode the given AppendEntries message without entries, sent by the given
+ * group, as a heartbeat of a UV__HEARTBEATS record. As with uvEncodeMessage(),
+ * the caller must release the first buffer and the array. */
+int uvEncodeHeartbeat(const struct raft_message *message,
+                      uint64_t group,
+                      uv_buf_t **bufs,
+                      unsigned *n_bufs);
+
+/* Return the size of a UV__HEARTBEATS record holding @n heartbeats encoded with
+ * uvEncodeHeartbeat(), whose size is @len in total. */
+size_t uvSizeofHeartbeats(unsigned n, size_t len);
+
+/* Encode the beginning of a UV__HEARTBEATS record holding @n heartbeats whose
+ * size is @len in total into @buf, which must be as large as returned by
+ * uvSizeofHeartbeats(). Return the position where the heartbeats must be
+ * copied. */
+void *uvEncodeHeartbeats(unsigned n, size_t len, void *buf);
+
 int uvDecodeMessage(unsigned long type,
                     const uv_buf_t *header,
                     struct raft_message *message,
                     size_t *payload_len);
 
+/* Fill @info with the details found in the header of a regular message that
+ * was decoded with uvDecodeMessage(). */
+void uvDecodeMessageInfo(unsigned long type,
+                         const uv_buf_t *header,
+                         struct uvMessageInfo *info);
+
+/* Decode the header of a compact message, filling both @message and @info.
+ * Return RAFT_MALFORMED if the header is truncated or invalid. */
+int uvDecodeCompactMessage(unsigned long type,
+                           const uv_buf_t *header,
+                           struct raft_message *message,
+                           size_t *payload_len,
+                           struct uvMessageInfo *info);
+
+/* Decode the header of a UV__GROUP_TAG record. Return RAFT_MALFORMED if it
+ * doesn't hold a valid group ID. */
+int uvDecodeGroupTag(const uv_buf_t *header, uint64_t *group);
+
+/* Decode the header of a UV__HEARTBEATS record, filling @heartbeats with an
+ * array of @n heartbeats that the caller must release. Return RAFT_MALFORMED
+ * if it's truncated or invalid. */
+int uvDecodeHeartbeats(const uv_buf_t *header,
+                       struct uvHeartbeat **heartbeats,
+                       unsigned *n);
+
 int uvDecodeBatchHeader(const void *batch,
                         struct raft_entry **entries,
                         unsigned *n);
@@ -1,5 +1,6 @@
 #include "assert.h"
 #include "heap.h"
+#include "metrics.h"
 #include "queue.h"
 #include "uv.h"
 #include "uv_os.h"
@@ -20,6 +21,7 @@ struct uvDyingSegment
     raft_index first_index; /* Index of first entry */
     raft_index last_index;  /* Index of last entry */
     int status;             /* Status code of blocking syscalls */
+    uint64_t duration;      /* Time taken by blocking syscalls */
     queue queue;            /* Link to finalize queue */
 };
 
@@ -34,6 +36,7 @@ static void uvFinalizeWorkCb(uv_work_t *work)
     char filename1[UV__FILENAME_LEN];
     char filename2[UV__FILENAME_LEN];
     char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    uint64_t start = uv_hrtime();
     int rv;
 
     sprintf(filename1, UV__OPEN_TEMPLATE, segment->counter);
@@ -65,6 +68,7 @@ sync:
         goto err;
     }
 
+    segment->duration = uv_hrtime() - start;
     segment->status = 0;
     return;
 
@@ -86,6 +90,8 @@ static void uvFinalizeAfterWorkCb(uv_work_t *work, int status)
     uv->finalize_work.data = NULL;
     if (segment->status != 0) {
         uv->errored = true;
+    } else {
+        metricsRecord(&uv->metrics.finalize_latency, segment->duration / 1000);
     }
     HeapFree(segment);
 
@@ -168,6 +168,7 @@ int UvFsOpenFileForReading(const char *dir,
 int UvFsAllocateFile(const char *dir,
                      const char *filename,
                      size_t size,
+                     bool dsync,
                      uv_file *fd,
                      char *errmsg)
 {
@@ -178,7 +179,9 @@ int UvFsAllocateFile(const char *dir,
     UvOsJoin(dir, filename, path);
 
     /* TODO: use RWF_DSYNC instead, if available. */
-    flags |= O_DSYNC;
+    if (dsync) {
+        flags |= O_DSYNC;
+    }
 
     rv = uvFsOpenFile(dir, filename, flags, S_IRUSR | S_IWUSR, fd, errmsg);
     if (rv != 0) {
@@ -682,8 +685,8 @@ int UvFsProbeCapabilities(const char *dir,
 
     /* Create a temporary probe file. */
     UvFsRemoveFile(dir, UV__FS_PROBE_FILE, ignored);
-    rv = UvFsAllocateFile(dir, UV__FS_PROBE_FILE, UV__FS_PROBE_FILE_SIZE, &fd,
-                          errmsg);
+    rv = UvFsAllocateFile(dir, UV__FS_PROBE_FILE, UV__FS_PROBE_FILE_SIZE, true,
+                          &fd, errmsg);
     if (rv != 0) {
         ErrMsgWrapf(errmsg, "create I/O capabilities probe file");
         goto err;
@@ -33,10 +33,12 @@ int UvFsFileIsEmpty(const char *dir,
                     char *errmsg);
 
 /* Create the given file in the given directory and allocate the given size to
- * it, returning its file descriptor. The file must not exist yet. */
+ * it, returning its file descriptor. The file must not exist yet. If @dsync is
+ * true the file is opened with O_DSYNC. */
 int UvFsAllocateFile(const char *dir,
                      const char *filename,
                      size_t size,
+                     bool dsync,
                      uv_file *fd,
                      char *errmsg);
 
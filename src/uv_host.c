@@ -0,0 +1,399 @@
+#include <string.h>
+
+#include "../include/raft/uv.h"
+#include "assert.h"
+#include "err.h"
+#include "heap.h"
+#include "uv.h"
+
+/* Hosting many raft groups in the same process works as follows:
+ *
+ * - The host creates a carrier @raft_io instance, which is never started but
+ *   owns the transport, the clients connected to other hosts and the servers
+ *   accepted from them.
+ *
+ * - Each group has its own hosted instance, which handles disk I/O on its own
+ *   but submits its messages to the clients of the carrier, tagging each of
+ *   them with its group ID.
+ *
+ * - The servers of the carrier dispatch each message they receive to the
+ *   hosted instance with the ID it was tagged with, looking it up in the array
+ *   of the host's instances, which is kept sorted by group ID.
+ *
+ * - A single timer ticks all the started instances, firing at the smallest
+ *   interval that any of them has requested. Instances with a longer interval
+ *   tick once at least their own interval has elapsed since their last tick.
+ *
+ * - With group commit enabled, hosted instances open their segments without
+ *   O_DSYNC, and after each write they wait for the next flush of the host.
+ *   While a flush is in progress, the writes that complete in the meantime are
+ *   queued, and the next flush makes all of them durable at once, issuing a
+ *   single syncfs() for each file system that their segments live on.
+ */
+
+/* Initial capacity of the array of hosted instances. */
+#define UV__HOST_GROUPS_INITIAL_SIZE 16
+
+struct uv *UvNet(struct uv *uv)
+{
+    if (uv->group != 0) {
+        return uv->host->carrier;
+    }
+    return uv;
+}
+
+/* Return the index of the first hosted instance whose group ID is not lower
+ * than the given one. */
+static unsigned uvHostSearch(struct uvHost *h, uint64_t group)
+{
+    unsigned lo = 0;
+    unsigned hi = h->n_groups;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (h->groups[mid]->group < group) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int UvHostAdd(struct uvHost *h, struct uv *uv)
+{
+    unsigned i = uvHostSearch(h, uv->group);
+
+    if (i < h->n_groups && h->groups[i]->group == uv->group) {
+        return RAFT_DUPLICATEID;
+    }
+
+    if (h->n_groups == h->groups_size) {
+        unsigned size = h->groups_size == 0 ? UV__HOST_GROUPS_INITIAL_SIZE
+                                            : h->groups_size * 2;
+        struct uv **groups = HeapRealloc(h->groups, size * sizeof *groups);
+        if (groups == NULL) {
+            return RAFT_NOMEM;
+        }
+        h->groups = groups;
+        h->groups_size = size;
+    }
+
+    memmove(&h->groups[i + 1], &h->groups[i],
+            (h->n_groups - i) * sizeof *h->groups);
+    h->groups[i] = uv;
+    h->n_groups++;
+
+    return 0;
+}
+
+void UvHostRemove(struct uvHost *h, struct uv *uv)
+{
+    unsigned i = uvHostSearch(h, uv->group);
+    assert(i < h->n_groups && h->groups[i] == uv);
+    h->n_groups--;
+    memmove(&h->groups[i], &h->groups[i + 1],
+            (h->n_groups - i) * sizeof *h->groups);
+}
+
+struct uv *UvHostGroup(struct uvHost *h, uint64_t group)
+{
+    unsigned i = uvHostSearch(h, group);
+    struct uv *uv;
+    if (i == h->n_groups || h->groups[i]->group != group) {
+        return NULL;
+    }
+    uv = h->groups[i];
+    if (uv->recv_cb == NULL || uv->closing) {
+        return NULL;
+    }
+    return uv;
+}
+
+/* Tick all the started instances whose interval has elapsed. */
+static void uvHostTimerCb(uv_timer_t *timer)
+{
+    struct uvHost *h = timer->data;
+    uint64_t now = uv_now(timer->loop);
+    unsigned i;
+
+    for (i = 0; i < h->n_groups; i++) {
+        struct uv *uv = h->groups[i];
+        if (uv->tick_cb == NULL || uv->closing) {
+            continue;
+        }
+        if (now - uv->tick_last < uv->tick_msecs) {
+            continue;
+        }
+        uv->tick_last = now;
+        uv->tick_cb(uv->io);
+    }
+}
+
+void UvHostStart(struct uvHost *h, struct uv *uv, unsigned msecs)
+{
+    int rv;
+
+    uv->tick_msecs = msecs;
+    uv->tick_last = uv_now(h->carrier->loop);
+
+    if (h->tick_msecs != 0 && h->tick_msecs <= msecs) {
+        return;
+    }
+    h->tick_msecs = msecs;
+    rv = uv_timer_start(&h->timer, uvHostTimerCb, msecs, msecs);
+    assert(rv == 0);
+}
+
+bool UvHostGroupCommit(struct uv *uv)
+{
+    return uv->group != 0 && uv->host->group_commit;
+}
+
+/* Flush the file systems holding the files of the inflight sync requests,
+ * sharing the outcome of a flush among the requests on the same device. */
+static void uvHostSyncWorkCb(uv_work_t *work)
+{
+    struct uvHost *h = work->data;
+    struct uvHostSync *req;
+    struct uvHostSync *prev;
+    queue *head;
+    queue *prev_head;
+    uv_stat_t sb;
+    int rv;
+
+    QUEUE_FOREACH(head, &h->sync_inflight)
+    {
+        req = QUEUE_DATA(head, struct uvHostSync, queue);
+        req->flushed = false;
+        rv = UvOsFstat(req->fd, &sb);
+        if (rv != 0) {
+            UvOsErrMsg(req->errmsg, "fstat", rv);
+            req->status = RAFT_IOERR;
+            continue;
+        }
+        req->dev = sb.st_dev;
+
+        QUEUE_FOREACH(prev_head, &h->sync_inflight)
+        {
+            if (prev_head == head) {
+                break;
+            }
+            prev = QUEUE_DATA(prev_head, struct uvHostSync, queue);
+            if (prev->flushed && prev->dev == req->dev) {
+                req->status = prev->status;
+                memcpy(req->errmsg, prev->errmsg, sizeof req->errmsg);
+                req->flushed = true;
+                break;
+            }
+        }
+        if (req->flushed) {
+            continue;
+        }
+
+        rv = UvOsSyncfs(req->fd);
+        if (rv != 0) {
+            UvOsErrMsg(req->errmsg, "syncfs", rv);
+            req->status = RAFT_IOERR;
+        } else {
+            req->status = 0;
+        }
+        req->flushed = true;
+    }
+}
+
+static void uvHostSyncStart(struct uvHost *h);
+
+static void uvHostSyncAfterWorkCb(uv_work_t *work, int status)
+{
+    struct uvHost *h = work->data;
+    struct uvHostSync *req;
+    queue *head;
+    queue q;
+
+    assert(status == 0);
+
+    QUEUE_INIT(&q);
+    while (!QUEUE_IS_EMPTY(&h->sync_inflight)) {
+        head = QUEUE_HEAD(&h->sync_inflight);
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(&q, head);
+    }
+
+    /* Start the next flush before firing the callbacks, since a callback might
+     * close its instance and the host along with it. */
+    if (!QUEUE_IS_EMPTY(&h->sync_reqs)) {
+        uvHostSyncStart(h);
+    }
+
+    while (!QUEUE_IS_EMPTY(&q)) {
+        head = QUEUE_HEAD(&q);
+        req = QUEUE_DATA(head, struct uvHostSync, queue);
+        QUEUE_REMOVE(head);
+        req->cb(req, req->status);
+    }
+}
+
+/* Flush all the sync requests that have been queued so far. */
+static void uvHostSyncStart(struct uvHost *h)
+{
+    queue *head;
+    int rv;
+
+    assert(QUEUE_IS_EMPTY(&h->sync_inflight));
+    assert(!QUEUE_IS_EMPTY(&h->sync_reqs));
+
+    while (!QUEUE_IS_EMPTY(&h->sync_reqs)) {
+        head = QUEUE_HEAD(&h->sync_reqs);
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(&h->sync_inflight, head);
+    }
+
+    rv = uv_queue_work(h->carrier->loop, &h->sync_work, uvHostSyncWorkCb,
+                       uvHostSyncAfterWorkCb);
+    assert(rv == 0); /* This should never fail */
+}
+
+void UvHostSync(struct uvHost *h,
+                struct uvHostSync *req,
+                uv_file fd,
+                uvHostSyncCb cb)
+{
+    req->fd = fd;
+    req->status = 0;
+    req->errmsg[0] = '\0';
+    req->cb = cb;
+    QUEUE_PUSH(&h->sync_reqs, &req->queue);
+    if (QUEUE_IS_EMPTY(&h->sync_inflight)) {
+        uvHostSyncStart(h);
+    }
+}
+
+int raft_uv_host_init(struct raft_uv_host *host,
+                      struct uv_loop_s *loop,
+                      struct raft_uv_transport *transport,
+                      raft_id id,
+                      const char *address)
+{
+    struct uvHost *h;
+    int rv;
+
+    assert(host != NULL);
+    assert(loop != NULL);
+    assert(transport != NULL);
+
+    h = HeapMalloc(sizeof *h);
+    if (h == NULL) {
+        rv = RAFT_NOMEM;
+        ErrMsgOom(host->errmsg);
+        goto err;
+    }
+    h->host = host;
+    h->groups = NULL;
+    h->n_groups = 0;
+    h->groups_size = 0;
+    h->tick_msecs = 0;
+    h->closing = false;
+    h->close_cb = NULL;
+    h->group_commit = false;
+    QUEUE_INIT(&h->sync_reqs);
+    QUEUE_INIT(&h->sync_inflight);
+    h->sync_work.data = h;
+
+    h->io.data = h;
+    rv = raft_uv_init(&h->io, loop, "", transport);
+    if (rv != 0) {
+        ErrMsgTransfer(h->io.errmsg, host->errmsg, "carrier");
+        goto err_after_alloc;
+    }
+    h->carrier = h->io.impl;
+    h->carrier->host = h;
+    h->carrier->id = id;
+
+    rv = transport->init(transport, id, address);
+    if (rv != 0) {
+        ErrMsgTransfer(transport->errmsg, host->errmsg, "transport");
+        goto err_after_carrier_init;
+    }
+    transport->data = h->carrier;
+
+    rv = uv_timer_init(loop, &h->timer);
+    assert(rv == 0); /* This should never fail */
+    h->timer.data = h;
+
+    host->impl = h;
+    return 0;
+
+err_after_carrier_init:
+    raft_uv_close(&h->io);
+err_after_alloc:
+    HeapFree(h);
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+int raft_uv_host_start(struct raft_uv_host *host)
+{
+    struct uvHost *h = host->impl;
+    int rv;
+    h->carrier->state = UV__ACTIVE;
+    rv = UvRecvStart(h->carrier);
+    if (rv != 0) {
+        ErrMsgTransfer(h->carrier->transport->errmsg, host->errmsg,
+                       "transport");
+        return rv;
+    }
+    return 0;
+}
+
+void raft_uv_host_set_group_commit(struct raft_uv_host *host, bool enabled)
+{
+    struct uvHost *h = host->impl;
+    assert(h->n_groups == 0);
+    h->group_commit = enabled;
+}
+
+static void uvHostMaybeFireCloseCb(struct uvHost *h)
+{
+    struct raft_uv_host *host = h->host;
+    raft_uv_host_close_cb cb = h->close_cb;
+
+    if (h->timer.data != NULL || h->carrier != NULL) {
+        return;
+    }
+
+    raft_uv_close(&h->io);
+    if (h->groups != NULL) {
+        HeapFree(h->groups);
+    }
+    HeapFree(h);
+
+    if (cb != NULL) {
+        cb(host);
+    }
+}
+
+static void uvHostTimerCloseCb(uv_handle_t *handle)
+{
+    struct uvHost *h = handle->data;
+    h->timer.data = NULL;
+    uvHostMaybeFireCloseCb(h);
+}
+
+static void uvHostCarrierCloseCb(struct raft_io *io)
+{
+    struct uvHost *h = io->data;
+    h->carrier = NULL;
+    uvHostMaybeFireCloseCb(h);
+}
+
+void raft_uv_host_close(struct raft_uv_host *host, raft_uv_host_close_cb cb)
+{
+    struct uvHost *h = host->impl;
+    assert(!h->closing);
+    assert(h->n_groups == 0);
+    h->closing = true;
+    h->close_cb = cb;
+    uv_close((uv_handle_t *)&h->timer, uvHostTimerCloseCb);
+    h->io.close(&h->io, uvHostCarrierCloseCb);
+}
@@ -0,0 +1,379 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../include/raft.h"
+#include "../include/raft/uv.h"
+#include "assert.h"
+#include "err.h"
+#include "heap.h"
+#include "queue.h"
+
+/* The happy path of a connection request is:
+ *
+ * - Queue the request and start the idle handle of the transport, so the
+ *   request gets processed asynchronously in the next loop iteration, without
+ *   the loop blocking for I/O in between. Idle handles run before prepare
+ *   ones, so messages that a client queues for its next flush upon connecting
+ *   are written out in the same iteration.
+ * - In the idle callback, look up the listening transport whose address
+ *   matches the requested one, create a pair of connected sockets, pass one end
+ *   to the accept callback of the listening transport and the other end to the
+ *   connect callback.
+ *
+ * Since both ends live in the same process, there's no handshake: the accept
+ * callback is passed the ID and address of the connecting transport directly.
+ *
+ * Possible failure modes are:
+ *
+ * - There's no listening transport with the requested address, or it's running
+ *   on a different event loop: fire the request callback with
+ *   RAFT_NOCONNECTION.
+ *
+ * - The transport gets closed: fire the callbacks of all requests that were
+ *   not yet processed with RAFT_CANCELED, once the idle handle is closed.
+ */
+
+struct UvLoopback
+{
+    struct raft_uv_transport *transport; /* Interface object we implement */
+    struct uv_loop_s *loop;              /* Event loop */
+    raft_id id;                          /* ID of this raft server */
+    const char *address;                 /* Address of this raft server */
+    struct uv_idle_s idle;               /* Process connect requests */
+    raft_uv_accept_cb accept_cb;         /* Call after accepting a connection */
+    queue connecting;                    /* Pending connection requests */
+    queue queue;                         /* Listening transports queue */
+    bool closing;                        /* True after close() is called */
+    raft_uv_transport_close_cb close_cb; /* Call when it's safe to free us */
+};
+
+/* Hold state for a single connection request. */
+struct uvLoopbackConnect
+{
+    struct raft_uv_connect *req; /* User request */
+    char *address;               /* Address to connect to */
+    queue queue;                 /* Pending connect queue */
+};
+
+/* All loopback transports in this process that are listening for
+ * connections. Transports running on different loops might be used by
+ * different threads, so access is protected by a mutex. */
+static queue uvLoopbackListeners = {&uvLoopbackListeners, &uvLoopbackListeners};
+static uv_mutex_t uvLoopbackListenersMutex;
+static uv_once_t uvLoopbackListenersOnce = UV_ONCE_INIT;
+
+static void uvLoopbackListenersInit(void)
+{
+    int rv;
+    rv = uv_mutex_init(&uvLoopbackListenersMutex);
+    assert(rv == 0);
+    (void)rv;
+}
+
+static void uvLoopbackListenersLock(void)
+{
+    uv_once(&uvLoopbackListenersOnce, uvLoopbackListenersInit);
+    uv_mutex_lock(&uvLoopbackListenersMutex);
+}
+
+static void uvLoopbackListenersUnlock(void)
+{
+    uv_mutex_unlock(&uvLoopbackListenersMutex);
+}
+
+/* Return the listening transport with the given address, if any. Must be
+ * called with the listeners mutex held. */
+static struct UvLoopback *uvLoopbackLookup(const char *address)
+{
+    queue *head;
+    QUEUE_FOREACH(head, &uvLoopbackListeners)
+    {
+        struct UvLoopback *l = QUEUE_DATA(head, struct UvLoopback, queue);
+        if (strcmp(l->address, address) == 0) {
+            return l;
+        }
+    }
+    return NULL;
+}
+
+/* Wrap a socket file descriptor into a new stream handle. */
+static int uvLoopbackOpen(struct uv_loop_s *loop,
+                          int fd,
+                          struct uv_stream_s **stream)
+{
+    struct uv_pipe_s *pipe;
+    int rv;
+    pipe = HeapMalloc(sizeof *pipe);
+    if (pipe == NULL) {
+        return RAFT_NOMEM;
+    }
+    rv = uv_pipe_init(loop, pipe, 0);
+    assert(rv == 0);
+    rv = uv_pipe_open(pipe, fd);
+    if (rv != 0) {
+        /* UNTESTED: this should fail only because of lack of resources. */
+        uv_close((struct uv_handle_s *)pipe, (uv_close_cb)HeapFree);
+        return RAFT_NOCONNECTION;
+    }
+    *stream = (struct uv_stream_s *)pipe;
+    return 0;
+}
+
+/* Create a new connection between the given transport and the given listening
+ * one, firing the accept callback of the latter. */
+static int uvLoopbackPair(struct UvLoopback *l,
+                          struct UvLoopback *listener,
+                          unsigned channel,
+                          struct uv_stream_s **stream)
+{
+    struct uv_stream_s *accepted;
+    int fds[2];
+    int rv;
+
+    rv = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+    if (rv != 0) {
+        ErrMsgPrintf(l->transport->errmsg, "socketpair(): %s",
+                     strerror(errno));
+        rv = RAFT_NOCONNECTION;
+        goto err;
+    }
+
+    rv = uvLoopbackOpen(l->loop, fds[0], stream);
+    if (rv != 0) {
+        goto err_after_socketpair;
+    }
+
+    rv = uvLoopbackOpen(l->loop, fds[1], &accepted);
+    if (rv != 0) {
+        close(fds[1]);
+        uv_close((struct uv_handle_s *)*stream, (uv_close_cb)HeapFree);
+        goto err;
+    }
+
+    listener->accept_cb(listener->transport, l->id, l->address, channel,
+                        accepted);
+
+    return 0;
+
+err_after_socketpair:
+    close(fds[0]);
+    close(fds[1]);
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+/* Process a single connection request and fire its callback. */
+static void uvLoopbackConnectFinish(struct UvLoopback *l,
+                                    struct uvLoopbackConnect *connect)
+{
+    struct raft_uv_connect *req = connect->req;
+    struct UvLoopback *listener;
+    struct uv_stream_s *stream = NULL;
+    int status;
+
+    /* A listener running on our loop can't go away before we're done, since
+     * it can only be closed by our thread. */
+    uvLoopbackListenersLock();
+    listener = uvLoopbackLookup(connect->address);
+    if (listener != NULL && listener->loop != l->loop) {
+        listener = NULL;
+    }
+    uvLoopbackListenersUnlock();
+
+    if (listener == NULL) {
+        ErrMsgPrintf(l->transport->errmsg, "no server listening on %s",
+                     connect->address);
+        status = RAFT_NOCONNECTION;
+    } else {
+        status = uvLoopbackPair(l, listener, req->channel, &stream);
+    }
+
+    HeapFree(connect->address);
+    HeapFree(connect);
+    req->cb(req, stream, status);
+}
+
+/* Invoked at the next loop iteration, process all pending connection
+ * requests. */
+static void uvLoopbackIdleCb(struct uv_idle_s *idle)
+{
+    struct UvLoopback *l = idle->data;
+    int rv;
+
+    rv = uv_idle_stop(&l->idle);
+    assert(rv == 0);
+
+    /* Callbacks might submit new requests or close the transport, so check at
+     * each iteration. */
+    while (!l->closing && !QUEUE_IS_EMPTY(&l->connecting)) {
+        struct uvLoopbackConnect *connect;
+        queue *head;
+        head = QUEUE_HEAD(&l->connecting);
+        connect = QUEUE_DATA(head, struct uvLoopbackConnect, queue);
+        QUEUE_REMOVE(head);
+        uvLoopbackConnectFinish(l, connect);
+    }
+}
+
+/* Implementation of raft_uv_transport->init. */
+static int uvLoopbackInit(struct raft_uv_transport *transport,
+                          raft_id id,
+                          const char *address)
+{
+    struct UvLoopback *l = transport->impl;
+    int rv;
+    assert(id > 0);
+    assert(address != NULL);
+    l->id = id;
+    l->address = address;
+    rv = uv_idle_init(l->loop, &l->idle);
+    assert(rv == 0);
+    l->idle.data = l;
+    return 0;
+}
+
+/* Implementation of raft_uv_transport->listen. */
+static int uvLoopbackListen(struct raft_uv_transport *transport,
+                            raft_uv_accept_cb cb)
+{
+    struct UvLoopback *l = transport->impl;
+    assert(!l->closing);
+    uvLoopbackListenersLock();
+    if (uvLoopbackLookup(l->address) != NULL) {
+        uvLoopbackListenersUnlock();
+        ErrMsgPrintf(transport->errmsg, "address already in use");
+        return RAFT_IOERR;
+    }
+    l->accept_cb = cb;
+    QUEUE_PUSH(&uvLoopbackListeners, &l->queue);
+    uvLoopbackListenersUnlock();
+    return 0;
+}
+
+/* Implementation of raft_uv_transport->connect. */
+static int uvLoopbackConnect(struct raft_uv_transport *transport,
+                             struct raft_uv_connect *req,
+                             raft_id id,
+                             const char *address,
+                             raft_uv_connect_cb cb)
+{
+    struct UvLoopback *l = transport->impl;
+    struct uvLoopbackConnect *connect;
+    int rv;
+    (void)id;
+    assert(!l->closing);
+
+    connect = HeapMalloc(sizeof *connect);
+    if (connect == NULL) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+    connect->address = HeapMalloc(strlen(address) + 1);
+    if (connect->address == NULL) {
+        rv = RAFT_NOMEM;
+        goto err_after_connect_alloc;
+    }
+    strcpy(connect->address, address);
+    connect->req = req;
+    req->cb = cb;
+
+    QUEUE_PUSH(&l->connecting, &connect->queue);
+    rv = uv_idle_start(&l->idle, uvLoopbackIdleCb);
+    assert(rv == 0);
+
+    return 0;
+
+err_after_connect_alloc:
+    HeapFree(connect);
+err:
+    ErrMsgOom(transport->errmsg);
+    assert(rv != 0);
+    return rv;
+}
+
+/* The idle handle has been closed, cancel all pending requests and fire the
+ * close callback. */
+static void uvLoopbackIdleCloseCb(struct uv_handle_s *handle)
+{
+    struct UvLoopback *l = handle->data;
+    assert(l->closing);
+    while (!QUEUE_IS_EMPTY(&l->connecting)) {
+        struct uvLoopbackConnect *connect;
+        struct raft_uv_connect *req;
+        queue *head;
+        head = QUEUE_HEAD(&l->connecting);
+        connect = QUEUE_DATA(head, struct uvLoopbackConnect, queue);
+        QUEUE_REMOVE(head);
+        req = connect->req;
+        HeapFree(connect->address);
+        HeapFree(connect);
+        req->cb(req, NULL, RAFT_CANCELED);
+    }
+    if (l->close_cb != NULL) {
+        l->close_cb(l->transport);
+    }
+}
+
+/* Implementation of raft_uv_transport->close. */
+static void uvLoopbackClose(struct raft_uv_transport *transport,
+                            raft_uv_transport_close_cb cb)
+{
+    struct UvLoopback *l = transport->impl;
+    assert(!l->closing);
+    l->closing = true;
+    l->close_cb = cb;
+    if (l->accept_cb != NULL) {
+        uvLoopbackListenersLock();
+        QUEUE_REMOVE(&l->queue);
+        uvLoopbackListenersUnlock();
+    }
+    /* The idle handle is initialized only by init(). */
+    if (l->idle.data == NULL) {
+        if (l->close_cb != NULL) {
+            l->close_cb(l->transport);
+        }
+        return;
+    }
+    uv_close((struct uv_handle_s *)&l->idle, uvLoopbackIdleCloseCb);
+}
+
+int raft_uv_loopback_init(struct raft_uv_transport *transport,
+                          struct uv_loop_s *loop)
+{
+    struct UvLoopback *l;
+    void *data = transport->data;
+    memset(transport, 0, sizeof *transport);
+    transport->data = data;
+    l = raft_malloc(sizeof *l);
+    if (l == NULL) {
+        ErrMsgOom(transport->errmsg);
+        return RAFT_NOMEM;
+    }
+    l->transport = transport;
+    l->loop = loop;
+    l->id = 0;
+    l->address = NULL;
+    l->idle.data = NULL;
+    l->accept_cb = NULL;
+    QUEUE_INIT(&l->connecting);
+    QUEUE_INIT(&l->queue);
+    l->closing = false;
+    l->close_cb = NULL;
+
+    transport->impl = l;
+    transport->init = uvLoopbackInit;
+    transport->close = uvLoopbackClose;
+    transport->listen = uvLoopbackListen;
+    transport->connect = uvLoopbackConnect;
+
+    return 0;
+}
+
+void raft_uv_loopback_close(struct raft_uv_transport *transport)
+{
+    struct UvLoopback *l = transport->impl;
+    raft_free(l);
+}
@@ -1,5 +1,6 @@
 #include "assert.h"
 #include "byte.h"
+#include "metrics.h"
 #include "uv.h"
 #include "uv_encoding.h"
 
@@ -177,6 +178,7 @@ int uvMetadataStore(struct uv *uv, const struct uvMetadata *metadata)
     uint8_t content[METADATA_CONTENT_SIZE]; /* Content of metadata file */
     struct raft_buffer buf;
     unsigned short n;
+    uint64_t start;
     int rv;
 
     assert(metadata->version > 0);
@@ -191,11 +193,14 @@ int uvMetadataStore(struct uv *uv, const struct uvMetadata *metadata)
     /* Write the metadata file, creating it if it does not exist. */
     buf.base = content;
     buf.len = sizeof content;
+    start = uv_hrtime();
     rv = UvFsMakeOrOverwriteFile(uv->dir, filename, &buf, uv->io->errmsg);
     if (rv != 0) {
         ErrMsgWrapf(uv->io->errmsg, "persist %s", filename);
         return rv;
     }
+    metricsRecord(&uv->metrics.metadata_latency,
+                  (uv_hrtime() - start) / 1000);
 
     return 0;
 }
@@ -109,6 +109,28 @@ int UvOsFdatasync(uv_file fd)
     return uv_fs_fdatasync(NULL, &req, fd, NULL);
 }
 
+int UvOsFstat(uv_file fd, uv_stat_t *sb)
+{
+    struct uv_fs_s req;
+    int rv;
+    rv = uv_fs_fstat(NULL, &req, fd, NULL);
+    if (rv != 0) {
+        return rv;
+    }
+    memcpy(sb, &req.statbuf, sizeof *sb);
+    return 0;
+}
+
+int UvOsSyncfs(uv_file fd)
+{
+    int rv;
+    rv = syncfs(fd);
+    if (rv != 0) {
+        return -errno;
+    }
+    return 0;
+}
+
 int UvOsStat(const char *path, uv_stat_t *sb)
 {
     struct uv_fs_s req;
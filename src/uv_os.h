@@ -86,6 +86,12 @@ int UvOsFsync(uv_file fd);
 /* Portable fdatasync() */
 int UvOsFdatasync(uv_file fd);
 
+/* Portable fstat() */
+int UvOsFstat(uv_file fd, uv_stat_t *sb);
+
+/* Flush the whole file system containing the given file (Linux only). */
+int UvOsSyncfs(uv_file fd);
+
 /* Portable stat() */
 int UvOsStat(const char *path, uv_stat_t *sb);
 
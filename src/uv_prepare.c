@@ -3,6 +3,7 @@
 
 #include "assert.h"
 #include "heap.h"
+#include "metrics.h"
 #include "uv.h"
 #include "uv_os.h"
 
@@ -48,6 +49,7 @@ struct uvIdleSegment
     unsigned long long counter;        /* Segment counter */
     char filename[UV__FILENAME_LEN];   /* Filename of the segment */
     uv_file fd;                        /* File descriptor of prepared file */
+    uint64_t duration;                 /* Time taken by threadpool callback */
     queue queue;                       /* Pool */
 };
 
@@ -55,10 +57,12 @@ static void uvPrepareWorkCb(uv_work_t *work)
 {
     struct uvIdleSegment *segment = work->data;
     struct uv *uv = segment->uv;
+    uint64_t start = uv_hrtime();
     int rv;
 
     rv = UvFsAllocateFile(uv->dir, segment->filename, segment->size,
-                          &segment->fd, segment->errmsg);
+                          !UvHostGroupCommit(uv), &segment->fd,
+                          segment->errmsg);
     if (rv != 0) {
         goto err;
     }
@@ -68,6 +72,7 @@ static void uvPrepareWorkCb(uv_work_t *work)
         goto err_after_allocate;
     }
 
+    segment->duration = uv_hrtime() - start;
     segment->status = 0;
     return;
 
@@ -230,6 +235,7 @@ static void uvPrepareAfterWorkCb(uv_work_t *work, int status)
     }
 
     assert(segment->fd >= 0);
+    metricsRecord(&uv->metrics.prepare_latency, segment->duration / 1000);
 
     tracef("completed creation of %s", segment->filename);
     QUEUE_PUSH(&uv->prepare_pool, &segment->queue);
@@ -3,6 +3,7 @@
 #include "../include/raft/uv.h"
 #include "assert.h"
 #include "byte.h"
+#include "compress.h"
 #include "configuration.h"
 #include "err.h"
 #include "heap.h"
@@ -21,17 +22,28 @@
  *   transport invokes our accept callback.
  *
  * - A new server object is created and added to the servers array. It starts
- *   reading from the stream handle of the new connection.
+ *   reading from the stream handle of the new connection into a reusable read
+ *   buffer, which can hold several messages at once.
  *
- * - The RPC message preamble is read, which contains the message type and the
- *   message length.
+ * - For each complete message available in the read buffer, the RPC message
+ *   preamble is parsed, which contains the message type and the message
+ *   length. The preamble and header of compact messages, which peers send
+ *   once we told them that we can decode them, are made of varints.
  *
- * - The RPC message header is read, whose content depends on the message type.
+ * - The RPC message header is decoded in place, whose content depends on the
+ *   message type.
  *
- * - Optionally, the RPC message payload is read (for AppendEntries requests).
+ * - Optionally, the RPC message payload is moved into its own buffer (for
+ *   AppendEntries and InstallSnapshot requests), since its ownership is
+ *   transferred to the user. If the payload was not fully read yet, its
+ *   remaining part is read directly into that buffer. If the payload was sent
+ *   compressed, it then gets decompressed into a new buffer.
  *
  * - The recv callback passed to raft_io->start() gets fired with the received
- *   message.
+ *   message. Servers of a host are shared by its raft groups, and messages
+ *   they receive are preceded by a record with the ID of the group whose recv
+ *   callback must be fired. Heartbeats can also come in a single record
+ *   holding the ones of several groups, each with its own group ID.
  *
  * Possible failure modes are:
  *
@@ -43,17 +55,34 @@
  *   handle and act like above.
  */
 
+/* Initial size of the read buffer of a server object. It gets enlarged if a
+ * message preamble and header don't fit in it. */
+#define UV__SERVER_READ_BUF_SIZE (64 * 1024)
+
+/* Size of a message preamble, containing the message type and length. */
+#define UV__PREAMBLE_SIZE (sizeof(uint64_t) * 2)
+
 struct uvServer
 {
     struct uv *uv;               /* libuv I/O implementation object */
     raft_id id;                  /* ID of the remote server */
     char *address;               /* Address of the other server */
+    unsigned channel;            /* Logical channel of the connection */
     struct uv_stream_s *stream;  /* Connection handle */
-    uv_buf_t buf;                /* Sliding buffer for reading incoming data */
-    uint64_t preamble[2];        /* Static buffer with the request preamble */
-    uv_buf_t header;             /* Dynamic buffer with the request header */
+    char *read_buf;              /* Reusable buffer for reading incoming data */
+    size_t read_size;            /* Size of the read buffer */
+    size_t read_head;            /* Offset of the first unparsed byte */
+    size_t read_tail;            /* Offset past the last byte read */
+    size_t read_need;            /* Bytes needed to parse the next message */
+    uv_buf_t buf;                /* Sliding window over the payload to read */
     uv_buf_t payload;            /* Dynamic buffer with the request payload */
     struct raft_message message; /* The message being received */
+    bool has_checksums;          /* Whether the batch checksums were sent */
+    struct uvBatchChecksums checksums; /* Checksums of the batch received */
+    struct uvBatch *batch;       /* Batch to hand to UvAppend, if any */
+    size_t decompressed_len;     /* Size of the payload once decompressed */
+    uint64_t capabilities;       /* Capabilities advertised by the remote */
+    uint64_t group;              /* Group of the message, if hosted */
     queue queue;                 /* Servers queue */
 };
 
@@ -63,10 +92,12 @@ static int uvServerInit(struct uvServer *s,
                         struct uv *uv,
                         const raft_id id,
                         const char *address,
+                        unsigned channel,
                         struct uv_stream_s *stream)
 {
     s->uv = uv;
     s->id = id;
+    s->channel = channel;
     s->address = HeapMalloc(strlen(address) + 1);
     if (s->address == NULL) {
         return RAFT_NOMEM;
@@ -74,43 +105,107 @@ static int uvServerInit(struct uvServer *s,
     strcpy(s->address, address);
     s->stream = stream;
     s->stream->data = s;
+    s->read_buf = NULL; /* Allocated upon the first read */
+    s->read_size = 0;
+    s->read_head = 0;
+    s->read_tail = 0;
+    s->read_need = UV__PREAMBLE_SIZE;
     s->buf.base = NULL;
     s->buf.len = 0;
-    s->preamble[0] = 0;
-    s->preamble[1] = 0;
-    s->header.base = NULL;
-    s->header.len = 0;
     s->message.type = 0;
     s->payload.base = NULL;
     s->payload.len = 0;
+    s->has_checksums = false;
+    s->batch = NULL;
+    s->decompressed_len = 0;
+    s->capabilities = 0;
+    s->group = 0;
     QUEUE_PUSH(&uv->servers, &s->queue);
     return 0;
 }
 
+/* Release all memory associated with a message whose header was decoded but
+ * that won't be passed to the user. */
+static void uvServerDiscardMessage(struct uvServer *s)
+{
+    switch (s->message.type) {
+        case RAFT_IO_APPEND_ENTRIES:
+            HeapFree(s->message.append_entries.entries);
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT:
+            configurationClose(&s->message.install_snapshot.conf);
+            break;
+    }
+    if (s->payload.base != NULL) {
+        HeapFree(s->payload.base);
+    }
+    if (s->batch != NULL) {
+        UvBatchRelease(s->batch);
+    }
+    s->message.type = 0;
+    s->payload.base = NULL;
+    s->payload.len = 0;
+    s->has_checksums = false;
+    s->batch = NULL;
+    s->decompressed_len = 0;
+    s->group = 0;
+}
+
 static void uvServerDestroy(struct uvServer *s)
 {
     QUEUE_REMOVE(&s->queue);
 
-    if (s->header.base != NULL) {
-        /* This means we were interrupted while reading the header. */
-        HeapFree(s->header.base);
-        switch (s->message.type) {
-            case RAFT_IO_APPEND_ENTRIES:
-                HeapFree(s->message.append_entries.entries);
-                break;
-            case RAFT_IO_INSTALL_SNAPSHOT:
-                configurationClose(&s->message.install_snapshot.conf);
-                break;
-        }
-    }
     if (s->payload.base != NULL) {
         /* This means we were interrupted while reading the payload. */
-        HeapFree(s->payload.base);
+        uvServerDiscardMessage(s);
+    }
+    if (s->read_buf != NULL) {
+        HeapFree(s->read_buf);
     }
     HeapFree(s->address);
     HeapFree(s->stream);
 }
 
+/* Move any unparsed data at the beginning of the read buffer, and make sure
+ * that the buffer is large enough to hold the next message preamble and
+ * header. */
+static int uvServerPrepareReadBuf(struct uvServer *s)
+{
+    size_t n = s->read_tail - s->read_head;
+
+    if (s->read_head > 0) {
+        memmove(s->read_buf, s->read_buf + s->read_head, n);
+        s->read_head = 0;
+        s->read_tail = n;
+    }
+
+    if (s->read_size < s->read_need) {
+        size_t size = UV__SERVER_READ_BUF_SIZE;
+        char *read_buf;
+        while (size < s->read_need) {
+            if (size > SIZE_MAX / 2) {
+                size = s->read_need;
+                break;
+            }
+            size *= 2;
+        }
+        read_buf = HeapMalloc(size);
+        if (read_buf == NULL) {
+            return RAFT_NOMEM;
+        }
+        if (n > 0) {
+            memcpy(read_buf, s->read_buf, n);
+        }
+        if (s->read_buf != NULL) {
+            HeapFree(s->read_buf);
+        }
+        s->read_buf = read_buf;
+        s->read_size = size;
+    }
+
+    return 0;
+}
+
 /* Invoked to initialize the read buffer for the next asynchronous read on the
  * socket. */
 static void uvServerAllocCb(uv_handle_t *handle,
@@ -118,55 +213,30 @@ static void uvServerAllocCb(uv_handle_t *handle,
                             uv_buf_t *buf)
 {
     struct uvServer *s = handle->data;
+    int rv;
     (void)suggested_size;
 
     assert(!s->uv->closing);
 
-    /* If this is the first read of the preamble, or of the header, or of the
-     * payload, then initialize the read buffer, according to the chunk of data
-     * that we expect next. */
-    if (s->buf.len == 0) {
-        assert(s->buf.base == NULL);
-
-        /* Check if we expect the preamble. */
-        if (s->header.len == 0) {
-            assert(s->preamble[0] == 0);
-            assert(s->preamble[1] == 0);
-            s->buf.base = (char *)s->preamble;
-            s->buf.len = sizeof s->preamble;
-            goto out;
-        }
-
-        /* Check if we expect the header. */
-        if (s->payload.len == 0) {
-            assert(s->header.len > 0);
-            assert(s->header.base == NULL);
-            s->header.base = HeapMalloc(s->header.len);
-            if (s->header.base == NULL) {
-                /* Setting all buffer fields to 0 will make read_cb fail with
-                 * ENOBUFS. */
-                memset(buf, 0, sizeof *buf);
-                return;
-            }
-            s->buf = s->header;
-            goto out;
-        }
-
-        /* If we get here we should be expecting the payload. */
-        assert(s->payload.len > 0);
-        s->payload.base = HeapMalloc(s->payload.len);
-        if (s->payload.base == NULL) {
-            /* Setting all buffer fields to 0 will make read_cb fail with
-             * ENOBUFS. */
-            memset(buf, 0, sizeof *buf);
-            return;
-        }
+    /* If we are in the middle of a payload that didn't fit in the read buffer,
+     * read the rest of it directly into its own buffer. */
+    if (s->buf.len > 0) {
+        assert(s->payload.base != NULL);
+        *buf = s->buf;
+        return;
+    }
 
-        s->buf = s->payload;
+    rv = uvServerPrepareReadBuf(s);
+    if (rv != 0) {
+        /* Setting all buffer fields to 0 will make read_cb fail with
+         * ENOBUFS. */
+        memset(buf, 0, sizeof *buf);
+        return;
     }
 
-out:
-    *buf = s->buf;
+    assert(s->read_tail < s->read_size);
+    buf->base = s->read_buf + s->read_tail;
+    buf->len = s->read_size - s->read_tail;
 }
 
 /* Callback invoked afer the stream handle of this server connection has been
@@ -185,24 +255,438 @@ static void uvServerAbort(struct uvServer *s)
     struct uv *uv = s->uv;
     QUEUE_REMOVE(&s->queue);
     QUEUE_PUSH(&uv->aborting, &s->queue);
+    /* The capabilities of this connection no longer count. */
+    if (s->capabilities != 0) {
+        UvSendSetPeerCapabilities(uv, s->id, UvRecvPeerCapabilities(uv, s->id));
+    }
     uv_close((struct uv_handle_s *)s->stream, uvServerStreamCloseCb);
 }
 
 /* Invoke the receive callback. */
 static void uvFireRecvCb(struct uvServer *s)
 {
-    s->uv->recv_cb(s->uv->io, &s->message);
+    struct uv *uv = s->uv;
+
+    /* Messages for a group that is not running on the host get dropped, as
+     * if the server was down. */
+    if (uv->host != NULL) {
+        uv = UvHostGroup(uv->host, s->group);
+        if (uv == NULL) {
+            Tracef(s->uv->tracer, "drop message for group %llu",
+                   (unsigned long long)s->group);
+            uvServerDiscardMessage(s);
+            return;
+        }
+    }
+
+    /* Let UvAppend use the batch checksums, if the entries of this message get
+     * appended while handling it. */
+    uv->recv_batch = s->batch;
+    uv->recv_cb(uv->io, &s->message);
+    uv->recv_batch = NULL;
 
     /* Reset our state as we'll start reading a new message. We don't need to
      * release the payload buffer, since ownership was transferred to the
      * user. */
-    memset(s->preamble, 0, sizeof s->preamble);
-    raft_free(s->header.base);
+    if (s->batch != NULL) {
+        UvBatchRelease(s->batch);
+    }
     s->message.type = 0;
-    s->header.base = NULL;
-    s->header.len = 0;
     s->payload.base = NULL;
     s->payload.len = 0;
+    s->has_checksums = false;
+    s->batch = NULL;
+    s->decompressed_len = 0;
+    s->group = 0;
+}
+
+/* Update the capabilities advertised by the remote server, and the ones cached
+ * by our clients connected to it. */
+static void uvServerSetCapabilities(struct uvServer *s, uint64_t capabilities)
+{
+    if (capabilities == s->capabilities) {
+        return;
+    }
+    s->capabilities = capabilities;
+    UvSendSetPeerCapabilities(s->uv, s->id,
+                              UvRecvPeerCapabilities(s->uv, s->id));
+}
+
+/* Dispatch the heartbeats of a UV__HEARTBEATS record to their groups. */
+static int uvServerRecvHeartbeats(struct uvServer *s, const uv_buf_t *header)
+{
+    struct uvHeartbeat *heartbeats;
+    unsigned n;
+    unsigned i;
+    int rv;
+
+    rv = uvDecodeHeartbeats(header, &heartbeats, &n);
+    if (rv != 0) {
+        Tracef(s->uv->tracer, "decode heartbeats: %s", errCodeToString(rv));
+        return rv;
+    }
+
+    for (i = 0; i < n; i++) {
+        uvServerSetCapabilities(s, heartbeats[i].capabilities);
+        s->message.type = RAFT_IO_APPEND_ENTRIES;
+        s->message.server_id = s->id;
+        s->message.server_address = s->address;
+        s->message.append_entries = heartbeats[i].args;
+        s->group = heartbeats[i].group;
+        uvFireRecvCb(s);
+        /* The recv callback might have closed the raft_io instance. */
+        if (s->uv->closing) {
+            break;
+        }
+    }
+
+    HeapFree(heartbeats);
+    return 0;
+}
+
+/* If the sender of an AppendEntries message included the checksums of its
+ * batch, validate the one of the batch header and prepare a batch object
+ * holding them. */
+static int uvServerCheckBatchHeader(struct uvServer *s,
+                                    const struct uvMessageInfo *info)
+{
+    const struct raft_append_entries *args = &s->message.append_entries;
+    struct uvBatch *batch;
+    uv_buf_t header;
+
+    if (args->n_entries == 0 || !info->has_checksums) {
+        return 0;
+    }
+    s->has_checksums = true;
+    s->checksums = info->checksums;
+
+    /* Compact messages don't carry the batch header in the format used by
+     * segment files, so we encode it from the decoded entries. */
+    if (info->batch.base != NULL) {
+        header = info->batch;
+    } else {
+        header.len = uvSizeofBatchHeader(args->n_entries);
+        header.base = HeapMalloc(header.len);
+        if (header.base == NULL) {
+            return RAFT_NOMEM;
+        }
+        uvEncodeBatchHeader(args->entries, args->n_entries, header.base);
+    }
+
+    if (byteCrc32(header.base, header.len, 0) != s->checksums.header) {
+        Tracef(s->uv->tracer, "batch header checksum mismatch");
+        if (info->batch.base == NULL) {
+            HeapFree(header.base);
+        }
+        return RAFT_CORRUPT;
+    }
+
+    /* The batch header sent by regular messages points into the read buffer,
+     * so it must be copied. */
+    if (info->batch.base != NULL) {
+        header.base = HeapMalloc(info->batch.len);
+        if (header.base == NULL) {
+            return 0;
+        }
+        memcpy(header.base, info->batch.base, info->batch.len);
+    }
+
+    /* If we can't allocate the batch object we'll just compute the checksums
+     * again when writing the entries to disk. */
+    batch = HeapMalloc(sizeof *batch);
+    if (batch == NULL) {
+        HeapFree(header.base);
+        return 0;
+    }
+    batch->header = header;
+    batch->refs = 1;
+    batch->n = args->n_entries;
+    batch->base = NULL;
+    batch->crc = s->checksums.header;
+    batch->data = NULL; /* Set once the data checksum gets validated */
+    batch->data_crc = 0;
+    QUEUE_INIT(&batch->queue);
+    s->batch = batch;
+
+    return 0;
+}
+
+/* Replace the compressed payload of the current message with its decompressed
+ * form. */
+static int uvServerDecompress(struct uvServer *s)
+{
+    void *data;
+    int rv;
+
+    data = HeapMalloc(s->decompressed_len);
+    if (data == NULL) {
+        uvServerDiscardMessage(s);
+        return RAFT_NOMEM;
+    }
+
+    rv = Decompress(s->payload.base, s->payload.len, data, s->decompressed_len);
+    if (rv != 0) {
+        Tracef(s->uv->tracer, "decompress payload: %s", errCodeToString(rv));
+        HeapFree(data);
+        uvServerDiscardMessage(s);
+        return RAFT_MALFORMED;
+    }
+
+    HeapFree(s->payload.base);
+    s->payload.base = data;
+    s->payload.len = s->decompressed_len;
+    s->decompressed_len = 0;
+
+    return 0;
+}
+
+/* Set the payload of the current message, which has been fully read, and fire
+ * the receive callback. */
+static int uvServerFinishPayload(struct uvServer *s)
+{
+    /* TODO: avoid converting from uv_buf_t */
+    struct raft_buffer payload;
+    int rv;
+    assert(s->payload.base != NULL);
+    assert(s->payload.len > 0);
+
+    if (s->decompressed_len > 0) {
+        rv = uvServerDecompress(s);
+        if (rv != 0) {
+            return rv;
+        }
+    }
+
+    switch (s->message.type) {
+        case RAFT_IO_APPEND_ENTRIES:
+            if (s->has_checksums) {
+                unsigned crc = byteCrc32(s->payload.base, s->payload.len, 0);
+                if (crc != s->checksums.data) {
+                    Tracef(s->uv->tracer, "batch data checksum mismatch");
+                    uvServerDiscardMessage(s);
+                    return RAFT_CORRUPT;
+                }
+                if (s->batch != NULL) {
+                    s->batch->data = s->payload.base;
+                    s->batch->data_crc = crc;
+                }
+            }
+            payload.base = s->payload.base;
+            payload.len = s->payload.len;
+            uvDecodeEntriesBatch(payload.base, 0,
+                                 s->message.append_entries.entries,
+                                 s->message.append_entries.n_entries);
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT:
+            s->message.install_snapshot.data.base = s->payload.base;
+            break;
+        default:
+            /* We should never have read a payload in the first place */
+            assert(0);
+    }
+
+    uvFireRecvCb(s);
+    return 0;
+}
+
+/* Parse the preamble of the next message in the read buffer, setting @type,
+ * @compact and the length of @header. Return false if the preamble is not
+ * complete yet. */
+static bool uvServerParsePreamble(struct uvServer *s,
+                                  uint64_t *type,
+                                  bool *compact,
+                                  uv_buf_t *header,
+                                  size_t *preamble_len)
+{
+    const uint8_t *start = (const uint8_t *)s->read_buf + s->read_head;
+    const uint8_t *end = (const uint8_t *)s->read_buf + s->read_tail;
+    uint64_t preamble[2];
+    uint64_t len;
+    const void *cursor;
+
+    /* The first byte is either the low byte of the type of a regular message
+     * or the type of a compact message, with the compact marker set. */
+    *compact = (start[0] & UV__COMPACT_MARKER) != 0;
+
+    if (*compact) {
+        cursor = start + 1;
+        if (!byteGetVarint(&cursor, end, &len)) {
+            s->read_need = (size_t)(end - start) + 1;
+            return false;
+        }
+        *type = (uint8_t)(start[0] & ~UV__COMPACT_MARKER);
+        *preamble_len = (size_t)((const uint8_t *)cursor - start);
+    } else {
+        if ((size_t)(end - start) < UV__PREAMBLE_SIZE) {
+            s->read_need = UV__PREAMBLE_SIZE;
+            return false;
+        }
+        memcpy(preamble, start, sizeof preamble);
+        *type = byteFlip64(preamble[0]);
+        len = byteFlip64(preamble[1]);
+        *preamble_len = UV__PREAMBLE_SIZE;
+    }
+
+    header->len = len > SIZE_MAX ? SIZE_MAX : (size_t)len;
+    return true;
+}
+
+/* Parse the next message in the read buffer, if it's complete. The more output
+ * parameter is set to true if a message was received and the buffer might
+ * contain further ones. */
+static int uvServerParse(struct uvServer *s, bool *more)
+{
+    uint64_t type;
+    bool compact;
+    uv_buf_t header;
+    size_t preamble_len;
+    struct uvMessageInfo info;
+    size_t n = s->read_tail - s->read_head;
+    int rv;
+
+    *more = false;
+
+    if (n == 0) {
+        s->read_need = UV__PREAMBLE_SIZE;
+        return 0;
+    }
+
+    /* The header decoding functions expect 8-byte aligned data, which might
+     * not be the case after a payload whose length is not a multiple of 8. */
+    if (s->read_head % sizeof(uint64_t) != 0) {
+        memmove(s->read_buf, s->read_buf + s->read_head, n);
+        s->read_head = 0;
+        s->read_tail = n;
+    }
+
+    if (!uvServerParsePreamble(s, &type, &compact, &header, &preamble_len)) {
+        if (compact && n >= UV__COMPACT_PREAMBLE_MAX_SIZE) {
+            Tracef(s->uv->tracer, "message has invalid length");
+            return RAFT_MALFORMED;
+        }
+        return 0;
+    }
+
+    /* The length of the header must be greater than zero. */
+    if (header.len == 0) {
+        Tracef(s->uv->tracer, "message has zero length");
+        return RAFT_MALFORMED;
+    }
+    if (header.len > UV__MAX_HEADER_SIZE) {
+        Tracef(s->uv->tracer, "message header too large");
+        return RAFT_MALFORMED;
+    }
+
+    /* Wait for the full header. */
+    if (n < preamble_len + header.len) {
+        s->read_need = preamble_len + header.len;
+        return 0;
+    }
+
+    header.base = s->read_buf + s->read_head + preamble_len;
+    s->read_head += preamble_len + header.len;
+    s->read_need = UV__PREAMBLE_SIZE;
+    n -= preamble_len + header.len;
+
+    /* Connections to a host carry the ID of the group of each message. */
+    if (compact && type == UV__GROUP_TAG && s->uv->host != NULL) {
+        rv = uvDecodeGroupTag(&header, &s->group);
+        if (rv != 0) {
+            Tracef(s->uv->tracer, "decode group tag: %s", errCodeToString(rv));
+            return rv;
+        }
+        *more = true;
+        return 0;
+    }
+
+    /* Heartbeats of several groups can come in a single record. */
+    if (compact && type == UV__HEARTBEATS && s->uv->host != NULL) {
+        rv = uvServerRecvHeartbeats(s, &header);
+        if (rv != 0) {
+            return rv;
+        }
+        *more = true;
+        return 0;
+    }
+
+    if (compact) {
+        rv = uvDecodeCompactMessage((unsigned long)type, &header, &s->message,
+                                    &s->payload.len, &info);
+    } else {
+        assert(type > 0);
+        rv = uvDecodeMessage((unsigned long)type, &header, &s->message,
+                             &s->payload.len);
+        if (rv == 0) {
+            uvDecodeMessageInfo((unsigned long)type, &header, &info);
+        }
+    }
+    if (rv != 0) {
+        Tracef(s->uv->tracer, "decode message: %s", errCodeToString(rv));
+        s->message.type = 0;
+        s->payload.len = 0;
+        return rv;
+    }
+
+    s->message.server_id = s->id;
+    s->message.server_address = s->address;
+
+    if (s->message.type == RAFT_IO_APPEND_ENTRIES) {
+        rv = uvServerCheckBatchHeader(s, &info);
+        if (rv != 0) {
+            uvServerDiscardMessage(s);
+            return rv;
+        }
+    }
+
+    if (info.has_capabilities) {
+        uvServerSetCapabilities(s, info.capabilities);
+    }
+
+    /* If the payload is compressed, what's left to read is the compressed
+     * data. */
+    if (s->payload.len > 0 && info.compressed_len > 0) {
+        s->decompressed_len = s->payload.len;
+        s->payload.len = info.compressed_len;
+    }
+
+    /* If the message has no payload, we're done. */
+    if (s->payload.len == 0) {
+        uvFireRecvCb(s);
+        *more = true;
+        return 0;
+    }
+
+    /* Move the payload into its own buffer, since its ownership will be
+     * transferred to the user. */
+    s->payload.base = HeapMalloc(s->payload.len);
+    if (s->payload.base == NULL) {
+        uvServerDiscardMessage(s);
+        return RAFT_NOMEM;
+    }
+
+    if (n > s->payload.len) {
+        n = s->payload.len;
+    }
+    memcpy(s->payload.base, s->read_buf + s->read_head, n);
+    s->read_head += n;
+
+    /* If part of the payload is still to be read, read it directly into the
+     * payload buffer. */
+    if (n < s->payload.len) {
+        assert(s->read_head == s->read_tail);
+        s->read_head = 0;
+        s->read_tail = 0;
+        s->buf.base = s->payload.base + n;
+        s->buf.len = s->payload.len - n;
+        return 0;
+    }
+
+    rv = uvServerFinishPayload(s);
+    if (rv != 0) {
+        return rv;
+    }
+    *more = true;
+    return 0;
 }
 
 /* Callback invoked when data has been read from the socket. */
@@ -211,98 +695,54 @@ static void uvServerReadCb(uv_stream_t *stream,
                            const uv_buf_t *buf)
 {
     struct uvServer *s = stream->data;
+    struct uv *uv = s->uv;
+    bool more;
     int rv;
 
     (void)buf;
 
-    assert(!s->uv->closing);
+    assert(!uv->closing);
 
-    /* If the read was successful, let's check if we have received all the data
-     * we expected. */
+    /* If the read was successful, let's parse all the messages that we have
+     * received in full. */
     if (nread > 0) {
         size_t n = (size_t)nread;
 
-        /* We shouldn't have read more data than the pending amount. */
-        assert(n <= s->buf.len);
-
-        /* Advance the read window */
-        s->buf.base += n;
-        s->buf.len -= n;
-
-        /* If there's more data to read in order to fill the current
-         * read buffer, just return, we'll be invoked again. */
         if (s->buf.len > 0) {
-            return;
-        }
+            /* We shouldn't have read more data than the pending amount. */
+            assert(n <= s->buf.len);
 
-        if (s->header.len == 0) {
-            /* If the header buffer is not set, it means that we've just
-             * completed reading the preamble. */
-            assert(s->header.base == NULL);
+            /* Advance the read window */
+            s->buf.base += n;
+            s->buf.len -= n;
 
-            s->header.len = (size_t)byteFlip64(s->preamble[1]);
-
-            /* The length of the header must be greater than zero. */
-            if (s->header.len == 0) {
-                Tracef(s->uv->tracer, "message has zero length");
-                goto abort;
+            /* If there's more data to read in order to fill the current
+             * payload, just return, we'll be invoked again. */
+            if (s->buf.len > 0) {
+                return;
             }
-        } else if (s->payload.len == 0) {
-            /* If the payload buffer is not set, it means we just completed
-             * reading the message header. */
-            uint64_t type;
-
-            assert(s->header.base != NULL);
-
-            type = byteFlip64(s->preamble[0]);
-            assert(type > 0);
 
-            rv = uvDecodeMessage((unsigned long)type, &s->header, &s->message,
-                                 &s->payload.len);
+            s->buf.base = NULL;
+            rv = uvServerFinishPayload(s);
             if (rv != 0) {
-                Tracef(s->uv->tracer, "decode message: %s",
-                       errCodeToString(rv));
                 goto abort;
             }
+            return;
+        }
 
-            s->message.server_id = s->id;
-            s->message.server_address = s->address;
+        assert(n <= s->read_size - s->read_tail);
+        s->read_tail += n;
 
-            /* If the message has no payload, we're done. */
-            if (s->payload.len == 0) {
-                uvFireRecvCb(s);
+        do {
+            rv = uvServerParse(s, &more);
+            if (rv != 0) {
+                goto abort;
             }
-        } else {
-            /* If we get here it means that we've just completed reading the
-             * payload. TODO: avoid converting from uv_buf_t */
-            struct raft_buffer payload;
-            assert(s->payload.base != NULL);
-            assert(s->payload.len > 0);
-
-            switch (s->message.type) {
-                case RAFT_IO_APPEND_ENTRIES:
-                    payload.base = s->payload.base;
-                    payload.len = s->payload.len;
-                    uvDecodeEntriesBatch(payload.base, 0,
-                                         s->message.append_entries.entries,
-                                         s->message.append_entries.n_entries);
-                    break;
-                case RAFT_IO_INSTALL_SNAPSHOT:
-                    s->message.install_snapshot.data.base = s->payload.base;
-                    break;
-                default:
-                    /* We should never have read a payload in the first place */
-                    assert(0);
+            /* The recv callback might have closed the raft_io instance. */
+            if (uv->closing) {
+                return;
             }
-
-            uvFireRecvCb(s);
-        }
-
-        /* Mark that we're done with this chunk. When the alloc callback will
-         * trigger again it will notice that it needs to change the read
-         * buffer. */
-        assert(s->buf.len == 0);
-        s->buf.base = NULL;
+        } while (more);
 
         return;
     }
@@ -338,6 +778,7 @@ static int uvServerStart(struct uvServer *s)
 static int uvAddServer(struct uv *uv,
                        raft_id id,
                        const char *address,
+                       unsigned channel,
                        struct uv_stream_s *stream)
 {
     struct uvServer *server;
@@ -350,7 +791,7 @@ static int uvAddServer(struct uv *uv,
         goto err;
     }
 
-    rv = uvServerInit(server, uv, id, address, stream);
+    rv = uvServerInit(server, uv, id, address, channel, stream);
     if (rv != 0) {
         goto err_after_server_alloc;
     }
@@ -375,12 +816,13 @@ err:
 static void uvRecvAcceptCb(struct raft_uv_transport *transport,
                            raft_id id,
                            const char *address,
+                           unsigned channel,
                            struct uv_stream_s *stream)
 {
     struct uv *uv = transport->data;
     int rv;
     assert(!uv->closing);
-    rv = uvAddServer(uv, id, address, stream);
+    rv = uvAddServer(uv, id, address, channel, stream);
     if (rv != 0) {
         tracef("add server: %s", errCodeToString(rv));
         uv_close((struct uv_handle_s *)stream, (uv_close_cb)HeapFree);
@@ -408,4 +850,33 @@ void UvRecvClose(struct uv *uv)
     }
 }
 
+size_t UvRecvBufferSize(struct uv *uv)
+{
+    size_t size = 0;
+    queue *head;
+    QUEUE_FOREACH(head, &uv->servers)
+    {
+        struct uvServer *s = QUEUE_DATA(head, struct uvServer, queue);
+        size += s->read_size;
+        if (s->payload.base != NULL) {
+            size += s->payload.len;
+        }
+    }
+    return size;
+}
+
+uint64_t UvRecvPeerCapabilities(struct uv *uv, raft_id id)
+{
+    uint64_t capabilities = 0;
+    queue *head;
+    QUEUE_FOREACH(head, &uv->servers)
+    {
+        struct uvServer *s = QUEUE_DATA(head, struct uvServer, queue);
+        if (s->id == id) {
+            capabilities |= s->capabilities;
+        }
+    }
+    return capabilities;
+}
+
 #undef tracef
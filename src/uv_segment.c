@@ -163,12 +163,15 @@ static int uvReadSegmentFile(struct uv *uv,
                              uint64_t *format)
 {
     char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    uint64_t start;
     int rv;
+    start = uv_hrtime();
     rv = UvFsReadFile(uv->dir, filename, buf, errmsg);
     if (rv != 0) {
         ErrMsgTransfer(errmsg, uv->io->errmsg, "read file");
         return RAFT_IOERR;
     }
+    uv->metrics.load.read += uv_hrtime() - start;
     if (buf->len < 8) {
         ErrMsgPrintf(uv->io->errmsg, "file has only %zu bytes", buf->len);
         HeapFree(buf->base);
@@ -221,6 +224,8 @@ static int uvLoadEntriesBatch(struct uv *uv,
     uint32_t crc2;             /* Actual checksum */
     char errmsg[RAFT_ERRMSG_BUF_SIZE];
     size_t start;
+    uint64_t t1; /* Time at which CRC checks of a section began */
+    uint64_t t2; /* Time at which decoding of a section began */
     int rv;
 
     /* Save the current offset, to provide more information when logging. */
@@ -277,6 +282,7 @@ static int uvLoadEntriesBatch(struct uv *uv,
     }
 
     /* Check batch header integrity. */
+    t1 = uv_hrtime();
     crc1 = byteFlip32(((uint32_t *)checksums)[0]);
     crc2 = byteCrc32(header.base, header.len, 0);
     if (crc1 != crc2) {
@@ -286,10 +292,12 @@ static int uvLoadEntriesBatch(struct uv *uv,
     }
 
     /* Decode the batch header, allocating the entries array. */
+    t2 = uv_hrtime();
     rv = uvDecodeBatchHeader(header.base, entries, n_entries);
     if (rv != 0) {
         goto err;
     }
+    uv->metrics.load.crc += t2 - t1;
 
     /* Calculate the total size of the batch data */
     data.len = 0;
@@ -307,6 +315,8 @@ static int uvLoadEntriesBatch(struct uv *uv,
     }
 
     /* Check batch data integrity. */
+    t1 = uv_hrtime();
+    uv->metrics.load.decode += t1 - t2;
     crc1 = byteFlip32(((uint32_t *)checksums)[1]);
     crc2 = byteCrc32(data.base, data.len, 0);
     if (crc1 != crc2) {
@@ -315,8 +325,11 @@ static int uvLoadEntriesBatch(struct uv *uv,
         goto err_after_header_decode;
     }
 
+    t2 = uv_hrtime();
+    uv->metrics.load.crc += t2 - t1;
     uvDecodeEntriesBatch(content->base, *offset - data.len, *entries,
                          *n_entries);
+    uv->metrics.load.decode += uv_hrtime() - t2;
 
     *last = *offset == content->len;
 
@@ -697,7 +710,8 @@ int uvSegmentBufferFormat(struct uvSegmentBuffer *b)
 
 int uvSegmentBufferAppend(struct uvSegmentBuffer *b,
                           const struct raft_entry entries[],
-                          unsigned n_entries)
+                          unsigned n_entries,
+                          const struct uvBatch *batch)
 {
     size_t size;   /* Total size of the batch */
     uint32_t crc1; /* Header checksum */
@@ -729,11 +743,20 @@ int uvSegmentBufferAppend(struct uvSegmentBuffer *b,
 
     /* Batch header */
     header = cursor;
-    uvEncodeBatchHeader(entries, n_entries, cursor);
-    crc1 = byteCrc32(header, uvSizeofBatchHeader(n_entries), 0);
+    if (batch != NULL) {
+        assert(batch->n == n_entries);
+        assert(batch->header.len == uvSizeofBatchHeader(n_entries));
+        memcpy(header, batch->header.base, batch->header.len);
+        crc1 = batch->crc;
+    } else {
+        uvEncodeBatchHeader(entries, n_entries, cursor);
+        crc1 = byteCrc32(header, uvSizeofBatchHeader(n_entries), 0);
+    }
     cursor = (uint8_t *)cursor + uvSizeofBatchHeader(n_entries);
 
-    /* Batch data */
+    /* Batch data. If the data checksum is already known, because it was
+     * computed when creating the batch or validated upon receiving it from the
+     * leader, don't compute it again. */
     crc2 = 0;
     for (i = 0; i < n_entries; i++) {
         const struct raft_entry *entry = &entries[i];
@@ -741,9 +764,14 @@ int uvSegmentBufferAppend(struct uvSegmentBuffer *b,
          * higher-level APIs. */
         assert(entry->buf.len % sizeof(uint64_t) == 0);
         memcpy(cursor, entry->buf.base, entry->buf.len);
-        crc2 = byteCrc32(cursor, entry->buf.len, crc2);
+        if (batch == NULL || batch->data == NULL) {
+            crc2 = byteCrc32(cursor, entry->buf.len, crc2);
+        }
         cursor = (uint8_t *)cursor + entry->buf.len;
     }
+    if (batch != NULL && batch->data != NULL) {
+        crc2 = batch->data_crc;
+    }
 
     bytePut32(&crc1_p, crc1);
     bytePut32(&crc2_p, crc2);
@@ -920,7 +948,7 @@ static int uvWriteClosedSegment(struct uv *uv,
     entry.type = RAFT_CHANGE;
     entry.buf = *conf;
 
-    rv = uvSegmentBufferAppend(&buf, &entry, 1);
+    rv = uvSegmentBufferAppend(&buf, &entry, 1, NULL);
     if (rv != 0) {
         uvSegmentBufferClose(&buf);
         return rv;
@@ -1020,7 +1048,7 @@ int uvSegmentTruncate(struct uv *uv,
         goto out_after_buffer_init;
     }
 
-    rv = uvSegmentBufferAppend(&buf, entries, m);
+    rv = uvSegmentBufferAppend(&buf, entries, m, NULL);
     if (rv != 0) {
         goto out_after_buffer_init;
     }
@@ -2,6 +2,7 @@
 
 #include "../include/raft/uv.h"
 #include "assert.h"
+#include "byte.h"
 #include "heap.h"
 #include "uv.h"
 #include "uv_encoding.h"
@@ -15,9 +16,15 @@
 
 /* The happy path for an raft_io_send request is:
  *
- * - Get the uvClient object whose address matches the one of target server.
- * - Encode the message and write it using the uvClient's TCP handle.
- * - Once the write completes, fire the send request callback.
+ * - Get the uvClient object whose address matches the one of target server, for
+ *   the logical channel the message belongs to.
+ * - Encode the message and queue it on the uvClient object.
+ * - Right before the loop polls for I/O, write all the messages queued in the
+ *   current loop iteration using a single write request on the uvClient's TCP
+ *   handle. Consecutive heartbeats sent by the raft groups of a host get
+ *   coalesced into a single record.
+ * - Once the write completes, fire the callbacks of all the send requests that
+ *   were part of it.
  *
  * Possible failure modes are:
  *
@@ -37,20 +44,28 @@
  *   stream, and start a re-connection attempt.
  */
 
-/* Maximum number of requests that can be buffered.  */
-#define UV__CLIENT_MAX_PENDING 3
+/* Maximum number of buffers that are coalesced into a single write request. A
+ * single message exceeding this limit is still written on its own. */
+#define UV__CLIENT_MAX_WRITE_BUFS 256
 
 struct uvClient
 {
     struct uv *uv;                  /* libuv I/O implementation object */
     struct uv_timer_s timer;        /* Schedule connection attempts */
+    struct uv_prepare_s flush;      /* Write queued messages before polling */
     struct raft_uv_connect connect; /* Connection request */
     struct uv_stream_s *stream;     /* Current connection handle */
     struct uv_stream_s *old_stream; /* Connection handle being closed */
     unsigned n_connect_attempt;     /* Consecutive connection attempts */
     raft_id id;                     /* ID of the other server */
     char *address;                  /* Address of the other server */
+    unsigned channel;               /* Logical channel of the connection */
+    uint64_t capabilities;          /* Advertised by the other server */
+    unsigned n_messages;            /* Outstanding send requests */
+    size_t n_bytes;                 /* Size of outstanding send requests */
+    bool backlogged;                /* Whether send limits are reached */
     queue pending;                  /* Pending send message requests */
+    queue queued;                   /* Send requests to write in next flush */
     queue queue;                    /* Clients queue */
     bool closing;                   /* True after calling uvClientAbort */
 };
@@ -58,51 +73,154 @@ struct uvClient
 /* Hold state for a single send RPC message request. */
 struct uvSend
 {
+    struct uv *uv;            /* Instance the request was submitted to */
     struct uvClient *client;  /* Client connected to the target server */
     struct raft_io_send *req; /* User request */
     uv_buf_t *bufs;           /* Encoded raft RPC message to send */
     unsigned n_bufs;          /* Number of buffers */
-    uv_write_t write;         /* Stream write request */
-    queue queue;              /* Pending send requests queue */
+    size_t size;              /* Total size of the buffers */
+    struct uvBatch *batch;    /* Shared batch header, for AppendEntries */
+    bool heartbeat;           /* Part of a UV__HEARTBEATS record */
+    queue queue;              /* Pending, queued or batch requests queue */
 };
 
+/* Hold state for a single stream write coalescing several send requests. */
+struct uvSendBatch
+{
+    struct uvClient *client; /* Client connected to the target server */
+    uv_buf_t *bufs;          /* Buffers of all the send requests */
+    unsigned n_bufs;         /* Number of buffers */
+    void **records;          /* UV__HEARTBEATS records written */
+    unsigned n_records;      /* Number of records */
+    uv_write_t write;        /* Stream write request */
+    queue sends;             /* Send requests being written */
+};
+
+/* Return true if the given client has reached the limits of outstanding send
+ * requests.
+ *
+ * Only the backlog of AppendEntries messages is reported to raft, which stops
+ * sending new entries to a backlogged server: clients for other channels, such
+ * as one busy sending a snapshot, never count as backlogged. */
+static bool uvClientIsBacklogged(struct uvClient *c)
+{
+    struct uv *uv = c->uv;
+    unsigned log_channel =
+        uv->channels ? RAFT_UV_CHANNEL_LOG : RAFT_UV_CHANNEL_CONTROL;
+    if (c->channel != log_channel) {
+        return false;
+    }
+    if (c->n_messages >= uv->send_max_messages ||
+        c->n_bytes >= uv->send_max_bytes) {
+        return true;
+    }
+    /* Without a connection, outstanding requests are pending, and those beyond
+     * this limit would be evicted if the next connection attempt fails too. */
+    if (c->stream == NULL && c->n_messages >= uv->send_max_pending) {
+        return true;
+    }
+    return false;
+}
+
+/* Update the backlogged flag of the given client, and the number of backlogged
+ * clients of its instance. Must be called whenever the outstanding requests or
+ * the connection of the client change. */
+static void uvClientUpdateBacklog(struct uvClient *c)
+{
+    struct uv *uv = c->uv;
+    bool backlogged = !c->closing && uvClientIsBacklogged(c);
+    if (backlogged == c->backlogged) {
+        return;
+    }
+    c->backlogged = backlogged;
+    if (backlogged) {
+        uv->n_backlogged++;
+    } else {
+        assert(uv->n_backlogged > 0);
+        uv->n_backlogged--;
+    }
+}
+
 /* Free all memory used by the given send request object, including the object
  * itself. */
 static void uvSendDestroy(struct uvSend *s)
 {
+    assert(s->uv->n_sends > 0);
+    s->uv->n_sends--;
+    if (s->client != NULL) {
+        assert(s->client->n_messages > 0);
+        assert(s->client->n_bytes >= s->size);
+        s->client->n_messages--;
+        s->client->n_bytes -= s->size;
+        uvClientUpdateBacklog(s->client);
+        assert(s->uv->send_bytes >= s->size);
+        s->uv->send_bytes -= s->size;
+    }
     if (s->bufs != NULL) {
-        /* Just release the first buffer. Further buffers are entry or snapshot
-         * payloads, which we were passed but we don't own. */
+        /* Just release the first buffer, which also holds the compressed
+         * payload, if any. Further buffers are entry or snapshot payloads,
+         * which we were passed but we don't own. */
         HeapFree(s->bufs[0].base);
 
         /* Release the buffers array. */
         HeapFree(s->bufs);
     }
+    if (s->batch != NULL) {
+        UvBatchRelease(s->batch);
+    }
     HeapFree(s);
 }
 
+/* Release the given send request and fire its callback with the given
+ * status. */
+static void uvSendFinish(struct uvSend *s, int status)
+{
+    struct uv *uv = s->uv;
+    struct raft_io_send *req = s->req;
+    uvSendDestroy(s);
+    if (req->cb != NULL) {
+        req->cb(req, status);
+    }
+    /* A closing hosted instance waits for its requests to complete, since
+     * they are handled by the clients of its host. */
+    if (uv->group != 0 && uv->closing) {
+        uvMaybeFireCloseCb(uv);
+    }
+}
+
 /* Initialize a new client associated with the given server. */
 static int uvClientInit(struct uvClient *c,
                         struct uv *uv,
                         raft_id id,
-                        const char *address)
+                        const char *address,
+                        unsigned channel)
 {
     int rv;
     c->uv = uv;
     c->timer.data = c;
+    c->flush.data = c;
     c->connect.data = NULL; /* Set upon starting a connect request */
+    c->connect.channel = channel;
     c->stream = NULL;       /* Set upon successful connection */
     c->old_stream = NULL;   /* Set after closing the current connection */
     c->n_connect_attempt = 0;
     c->id = id;
+    c->channel = channel;
+    c->capabilities = UvRecvPeerCapabilities(uv, id);
+    c->n_messages = 0;
+    c->n_bytes = 0;
+    c->backlogged = false;
     c->address = HeapMalloc(strlen(address) + 1);
     if (c->address == NULL) {
         return RAFT_NOMEM;
     }
     rv = uv_timer_init(c->uv->loop, &c->timer);
     assert(rv == 0);
+    rv = uv_prepare_init(c->uv->loop, &c->flush);
+    assert(rv == 0);
     strcpy(c->address, address);
     QUEUE_INIT(&c->pending);
+    QUEUE_INIT(&c->queued);
     c->closing = false;
     QUEUE_PUSH(&uv->clients, &c->queue);
     return 0;
@@ -115,6 +233,7 @@ static void uvClientMaybeDestroy(struct uvClient *c)
     struct uv *uv = c->uv;
 
     assert(c->stream == NULL);
+    assert(QUEUE_IS_EMPTY(&c->queued));
 
     if (c->connect.data != NULL) {
         return;
@@ -122,6 +241,9 @@ static void uvClientMaybeDestroy(struct uvClient *c)
     if (c->timer.data != NULL) {
         return;
     }
+    if (c->flush.data != NULL) {
+        return;
+    }
     if (c->old_stream != NULL) {
         return;
     }
@@ -129,16 +251,13 @@ static void uvClientMaybeDestroy(struct uvClient *c)
     while (!QUEUE_IS_EMPTY(&c->pending)) {
         queue *head;
         struct uvSend *send;
-        struct raft_io_send *req;
         head = QUEUE_HEAD(&c->pending);
         send = QUEUE_DATA(head, struct uvSend, queue);
         QUEUE_REMOVE(head);
-        req = send->req;
-        uvSendDestroy(send);
-        if (req->cb != NULL) {
-            req->cb(req, RAFT_CANCELED);
-        }
+        uvSendFinish(send, RAFT_CANCELED);
     }
+    uvClientUpdateBacklog(c);
+    assert(!c->backlogged);
 
     QUEUE_REMOVE(&c->queue);
 
@@ -174,15 +293,38 @@ static void uvClientDisconnect(struct uvClient *c)
     assert(c->old_stream == NULL);
     c->old_stream = c->stream;
     c->stream = NULL;
+    uvClientUpdateBacklog(c);
     uv_close((struct uv_handle_s *)c->old_stream, uvClientDisconnectCloseCb);
 }
 
-/* Invoked once an encoded RPC message has been written out. */
+/* Release the given batch object and fire the callbacks of all its send
+ * requests with the given status. */
+static void uvSendBatchFinish(struct uvSendBatch *batch, int status)
+{
+    unsigned i;
+    for (i = 0; i < batch->n_records; i++) {
+        HeapFree(batch->records[i]);
+    }
+    if (batch->records != NULL) {
+        HeapFree(batch->records);
+    }
+    HeapFree(batch->bufs);
+    while (!QUEUE_IS_EMPTY(&batch->sends)) {
+        queue *head;
+        struct uvSend *send;
+        head = QUEUE_HEAD(&batch->sends);
+        send = QUEUE_DATA(head, struct uvSend, queue);
+        QUEUE_REMOVE(head);
+        uvSendFinish(send, status);
+    }
+    HeapFree(batch);
+}
+
+/* Invoked once a batch of encoded RPC messages has been written out. */
 static void uvSendWriteCb(struct uv_write_s *write, const int status)
 {
-    struct uvSend *send = write->data;
-    struct uvClient *c = send->client;
-    struct raft_io_send *req = send->req;
+    struct uvSendBatch *batch = write->data;
+    struct uvClient *c = batch->client;
     int cb_status = 0;
 
     /* If the write failed and we're not currently closing, let's consider the
@@ -200,44 +342,227 @@ static void uvSendWriteCb(struct uv_write_s *write, const int status)
         }
     }
 
-    uvSendDestroy(send);
+    uvSendBatchFinish(batch, cb_status);
+}
 
-    if (req->cb != NULL) {
-        req->cb(req, cb_status);
+/* Move all queued send requests back to the pending queue, ahead of any request
+ * that was already pending. */
+static void uvClientRequeue(struct uvClient *c)
+{
+    queue *head;
+    while (!QUEUE_IS_EMPTY(&c->pending)) {
+        head = QUEUE_HEAD(&c->pending);
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(&c->queued, head);
+    }
+    while (!QUEUE_IS_EMPTY(&c->queued)) {
+        head = QUEUE_HEAD(&c->queued);
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(&c->pending, head);
+    }
+}
+
+/* Return the number of buffers that the given send request adds to a batch,
+ * where @prev is the request preceding it in the batch, if any. Consecutive
+ * heartbeats are coalesced into a single UV__HEARTBEATS record. */
+static unsigned uvSendBatchBufs(const struct uvSend *send,
+                                const struct uvSend *prev)
+{
+    if (send->heartbeat) {
+        return prev != NULL && prev->heartbeat ? 0 : 1;
     }
+    return send->n_bufs;
 }
 
-static int uvClientSend(struct uvClient *c, struct uvSend *send)
+/* Encode a UV__HEARTBEATS record holding the heartbeat at @head and the ones
+ * following it in the batch, advancing @head past them. */
+static int uvSendBatchEncodeHeartbeats(struct uvSendBatch *batch,
+                                       queue **head,
+                                       uv_buf_t *buf)
 {
+    queue *first = *head;
+    unsigned n = 0;
+    size_t len = 0;
+    void *cursor;
+
+    while (*head != &batch->sends) {
+        struct uvSend *send = QUEUE_DATA(*head, struct uvSend, queue);
+        if (!send->heartbeat) {
+            break;
+        }
+        n++;
+        len += send->bufs[0].len;
+        *head = QUEUE_NEXT(*head);
+    }
+
+    buf->len = uvSizeofHeartbeats(n, len);
+    buf->base = HeapMalloc(buf->len);
+    if (buf->base == NULL) {
+        return RAFT_NOMEM;
+    }
+    batch->records[batch->n_records] = buf->base;
+    batch->n_records++;
+
+    cursor = uvEncodeHeartbeats(n, len, buf->base);
+    while (first != *head) {
+        struct uvSend *send = QUEUE_DATA(first, struct uvSend, queue);
+        memcpy(cursor, send->bufs[0].base, send->bufs[0].len);
+        cursor = (uint8_t *)cursor + send->bufs[0].len;
+        first = QUEUE_NEXT(first);
+    }
+
+    return 0;
+}
+
+/* Write a single batch containing the oldest queued send requests, up to
+ * UV__CLIENT_MAX_WRITE_BUFS buffers in total. */
+static int uvClientFlushBatch(struct uvClient *c)
+{
+    struct uvSendBatch *batch;
+    struct uvSend *prev = NULL;
+    unsigned n_records = 0;
+    queue *head;
+    unsigned i;
     int rv;
-    assert(!c->closing);
-    send->client = c;
 
-    /* If there's no connection available, let's queue the request. */
-    if (c->stream == NULL) {
-        tracef("no connection available -> enqueue message");
-        QUEUE_PUSH(&c->pending, &send->queue);
-        return 0;
+    assert(c->stream != NULL);
+    assert(!QUEUE_IS_EMPTY(&c->queued));
+
+    batch = HeapMalloc(sizeof *batch);
+    if (batch == NULL) {
+        /* Fail the oldest request, like the ones of a batch that can't be
+         * written, so the flush loop still makes progress. */
+        head = QUEUE_HEAD(&c->queued);
+        QUEUE_REMOVE(head);
+        uvSendFinish(QUEUE_DATA(head, struct uvSend, queue), RAFT_NOMEM);
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+    batch->client = c;
+    batch->bufs = NULL;
+    batch->n_bufs = 0;
+    batch->records = NULL;
+    batch->n_records = 0;
+    QUEUE_INIT(&batch->sends);
+
+    /* Move to the batch as many send requests as fit, but at least one. */
+    while (!QUEUE_IS_EMPTY(&c->queued)) {
+        struct uvSend *send;
+        unsigned n;
+        head = QUEUE_HEAD(&c->queued);
+        send = QUEUE_DATA(head, struct uvSend, queue);
+        n = uvSendBatchBufs(send, prev);
+        if (batch->n_bufs > 0 &&
+            batch->n_bufs + n > UV__CLIENT_MAX_WRITE_BUFS) {
+            break;
+        }
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(&batch->sends, head);
+        batch->n_bufs += n;
+        if (send->heartbeat && n > 0) {
+            n_records++;
+        }
+        prev = send;
+    }
+
+    batch->bufs = HeapMalloc(batch->n_bufs * sizeof *batch->bufs);
+    if (batch->bufs == NULL) {
+        rv = RAFT_NOMEM;
+        goto err_after_batch_alloc;
+    }
+    if (n_records > 0) {
+        batch->records = HeapMalloc(n_records * sizeof *batch->records);
+        if (batch->records == NULL) {
+            rv = RAFT_NOMEM;
+            goto err_after_batch_alloc;
+        }
     }
 
-    tracef("connection available -> write message");
-    send->write.data = send;
-    rv = uv_write(&send->write, c->stream, send->bufs, send->n_bufs,
+    i = 0;
+    head = QUEUE_NEXT(&batch->sends);
+    while (head != &batch->sends) {
+        struct uvSend *send = QUEUE_DATA(head, struct uvSend, queue);
+        if (send->heartbeat) {
+            rv = uvSendBatchEncodeHeartbeats(batch, &head, &batch->bufs[i]);
+            if (rv != 0) {
+                goto err_after_batch_alloc;
+            }
+            i++;
+            continue;
+        }
+        memcpy(&batch->bufs[i], send->bufs, send->n_bufs * sizeof *send->bufs);
+        i += send->n_bufs;
+        head = QUEUE_NEXT(head);
+    }
+    assert(i == batch->n_bufs);
+
+    tracef("write %u buffers", batch->n_bufs);
+    batch->write.data = batch;
+    rv = uv_write(&batch->write, c->stream, batch->bufs, batch->n_bufs,
                   uvSendWriteCb);
     if (rv != 0) {
-        tracef("write message failed -> rv %d", rv);
+        tracef("write messages failed -> rv %d", rv);
         /* UNTESTED: what are the error conditions? perhaps ENOMEM */
-        return RAFT_IOERR;
+        rv = RAFT_IOERR;
+        goto err_after_batch_alloc;
     }
 
     return 0;
+
+err_after_batch_alloc:
+    uvSendBatchFinish(batch, rv);
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+/* Invoked right before the loop polls for I/O, write out all the send requests
+ * that were queued in the current loop iteration. */
+static void uvClientFlushCb(uv_prepare_t *prepare)
+{
+    struct uvClient *c = prepare->data;
+    int rv;
+
+    rv = uv_prepare_stop(&c->flush);
+    assert(rv == 0);
+
+    /* Send callbacks fired upon failure might submit new requests or abort the
+     * client, so check the stream at each iteration. */
+    while (c->stream != NULL && !QUEUE_IS_EMPTY(&c->queued)) {
+        uvClientFlushBatch(c);
+    }
+
+    /* If the connection was lost in the meantime, park the requests until we
+     * reconnect. */
+    if (!QUEUE_IS_EMPTY(&c->queued)) {
+        assert(c->stream == NULL);
+        uvClientRequeue(c);
+    }
+}
+
+static void uvClientSend(struct uvClient *c, struct uvSend *send)
+{
+    int rv;
+    assert(!c->closing);
+    assert(send->client == c);
+
+    /* If there's no connection available, let's queue the request. */
+    if (c->stream == NULL) {
+        tracef("no connection available -> enqueue message");
+        QUEUE_PUSH(&c->pending, &send->queue);
+        return;
+    }
+
+    tracef("connection available -> queue message for next flush");
+    QUEUE_PUSH(&c->queued, &send->queue);
+    rv = uv_prepare_start(&c->flush, uvClientFlushCb);
+    assert(rv == 0);
 }
 
 /* Try to execute all send requests that were blocked in the queue waiting for a
  * connection. */
 static void uvClientSendPending(struct uvClient *c)
 {
-    int rv;
     assert(c->stream != NULL);
     tracef(c, "send pending messages");
     while (!QUEUE_IS_EMPTY(&c->pending)) {
@@ -246,13 +571,7 @@ static void uvClientSendPending(struct uvClient *c)
         head = QUEUE_HEAD(&c->pending);
         send = QUEUE_DATA(head, struct uvSend, queue);
         QUEUE_REMOVE(head);
-        rv = uvClientSend(c, send);
-        if (rv != 0) {
-            if (send->req->cb != NULL) {
-                send->req->cb(send->req, rv);
-            }
-            uvSendDestroy(send);
-        }
+        uvClientSend(c, send);
     }
 }
 
@@ -310,27 +629,24 @@ static void uvClientConnectCb(struct raft_uv_connect *req,
         c->stream = stream;
         c->n_connect_attempt = 0;
         c->stream->data = c;
+        uvClientUpdateBacklog(c);
         uvClientSendPending(c);
         return;
     }
 
     /* Shrink the queue of pending requests, by failing the oldest ones */
     n_pending = uvClientPendingCount(c);
-    if (n_pending > UV__CLIENT_MAX_PENDING) {
+    if (n_pending > c->uv->send_max_pending) {
         unsigned i;
-        for (i = 0; i < n_pending - UV__CLIENT_MAX_PENDING; i++) {
-            tracef("queue full -> evict oldest message");
+        for (i = 0; i < n_pending - c->uv->send_max_pending; i++) {
             queue *head;
             struct uvSend *old_send;
-            struct raft_io_send *old_req;
             head = QUEUE_HEAD(&c->pending);
             old_send = QUEUE_DATA(head, struct uvSend, queue);
             QUEUE_REMOVE(head);
-            old_req = old_send->req;
-            uvSendDestroy(old_send);
-            if (old_req->cb != NULL) {
-                old_req->cb(old_req, RAFT_NOCONNECTION);
-            }
+            tracef("queue full -> evict oldest message");
+            old_send->uv->metrics.sends_evicted++;
+            uvSendFinish(old_send, RAFT_NOCONNECTION);
         }
     }
 
@@ -374,6 +690,14 @@ static void uvClientTimerCloseCb(struct uv_handle_s *handle)
     uvClientMaybeDestroy(c);
 }
 
+static void uvClientFlushCloseCb(struct uv_handle_s *handle)
+{
+    struct uvClient *c = handle->data;
+    assert(handle == (struct uv_handle_s *)&c->flush);
+    c->flush.data = NULL;
+    uvClientMaybeDestroy(c);
+}
+
 /* Start shutting down a client. This happens when the `raft_io` instance
  * has been closed or when the address of the client has changed. */
 static void uvClientAbort(struct uvClient *c)
@@ -401,14 +725,20 @@ static void uvClientAbort(struct uvClient *c)
     /* Closing the timer implicitly stop it, so the timeout callback won't be
      * fired. */
     uv_close((struct uv_handle_s *)&c->timer, uvClientTimerCloseCb);
+
+    /* Messages that were not yet flushed will be canceled along with the
+     * pending ones. */
+    uv_close((struct uv_handle_s *)&c->flush, uvClientFlushCloseCb);
+    uvClientRequeue(c);
     c->closing = true;
 }
 
-/* Find the client object associated with the given server, or create one if
- * there's none yet. */
+/* Find the client object associated with the given server and channel, or
+ * create one if there's none yet. */
 static int uvGetClient(struct uv *uv,
                        const raft_id id,
                        const char *address,
+                       unsigned channel,
                        struct uvClient **client)
 {
     queue *head;
@@ -418,7 +748,7 @@ static int uvGetClient(struct uv *uv,
     QUEUE_FOREACH(head, &uv->clients)
     {
         *client = QUEUE_DATA(head, struct uvClient, queue);
-        if ((*client)->id != id) {
+        if ((*client)->id != id || (*client)->channel != channel) {
             continue;
         }
 
@@ -438,7 +768,7 @@ static int uvGetClient(struct uv *uv,
         goto err;
     }
 
-    rv = uvClientInit(*client, uv, id, address);
+    rv = uvClientInit(*client, uv, id, address, channel);
     if (rv != 0) {
         goto err_after_client_alloc;
     }
@@ -455,14 +785,112 @@ err:
     return rv;
 }
 
+/* Return the logical channel that the given message should be sent over.
+ *
+ * Heartbeats go over the same channel as the other AppendEntries messages,
+ * since they must not overtake them: a follower would reject a heartbeat whose
+ * previous index refers to entries that it didn't receive yet, and the leader
+ * would then fall back to probing. */
+static unsigned uvSendChannel(struct uv *uv, const struct raft_message *message)
+{
+    if (!uv->channels) {
+        return RAFT_UV_CHANNEL_CONTROL;
+    }
+    switch (message->type) {
+        case RAFT_IO_APPEND_ENTRIES:
+            return RAFT_UV_CHANNEL_LOG;
+        case RAFT_IO_INSTALL_SNAPSHOT:
+            return RAFT_UV_CHANNEL_SNAPSHOT;
+        default:
+            return RAFT_UV_CHANNEL_CONTROL;
+    }
+}
+
+/* Compute the checksums of the batch of entries in the given AppendEntries
+ * message, in the same way it's done for segment files. The data checksum of
+ * the batch of an append request was already computed when creating it. */
+static void uvSendChecksums(const struct raft_message *message,
+                            const struct uvBatch *batch,
+                            struct uvBatchChecksums *checksums)
+{
+    const struct raft_append_entries *args = &message->append_entries;
+    unsigned i;
+    checksums->header = batch->crc;
+    if (batch->data != NULL) {
+        checksums->data = batch->data_crc;
+        return;
+    }
+    checksums->data = 0;
+    for (i = 0; i < args->n_entries; i++) {
+        const struct raft_buffer *buf = &args->entries[i].buf;
+        checksums->data = byteCrc32(buf->base, buf->len, checksums->data);
+    }
+}
+
+/* Return the size of the payload of the given message. */
+static size_t uvSendPayloadLen(const struct raft_message *message)
+{
+    size_t len = 0;
+    unsigned i;
+    switch (message->type) {
+        case RAFT_IO_APPEND_ENTRIES:
+            for (i = 0; i < message->append_entries.n_entries; i++) {
+                len += message->append_entries.entries[i].buf.len;
+            }
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT:
+            len = message->install_snapshot.data.len;
+            break;
+    }
+    return len;
+}
+
+/* Return true if the payload of the given message should be compressed. */
+static bool uvSendShouldCompress(struct uv *uv,
+                                 const struct raft_message *message,
+                                 uint64_t capabilities)
+{
+    size_t len;
+    if (!uv->compression) {
+        return false;
+    }
+    len = uvSendPayloadLen(message);
+    if (len == 0 || len < uv->compression_threshold) {
+        return false;
+    }
+    return (capabilities & UV__CAPABILITY_COMPRESSION) != 0;
+}
+
+/* Return true if the headers of messages should be compact. */
+static bool uvSendShouldCompact(struct uv *uv, uint64_t capabilities)
+{
+    return uv->compact && (capabilities & UV__CAPABILITY_COMPACT) != 0;
+}
+
+/* Return true if the given message is a heartbeat that a hosted instance can
+ * send as part of a UV__HEARTBEATS record. */
+static bool uvSendIsHeartbeat(struct uv *uv,
+                              const struct raft_message *message,
+                              uint64_t capabilities)
+{
+    if (uv->group == 0 || (capabilities & UV__CAPABILITY_HEARTBEATS) == 0) {
+        return false;
+    }
+    return message->type == RAFT_IO_APPEND_ENTRIES &&
+           message->append_entries.n_entries == 0;
+}
+
 int UvSend(struct raft_io *io,
            struct raft_io_send *req,
            const struct raft_message *message,
            raft_io_send_cb cb)
 {
     struct uv *uv = io->impl;
+    struct uv *net = UvNet(uv);
+    struct uvBatchChecksums checksums;
     struct uvSend *send;
     struct uvClient *client;
+    unsigned i;
     int rv;
 
     assert(!uv->closing);
@@ -473,26 +901,68 @@ int UvSend(struct raft_io *io,
         rv = RAFT_NOMEM;
         goto err;
     }
+    send->uv = uv;
+    send->client = NULL;
     send->req = req;
+    send->bufs = NULL;
+    send->size = 0;
+    send->batch = NULL;
+    send->heartbeat = false;
     req->cb = cb;
+    uv->n_sends++;
+
+    /* The batch header of AppendEntries messages is shared by all the messages
+     * carrying the same entries, and by the disk write of those entries. */
+    if (message->type == RAFT_IO_APPEND_ENTRIES &&
+        message->append_entries.n_entries > 0) {
+        rv = UvBatchAcquire(uv, message->append_entries.entries,
+                            message->append_entries.n_entries, &send->batch);
+        if (rv != 0) {
+            goto err_after_send_alloc;
+        }
+    }
 
-    rv = uvEncodeMessage(message, &send->bufs, &send->n_bufs);
-    if (rv != 0) {
-        send->bufs = NULL;
-        goto err_after_send_alloc;
+    if (send->batch != NULL && net->wire_checksums) {
+        uvSendChecksums(message, send->batch, &checksums);
     }
 
     /* Get a client object connected to the target server, creating it if it
-     * doesn't exist yet. */
-    rv = uvGetClient(uv, message->server_id, message->server_address, &client);
+     * doesn't exist yet. The groups of a host share its clients. */
+    rv = uvGetClient(net, message->server_id, message->server_address,
+                     uvSendChannel(net, message), &client);
     if (rv != 0) {
         goto err_after_send_alloc;
     }
 
-    rv = uvClientSend(client, send);
+    /* Heartbeats of hosted instances get coalesced with the ones of the other
+     * groups of the host at flush time. */
+    send->heartbeat = uvSendIsHeartbeat(uv, message, client->capabilities);
+    if (send->heartbeat) {
+        rv = uvEncodeHeartbeat(message, uv->group, &send->bufs, &send->n_bufs);
+    } else {
+        rv = uvEncodeMessage(
+            message, send->batch != NULL ? &send->batch->header : NULL,
+            send->batch != NULL && net->wire_checksums ? &checksums : NULL,
+            uvSendShouldCompress(net, message, client->capabilities),
+            uvSendShouldCompact(net, client->capabilities), uv->group,
+            &send->bufs, &send->n_bufs);
+    }
     if (rv != 0) {
+        send->bufs = NULL;
         goto err_after_send_alloc;
     }
+    for (i = 0; i < send->n_bufs; i++) {
+        send->size += send->bufs[i].len;
+    }
+
+    /* Account for the request until it completes. */
+    send->client = client;
+    client->n_messages++;
+    client->n_bytes += send->size;
+    uvClientUpdateBacklog(client);
+    uv->send_bytes += send->size;
+
+    uvClientSend(client, send);
 
     return 0;
 
@@ -503,9 +973,84 @@ err:
     return rv;
 }
 
+bool UvSendBacklogged(struct raft_io *io, raft_id id)
+{
+    struct uv *uv = UvNet(io->impl);
+    queue *head;
+    /* Usually no server is backlogged, and there's no need to look further. */
+    if (uv->n_backlogged == 0) {
+        return false;
+    }
+    QUEUE_FOREACH(head, &uv->clients)
+    {
+        struct uvClient *c = QUEUE_DATA(head, struct uvClient, queue);
+        if (c->id == id && c->backlogged) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void UvSendSetPeerCapabilities(struct uv *uv,
+                               raft_id id,
+                               uint64_t capabilities)
+{
+    queue *head;
+    QUEUE_FOREACH(head, &uv->clients)
+    {
+        struct uvClient *c = QUEUE_DATA(head, struct uvClient, queue);
+        if (c->id == id) {
+            c->capabilities = capabilities;
+        }
+    }
+}
+
+/* Move the requests of the given instance found in @q to @canceled. */
+static void uvSendCollect(struct uv *uv, queue *q, queue *canceled)
+{
+    queue *head = QUEUE_NEXT(q);
+    while (head != q) {
+        struct uvSend *send = QUEUE_DATA(head, struct uvSend, queue);
+        head = QUEUE_NEXT(head);
+        if (send->uv == uv) {
+            QUEUE_REMOVE(&send->queue);
+            QUEUE_PUSH(canceled, &send->queue);
+        }
+    }
+}
+
+/* Cancel the requests of a hosted instance that were not yet written by the
+ * clients of its host, which keep running. */
+static void uvSendCancelGroup(struct uv *uv)
+{
+    struct uv *net = UvNet(uv);
+    queue canceled;
+    queue *head;
+
+    QUEUE_INIT(&canceled);
+    QUEUE_FOREACH(head, &net->clients)
+    {
+        struct uvClient *c = QUEUE_DATA(head, struct uvClient, queue);
+        uvSendCollect(uv, &c->pending, &canceled);
+        uvSendCollect(uv, &c->queued, &canceled);
+    }
+
+    while (!QUEUE_IS_EMPTY(&canceled)) {
+        struct uvSend *send;
+        head = QUEUE_HEAD(&canceled);
+        send = QUEUE_DATA(head, struct uvSend, queue);
+        QUEUE_REMOVE(head);
+        uvSendFinish(send, RAFT_CANCELED);
+    }
+}
+
 void UvSendClose(struct uv *uv)
 {
     assert(uv->closing);
+    if (uv->group != 0) {
+        uvSendCancelGroup(uv);
+        return;
+    }
     while (!QUEUE_IS_EMPTY(&uv->clients)) {
         queue *head;
         struct uvClient *client;
@@ -1,6 +1,7 @@
 #include "uv_tcp.h"
 
 #include <string.h>
+#include <sys/un.h>
 
 #include "../include/raft.h"
 #include "../include/raft/uv.h"
@@ -18,11 +19,15 @@ static int uvTcpInit(struct raft_uv_transport *transport,
     assert(address != NULL);
     t->id = id;
     t->address = address;
-    rv = uv_tcp_init(t->loop, &t->listener);
-    if (rv != 0) {
-        return rv;
+    if (t->unix_socket) {
+        rv = UvTcpCheckPath(address);
+        if (rv != 0) {
+            ErrMsgPrintf(transport->errmsg, "socket path is too long");
+            return rv;
+        }
     }
-    t->listener.data = t;
+    UvTcpHandleInit(t, &t->listener);
+    t->listener.handle.data = t;
     return 0;
 }
 
@@ -47,7 +52,7 @@ void UvTcpMaybeFireCloseCb(struct UvTcp *t)
     assert(QUEUE_IS_EMPTY(&t->accepting));
     assert(QUEUE_IS_EMPTY(&t->connecting));
 
-    if (t->listener.data != NULL) {
+    if (t->listener.handle.data != NULL) {
         return;
     }
     if (!QUEUE_IS_EMPTY(&t->aborting)) {
@@ -59,8 +64,30 @@ void UvTcpMaybeFireCloseCb(struct UvTcp *t)
     }
 }
 
-int raft_uv_tcp_init(struct raft_uv_transport *transport,
-                     struct uv_loop_s *loop)
+void UvTcpHandleInit(struct UvTcp *t, union UvTcpHandle *handle)
+{
+    int rv;
+    if (t->unix_socket) {
+        rv = uv_pipe_init(t->loop, &handle->pipe, 0);
+    } else {
+        rv = uv_tcp_init(t->loop, &handle->tcp);
+    }
+    assert(rv == 0);
+    (void)rv;
+}
+
+int UvTcpCheckPath(const char *address)
+{
+    struct sockaddr_un addr;
+    if (strlen(address) >= sizeof addr.sun_path) {
+        return RAFT_NAMETOOLONG;
+    }
+    return 0;
+}
+
+static int uvTcpInitTransport(struct raft_uv_transport *transport,
+                              struct uv_loop_s *loop,
+                              bool unix_socket)
 {
     struct UvTcp *t;
     void *data = transport->data;
@@ -75,7 +102,9 @@ int raft_uv_tcp_init(struct raft_uv_transport *transport,
     t->loop = loop;
     t->id = 0;
     t->address = NULL;
-    t->listener.data = NULL;
+    t->unix_socket = unix_socket;
+    t->bound = false;
+    t->listener.handle.data = NULL;
     t->accept_cb = NULL;
     QUEUE_INIT(&t->accepting);
     QUEUE_INIT(&t->connecting);
@@ -92,8 +121,25 @@ int raft_uv_tcp_init(struct raft_uv_transport *transport,
     return 0;
 }
 
+int raft_uv_tcp_init(struct raft_uv_transport *transport,
+                     struct uv_loop_s *loop)
+{
+    return uvTcpInitTransport(transport, loop, false);
+}
+
 void raft_uv_tcp_close(struct raft_uv_transport *transport)
 {
     struct UvTcp *t = transport->impl;
     raft_free(t);
 }
+
+int raft_uv_unix_init(struct raft_uv_transport *transport,
+                      struct uv_loop_s *loop)
+{
+    return uvTcpInitTransport(transport, loop, true);
+}
+
+void raft_uv_unix_close(struct raft_uv_transport *transport)
+{
+    raft_uv_tcp_close(transport);
+}
@@ -7,13 +7,30 @@
 /* Protocol version. */
 #define UV__TCP_HANDSHAKE_PROTOCOL 1
 
+/* Protocol version of handshakes that also carry the logical channel of the
+ * connection. Only used for channels other than the control one, so control
+ * connections keep working with servers that only know version 1. */
+#define UV__TCP_HANDSHAKE_PROTOCOL_CHANNEL 2
+
+/* Handle of a socket, which is either a TCP or a Unix domain one depending on
+ * the type of the transport. */
+union UvTcpHandle
+{
+    struct uv_handle_s handle;
+    struct uv_stream_s stream;
+    struct uv_tcp_s tcp;
+    struct uv_pipe_s pipe;
+};
+
 struct UvTcp
 {
     struct raft_uv_transport *transport; /* Interface object we implement */
     struct uv_loop_s *loop;              /* Event loop */
     raft_id id;                          /* ID of this raft server */
     const char *address;                 /* Address of this raft server */
-    struct uv_tcp_s listener;            /* Listening TCP socket handle */
+    bool unix_socket;                    /* Use Unix domain sockets */
+    bool bound;                          /* Socket file created by listen() */
+    union UvTcpHandle listener;          /* Listening socket handle */
     raft_uv_accept_cb accept_cb;         /* Call after accepting a connection */
     queue accepting;                     /* Connections being accepted */
     queue connecting;                    /* Pending connection requests */
@@ -22,6 +39,12 @@ struct UvTcp
     raft_uv_transport_close_cb close_cb; /* Call when it's safe to free us */
 };
 
+/* Initialize a socket handle of the type used by the transport. */
+void UvTcpHandleInit(struct UvTcp *t, union UvTcpHandle *handle);
+
+/* Check that the given address is a valid Unix domain socket path. */
+int UvTcpCheckPath(const char *address);
+
 /* Implementation of raft_uv_transport->listen. */
 int UvTcpListen(struct raft_uv_transport *transport, raft_uv_accept_cb cb);
 
@@ -28,7 +28,7 @@ struct uvTcpConnect
     struct UvTcp *t;             /* Transport implementation */
     struct raft_uv_connect *req; /* User request */
     uv_buf_t handshake;          /* Handshake data */
-    struct uv_tcp_s *tcp;        /* TCP connection socket handle */
+    union UvTcpHandle *tcp;      /* Connection socket handle */
     struct uv_connect_s connect; /* TCP connection request */
     struct uv_write_s write;     /* TCP handshake request */
     int status;                  /* Returned to the request callback */
@@ -36,22 +36,35 @@ struct uvTcpConnect
 };
 
 /* Encode an handshake message into the given buffer. */
-static int uvTcpEncodeHandshake(raft_id id, const char *address, uv_buf_t *buf)
+static int uvTcpEncodeHandshake(raft_id id,
+                                const char *address,
+                                unsigned channel,
+                                uv_buf_t *buf)
 {
     void *cursor;
     size_t address_len = bytePad64(strlen(address) + 1);
     buf->len = sizeof(uint64_t) + /* Protocol version. */
                sizeof(uint64_t) + /* Server ID. */
                sizeof(uint64_t) /* Size of the address buffer */;
+    if (channel != RAFT_UV_CHANNEL_CONTROL) {
+        buf->len += sizeof(uint64_t); /* Channel */
+    }
     buf->len += address_len;
     buf->base = HeapMalloc(buf->len);
     if (buf->base == NULL) {
         return RAFT_NOMEM;
     }
     cursor = buf->base;
-    bytePut64(&cursor, UV__TCP_HANDSHAKE_PROTOCOL);
-    bytePut64(&cursor, id);
-    bytePut64(&cursor, address_len);
+    if (channel != RAFT_UV_CHANNEL_CONTROL) {
+        bytePut64(&cursor, UV__TCP_HANDSHAKE_PROTOCOL_CHANNEL);
+        bytePut64(&cursor, id);
+        bytePut64(&cursor, address_len);
+        bytePut64(&cursor, channel);
+    } else {
+        bytePut64(&cursor, UV__TCP_HANDSHAKE_PROTOCOL);
+        bytePut64(&cursor, id);
+        bytePut64(&cursor, address_len);
+    }
     strcpy(cursor, address);
     return 0;
 }
@@ -127,7 +140,8 @@ static void uvTcpConnectUvConnectCb(struct uv_connect_s *req, int status)
     if (status != 0) {
         assert(status != UV_ECANCELED); /* t->closing would have been true */
         connect->status = RAFT_NOCONNECTION;
-        ErrMsgPrintf(t->transport->errmsg, "uv_tcp_connect(): %s",
+        ErrMsgPrintf(t->transport->errmsg, "%s(): %s",
+                     t->unix_socket ? "uv_pipe_connect" : "uv_tcp_connect",
                      uv_strerror(status));
         goto err;
     }
@@ -153,13 +167,22 @@ static int uvTcpConnectStart(struct uvTcpConnect *r, const char *address)
     struct sockaddr_in addr;
     int rv;
 
-    rv = uvIpParse(address, &addr);
-    if (rv != 0) {
-        goto err;
+    if (t->unix_socket) {
+        rv = UvTcpCheckPath(address);
+        if (rv != 0) {
+            ErrMsgPrintf(t->transport->errmsg, "socket path is too long");
+            goto err;
+        }
+    } else {
+        rv = uvIpParse(address, &addr);
+        if (rv != 0) {
+            goto err;
+        }
     }
 
     /* Initialize the handshake buffer. */
-    rv = uvTcpEncodeHandshake(t->id, t->address, &r->handshake);
+    rv = uvTcpEncodeHandshake(t->id, t->address, r->req->channel,
+                              &r->handshake);
     if (rv != 0) {
         assert(rv == RAFT_NOMEM);
         ErrMsgOom(r->t->transport->errmsg);
@@ -173,11 +196,17 @@ static int uvTcpConnectStart(struct uvTcpConnect *r, const char *address)
         goto err_after_encode_handshake;
     }
 
-    rv = uv_tcp_init(r->t->loop, r->tcp);
-    assert(rv == 0);
-    r->tcp->data = r;
+    UvTcpHandleInit(t, r->tcp);
+    r->tcp->handle.data = r;
+
+    if (t->unix_socket) {
+        /* Errors are reported asynchronously to the connect callback. */
+        uv_pipe_connect(&r->connect, &r->tcp->pipe, address,
+                        uvTcpConnectUvConnectCb);
+        return 0;
+    }
 
-    rv = uv_tcp_connect(&r->connect, r->tcp, (struct sockaddr *)&addr,
+    rv = uv_tcp_connect(&r->connect, &r->tcp->tcp, (struct sockaddr *)&addr,
                         uvTcpConnectUvConnectCb);
     if (rv != 0) {
         /* UNTESTED: since parsing succeed, this should fail only because of
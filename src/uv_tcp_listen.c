@@ -1,9 +1,16 @@
+#include <errno.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include "assert.h"
 #include "byte.h"
+#include "err.h"
 #include "heap.h"
 #include "uv_ip.h"
+#include "uv_os.h"
 #include "uv_tcp.h"
 
 /* The happy path of an incoming connection is:
@@ -12,7 +19,8 @@
  *   incoming connection is uv_accept()'ed. We call uv_read_start() to get
  *   notified about received handshake data.
  *
- * - Once the preamble is received, we start waiting for the server address.
+ * - Once the preamble is received, we start waiting for the server address,
+ *   possibly preceded by the logical channel of the connection.
  *
  * - Once the server address is received, we fire the receive callback.
  *
@@ -36,22 +44,27 @@ struct uvTcpHandshake
 struct uvTcpIncoming
 {
     struct UvTcp *t;                 /* Transport implementation */
-    struct uv_tcp_s *tcp;            /* TCP connection socket handle */
+    union UvTcpHandle *tcp;          /* Connection socket handle */
     struct uvTcpHandshake handshake; /* Handshake data */
     queue queue;                     /* Pending accept queue */
 };
 
 /* Decode the handshake preamble, containing the protocol version, the ID of the
  * connecting server and the length of its address. Also, allocate the buffer to
- * start reading the server address. */
+ * start reading the server address, which in version 2 of the protocol is
+ * preceded by the logical channel of the connection. */
 static int uvTcpDecodePreamble(struct uvTcpHandshake *h)
 {
     uint64_t protocol;
     protocol = byteFlip64(h->preamble[0]);
-    if (protocol != UV__TCP_HANDSHAKE_PROTOCOL) {
+    if (protocol != UV__TCP_HANDSHAKE_PROTOCOL &&
+        protocol != UV__TCP_HANDSHAKE_PROTOCOL_CHANNEL) {
         return RAFT_MALFORMED;
     }
     h->address.len = (size_t)byteFlip64(h->preamble[2]);
+    if (protocol == UV__TCP_HANDSHAKE_PROTOCOL_CHANNEL) {
+        h->address.len += sizeof(uint64_t);
+    }
     h->address.base = HeapMalloc(h->address.len);
     if (h->address.base == NULL) {
         return RAFT_NOMEM;
@@ -106,6 +119,7 @@ static void uvTcpIncomingReadCbAddress(uv_stream_t *stream,
     struct uvTcpIncoming *incoming = stream->data;
     char *address;
     raft_id id;
+    uint64_t channel;
     size_t n;
     int rv;
 
@@ -134,13 +148,26 @@ static void uvTcpIncomingReadCbAddress(uv_stream_t *stream,
         return;
     }
 
+    address = incoming->handshake.address.base;
+    channel = RAFT_UV_CHANNEL_CONTROL;
+    if (byteFlip64(incoming->handshake.preamble[0]) ==
+        UV__TCP_HANDSHAKE_PROTOCOL_CHANNEL) {
+        const void *cursor = address;
+        channel = byteGet64(&cursor);
+        if (channel >= RAFT_UV_N_CHANNELS) {
+            uvTcpIncomingAbort(incoming);
+            return;
+        }
+        address += sizeof(uint64_t);
+    }
+
     /* If we have completed reading the address, let's fire the callback. */
     rv = uv_read_stop(stream);
     assert(rv == 0);
     id = byteFlip64(incoming->handshake.preamble[1]);
-    address = incoming->handshake.address.base;
     QUEUE_REMOVE(&incoming->queue);
     incoming->t->accept_cb(incoming->t->transport, id, address,
+                           (unsigned)channel,
                            (struct uv_stream_s *)incoming->tcp);
     HeapFree(incoming->handshake.address.base);
     HeapFree(incoming);
@@ -215,10 +242,8 @@ static int uvTcpIncomingStart(struct uvTcpIncoming *incoming)
     if (incoming->tcp == NULL) {
         return RAFT_NOMEM;
     }
-    incoming->tcp->data = incoming;
-
-    rv = uv_tcp_init(incoming->t->loop, incoming->tcp);
-    assert(rv == 0);
+    UvTcpHandleInit(incoming->t, incoming->tcp);
+    incoming->tcp->handle.data = incoming;
 
     rv = uv_accept((struct uv_stream_s *)&incoming->t->listener,
                    (struct uv_stream_s *)incoming->tcp);
@@ -275,6 +300,53 @@ err:
     assert(rv != 0);
 }
 
+/* Remove the socket file at the address of the given transport if it was left
+ * behind by a previous run, that is if it's a socket that nobody is listening
+ * on anymore. Fail if there's anything else at that path. */
+static int uvTcpRemoveStaleSocket(struct UvTcp *t)
+{
+    struct sockaddr_un addr;
+    struct stat sb;
+    int fd;
+    int rv;
+
+    rv = lstat(t->address, &sb);
+    if (rv != 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        ErrMsgPrintf(t->transport->errmsg, "lstat(): %s", strerror(errno));
+        return RAFT_IOERR;
+    }
+    if (!S_ISSOCK(sb.st_mode)) {
+        ErrMsgPrintf(t->transport->errmsg, "%s exists and is not a socket",
+                     t->address);
+        return RAFT_DUPLICATEADDRESS;
+    }
+
+    /* Probe the socket: only a refused connection tells that it's stale. */
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        ErrMsgPrintf(t->transport->errmsg, "socket(): %s", strerror(errno));
+        return RAFT_IOERR;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, t->address);
+    rv = connect(fd, (const struct sockaddr *)&addr, sizeof addr);
+    if (rv != 0) {
+        rv = errno;
+    }
+    close(fd);
+    if (rv != ECONNREFUSED) {
+        ErrMsgPrintf(t->transport->errmsg, "%s is in use", t->address);
+        return RAFT_DUPLICATEADDRESS;
+    }
+
+    UvOsUnlink(t->address);
+    return 0;
+}
+
 int UvTcpListen(struct raft_uv_transport *transport, raft_uv_accept_cb cb)
 {
     struct UvTcp *t;
@@ -284,14 +356,28 @@ int UvTcpListen(struct raft_uv_transport *transport, raft_uv_accept_cb cb)
     t = transport->impl;
     t->accept_cb = cb;
 
-    rv = uvIpParse(t->address, &addr);
-    if (rv != 0) {
-        return rv;
-    }
-    rv = uv_tcp_bind(&t->listener, (const struct sockaddr *)&addr, 0);
-    if (rv != 0) {
-        /* UNTESTED: what are the error conditions? */
-        return RAFT_IOERR;
+    if (t->unix_socket) {
+        rv = uvTcpRemoveStaleSocket(t);
+        if (rv != 0) {
+            return rv;
+        }
+        rv = uv_pipe_bind(&t->listener.pipe, t->address);
+        if (rv != 0) {
+            ErrMsgPrintf(transport->errmsg, "uv_pipe_bind(): %s",
+                         uv_strerror(rv));
+            return rv == UV_EADDRINUSE ? RAFT_DUPLICATEADDRESS : RAFT_IOERR;
+        }
+        t->bound = true;
+    } else {
+        rv = uvIpParse(t->address, &addr);
+        if (rv != 0) {
+            return rv;
+        }
+        rv = uv_tcp_bind(&t->listener.tcp, (const struct sockaddr *)&addr, 0);
+        if (rv != 0) {
+            /* UNTESTED: what are the error conditions? */
+            return RAFT_IOERR;
+        }
     }
     rv = uv_listen((uv_stream_t *)&t->listener, 1, uvTcpListenCb);
     if (rv != 0) {
@@ -307,7 +393,7 @@ static void uvTcpListenCloseCbListener(struct uv_handle_s *handle)
 {
     struct UvTcp *t = handle->data;
     assert(t->closing);
-    t->listener.data = NULL;
+    t->listener.handle.data = NULL;
     UvTcpMaybeFireCloseCb(t);
 }
 
@@ -315,7 +401,7 @@ void UvTcpListenClose(struct UvTcp *t)
 {
     queue *head;
     assert(t->closing);
-    assert(t->listener.data != NULL);
+    assert(t->listener.handle.data != NULL);
 
     while (!QUEUE_IS_EMPTY(&t->accepting)) {
         struct uvTcpIncoming *incoming;
@@ -324,5 +410,11 @@ void UvTcpListenClose(struct UvTcp *t)
         uvTcpIncomingAbort(incoming);
     }
 
+    /* Don't leave our socket file behind. */
+    if (t->bound) {
+        UvOsUnlink(t->address);
+        t->bound = false;
+    }
+
     uv_close((struct uv_handle_s *)&t->listener, uvTcpListenCloseCbListener);
 }
@@ -112,6 +112,51 @@ TEST(raft_apply, first, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* The time at which the request goes through each stage is recorded, in
+ * microseconds. */
+TEST(raft_apply, times, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply_times *times;
+    uint64_t submitted = CLUSTER_TIME * 1000;
+    CLUSTER_SET_DISK_LATENCY(0, 10);
+    CLUSTER_SET_NETWORK_LATENCY(0, 20);
+    CLUSTER_SET_NETWORK_LATENCY(1, 20);
+    APPLY_SUBMIT(0);
+    APPLY_WAIT;
+    times = &_req.times;
+    munit_assert_int(times->submitted, ==, submitted);
+    munit_assert_int(times->appended, ==, submitted);
+    munit_assert_int(times->persisted, ==, submitted + 10000);
+    munit_assert_int(times->committed, >=, submitted + 40000);
+    munit_assert_int(times->applied, ==, times->committed);
+    return MUNIT_OK;
+}
+
+/* The stages of a request with several commands are recorded once all its
+ * entries have gone through them. */
+TEST(raft_apply, timesMultipleCommands, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_buffer bufs[2];
+    struct raft_apply req;
+    struct result result = {0, false};
+    uint64_t submitted = CLUSTER_TIME * 1000;
+    int rv;
+    CLUSTER_SET_DISK_LATENCY(0, 10);
+    FsmEncodeSetX(1, &bufs[0]);
+    FsmEncodeSetX(2, &bufs[1]);
+    req.data = &result;
+    rv = raft_apply(CLUSTER_RAFT(0), &req, bufs, 2, applyCbAssertResult);
+    munit_assert_int(rv, ==, 0);
+    CLUSTER_STEP_UNTIL(applyCbHasFired, &result, 2000);
+    munit_assert_int(req.n, ==, 2);
+    munit_assert_int(req.times.appended, ==, submitted);
+    munit_assert_int(req.times.persisted, ==, submitted + 10000);
+    munit_assert_int(req.times.committed, >, 0);
+    return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * Failure scenarios
@@ -198,6 +198,64 @@ TEST(raft_fixture_step, deliver, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Messages sent over a link with limited bandwidth are delayed by the time it
+ * takes to transmit them and the messages sent before them. */
+TEST(raft_fixture_step, bandwidth, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_fixture_event *event;
+    (void)params;
+    raft_fixture_set_network_bandwidth(&f->fixture, 0, 32000);
+    STEP_UNTIL_STATE_IS(0, RAFT_CANDIDATE); /* Server 0 starts election */
+    STEP_N(2);                              /* Server 0 sends 2 RequestVote */
+    STEP_N(2);                              /* Ticks for server 1 and 2 */
+    event = STEP;
+    munit_assert_int(event->server_index, ==, 0);
+    munit_assert_int(event->type, ==, RAFT_FIXTURE_NETWORK);
+    ASSERT_TIME(1017);
+    return MUNIT_OK;
+}
+
+/* Messages are delivered only after the receiving server has spent the CPU
+ * time needed to process them. */
+TEST(raft_fixture_step, messageCost, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_fixture_event *event;
+    (void)params;
+    raft_fixture_set_message_cost(&f->fixture, 1, 2500);
+    raft_fixture_set_message_cost(&f->fixture, 2, 2500);
+    STEP_UNTIL_STATE_IS(0, RAFT_CANDIDATE); /* Server 0 starts election */
+    STEP_N(2);                              /* Server 0 sends 2 RequestVote */
+    STEP_N(2);                              /* Ticks for server 1 and 2 */
+    event = STEP;
+    munit_assert_int(event->server_index, ==, 0);
+    munit_assert_int(event->type, ==, RAFT_FIXTURE_NETWORK);
+    ASSERT_TIME(1018);
+    return MUNIT_OK;
+}
+
+/* Appends are synced one at a time. */
+TEST(raft_fixture_step, fsyncCost, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply *req1 = munit_malloc(sizeof *req1);
+    struct raft_apply *req2 = munit_malloc(sizeof *req2);
+    raft_time now;
+    (void)params;
+    ELECT(0);
+    raft_fixture_set_fsync_cost(&f->fixture, 0, 5000);
+    now = raft_fixture_time(&f->fixture);
+    APPLY(0, req1);
+    APPLY(0, req2);
+    STEP_UNTIL_APPLIED(3);
+    munit_assert_int(req1->times.persisted, ==, (now + 15) * 1000);
+    munit_assert_int(req2->times.persisted, ==, (now + 20) * 1000);
+    free(req1);
+    free(req2);
+    return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * raft_fixture_elect
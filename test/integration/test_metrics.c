@@ -0,0 +1,276 @@
+#include "../lib/cluster.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ *****************************************************************************/
+
+struct fixture
+{
+    FIXTURE_CLUSTER;
+};
+
+static void *setUp(const MunitParameter params[], MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_CLUSTER(2);
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_CLUSTER;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+/* Fetch the metrics of the I'th raft instance. */
+#define GET_METRICS(I, METRICS) raft_get_metrics(CLUSTER_RAFT(I), METRICS)
+
+/* Apply a new entry on the leader and wait for the I'th server to apply it. */
+#define APPLY_AND_WAIT(I)                                            \
+    do {                                                             \
+        struct raft_apply *req_ = munit_malloc(sizeof *req_);        \
+        raft_index index_ = raft_last_index(CLUSTER_RAFT(0)) + 1;    \
+        CLUSTER_APPLY_ADD_X(0, req_, 1, NULL);                       \
+        CLUSTER_STEP_UNTIL_APPLIED(I, index_, 2000);                 \
+        free(req_);                                                  \
+    } while (0)
+
+/******************************************************************************
+ *
+ * raft_get_metrics
+ *
+ *****************************************************************************/
+
+SUITE(raft_get_metrics)
+
+/* Entries appended, sent and applied are counted. */
+TEST(raft_get_metrics, counters, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_metrics leader;
+    struct raft_metrics follower;
+
+    APPLY_AND_WAIT(1);
+    GET_METRICS(0, &leader);
+    GET_METRICS(1, &follower);
+
+    munit_assert_int(leader.elections, ==, 1);
+    munit_assert_int(leader.entries_appended, ==, 1);
+    munit_assert_int(leader.bytes_appended, ==, 16);
+    munit_assert_int(leader.entries_sent, ==, 1);
+    munit_assert_int(leader.bytes_sent, ==, 16);
+    munit_assert_int(leader.entries_applied, ==, 1);
+    munit_assert_int(leader.bytes_applied, ==, 16);
+    munit_assert_int(leader.snapshots_taken, ==, 0);
+
+    munit_assert_int(follower.elections, ==, 0);
+    munit_assert_int(follower.entries_appended, ==, 1);
+    munit_assert_int(follower.entries_sent, ==, 0);
+    munit_assert_int(follower.entries_applied, ==, 1);
+
+    return MUNIT_OK;
+}
+
+/* The leader records the time it takes for each apply request to be committed
+ * and applied, in microseconds. */
+TEST(raft_get_metrics, latency, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_metrics metrics;
+
+    CLUSTER_SET_NETWORK_LATENCY(0, 20);
+    CLUSTER_SET_NETWORK_LATENCY(1, 20);
+    APPLY_AND_WAIT(0);
+    APPLY_AND_WAIT(0);
+    GET_METRICS(0, &metrics);
+
+    munit_assert_int(metrics.commit_latency.count, ==, 2);
+    munit_assert_int(metrics.commit_latency.max, >=, 40000);
+    munit_assert_int(metrics.apply_latency.count, ==, 2);
+    munit_assert_int(metrics.apply_latency.max, >=,
+                     metrics.commit_latency.max);
+
+    GET_METRICS(1, &metrics);
+    munit_assert_int(metrics.commit_latency.count, ==, 0);
+
+    return MUNIT_OK;
+}
+
+/* Apply requests in flight at the same time all get their latency recorded. */
+TEST(raft_get_metrics, latencyConcurrent, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply reqs[3];
+    struct raft_metrics metrics;
+    raft_index index = raft_last_index(CLUSTER_RAFT(0)) + 3;
+    unsigned i;
+
+    CLUSTER_SET_NETWORK_LATENCY(0, 20);
+    CLUSTER_SET_NETWORK_LATENCY(1, 20);
+    for (i = 0; i < 3; i++) {
+        CLUSTER_APPLY_ADD_X(0, &reqs[i], 1, NULL);
+    }
+    CLUSTER_STEP_UNTIL_APPLIED(0, index, 2000);
+    GET_METRICS(0, &metrics);
+
+    munit_assert_int(metrics.commit_latency.count, ==, 3);
+    munit_assert_int(metrics.apply_latency.count, ==, 3);
+    for (i = 0; i < 3; i++) {
+        munit_assert_int(reqs[i].times.committed - reqs[i].times.submitted,
+                         <=, metrics.commit_latency.max);
+    }
+
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * raft_get_ack_latency
+ *
+ *****************************************************************************/
+
+SUITE(raft_get_ack_latency)
+
+/* The leader samples the time it takes for each follower to acknowledge new
+ * entries. */
+TEST(raft_get_ack_latency, follower, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_histogram latency;
+    int rv;
+
+    CLUSTER_SET_NETWORK_LATENCY(0, 20);
+    CLUSTER_SET_NETWORK_LATENCY(1, 20);
+    APPLY_AND_WAIT(1);
+    rv = raft_get_ack_latency(CLUSTER_RAFT(0), 2, &latency);
+    munit_assert_int(rv, ==, 0);
+    munit_assert_int(latency.count, ==, 1);
+    munit_assert_int(latency.max, >=, 40);
+    munit_assert_int(raft_histogram_percentile(&latency, 50), ==,
+                     latency.max);
+
+    return MUNIT_OK;
+}
+
+/* Only the leader tracks acknowledgements. */
+TEST(raft_get_ack_latency, notLeader, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_histogram latency;
+    int rv;
+    rv = raft_get_ack_latency(CLUSTER_RAFT(1), 1, &latency);
+    munit_assert_int(rv, ==, RAFT_NOTLEADER);
+    return MUNIT_OK;
+}
+
+/* The server must be part of the configuration. */
+TEST(raft_get_ack_latency, badId, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_histogram latency;
+    int rv;
+    rv = raft_get_ack_latency(CLUSTER_RAFT(0), 3, &latency);
+    munit_assert_int(rv, ==, RAFT_BADID);
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * raft_get_memory
+ *
+ *****************************************************************************/
+
+SUITE(raft_get_memory)
+
+/* Once entries are persisted and replicated, only the log holds them. */
+TEST(raft_get_memory, idle, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_memory memory;
+
+    APPLY_AND_WAIT(1);
+    APPLY_AND_WAIT(0);
+    raft_get_memory(CLUSTER_RAFT(0), &memory);
+
+    munit_assert_int(memory.log_entries, >=, 16);
+    munit_assert_int(memory.log_shared, ==, 0);
+    munit_assert_int(memory.log_pinned, ==, 0);
+    munit_assert_int(memory.log_index, >, 0);
+    munit_assert_int(memory.snapshots, ==, 0);
+
+    return MUNIT_OK;
+}
+
+/* Entries that are being written to disk are accounted as shared. */
+TEST(raft_get_memory, shared, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply *req = munit_malloc(sizeof *req);
+    struct raft_memory memory;
+    raft_index index = raft_last_index(CLUSTER_RAFT(0)) + 1;
+
+    CLUSTER_SET_DISK_LATENCY(0, 100);
+    CLUSTER_APPLY_ADD_X(0, req, 1, NULL);
+    raft_get_memory(CLUSTER_RAFT(0), &memory);
+    munit_assert_int(memory.log_shared, ==, 16);
+
+    CLUSTER_STEP_UNTIL_APPLIED(0, index, 2000);
+    raft_get_memory(CLUSTER_RAFT(0), &memory);
+    munit_assert_int(memory.log_shared, ==, 0);
+
+    free(req);
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * raft_histogram_percentile
+ *
+ *****************************************************************************/
+
+SUITE(raft_histogram_percentile)
+
+/* An empty histogram has no percentiles. */
+TEST(raft_histogram_percentile, empty, NULL, NULL, 0, NULL)
+{
+    struct raft_histogram h = {0};
+    munit_assert_int(raft_histogram_percentile(&h, 50), ==, 0);
+    return MUNIT_OK;
+}
+
+/* Percentiles are the upper bound of the bucket holding the sample of the
+ * requested rank, capped to the largest sample. */
+TEST(raft_histogram_percentile, buckets, NULL, NULL, 0, NULL)
+{
+    struct raft_histogram h = {0};
+
+    /* Two samples of value 1, and two samples between 12 and 13, which are
+     * counted by the third sub-bucket of the [8, 16) range. */
+    h.count = 4;
+    h.max = 13;
+    h.buckets[1] = 2;
+    h.buckets[10] = 2;
+
+    munit_assert_int(raft_histogram_percentile(&h, 0), ==, 1);
+    munit_assert_int(raft_histogram_percentile(&h, 50), ==, 1);
+    munit_assert_int(raft_histogram_percentile(&h, 75), ==, 13);
+    munit_assert_int(raft_histogram_percentile(&h, 100), ==, 13);
+
+    h.max = 100;
+    munit_assert_int(raft_histogram_percentile(&h, 99), ==, 13);
+
+    return MUNIT_OK;
+}
@@ -293,6 +293,39 @@ TEST(replication, sendPipeline, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* While the connection to a follower in pipeline mode is backlogged, new
+ * entries are held back until the next heartbeat after the backlog drains. */
+TEST(replication, sendPipelineBacklogged, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft *raft;
+    struct raft_apply req;
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+
+    raft = CLUSTER_RAFT(0);
+
+    /* Server 0 becomes leader and sends the initial heartbeat, receiving a
+     * successful response. */
+    CLUSTER_STEP_UNTIL_ELAPSED(1060);
+    ASSERT_LEADER(0);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 1);
+
+    /* Server 0 receives a new entry while its connection to server 1 is
+     * backlogged, so nothing is sent. */
+    CLUSTER_SATURATE(0, 1);
+    CLUSTER_APPLY_ADD_X(0, &req, 1, NULL);
+    CLUSTER_STEP;
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 1);
+    munit_assert_int(raft->leader_state.progress[1].next_index, ==, 2);
+
+    /* Once the backlog drains, the entry goes out with the next heartbeat. */
+    CLUSTER_DESATURATE(0, 1);
+    CLUSTER_STEP_UNTIL_APPLIED(0, 2, 1000);
+
+    return MUNIT_OK;
+}
+
 /* A follower disconnects while in probe mode. */
 TEST(replication, sendDisconnect, setUp, tearDown, 0, NULL)
 {
@@ -814,3 +847,114 @@ TEST(replication, resultRetry, setUp, tearDown, 0, NULL)
 
     return MUNIT_OK;
 }
+
+/* With quiescence enabled, an idle leader sends a last round of heartbeats and
+ * then only a keepalive heartbeat every ten heartbeat timeouts, while its
+ * followers lengthen their election timers accordingly. */
+TEST(replication, quiesce, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    unsigned n;
+    raft_set_quiescence(CLUSTER_RAFT(0), true);
+    BOOTSTRAP_START_AND_ELECT;
+
+    CLUSTER_STEP_UNTIL_ELAPSED(500);
+    munit_assert_true(CLUSTER_RAFT(0)->leader_state.quiescent);
+    munit_assert_true(CLUSTER_RAFT(1)->follower_state.quiescent);
+
+    n = CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES);
+    CLUSTER_STEP_UNTIL_ELAPSED(10000);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), <=, n + 10);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), >=, n + 9);
+    ASSERT_LEADER(0);
+    ASSERT_FOLLOWER(1);
+    munit_assert_true(CLUSTER_RAFT(0)->leader_state.quiescent);
+    munit_assert_true(CLUSTER_RAFT(1)->follower_state.quiescent);
+
+    return MUNIT_OK;
+}
+
+/* A quiescent leader resumes replication as soon as a new entry is appended,
+ * and quiesces again once it's replicated and applied everywhere. */
+TEST(replication, quiesceNewEntry, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply req;
+    raft_set_quiescence(CLUSTER_RAFT(0), true);
+    BOOTSTRAP_START_AND_ELECT;
+    CLUSTER_STEP_UNTIL_ELAPSED(500);
+    munit_assert_true(CLUSTER_RAFT(0)->leader_state.quiescent);
+
+    CLUSTER_APPLY_ADD_X(0, &req, 1, NULL);
+    munit_assert_false(CLUSTER_RAFT(0)->leader_state.quiescent);
+    CLUSTER_STEP_UNTIL_DELIVERED(0, 1, 100);
+    munit_assert_false(CLUSTER_RAFT(1)->follower_state.quiescent);
+
+    CLUSTER_STEP_UNTIL_APPLIED(1, 2, 1000);
+    CLUSTER_STEP_UNTIL_ELAPSED(500);
+    munit_assert_true(CLUSTER_RAFT(0)->leader_state.quiescent);
+    munit_assert_true(CLUSTER_RAFT(1)->follower_state.quiescent);
+
+    return MUNIT_OK;
+}
+
+/* If a quiescent leader crashes, its followers eventually time out and elect a
+ * new leader on their own. */
+TEST(replication, quiesceLeaderCrash, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CLUSTER_GROW;
+    raft_set_quiescence(CLUSTER_RAFT(0), true);
+    BOOTSTRAP_START_AND_ELECT;
+    CLUSTER_STEP_UNTIL_ELAPSED(500);
+    munit_assert_true(CLUSTER_RAFT(1)->follower_state.quiescent);
+    munit_assert_true(CLUSTER_RAFT(2)->follower_state.quiescent);
+
+    CLUSTER_KILL(0);
+    CLUSTER_STEP_UNTIL_HAS_NO_LEADER(1000);
+    CLUSTER_STEP_UNTIL_HAS_LEADER(50000);
+    munit_assert_int(CLUSTER_LEADER, !=, 0);
+
+    return MUNIT_OK;
+}
+
+/* If a quiescent leader gets partitioned from its followers, it stops hearing
+ * their answers to its keepalive heartbeats and steps down. */
+TEST(replication, quiesceLeaderPartitioned, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_set_quiescence(CLUSTER_RAFT(0), true);
+    BOOTSTRAP_START_AND_ELECT;
+    CLUSTER_STEP_UNTIL_ELAPSED(500);
+    munit_assert_true(CLUSTER_RAFT(0)->leader_state.quiescent);
+
+    CLUSTER_SATURATE_BOTHWAYS(0, 1);
+    CLUSTER_STEP_UNTIL_STATE_IS(0, RAFT_FOLLOWER, 25000);
+
+    return MUNIT_OK;
+}
+
+/* A follower whose election timer gets resumed and that misses the keepalive
+ * heartbeats eventually requests votes, which makes the quiescent leader resume
+ * sending heartbeats. */
+TEST(replication, quiesceResumeFollower, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_set_quiescence(CLUSTER_RAFT(0), true);
+    BOOTSTRAP_START_AND_ELECT;
+    CLUSTER_STEP_UNTIL_ELAPSED(500);
+    munit_assert_true(CLUSTER_RAFT(1)->follower_state.quiescent);
+
+    raft_set_quiescence(CLUSTER_RAFT(1), false);
+    munit_assert_false(CLUSTER_RAFT(1)->follower_state.quiescent);
+    CLUSTER_SATURATE(0, 1);
+    CLUSTER_STEP_UNTIL_STATE_IS(1, RAFT_CANDIDATE, 3000);
+    CLUSTER_DESATURATE(0, 1);
+
+    /* The cluster converges to a leader that both servers agree on. */
+    CLUSTER_STEP_UNTIL_ELAPSED(5000);
+    munit_assert_true(CLUSTER_HAS_LEADER);
+    munit_assert_int(CLUSTER_TERM(0), ==, CLUSTER_TERM(1));
+
+    return MUNIT_OK;
+}
@@ -0,0 +1,148 @@
+#include "../lib/cluster.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ *****************************************************************************/
+
+struct fixture
+{
+    FIXTURE_CLUSTER;
+};
+
+static void *setUp(const MunitParameter params[], MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_CLUSTER(3);
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_CLUSTER;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+/* Get the replication status of the server with the given ID, as seen by the
+ * I'th server, asserting that the given value is returned. */
+#define STATUS(I, ID, STATUS, RV)                                        \
+    do {                                                                 \
+        int rv_;                                                         \
+        rv_ = raft_replication_status(CLUSTER_RAFT(I), ID, STATUS);      \
+        munit_assert_int(rv_, ==, RV);                                   \
+    } while (0)
+
+/******************************************************************************
+ *
+ * raft_replication_status
+ *
+ *****************************************************************************/
+
+SUITE(raft_replication_status)
+
+/* A follower that has all entries has no lag. */
+TEST(raft_replication_status, upToDate, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_replication_status status;
+    CLUSTER_MAKE_PROGRESS;
+    STATUS(0, 2, &status, 0);
+    munit_assert_int(status.id, ==, 2);
+    munit_assert_int(status.mode, ==, RAFT_REPLICATION_PIPELINE);
+    munit_assert_int(status.match_index, ==, 2);
+    munit_assert_int(status.next_index, ==, 3);
+    munit_assert_int(status.lag, ==, 0);
+    munit_assert_int(status.lag_bytes, ==, 0);
+    munit_assert_int(status.inflight_bytes, ==, 0);
+    munit_assert_int(status.margin, ==, 3);
+    munit_assert_int(status.snapshot_index, ==, 0);
+    return MUNIT_OK;
+}
+
+/* The leader reports its own status too. */
+TEST(raft_replication_status, self, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_replication_status status;
+    CLUSTER_MAKE_PROGRESS;
+    STATUS(0, 1, &status, 0);
+    munit_assert_int(status.match_index, ==, 2);
+    munit_assert_int(status.lag, ==, 0);
+    munit_assert_int(status.last_ack_age, ==, 0);
+    return MUNIT_OK;
+}
+
+/* The entries that a disconnected follower is missing are reported, along with
+ * the time elapsed since it last replied. */
+TEST(raft_replication_status, lagging, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_replication_status status;
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_ELAPSED(500);
+    STATUS(0, 3, &status, 0);
+    munit_assert_int(status.match_index, ==, 0);
+    munit_assert_int(status.lag, ==, 3);
+    munit_assert_int(status.lag_bytes, ==, CLUSTER_RAFT(0)->log.bytes);
+    munit_assert_int(status.inflight_bytes, <=, status.lag_bytes);
+    munit_assert_int(status.last_ack_age, >=, 500);
+    return MUNIT_OK;
+}
+
+/* A follower that fell behind the leader's snapshot has no margin, and the
+ * transfer of the snapshot is reported. */
+TEST(raft_replication_status, snapshot, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_replication_status status;
+    raft_set_snapshot_threshold(CLUSTER_RAFT(0), 3);
+    raft_set_snapshot_trailing(CLUSTER_RAFT(0), 1);
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+
+    /* Let the leader send the snapshot, but not the follower reply. */
+    CLUSTER_DESATURATE(0, 2);
+    CLUSTER_STEP_UNTIL_ELAPSED(200);
+    STATUS(0, 3, &status, 0);
+    munit_assert_int(status.mode, ==, RAFT_REPLICATION_SNAPSHOT);
+    munit_assert_int(status.margin, ==, 0);
+    munit_assert_int(status.snapshot_index, ==, 3);
+    munit_assert_int(status.snapshot_delegate, ==, 0);
+    munit_assert_int(status.snapshot_size, >, 0);
+    munit_assert_int(status.snapshot_age, >, 0);
+    return MUNIT_OK;
+}
+
+/* Only the leader knows the replication status of servers. */
+TEST(raft_replication_status, notLeader, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_replication_status status;
+    STATUS(1, 1, &status, RAFT_NOTLEADER);
+    return MUNIT_OK;
+}
+
+/* The server must be part of the configuration. */
+TEST(raft_replication_status, badId, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_replication_status status;
+    STATUS(0, 4, &status, RAFT_BADID);
+    return MUNIT_OK;
+}
@@ -53,6 +53,33 @@ static void tearDown(void *data)
         }                                                       \
     }
 
+/* Set the snapshot bytes threshold on all servers of the cluster */
+#define SET_SNAPSHOT_THRESHOLD_BYTES(VALUE)                            \
+    {                                                                  \
+        unsigned i;                                                    \
+        for (i = 0; i < CLUSTER_N; i++) {                              \
+            raft_set_snapshot_threshold_bytes(CLUSTER_RAFT(i), VALUE); \
+        }                                                              \
+    }
+
+/* Enable the adaptive snapshot policy on all servers of the cluster */
+#define SET_SNAPSHOT_ADAPTIVE                                   \
+    {                                                           \
+        unsigned i;                                             \
+        for (i = 0; i < CLUSTER_N; i++) {                       \
+            raft_set_snapshot_adaptive(CLUSTER_RAFT(i), true);  \
+        }                                                       \
+    }
+
+/* Enable snapshot delegation on all servers of the cluster */
+#define SET_SNAPSHOT_DELEGATE                                   \
+    {                                                           \
+        unsigned i;                                             \
+        for (i = 0; i < CLUSTER_N; i++) {                       \
+            raft_set_snapshot_delegate(CLUSTER_RAFT(i), true);  \
+        }                                                       \
+    }
+
 /******************************************************************************
  *
  * Successfully install a snapshot
@@ -236,3 +263,209 @@ TEST(snapshot, installMultipleTimeOutAppendAfter, setUp, tearDown, 0, NULL)
 
     return MUNIT_OK;
 }
+
+/* A snapshot is taken when the bytes threshold is reached, even if the entries
+ * threshold is not. */
+TEST(snapshot, thresholdBytes, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    (void)params;
+
+    SET_SNAPSHOT_THRESHOLD(1000);
+    SET_SNAPSHOT_THRESHOLD_BYTES(16);
+    SET_SNAPSHOT_TRAILING(1);
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+
+    /* Apply a few of entries, to force a snapshot to be taken. */
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    munit_assert_int(CLUSTER_RAFT(0)->log.snapshot.last_index, >, 0);
+
+    /* Reconnect the follower and wait for it to catch up */
+    CLUSTER_DESATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL_APPLIED(2, 4, 5000);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_INSTALL_SNAPSHOT), >=, 1);
+
+    return MUNIT_OK;
+}
+
+/* With the adaptive policy, the number of trailing entries is reduced to fit
+ * the bytes threshold. */
+TEST(snapshot, adaptiveTrailing, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    (void)params;
+
+    SET_SNAPSHOT_THRESHOLD(3);
+    SET_SNAPSHOT_THRESHOLD_BYTES(16);
+    SET_SNAPSHOT_TRAILING(1000);
+    SET_SNAPSHOT_ADAPTIVE;
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+
+    /* Apply a few of entries, to force a snapshot to be taken. */
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+
+    /* The log holds at most the trailing entries fitting the bytes threshold,
+     * plus the entries applied after the last snapshot. */
+    munit_assert_int(CLUSTER_RAFT(0)->log.bytes, <=, 2 * 16);
+
+    /* The follower can't catch up without a snapshot */
+    CLUSTER_DESATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL_APPLIED(2, 5, 5000);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_INSTALL_SNAPSHOT), >=, 1);
+
+    return MUNIT_OK;
+}
+
+/* With the adaptive policy, a new snapshot is postponed if the last one took a
+ * significant amount of time compared to the time elapsed since then, unless
+ * the log has grown past twice the threshold. */
+TEST(snapshot, adaptivePostpone, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft *r = CLUSTER_RAFT(0);
+    raft_index index;
+    (void)params;
+
+    SET_SNAPSHOT_THRESHOLD(3);
+    SET_SNAPSHOT_TRAILING(1);
+    SET_SNAPSHOT_ADAPTIVE;
+    CLUSTER_SET_DISK_LATENCY(0, 50);
+
+    /* The first snapshot is taken as soon as the threshold is reached. */
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_ELAPSED(100);
+    index = r->log.snapshot.last_index;
+    munit_assert_int(index, >, 0);
+    munit_assert_int(r->snapshot.cost, >=, 50);
+
+    /* Reaching the threshold again shortly after doesn't trigger a new one. */
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_ELAPSED(100);
+    munit_assert_int(r->log.snapshot.last_index, ==, index);
+
+    /* Twice the threshold does. */
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_ELAPSED(100);
+    munit_assert_int(r->log.snapshot.last_index, >, index);
+    munit_assert_int(r->snapshot.bytes, <, 3 * 16);
+
+    return MUNIT_OK;
+}
+
+/* With delegation enabled, the leader asks an up-to-date follower to send its
+ * snapshot to a follower that has fallen behind. */
+TEST(snapshot, delegate, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    unsigned n;
+    (void)params;
+
+    SET_SNAPSHOT_THRESHOLD(3);
+    SET_SNAPSHOT_TRAILING(1);
+    SET_SNAPSHOT_DELEGATE;
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+
+    /* Apply a few of entries, to force a snapshot to be taken on the leader
+     * and on the first follower. */
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_APPLIED(1, 4, 5000);
+
+    /* Let the first follower report its snapshot to the leader, in the result
+     * of the next heartbeat. */
+    CLUSTER_STEP_UNTIL_ELAPSED(200);
+    munit_assert_int(CLUSTER_RAFT(0)->leader_state.progress[1].last_snapshot,
+                     ==, CLUSTER_RAFT(0)->log.snapshot.last_index);
+
+    /* Reconnect the follower and wait for it to catch up */
+    n = CLUSTER_N_SEND(0, RAFT_IO_INSTALL_SNAPSHOT);
+    CLUSTER_DESATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL_APPLIED(2, 4, 5000);
+
+    /* The snapshot was sent by the first follower. */
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_DELEGATE_SNAPSHOT), >=, 1);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_INSTALL_SNAPSHOT), ==, n);
+    munit_assert_int(CLUSTER_N_SEND(1, RAFT_IO_INSTALL_SNAPSHOT), >=, 1);
+
+    /* Replication resumes from the leader. */
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_APPLIED(2, 5, 5000);
+
+    return MUNIT_OK;
+}
+
+/* If no follower has a snapshot at least as recent as the leader's one, the
+ * leader sends its own snapshot right away. */
+TEST(snapshot, delegateStale, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    (void)params;
+
+    SET_SNAPSHOT_THRESHOLD(3);
+    SET_SNAPSHOT_TRAILING(1);
+    SET_SNAPSHOT_DELEGATE;
+    raft_set_snapshot_threshold(CLUSTER_RAFT(1), 1000);
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+
+    /* Apply a few of entries, to force a snapshot to be taken on the
+     * leader. */
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+
+    /* Reconnect the follower and wait for it to catch up */
+    CLUSTER_DESATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL_APPLIED(2, 4, 5000);
+
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_DELEGATE_SNAPSHOT), ==, 0);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_INSTALL_SNAPSHOT), >=, 1);
+    munit_assert_int(CLUSTER_N_SEND(1, RAFT_IO_INSTALL_SNAPSHOT), ==, 0);
+
+    return MUNIT_OK;
+}
+
+/* If the delegate can't deliver its snapshot, the leader eventually sends its
+ * own snapshot. */
+TEST(snapshot, delegateFallback, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    unsigned n;
+    (void)params;
+
+    SET_SNAPSHOT_THRESHOLD(3);
+    SET_SNAPSHOT_TRAILING(1);
+    SET_SNAPSHOT_DELEGATE;
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+    CLUSTER_SATURATE_BOTHWAYS(1, 2);
+
+    /* Apply a few of entries, to force a snapshot to be taken on the leader
+     * and on the first follower, and let the follower report it. */
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_APPLIED(1, 4, 5000);
+    CLUSTER_STEP_UNTIL_ELAPSED(200);
+
+    /* Reconnect the follower to the leader only and wait for it to catch
+     * up. */
+    n = CLUSTER_N_SEND(0, RAFT_IO_INSTALL_SNAPSHOT);
+    CLUSTER_DESATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL_APPLIED(2, 4, 5000);
+
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_DELEGATE_SNAPSHOT), >=, 1);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_INSTALL_SNAPSHOT), >, n);
+
+    return MUNIT_OK;
+}
@@ -0,0 +1,186 @@
+#include <string.h>
+
+#include "../lib/cluster.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ *****************************************************************************/
+
+#define CAPACITY 256
+
+struct fixture
+{
+    FIXTURE_CLUSTER;
+    struct raft_trace_ring *ring;
+    size_t size;
+    char text[CAPACITY * 128]; /* Decoded ring */
+};
+
+static void *setUp(const MunitParameter params[], MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_CLUSTER(2);
+    CLUSTER_BOOTSTRAP;
+    f->ring = NULL;
+    f->size = 0;
+    f->text[0] = 0;
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_CLUSTER;
+    free(f->ring);
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+/* Allocate a trace ring with the given capacity and attach it to the I'th raft
+ * instance. */
+#define RING_SET(I, CAPACITY_)                                \
+    do {                                                      \
+        int rv_;                                              \
+        f->size = raft_trace_ring_size(CAPACITY_);            \
+        f->ring = munit_malloc(f->size);                      \
+        rv_ = raft_trace_ring_init(f->ring, CAPACITY_);       \
+        munit_assert_int(rv_, ==, 0);                         \
+        raft_set_trace_ring(CLUSTER_RAFT(I), f->ring);        \
+    } while (0)
+
+/* Decode the trace ring into f->text, asserting the given return value. */
+#define RING_DECODE(RV)                                                     \
+    do {                                                                    \
+        FILE *file_ = tmpfile();                                            \
+        size_t n_;                                                          \
+        int rv_;                                                            \
+        munit_assert_ptr_not_null(file_);                                   \
+        rv_ = raft_trace_ring_decode(f->ring, f->size, file_);              \
+        munit_assert_int(rv_, ==, RV);                                      \
+        rewind(file_);                                                      \
+        n_ = fread(f->text, 1, sizeof f->text - 1, file_);                  \
+        f->text[n_] = 0;                                                    \
+        fclose(file_);                                                      \
+    } while (0)
+
+/* Assert that the decoded ring contains the given text. */
+#define ASSERT_DECODED(TEXT) munit_assert_ptr_not_null(strstr(f->text, TEXT))
+
+/* Count the number of decoded lines. */
+static unsigned countLines(const char *text)
+{
+    unsigned n = 0;
+    for (; *text != 0; text++) {
+        if (*text == '\n') {
+            n++;
+        }
+    }
+    return n;
+}
+
+/******************************************************************************
+ *
+ * raft_trace_ring
+ *
+ *****************************************************************************/
+
+SUITE(raft_trace_ring)
+
+/* The capacity of a trace ring must be a power of two. */
+TEST(raft_trace_ring, invalidCapacity, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_trace_ring *ring = munit_malloc(raft_trace_ring_size(3));
+    (void)f;
+    munit_assert_int(raft_trace_ring_init(ring, 0), ==, RAFT_INVALID);
+    munit_assert_int(raft_trace_ring_init(ring, 3), ==, RAFT_INVALID);
+    free(ring);
+    return MUNIT_OK;
+}
+
+/* A ring that was never written to decodes to nothing. */
+TEST(raft_trace_ring, empty, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    RING_SET(0, 8);
+    RING_DECODE(0);
+    munit_assert_string_equal(f->text, "");
+    return MUNIT_OK;
+}
+
+/* The events of an election and of the replication of an entry are
+ * recorded. */
+TEST(raft_trace_ring, election, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply req;
+    RING_SET(0, CAPACITY);
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    CLUSTER_APPLY_ADD_X(0, &req, 1, NULL);
+    CLUSTER_STEP_UNTIL_APPLIED(0, 2, 2000);
+    RING_DECODE(0);
+    ASSERT_DECODED(" 1 state state=follower term=1\n");
+    ASSERT_DECODED(" 1 election term=2 last_index=1 last_term=1 "
+                   "pre_vote=false\n");
+    ASSERT_DECODED(" 1 state state=leader term=2\n");
+    ASSERT_DECODED(" 1 append index=2 n=1\n");
+    ASSERT_DECODED(" 1 append_done index=2 n=1 status=ok\n");
+    ASSERT_DECODED(" 1 recv_result server=2 rejected=0 last_index=2\n");
+    ASSERT_DECODED(" 1 commit index=2\n");
+    ASSERT_DECODED(" 1 apply index=2\n");
+    return MUNIT_OK;
+}
+
+/* When the ring is full, the oldest records get overwritten. */
+TEST(raft_trace_ring, wrapAround, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply req;
+    RING_SET(0, 4);
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    CLUSTER_APPLY_ADD_X(0, &req, 1, NULL);
+    CLUSTER_STEP_UNTIL_APPLIED(0, 2, 2000);
+    munit_assert_int(f->ring->head, >, 4);
+    RING_DECODE(0);
+    munit_assert_int(countLines(f->text), ==, 4);
+    munit_assert_ptr_null(strstr(f->text, "state=follower"));
+    return MUNIT_OK;
+}
+
+/* Detaching the ring stops recording. */
+TEST(raft_trace_ring, detach, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    uint64_t head;
+    RING_SET(0, 8);
+    CLUSTER_START;
+    head = f->ring->head;
+    raft_set_trace_ring(CLUSTER_RAFT(0), NULL);
+    CLUSTER_ELECT(0);
+    munit_assert_int(f->ring->head, ==, head);
+    return MUNIT_OK;
+}
+
+/* A memory block that doesn't contain a trace ring is rejected. */
+TEST(raft_trace_ring, malformed, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    RING_SET(0, 8);
+    RING_DECODE(0);
+    f->size = raft_trace_ring_size(8) - 1;
+    RING_DECODE(RAFT_MALFORMED);
+    f->size = raft_trace_ring_size(8);
+    f->ring->magic = 0;
+    RING_DECODE(RAFT_MALFORMED);
+    return MUNIT_OK;
+}
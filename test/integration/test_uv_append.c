@@ -2,7 +2,9 @@
 #include "../lib/runner.h"
 #include "../lib/uv.h"
 #include "../lib/aio.h"
+#include "../../src/byte.h"
 #include "../../src/uv.h"
+#include "../../src/uv_encoding.h"
 
 /* Maximum number of blocks a segment can have */
 #define MAX_SEGMENT_BLOCKS 4
@@ -170,6 +172,7 @@ TEST(append, prepareSegments, setUp, tearDown, 0, NULL)
 TEST(append, finalizeSegment, setUp, tearDown, 0, NULL)
 {
     struct fixture *f = data;
+    struct raft_uv_metrics metrics;
     APPEND(MAX_SEGMENT_BLOCKS, SEGMENT_BLOCK_SIZE);
     APPEND(1, 64);
     while (!DirHasFile(f->dir, "open-4")) {
@@ -179,6 +182,12 @@ TEST(append, finalizeSegment, setUp, tearDown, 0, NULL)
         DirHasFile(f->dir, "0000000000000001-0000000000000004"));
     munit_assert_false(DirHasFile(f->dir, "open-1"));
     munit_assert_true(DirHasFile(f->dir, "open-4"));
+    raft_uv_get_metrics(&f->io, &metrics);
+    while (metrics.finalizes_pending > 0) {
+        LOOP_RUN(1);
+        raft_uv_get_metrics(&f->io, &metrics);
+    }
+    munit_assert_int(metrics.finalize_latency.count, ==, 1);
     return MUNIT_OK;
 }
 
@@ -298,6 +307,105 @@ TEST(append, batch, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* The latency of each append request and of each durable write is recorded in
+ * the metrics. Without group commit there's no separate flush. */
+TEST(append, metrics, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_uv_metrics metrics;
+    APPEND_SUBMIT(0, 1, 64);
+    APPEND_SUBMIT(1, 1, 64);
+    APPEND_WAIT(0);
+    APPEND_WAIT(1);
+    raft_uv_get_metrics(&f->io, &metrics);
+    munit_assert_int(metrics.writes, ==, 1);
+    munit_assert_int(metrics.bytes_written, ==, SEGMENT_BLOCK_SIZE);
+    munit_assert_int(metrics.append_latency.count, ==, 2);
+    munit_assert_int(metrics.write_latency.count, ==, 1);
+    munit_assert_int(metrics.append_latency.max, >=,
+                     metrics.write_latency.max);
+    munit_assert_int(metrics.fsync_latency.count, ==, 0);
+    munit_assert_int(metrics.prepare_latency.count, >=, 1);
+    munit_assert_int(metrics.appends_pending, ==, 0);
+    munit_assert_int(metrics.appends_writing, ==, 0);
+    return MUNIT_OK;
+}
+
+/* Append requests waiting for the first segment to be prepared are reported
+ * as queued. */
+TEST(append, queued, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_uv_metrics metrics;
+    APPEND_SUBMIT(0, 1, 64);
+    APPEND_SUBMIT(1, 1, 64);
+    raft_uv_get_metrics(&f->io, &metrics);
+    munit_assert_int(metrics.appends_pending, ==, 2);
+    munit_assert_int(metrics.appends_writing, ==, 0);
+    munit_assert_int(metrics.prepares_pending, ==, 1);
+    APPEND_WAIT(0);
+    APPEND_WAIT(1);
+    raft_uv_get_metrics(&f->io, &metrics);
+    munit_assert_int(metrics.appends_pending, ==, 0);
+    munit_assert_int(metrics.prepares_pending, ==, 0);
+    return MUNIT_OK;
+}
+
+/* The write buffer of the open segment is reported in the memory usage. */
+TEST(append, memory, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_uv_memory memory;
+    raft_uv_get_memory(&f->io, &memory);
+    munit_assert_int(memory.segment_buffers, ==, 0);
+    APPEND(1, 64);
+    raft_uv_get_memory(&f->io, &memory);
+    munit_assert_int(memory.segment_buffers, >=, SEGMENT_BLOCK_SIZE);
+    munit_assert_int(memory.send_queue, ==, 0);
+    munit_assert_int(memory.recv_buffers, ==, 0);
+    return MUNIT_OK;
+}
+
+/* If the entries being appended are the ones of a batch just received from the
+ * network, its checksums are reused. */
+TEST(append, receivedBatch, setUp, tearDownDeps, 0, NULL)
+{
+    struct fixture *f = data;
+    struct uv *uv = f->io.impl;
+    struct raft_io_append req;
+    struct result result = {0, false, NULL};
+    struct uvBatch batch;
+    char header[64];
+    int i;
+    int rv;
+    ENTRIES(0, 3, 16);
+
+    for (i = 0; i < 3; i++) {
+        _entries0[i].batch = _entries_data0;
+    }
+    uvEncodeBatchHeader(_entries0, 3, header);
+    batch.refs = 1;
+    batch.n = 3;
+    batch.header.base = header;
+    batch.header.len = uvSizeofBatchHeader(3);
+    batch.crc = byteCrc32(header, batch.header.len, 0);
+    batch.data = _entries_data0;
+    batch.data_crc = byteCrc32(_entries_data0, sizeof _entries_data0, 0);
+
+    uv->recv_batch = &batch;
+    req.data = &result;
+    rv = f->io.append(&f->io, &req, _entries0, 3, appendCbAssertResult);
+    munit_assert_int(rv, ==, 0);
+    uv->recv_batch = NULL;
+    munit_assert_int(batch.refs, ==, 2);
+
+    LOOP_RUN_UNTIL(&result.done);
+    munit_assert_int(batch.refs, ==, 1);
+
+    ASSERT_ENTRIES(3, 48);
+    return MUNIT_OK;
+}
+
 /* An append request submitted while a write operation is in progress gets
  * executed only when the write completes. */
 TEST(append, wait, setUp, tearDown, 0, NULL)
@@ -0,0 +1,321 @@
+#include "../../include/raft/uv.h"
+#include "../lib/cluster.h"
+#include "../lib/loop.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Fixture with a cluster whose leader is fed by an apply queue, which is driven
+ * by a libuv loop.
+ *
+ *****************************************************************************/
+
+#define N_THREADS 4
+#define N_PER_THREAD 100
+
+struct fixture
+{
+    FIXTURE_CLUSTER;
+    FIXTURE_LOOP;
+    struct raft_uv_apply_queue queue;
+    unsigned n_done;   /* Number of completed requests */
+    unsigned n_notify; /* Number of notifications */
+    bool closed;
+};
+
+struct result
+{
+    struct fixture *f;
+    int status;
+    bool done;
+};
+
+static void applyCbAssertResult(struct raft_apply_async *req,
+                                int status,
+                                void *result)
+{
+    struct result *r = req->data;
+    (void)result;
+    munit_assert_int(status, ==, r->status);
+    r->done = true;
+    r->f->n_done++;
+}
+
+static void notifyCb(struct raft_uv_apply_queue *q)
+{
+    struct fixture *f = q->data;
+    f->n_notify++;
+}
+
+static void closeCb(struct raft_uv_apply_queue *q)
+{
+    struct fixture *f = q->data;
+    f->closed = true;
+}
+
+/******************************************************************************
+ *
+ * Set up and tear down.
+ *
+ *****************************************************************************/
+
+static void *setUp(const MunitParameter params[], MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    int rv;
+    SETUP_CLUSTER(2);
+    SETUP_LOOP;
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    rv = raft_uv_apply_queue_init(&f->queue, &f->loop, CLUSTER_RAFT(0));
+    munit_assert_int(rv, ==, 0);
+    f->queue.data = f;
+    f->n_done = 0;
+    f->n_notify = 0;
+    f->closed = false;
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    if (!f->closed) {
+        raft_uv_apply_queue_close(&f->queue, closeCb);
+        LOOP_RUN_UNTIL(&f->closed);
+    }
+    TEAR_DOWN_LOOP;
+    TEAR_DOWN_CLUSTER;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+/* Submit a request to add the given value to x, with the given result
+ * object. */
+#define SUBMIT(REQ, RESULT, VALUE)                                      \
+    do {                                                                \
+        struct raft_buffer _buf;                                        \
+        int _rv;                                                        \
+        (RESULT)->f = f;                                                \
+        (RESULT)->done = false;                                         \
+        (REQ)->data = RESULT;                                           \
+        FsmEncodeAddX(VALUE, &_buf);                                    \
+        _rv = raft_apply_async(&f->queue, REQ, &_buf,                   \
+                               applyCbAssertResult);                    \
+        munit_assert_int(_rv, ==, 0);                                   \
+    } while (0)
+
+/* Submitter thread. */
+struct submitter
+{
+    struct raft_uv_apply_queue *queue;
+    struct raft_apply_async reqs[N_PER_THREAD];
+    struct result results[N_PER_THREAD];
+    struct raft_buffer bufs[N_PER_THREAD];
+};
+
+static void submitterMain(void *arg)
+{
+    struct submitter *s = arg;
+    unsigned i;
+    for (i = 0; i < N_PER_THREAD; i++) {
+        int rv;
+        s->reqs[i].data = &s->results[i];
+        rv = raft_apply_async(s->queue, &s->reqs[i], &s->bufs[i],
+                              applyCbAssertResult);
+        munit_assert_int(rv, ==, 0);
+    }
+}
+
+/******************************************************************************
+ *
+ * raft_apply_async
+ *
+ *****************************************************************************/
+
+SUITE(raft_apply_async)
+
+/* Requests submitted before the loop runs are appended as a single batch, and
+ * their callbacks fire in order once their commands are applied. */
+TEST(raft_apply_async, batch, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply_async reqs[3];
+    struct result results[3] = {{f, 0, false}, {f, 0, false}, {f, 0, false}};
+    raft_index last_index = raft_last_index(CLUSTER_RAFT(0));
+    unsigned i;
+
+    for (i = 0; i < 3; i++) {
+        SUBMIT(&reqs[i], &results[i], (int)i + 1);
+    }
+    munit_assert_int(raft_last_index(CLUSTER_RAFT(0)), ==, last_index);
+
+    LOOP_RUN(1);
+    munit_assert_int(raft_last_index(CLUSTER_RAFT(0)), ==, last_index + 3);
+    munit_assert_int(reqs[0].apply.index, ==, last_index + 1);
+    munit_assert_int(reqs[2].apply.index, ==, last_index + 3);
+
+    CLUSTER_STEP_UNTIL_APPLIED(0, last_index + 3, 2000);
+    munit_assert_int(f->n_done, ==, 3);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 6);
+    return MUNIT_OK;
+}
+
+/* The lifecycle times of batched requests use the same microsecond clock as
+ * the ones of regular requests, and so do the latencies recorded for them. */
+TEST(raft_apply_async, times, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply_async reqs[3];
+    struct result results[3] = {{f, 0, false}, {f, 0, false}, {f, 0, false}};
+    raft_index last_index = raft_last_index(CLUSTER_RAFT(0));
+    uint64_t start = CLUSTER_TIME * 1000;
+    uint64_t elapsed;
+    struct raft_metrics metrics;
+    unsigned i;
+
+    for (i = 0; i < 3; i++) {
+        SUBMIT(&reqs[i], &results[i], (int)i + 1);
+    }
+    LOOP_RUN(1);
+    CLUSTER_STEP_UNTIL_APPLIED(0, last_index + 3, 2000);
+    munit_assert_int(f->n_done, ==, 3);
+    elapsed = CLUSTER_TIME * 1000 - start;
+
+    for (i = 0; i < 3; i++) {
+        struct raft_apply_times *times = &reqs[i].apply.times;
+        munit_assert_int(times->submitted, >=, start);
+        munit_assert_int(times->submitted, <=, times->committed);
+        munit_assert_int(times->committed, <=, times->applied);
+        munit_assert_int(times->applied, <=, start + elapsed);
+    }
+
+    raft_get_metrics(CLUSTER_RAFT(0), &metrics);
+    munit_assert_int(metrics.commit_latency.count, ==, 3);
+    munit_assert_int(metrics.commit_latency.max, <=, elapsed);
+    munit_assert_int(metrics.apply_latency.count, ==, 3);
+    munit_assert_int(metrics.apply_latency.max, <=, elapsed);
+    return MUNIT_OK;
+}
+
+/* Requests can be submitted concurrently from several threads. */
+TEST(raft_apply_async, threads, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    static struct submitter submitters[N_THREADS];
+    uv_thread_t threads[N_THREADS];
+    raft_index last_index = raft_last_index(CLUSTER_RAFT(0));
+    unsigned i;
+    unsigned j;
+    int rv;
+
+    for (i = 0; i < N_THREADS; i++) {
+        submitters[i].queue = &f->queue;
+        for (j = 0; j < N_PER_THREAD; j++) {
+            submitters[i].results[j].f = f;
+            submitters[i].results[j].status = 0;
+            submitters[i].results[j].done = false;
+            FsmEncodeAddX(1, &submitters[i].bufs[j]);
+        }
+    }
+    for (i = 0; i < N_THREADS; i++) {
+        rv = uv_thread_create(&threads[i], submitterMain, &submitters[i]);
+        munit_assert_int(rv, ==, 0);
+    }
+    for (i = 0; i < N_THREADS; i++) {
+        rv = uv_thread_join(&threads[i]);
+        munit_assert_int(rv, ==, 0);
+    }
+
+    LOOP_RUN(1);
+    munit_assert_int(raft_last_index(CLUSTER_RAFT(0)), ==,
+                     last_index + N_THREADS * N_PER_THREAD);
+
+    CLUSTER_STEP_UNTIL_APPLIED(0, last_index + N_THREADS * N_PER_THREAD, 5000);
+    munit_assert_int(f->n_done, ==, N_THREADS * N_PER_THREAD);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, N_THREADS * N_PER_THREAD);
+    return MUNIT_OK;
+}
+
+/* With a notify callback set, completed requests are delivered by polling. */
+TEST(raft_apply_async, poll, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply_async reqs[2];
+    struct result results[2] = {{f, 0, false}, {f, 0, false}};
+    raft_index last_index = raft_last_index(CLUSTER_RAFT(0));
+
+    raft_uv_apply_queue_set_notify(&f->queue, notifyCb);
+    SUBMIT(&reqs[0], &results[0], 1);
+    SUBMIT(&reqs[1], &results[1], 1);
+    LOOP_RUN(1);
+
+    CLUSTER_STEP_UNTIL_APPLIED(0, last_index + 2, 2000);
+    munit_assert_int(f->n_notify, ==, 1);
+    munit_assert_int(f->n_done, ==, 0);
+
+    munit_assert_int(raft_uv_apply_queue_poll(&f->queue), ==, 2);
+    munit_assert_int(f->n_done, ==, 2);
+    munit_assert_int(raft_uv_apply_queue_poll(&f->queue), ==, 0);
+    return MUNIT_OK;
+}
+
+/* If the raft instance is not the leader, requests fail with
+ * RAFT_NOTLEADER. */
+TEST(raft_apply_async, notLeader, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply_async req;
+    struct result result = {f, RAFT_NOTLEADER, false};
+    int rv;
+
+    raft_uv_apply_queue_close(&f->queue, closeCb);
+    LOOP_RUN_UNTIL(&f->closed);
+    rv = raft_uv_apply_queue_init(&f->queue, &f->loop, CLUSTER_RAFT(1));
+    munit_assert_int(rv, ==, 0);
+    f->closed = false;
+
+    SUBMIT(&req, &result, 1);
+    LOOP_RUN(1);
+    munit_assert_true(result.done);
+    return MUNIT_OK;
+}
+
+/* Requests that were not proposed yet are canceled when closing the queue. */
+TEST(raft_apply_async, close, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply_async req;
+    struct result result = {f, RAFT_CANCELED, false};
+
+    SUBMIT(&req, &result, 1);
+    raft_uv_apply_queue_close(&f->queue, closeCb);
+    munit_assert_true(result.done);
+    LOOP_RUN_UNTIL(&f->closed);
+    return MUNIT_OK;
+}
+
+/* Closing the queue waits for the requests that were proposed to complete. */
+TEST(raft_apply_async, closeWithInflight, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply_async req;
+    struct result result = {f, 0, false};
+    raft_index last_index = raft_last_index(CLUSTER_RAFT(0));
+
+    SUBMIT(&req, &result, 1);
+    LOOP_RUN(1);
+    raft_uv_apply_queue_close(&f->queue, closeCb);
+    LOOP_RUN(1);
+    munit_assert_false(f->closed);
+
+    CLUSTER_STEP_UNTIL_APPLIED(0, last_index + 1, 2000);
+    munit_assert_true(result.done);
+    munit_assert_true(f->closed);
+    return MUNIT_OK;
+}
@@ -0,0 +1,690 @@
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "../../src/uv.h"
+#include "../../src/uv_encoding.h"
+#include "../lib/runner.h"
+#include "../lib/uv.h"
+
+/******************************************************************************
+ *
+ * Fixture with two hosts running two raft groups each, connected through the
+ * loopback transport.
+ *
+ *****************************************************************************/
+
+#define N_HOSTS 2
+#define N_GROUPS 2
+
+struct group
+{
+    struct raft_io io;
+    char dir[256];
+    unsigned n_recv;             /* Number of messages received */
+    struct raft_message message; /* Last message received */
+    unsigned n_ticks;            /* Number of ticks */
+    bool closed;
+};
+
+struct host
+{
+    struct raft_uv_transport transport;
+    struct raft_uv_host host;
+    raft_id id;
+    char address[16];
+    struct group groups[N_GROUPS];
+    bool closed;
+};
+
+struct fixture
+{
+    FIXTURE_DIR;
+    FIXTURE_HEAP;
+    FIXTURE_LOOP;
+    struct host hosts[N_HOSTS];
+};
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+static void recvCb(struct raft_io *io, struct raft_message *message)
+{
+    struct group *g = io->data;
+    g->n_recv++;
+    g->message = *message;
+    if (message->type == RAFT_IO_APPEND_ENTRIES &&
+        message->append_entries.n_entries > 0) {
+        raft_free(message->append_entries.entries[0].batch);
+        raft_free(message->append_entries.entries);
+    }
+}
+
+static void tickCb(struct raft_io *io)
+{
+    struct group *g = io->data;
+    g->n_ticks++;
+}
+
+static void groupCloseCb(struct raft_io *io)
+{
+    struct group *g = io->data;
+    g->closed = true;
+}
+
+static void hostCloseCb(struct raft_uv_host *host)
+{
+    struct host *h = host->data;
+    h->closed = true;
+}
+
+struct result
+{
+    int status;
+    bool done;
+};
+
+static void sendCbAssertResult(struct raft_io_send *req, int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    result->done = true;
+}
+
+static void appendCbAssertResult(struct raft_io_append *req, int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    result->done = true;
+}
+
+#define HOST(I) (&f->hosts[I])
+#define GROUP(I, G) (&f->hosts[I].groups[(G)-1])
+
+/* Initialize and start the group with ID G on host I. */
+#define GROUP_START(I, G, MSECS)                                             \
+    do {                                                                     \
+        struct group *_g = GROUP(I, G);                                      \
+        int _rv;                                                             \
+        _rv = mkdir(_g->dir, 0755);                                          \
+        munit_assert_int(_rv, ==, 0);                                        \
+        _rv = raft_uv_init_group(&_g->io, &HOST(I)->host, _g->dir, G);       \
+        munit_assert_int(_rv, ==, 0);                                        \
+        _g->io.data = _g;                                                    \
+        _rv = _g->io.init(&_g->io, HOST(I)->id, HOST(I)->address);           \
+        munit_assert_int(_rv, ==, 0);                                        \
+        _rv = _g->io.start(&_g->io, MSECS, tickCb, recvCb);                  \
+        munit_assert_int(_rv, ==, 0);                                        \
+    } while (0)
+
+/* Initialize the group with ID G on host I using its existing directory, then
+ * load its data, assert that it has N entries, and start it. */
+#define GROUP_OPEN(I, G, N)                                                 \
+    do {                                                                    \
+        struct group *_g = GROUP(I, G);                                     \
+        raft_term _term;                                                    \
+        raft_id _voted_for;                                                 \
+        struct raft_snapshot *_snapshot;                                    \
+        raft_index _start_index;                                            \
+        struct raft_entry *_entries;                                        \
+        size_t _n;                                                          \
+        int _rv;                                                            \
+        _g->closed = false;                                                 \
+        _rv = raft_uv_init_group(&_g->io, &HOST(I)->host, _g->dir, G);      \
+        munit_assert_int(_rv, ==, 0);                                       \
+        _g->io.data = _g;                                                   \
+        _rv = _g->io.init(&_g->io, HOST(I)->id, HOST(I)->address);          \
+        munit_assert_int(_rv, ==, 0);                                       \
+        _rv = _g->io.load(&_g->io, &_term, &_voted_for, &_snapshot,         \
+                          &_start_index, &_entries, &_n);                   \
+        munit_assert_int(_rv, ==, 0);                                       \
+        munit_assert_ptr_null(_snapshot);                                   \
+        munit_assert_int(_start_index, ==, 1);                              \
+        munit_assert_int(_n, ==, N);                                        \
+        if (_n > 0) {                                                       \
+            munit_assert_int(*(uint64_t *)_entries[0].buf.base, ==, G);     \
+            raft_free(_entries[0].batch);                                   \
+            raft_free(_entries);                                            \
+        }                                                                   \
+        _rv = _g->io.start(&_g->io, 3000, tickCb, recvCb);                  \
+        munit_assert_int(_rv, ==, 0);                                       \
+    } while (0)
+
+/* Submit a request to append an entry containing the ID of group G on host I,
+ * without waiting for it to complete. */
+#define APPEND(I, G, REQ, ENTRY)                                           \
+    do {                                                                   \
+        int _rv;                                                           \
+        (ENTRY)->term = 1;                                                 \
+        (ENTRY)->type = RAFT_COMMAND;                                      \
+        (ENTRY)->buf.base = raft_malloc(8);                                \
+        (ENTRY)->buf.len = 8;                                              \
+        (ENTRY)->batch = NULL;                                             \
+        munit_assert_ptr_not_null((ENTRY)->buf.base);                      \
+        *(uint64_t *)(ENTRY)->buf.base = G;                                \
+        _rv = GROUP(I, G)->io.append(&GROUP(I, G)->io, REQ, ENTRY, 1,      \
+                                     appendCbAssertResult);                \
+        munit_assert_int(_rv, ==, 0);                                      \
+    } while (0)
+
+/* Close and release the group with ID G on host I. */
+#define GROUP_CLOSE(I, G)                            \
+    do {                                             \
+        struct group *_g = GROUP(I, G);              \
+        _g->io.close(&_g->io, groupCloseCb);         \
+        LOOP_RUN_UNTIL(&_g->closed);                 \
+        raft_uv_close(&_g->io);                      \
+    } while (0)
+
+/* Send a RequestVote message with the given term from group G on host I to
+ * the same group on host J, and wait for the send callback to fire. */
+#define SEND(I, G, J, TERM)                                               \
+    do {                                                                  \
+        struct raft_message _message;                                     \
+        struct raft_io_send _req;                                         \
+        struct result _result = {0, false};                               \
+        int _rv;                                                          \
+        _message.type = RAFT_IO_REQUEST_VOTE;                             \
+        _message.server_id = HOST(J)->id;                                 \
+        _message.server_address = HOST(J)->address;                       \
+        _message.request_vote.term = TERM;                                \
+        _message.request_vote.candidate_id = HOST(I)->id;                 \
+        _message.request_vote.last_log_index = 0;                         \
+        _message.request_vote.last_log_term = 0;                          \
+        _message.request_vote.disrupt_leader = false;                     \
+        _message.request_vote.pre_vote = false;                           \
+        _req.data = &_result;                                             \
+        _rv = GROUP(I, G)->io.send(&GROUP(I, G)->io, &_req, &_message,    \
+                                   sendCbAssertResult);                   \
+        munit_assert_int(_rv, ==, 0);                                     \
+        LOOP_RUN_UNTIL(&_result.done);                                    \
+    } while (0)
+
+/* Submit a heartbeat with the given term from group G on host I to the same
+ * group on host J, without waiting for it to be sent. */
+#define HEARTBEAT(I, G, J, TERM, QUIESCE, REQ)                              \
+    do {                                                                    \
+        struct raft_message _message;                                       \
+        int _rv;                                                            \
+        _message.type = RAFT_IO_APPEND_ENTRIES;                             \
+        _message.server_id = HOST(J)->id;                                   \
+        _message.server_address = HOST(J)->address;                         \
+        _message.append_entries.term = TERM;                                \
+        _message.append_entries.prev_log_index = 1;                         \
+        _message.append_entries.prev_log_term = 1;                          \
+        _message.append_entries.leader_commit = 1;                          \
+        _message.append_entries.entries = NULL;                             \
+        _message.append_entries.n_entries = 0;                              \
+        _message.append_entries.quiesce = QUIESCE;                          \
+        _rv = GROUP(I, G)->io.send(&GROUP(I, G)->io, REQ, &_message,        \
+                                   sendCbAssertResult);                     \
+        munit_assert_int(_rv, ==, 0);                                       \
+    } while (0)
+
+/* Send an AppendEntries result from group G on host I to the same group on
+ * host J, which learns the capabilities of host I, and wait for it to be
+ * received. */
+#define SEND_RESULT(I, G, J)                                                \
+    do {                                                                    \
+        struct raft_message _message;                                       \
+        struct raft_io_send _req;                                           \
+        struct result _result = {0, false};                                 \
+        unsigned _n = GROUP(J, G)->n_recv;                                  \
+        int _rv;                                                            \
+        _message.type = RAFT_IO_APPEND_ENTRIES_RESULT;                      \
+        _message.server_id = HOST(J)->id;                                   \
+        _message.server_address = HOST(J)->address;                         \
+        _message.append_entries_result.term = 1;                            \
+        _message.append_entries_result.rejected = 0;                        \
+        _message.append_entries_result.last_log_index = 1;                  \
+        _message.append_entries_result.snapshot_index = 0;                  \
+        _req.data = &_result;                                               \
+        _rv = GROUP(I, G)->io.send(&GROUP(I, G)->io, &_req, &_message,      \
+                                   sendCbAssertResult);                     \
+        munit_assert_int(_rv, ==, 0);                                       \
+        LOOP_RUN_UNTIL(&_result.done);                                      \
+        RECV_WAIT(J, G, _n + 1);                                            \
+    } while (0)
+
+/* Run the loop until group G on host I has received N messages in total. */
+#define RECV_WAIT(I, G, N)                              \
+    do {                                                \
+        unsigned _i;                                    \
+        for (_i = 0; _i < LOOP_MAX_RUN; _i++) {         \
+            if (GROUP(I, G)->n_recv >= N) {             \
+                break;                                  \
+            }                                           \
+            LOOP_RUN(1);                                \
+        }                                               \
+        munit_assert_int(GROUP(I, G)->n_recv, ==, N);   \
+    } while (0)
+
+/* Return the capabilities that host I knows host J supports. */
+static uint64_t hostPeerCapabilities(struct host *h, struct host *peer)
+{
+    struct uvHost *impl = h->host.impl;
+    return UvRecvPeerCapabilities(impl->carrier, peer->id);
+}
+
+/* Return the number of connections accepted by host I. */
+static unsigned hostServers(struct host *h)
+{
+    struct uvHost *impl = h->host.impl;
+    queue *head;
+    unsigned n = 0;
+    QUEUE_FOREACH(head, &impl->carrier->servers) { n++; }
+    return n;
+}
+
+/******************************************************************************
+ *
+ * Set up and tear down.
+ *
+ *****************************************************************************/
+
+static void *setUp(const MunitParameter params[], void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    unsigned i;
+    unsigned j;
+    int rv;
+    SET_UP_DIR;
+    SET_UP_HEAP;
+    SETUP_LOOP;
+    for (i = 0; i < N_HOSTS; i++) {
+        struct host *h = HOST(i);
+        h->id = i + 1;
+        sprintf(h->address, "host%u", i + 1);
+        h->closed = false;
+        h->host.data = h;
+        for (j = 0; j < N_GROUPS; j++) {
+            struct group *g = &h->groups[j];
+            sprintf(g->dir, "%s/%u-%u", f->dir, i + 1, j + 1);
+            g->n_recv = 0;
+            g->n_ticks = 0;
+            g->closed = false;
+        }
+        rv = raft_uv_loopback_init(&h->transport, &f->loop);
+        munit_assert_int(rv, ==, 0);
+        rv = raft_uv_host_init(&h->host, &f->loop, &h->transport, h->id,
+                               h->address);
+        munit_assert_int(rv, ==, 0);
+        rv = raft_uv_host_start(&h->host);
+        munit_assert_int(rv, ==, 0);
+    }
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    unsigned i;
+    if (f == NULL) {
+        return;
+    }
+    for (i = 0; i < N_HOSTS; i++) {
+        struct host *h = HOST(i);
+        raft_uv_host_close(&h->host, hostCloseCb);
+        LOOP_RUN_UNTIL(&h->closed);
+        raft_uv_loopback_close(&h->transport);
+    }
+    TEAR_DOWN_LOOP;
+    TEAR_DOWN_HEAP;
+    TEAR_DOWN_DIR;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * raft_uv_host
+ *
+ *****************************************************************************/
+
+SUITE(raft_uv_host)
+
+/* Messages sent by different groups of a host to another host are delivered
+ * to the matching groups, over a single connection. */
+TEST(raft_uv_host, dispatch, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    GROUP_START(0, 1, 3000);
+    GROUP_START(0, 2, 3000);
+    GROUP_START(1, 1, 3000);
+    GROUP_START(1, 2, 3000);
+
+    SEND(0, 1, 1, 10);
+    SEND(0, 2, 1, 20);
+    RECV_WAIT(1, 1, 1);
+    RECV_WAIT(1, 2, 1);
+    munit_assert_int(GROUP(1, 1)->message.request_vote.term, ==, 10);
+    munit_assert_int(GROUP(1, 2)->message.request_vote.term, ==, 20);
+    munit_assert_int(GROUP(1, 1)->message.server_id, ==, 1);
+    munit_assert_int(hostServers(HOST(1)), ==, 1);
+
+    /* Replies go over the connection of the other host. */
+    SEND(1, 2, 0, 30);
+    RECV_WAIT(0, 2, 1);
+    munit_assert_int(GROUP(0, 2)->message.request_vote.term, ==, 30);
+    munit_assert_int(GROUP(0, 1)->n_recv, ==, 0);
+
+    GROUP_CLOSE(0, 1);
+    GROUP_CLOSE(0, 2);
+    GROUP_CLOSE(1, 1);
+    GROUP_CLOSE(1, 2);
+    return MUNIT_OK;
+}
+
+/* Messages for a group that is not running on the receiving host are dropped,
+ * without affecting the other groups. */
+TEST(raft_uv_host, unknownGroup, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    GROUP_START(0, 1, 3000);
+    GROUP_START(0, 2, 3000);
+    GROUP_START(1, 1, 3000);
+
+    SEND(0, 2, 1, 10);
+    SEND(0, 1, 1, 20);
+    RECV_WAIT(1, 1, 1);
+    munit_assert_int(GROUP(1, 1)->message.request_vote.term, ==, 20);
+    munit_assert_int(hostServers(HOST(1)), ==, 1);
+
+    GROUP_CLOSE(0, 1);
+    GROUP_CLOSE(0, 2);
+    GROUP_CLOSE(1, 1);
+    return MUNIT_OK;
+}
+
+/* AppendEntries messages carrying entries are dispatched as well, along with
+ * their batch checksums. */
+TEST(raft_uv_host, appendEntries, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+    struct raft_entry entries[2];
+    struct raft_io_send req;
+    struct result result = {0, false};
+    uint8_t data1[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint8_t data2[3] = {9, 10, 11};
+    int rv;
+
+    GROUP_START(0, 2, 3000);
+    GROUP_START(1, 2, 3000);
+    raft_uv_set_wire_checksums(&GROUP(0, 2)->io, true);
+
+    entries[0].term = 1;
+    entries[0].type = RAFT_COMMAND;
+    entries[0].buf.base = data1;
+    entries[0].buf.len = sizeof data1;
+    entries[1].term = 2;
+    entries[1].type = RAFT_COMMAND;
+    entries[1].buf.base = data2;
+    entries[1].buf.len = sizeof data2;
+
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.server_id = 2;
+    message.server_address = HOST(1)->address;
+    message.append_entries.term = 2;
+    message.append_entries.prev_log_index = 0;
+    message.append_entries.prev_log_term = 0;
+    message.append_entries.leader_commit = 0;
+    message.append_entries.entries = entries;
+    message.append_entries.n_entries = 2;
+    message.append_entries.quiesce = false;
+
+    req.data = &result;
+    rv = GROUP(0, 2)->io.send(&GROUP(0, 2)->io, &req, &message,
+                              sendCbAssertResult);
+    munit_assert_int(rv, ==, 0);
+    LOOP_RUN_UNTIL(&result.done);
+    RECV_WAIT(1, 2, 1);
+    munit_assert_int(GROUP(1, 2)->message.type, ==, RAFT_IO_APPEND_ENTRIES);
+    munit_assert_int(GROUP(1, 2)->message.append_entries.n_entries, ==, 2);
+
+    GROUP_CLOSE(0, 2);
+    GROUP_CLOSE(1, 2);
+    return MUNIT_OK;
+}
+
+/* All groups are ticked by the timer of the host, each at its own interval. */
+TEST(raft_uv_host, tick, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    bool done = false;
+    GROUP_START(0, 1, 10);
+    GROUP_START(0, 2, 30);
+    while (!done) {
+        LOOP_RUN(1);
+        done = GROUP(0, 2)->n_ticks >= 2;
+    }
+    munit_assert_int(GROUP(0, 1)->n_ticks, >=, 4);
+    GROUP_CLOSE(0, 1);
+    GROUP_CLOSE(0, 2);
+    return MUNIT_OK;
+}
+
+/* Closing a group cancels the messages it has queued, while the other groups
+ * keep using the connections of the host. */
+TEST(raft_uv_host, closeWithPendingSend, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+    struct raft_io_send req;
+    struct result result = {RAFT_CANCELED, false};
+    int rv;
+
+    GROUP_START(0, 1, 3000);
+    GROUP_START(0, 2, 3000);
+    GROUP_START(1, 2, 3000);
+
+    /* There's no host listening at this address. */
+    message.type = RAFT_IO_TIMEOUT_NOW;
+    message.server_id = 3;
+    message.server_address = "host3";
+    message.timeout_now.term = 1;
+    message.timeout_now.last_log_index = 0;
+    message.timeout_now.last_log_term = 0;
+    req.data = &result;
+    rv = GROUP(0, 1)->io.send(&GROUP(0, 1)->io, &req, &message,
+                              sendCbAssertResult);
+    munit_assert_int(rv, ==, 0);
+
+    GROUP_CLOSE(0, 1);
+    munit_assert_true(result.done);
+
+    SEND(0, 2, 1, 10);
+    RECV_WAIT(1, 2, 1);
+
+    GROUP_CLOSE(0, 2);
+    GROUP_CLOSE(1, 2);
+    return MUNIT_OK;
+}
+
+/* Heartbeats sent by different groups of a host to another host in the same
+ * loop iteration are coalesced, once the other host has advertised that it
+ * supports it. */
+TEST(raft_uv_host, heartbeats, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_io_send reqs[N_GROUPS];
+    struct result results[N_GROUPS] = {{0, false}, {0, false}};
+
+    GROUP_START(0, 1, 3000);
+    GROUP_START(0, 2, 3000);
+    GROUP_START(1, 1, 3000);
+    GROUP_START(1, 2, 3000);
+
+    SEND_RESULT(1, 1, 0);
+    munit_assert_true((hostPeerCapabilities(HOST(0), HOST(1)) &
+                       UV__CAPABILITY_HEARTBEATS) != 0);
+
+    reqs[0].data = &results[0];
+    reqs[1].data = &results[1];
+    HEARTBEAT(0, 1, 1, 10, false, &reqs[0]);
+    HEARTBEAT(0, 2, 1, 20, true, &reqs[1]);
+    LOOP_RUN_UNTIL(&results[1].done);
+    munit_assert_true(results[0].done);
+
+    RECV_WAIT(1, 1, 1);
+    RECV_WAIT(1, 2, 1);
+    munit_assert_int(GROUP(1, 1)->message.type, ==, RAFT_IO_APPEND_ENTRIES);
+    munit_assert_int(GROUP(1, 1)->message.server_id, ==, 1);
+    munit_assert_int(GROUP(1, 1)->message.append_entries.term, ==, 10);
+    munit_assert_int(GROUP(1, 1)->message.append_entries.n_entries, ==, 0);
+    munit_assert_false(GROUP(1, 1)->message.append_entries.quiesce);
+    munit_assert_int(GROUP(1, 2)->message.append_entries.term, ==, 20);
+    munit_assert_int(GROUP(1, 2)->message.append_entries.prev_log_index, ==,
+                     1);
+    munit_assert_int(GROUP(1, 2)->message.append_entries.leader_commit, ==, 1);
+    munit_assert_true(GROUP(1, 2)->message.append_entries.quiesce);
+
+    GROUP_CLOSE(0, 1);
+    GROUP_CLOSE(0, 2);
+    GROUP_CLOSE(1, 1);
+    GROUP_CLOSE(1, 2);
+    return MUNIT_OK;
+}
+
+/* Coalesced heartbeats for a group that is not running on the receiving host
+ * are dropped, while the other ones are delivered. */
+TEST(raft_uv_host, heartbeatsUnknownGroup, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_io_send reqs[N_GROUPS];
+    struct result results[N_GROUPS] = {{0, false}, {0, false}};
+
+    GROUP_START(0, 1, 3000);
+    GROUP_START(0, 2, 3000);
+    GROUP_START(1, 2, 3000);
+
+    SEND_RESULT(1, 2, 0);
+
+    reqs[0].data = &results[0];
+    reqs[1].data = &results[1];
+    HEARTBEAT(0, 1, 1, 10, false, &reqs[0]);
+    HEARTBEAT(0, 2, 1, 20, false, &reqs[1]);
+    LOOP_RUN_UNTIL(&results[1].done);
+
+    RECV_WAIT(1, 2, 1);
+    munit_assert_int(GROUP(1, 2)->message.append_entries.term, ==, 20);
+    munit_assert_int(hostServers(HOST(1)), ==, 1);
+
+    GROUP_CLOSE(0, 1);
+    GROUP_CLOSE(0, 2);
+    GROUP_CLOSE(1, 2);
+    return MUNIT_OK;
+}
+
+/* With group commit enabled, the appends of the groups of a host complete
+ * after the flush of the host, and they are durable. */
+TEST(raft_uv_host, groupCommit, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_io_append reqs[N_GROUPS];
+    struct raft_entry entries[N_GROUPS];
+    struct result results[N_GROUPS] = {{0, false}, {0, false}};
+    struct raft_uv_metrics metrics;
+    unsigned i;
+    int rv;
+
+    raft_uv_host_set_group_commit(&HOST(0)->host, true);
+    for (i = 0; i < N_GROUPS; i++) {
+        rv = mkdir(GROUP(0, i + 1)->dir, 0755);
+        munit_assert_int(rv, ==, 0);
+    }
+    GROUP_OPEN(0, 1, 0);
+    GROUP_OPEN(0, 2, 0);
+
+    for (i = 0; i < N_GROUPS; i++) {
+        reqs[i].data = &results[i];
+        APPEND(0, i + 1, &reqs[i], &entries[i]);
+    }
+    LOOP_RUN_UNTIL(&results[0].done);
+    LOOP_RUN_UNTIL(&results[1].done);
+    for (i = 0; i < N_GROUPS; i++) {
+        raft_free(entries[i].buf.base);
+        raft_uv_get_metrics(&GROUP(0, i + 1)->io, &metrics);
+        munit_assert_int(metrics.write_latency.count, ==, 1);
+        munit_assert_int(metrics.fsync_latency.count, ==, 1);
+    }
+
+    GROUP_CLOSE(0, 1);
+    GROUP_CLOSE(0, 2);
+
+    GROUP_OPEN(0, 1, 1);
+    GROUP_OPEN(0, 2, 1);
+    GROUP_CLOSE(0, 1);
+    GROUP_CLOSE(0, 2);
+    return MUNIT_OK;
+}
+
+/* A group that gets closed while its write waits for the flush of the host
+ * completes its append once the flush is done. */
+TEST(raft_uv_host, groupCommitClose, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_io_append req1;
+    struct raft_io_append req2;
+    struct raft_entry entry1;
+    struct raft_entry entry2;
+    struct result result1 = {0, false};
+    struct result result2 = {0, false};
+    int rv;
+
+    raft_uv_host_set_group_commit(&HOST(0)->host, true);
+    rv = mkdir(GROUP(0, 1)->dir, 0755);
+    munit_assert_int(rv, ==, 0);
+    GROUP_OPEN(0, 1, 0);
+
+    req1.data = &result1;
+    APPEND(0, 1, &req1, &entry1);
+    LOOP_RUN_UNTIL(&result1.done);
+    raft_free(entry1.buf.base);
+
+    /* The open segment is ready, so this write starts right away. */
+    req2.data = &result2;
+    APPEND(0, 1, &req2, &entry2);
+    GROUP_CLOSE(0, 1);
+    munit_assert_true(result2.done);
+    raft_free(entry2.buf.base);
+
+    GROUP_OPEN(0, 1, 2);
+    GROUP_CLOSE(0, 1);
+    return MUNIT_OK;
+}
+
+/* A host can't run two groups with the same ID. */
+TEST(raft_uv_host, duplicateGroup, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_io io;
+    int rv;
+    GROUP_START(0, 1, 3000);
+    io.data = NULL;
+    rv = raft_uv_init_group(&io, &HOST(0)->host, GROUP(0, 1)->dir, 1);
+    munit_assert_int(rv, ==, RAFT_DUPLICATEID);
+    munit_assert_string_equal(io.errmsg, "group 1 already exists");
+    GROUP_CLOSE(0, 1);
+    return MUNIT_OK;
+}
+
+/* Hosted groups must use the ID of their host. */
+TEST(raft_uv_host, wrongId, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct group *g = GROUP(0, 1);
+    int rv;
+    rv = mkdir(g->dir, 0755);
+    munit_assert_int(rv, ==, 0);
+    rv = raft_uv_init_group(&g->io, &HOST(0)->host, g->dir, 1);
+    munit_assert_int(rv, ==, 0);
+    g->io.data = g;
+    rv = g->io.init(&g->io, 5, "host5");
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    munit_assert_string_equal(g->io.errmsg,
+                              "server ID 5 doesn't match host ID 1");
+    GROUP_CLOSE(0, 1);
+    return MUNIT_OK;
+}
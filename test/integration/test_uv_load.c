@@ -442,6 +442,34 @@ TEST(load, bothOpenAndClosedSegments, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* The time spent in each phase of the load is recorded in the metrics. */
+TEST(load, metrics, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_uv_load_times *times;
+    struct raft_uv_metrics metrics;
+    APPEND(2, 1);
+    APPEND(1, 3);
+    UNFINALIZE(3, 3, 1);
+    LOAD(0,    /* term                                              */
+         0,    /* voted for                                         */
+         NULL, /* snapshot                                          */
+         1,    /* start index                                       */
+         1,    /* data for first loaded entry    */
+         3     /* n entries                                         */
+    );
+    raft_uv_get_metrics(&f->io, &metrics);
+    times = &metrics.load;
+    munit_assert_int(times->snapshot, ==, 0);
+    munit_assert_int(times->read, >, 0);
+    munit_assert_int(times->crc, >, 0);
+    munit_assert_int(times->segments, >=,
+                     times->read + times->crc + times->decode);
+    munit_assert_int(times->total, >=,
+                     times->metadata + times->list + times->segments);
+    return MUNIT_OK;
+}
+
 /* The data directory has an allocated open segment which contains non-zero
  * corrupted data in its second batch. */
 TEST(load, openSegmentWithNonZeroData, setUp, tearDown, 0, NULL)
@@ -0,0 +1,232 @@
+#include "../../include/raft.h"
+#include "../../include/raft/uv.h"
+#include "../lib/heap.h"
+#include "../lib/loop.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Fixture with two in-process raft_uv_transport objects.
+ *
+ *****************************************************************************/
+
+struct fixture
+{
+    FIXTURE_HEAP;
+    FIXTURE_LOOP;
+    struct raft_uv_transport server; /* Listening transport */
+    struct raft_uv_transport client; /* Connecting transport */
+    bool accepted;
+    unsigned channel;
+    unsigned n_closed;
+};
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+#define SERVER_ADDRESS "server"
+#define CLIENT_ADDRESS "client"
+
+struct result
+{
+    int status;
+    bool done;
+};
+
+static void closeCb(struct raft_uv_transport *transport)
+{
+    struct fixture *f = transport->data;
+    f->n_closed++;
+}
+
+static void acceptCb(struct raft_uv_transport *t,
+                     raft_id id,
+                     const char *address,
+                     unsigned channel,
+                     struct uv_stream_s *stream)
+{
+    struct fixture *f = t->data;
+    munit_assert_int(id, ==, 2);
+    munit_assert_string_equal(address, CLIENT_ADDRESS);
+    f->accepted = true;
+    f->channel = channel;
+    uv_close((struct uv_handle_s *)stream, (uv_close_cb)raft_free);
+}
+
+static void connectCbAssertResult(struct raft_uv_connect *req,
+                                  struct uv_stream_s *stream,
+                                  int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    if (status == 0) {
+        uv_close((struct uv_handle_s *)stream, (uv_close_cb)raft_free);
+    } else {
+        munit_assert_ptr_null(stream);
+    }
+    result->done = true;
+}
+
+#define CONNECT_REQ(ADDRESS, STATUS)                                       \
+    struct raft_uv_connect _req;                                           \
+    struct result _result = {STATUS, false};                               \
+    int _rv;                                                               \
+    _req.data = &_result;                                                  \
+    _req.channel = RAFT_UV_CHANNEL_CONTROL;                                \
+    _rv = f->client.connect(&f->client, &_req, 1, ADDRESS,                 \
+                            connectCbAssertResult);                        \
+    munit_assert_int(_rv, ==, 0)
+
+/* Submit a connect request and wait for it to complete with the given
+ * status. */
+#define CONNECT(ADDRESS, STATUS)              \
+    {                                         \
+        CONNECT_REQ(ADDRESS, STATUS);         \
+        LOOP_RUN_UNTIL(&_result.done);        \
+    }
+
+#define CLOSE_SUBMIT                             \
+    f->server.close(&f->server, closeCb);        \
+    f->client.close(&f->client, closeCb)
+#define CLOSE_WAIT                                     \
+    {                                                  \
+        bool _closed = false;                          \
+        while (!_closed) {                             \
+            LOOP_RUN(1);                               \
+            _closed = f->n_closed == 2;                \
+        }                                              \
+    }
+
+/******************************************************************************
+ *
+ * Set up and tear down.
+ *
+ *****************************************************************************/
+
+static void *setUp(const MunitParameter params[], MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    int rv;
+    SET_UP_HEAP;
+    SETUP_LOOP;
+    rv = raft_uv_loopback_init(&f->server, &f->loop);
+    munit_assert_int(rv, ==, 0);
+    rv = raft_uv_loopback_init(&f->client, &f->loop);
+    munit_assert_int(rv, ==, 0);
+    f->server.data = f;
+    f->client.data = f;
+    rv = f->server.init(&f->server, 1, SERVER_ADDRESS);
+    munit_assert_int(rv, ==, 0);
+    rv = f->client.init(&f->client, 2, CLIENT_ADDRESS);
+    munit_assert_int(rv, ==, 0);
+    rv = f->server.listen(&f->server, acceptCb);
+    munit_assert_int(rv, ==, 0);
+    f->accepted = false;
+    f->n_closed = 0;
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    if (f->n_closed == 0) {
+        CLOSE_SUBMIT;
+        CLOSE_WAIT;
+    }
+    raft_uv_loopback_close(&f->client);
+    raft_uv_loopback_close(&f->server);
+    TEAR_DOWN_LOOP;
+    TEAR_DOWN_HEAP;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * raft_uv_transport->connect()
+ *
+ *****************************************************************************/
+
+SUITE(loopback)
+
+/* Successfully connect to a listening transport. */
+TEST(loopback, connect, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CONNECT(SERVER_ADDRESS, 0);
+    munit_assert_true(f->accepted);
+    return MUNIT_OK;
+}
+
+/* Connect to an address with no listening transport. */
+TEST(loopback, noListener, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CONNECT("bogus", RAFT_NOCONNECTION);
+    munit_assert_string_equal(f->client.errmsg, "no server listening on bogus");
+    munit_assert_false(f->accepted);
+    return MUNIT_OK;
+}
+
+/* Connect to a transport that was closed. */
+TEST(loopback, listenerClosed, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    f->server.close(&f->server, closeCb);
+    CONNECT(SERVER_ADDRESS, RAFT_NOCONNECTION);
+    f->client.close(&f->client, closeCb);
+    CLOSE_WAIT;
+    return MUNIT_OK;
+}
+
+/* Two transports can't listen on the same address. */
+TEST(loopback, addressInUse, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_uv_transport other;
+    int rv;
+    rv = raft_uv_loopback_init(&other, &f->loop);
+    munit_assert_int(rv, ==, 0);
+    other.data = f;
+    rv = other.init(&other, 3, SERVER_ADDRESS);
+    munit_assert_int(rv, ==, 0);
+    rv = other.listen(&other, acceptCb);
+    munit_assert_int(rv, ==, RAFT_IOERR);
+    munit_assert_string_equal(other.errmsg, "address already in use");
+    other.close(&other, closeCb);
+    LOOP_RUN_UNTIL(&f->n_closed);
+    f->n_closed = 0;
+    raft_uv_loopback_close(&other);
+    return MUNIT_OK;
+}
+
+/* A transport can be closed without having been initialized. */
+TEST(loopback, closeWithoutInit, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_uv_transport other;
+    int rv;
+    rv = raft_uv_loopback_init(&other, &f->loop);
+    munit_assert_int(rv, ==, 0);
+    other.data = f;
+    other.close(&other, closeCb);
+    munit_assert_int(f->n_closed, ==, 1);
+    f->n_closed = 0;
+    raft_uv_loopback_close(&other);
+    return MUNIT_OK;
+}
+
+/* The transport is closed before a connect request gets processed. */
+TEST(loopback, closeBeforeConnected, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CONNECT_REQ(SERVER_ADDRESS, RAFT_CANCELED);
+    CLOSE_SUBMIT;
+    munit_assert_false(_result.done);
+    CLOSE_WAIT;
+    munit_assert_true(_result.done);
+    munit_assert_false(f->accepted);
+    return MUNIT_OK;
+}
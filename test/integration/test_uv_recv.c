@@ -1,3 +1,5 @@
+#include "../../src/uv.h"
+#include "../../src/uv_encoding.h"
 #include "../lib/runner.h"
 #include "../lib/tcp.h"
 #include "../lib/uv.h"
@@ -34,6 +36,7 @@ struct result
 {
     struct raft_message *message;
     bool done;
+    unsigned n; /* Number of messages still expected */
 };
 
 static void recvCb(struct raft_io *io, struct raft_message *m1)
@@ -63,6 +66,8 @@ static void recvCb(struct raft_io *io, struct raft_message *m1)
         case RAFT_IO_APPEND_ENTRIES:
             munit_assert_int(m1->append_entries.n_entries, ==,
                              m2->append_entries.n_entries);
+            munit_assert_int(m1->append_entries.quiesce, ==,
+                             m2->append_entries.quiesce);
             for (i = 0; i < m1->append_entries.n_entries; i++) {
                 struct raft_entry *entry1 = &m1->append_entries.entries[i];
                 struct raft_entry *entry2 = &m2->append_entries.entries[i];
@@ -85,6 +90,8 @@ static void recvCb(struct raft_io *io, struct raft_message *m1)
                              m2->append_entries_result.rejected);
             munit_assert_int(m1->append_entries_result.last_log_index, ==,
                              m2->append_entries_result.last_log_index);
+            munit_assert_int(m1->append_entries_result.snapshot_index, ==,
+                             m2->append_entries_result.snapshot_index);
             break;
         case RAFT_IO_INSTALL_SNAPSHOT:
             munit_assert_int(m1->install_snapshot.conf.n, ==,
@@ -98,6 +105,8 @@ static void recvCb(struct raft_io *io, struct raft_message *m1)
             }
             munit_assert_int(m1->install_snapshot.data.len, ==,
                              m2->install_snapshot.data.len);
+            munit_assert_int(m1->install_snapshot.leader_id, ==,
+                             m2->install_snapshot.leader_id);
             munit_assert_int(memcmp(m1->install_snapshot.data.base,
                                     m2->install_snapshot.data.base,
                                     m2->install_snapshot.data.len),
@@ -112,8 +121,18 @@ static void recvCb(struct raft_io *io, struct raft_message *m1)
             munit_assert_int(m1->timeout_now.last_log_term, ==,
                              m2->timeout_now.last_log_term);
             break;
+        case RAFT_IO_DELEGATE_SNAPSHOT:
+            munit_assert_int(m1->delegate_snapshot.term, ==,
+                             m2->delegate_snapshot.term);
+            munit_assert_int(m1->delegate_snapshot.server_id, ==,
+                             m2->delegate_snapshot.server_id);
+            break;
     };
-    result->done = true;
+    munit_assert_uint(result->n, >, 0);
+    result->n--;
+    if (result->n == 0) {
+        result->done = true;
+    }
 }
 
 static void peerSendCb(struct raft_io_send *req, int status)
@@ -170,28 +189,76 @@ static void peerCloseCb(struct raft_io *io)
         uv_loop_close(_loop);                                      \
     } while (0)
 
+/* Submit a request to send a message to the main fixture's raft_io instance
+ * using the fixture's peer instance. */
+#define PEER_SEND_SUBMIT(MESSAGE)                                   \
+    struct raft_io_send _req;                                       \
+    bool _done = false;                                             \
+    int _rv;                                                        \
+    (MESSAGE)->server_id = 1;                                       \
+    (MESSAGE)->server_address = "127.0.0.1:9001";                   \
+    _req.data = &_done;                                             \
+    _rv = f->peer.io.send(&f->peer.io, &_req, MESSAGE, peerSendCb); \
+    munit_assert_int(_rv, ==, 0)
+
+/* Wait for the send request submitted with PEER_SEND_SUBMIT to complete. */
+#define PEER_SEND_WAIT                               \
+    do {                                             \
+        int _i;                                      \
+        for (_i = 0; _i < 10; _i++) {                \
+            if (_done) {                             \
+                break;                               \
+            }                                        \
+            uv_run(&f->peer.loop, UV_RUN_ONCE);      \
+        }                                            \
+        munit_assert_true(_done);                    \
+    } while (0)
+
 /* Send a message to the main fixture's raft_io instance using the fixture's
  * peer instance. */
-#define PEER_SEND(MESSAGE)                                \
-    do {                                                  \
-        struct uv_loop_s *_loop = &f->peer.loop;          \
-        struct raft_io *_io = &f->peer.io;                \
-        struct raft_io_send _req;                         \
-        bool _done = false;                               \
-        int _i;                                           \
-        int _rv;                                          \
-        (MESSAGE)->server_id = 1;                         \
-        (MESSAGE)->server_address = "127.0.0.1:9001";     \
-        _req.data = &_done;                               \
-        _rv = _io->send(_io, &_req, MESSAGE, peerSendCb); \
-        munit_assert_int(_rv, ==, 0);                     \
-        for (_i = 0; _i < 10; _i++) {                     \
-            if (_done) {                                  \
-                break;                                    \
-            }                                             \
-            uv_run(_loop, UV_RUN_ONCE);                   \
-        }                                                 \
-        munit_assert_true(_done);                         \
+#define PEER_SEND(MESSAGE)          \
+    do {                            \
+        PEER_SEND_SUBMIT(MESSAGE);  \
+        PEER_SEND_WAIT;             \
+    } while (0)
+
+static void peerRecvCb(struct raft_io *io, struct raft_message *message)
+{
+    bool *done = io->data;
+    munit_assert_int(message->type, ==, RAFT_IO_APPEND_ENTRIES_RESULT);
+    *done = true;
+}
+
+/* Start the fixture's peer raft_io instance and send it an AppendEntries
+ * result from the main one, which tells the peer whether the main instance
+ * accepts compressed payloads and compact headers. */
+#define PEER_RECV_RESULT                                                     \
+    do {                                                                     \
+        struct raft_message _message;                                        \
+        struct raft_io_send _req;                                            \
+        bool _sent = false;                                                  \
+        bool _received = false;                                              \
+        int _i;                                                              \
+        int _rv;                                                             \
+        _rv = f->peer.io.start(&f->peer.io, 10000, NULL, peerRecvCb);        \
+        munit_assert_int(_rv, ==, 0);                                        \
+        f->peer.io.data = &_received;                                        \
+        _message.type = RAFT_IO_APPEND_ENTRIES_RESULT;                       \
+        _message.server_id = 2;                                              \
+        _message.server_address = "127.0.0.1:9002";                          \
+        _message.append_entries_result.term = 1;                             \
+        _message.append_entries_result.rejected = 0;                         \
+        _message.append_entries_result.last_log_index = 1;                   \
+        _message.append_entries_result.snapshot_index = 0;                   \
+        _req.data = &_sent;                                                  \
+        _rv = f->io.send(&f->io, &_req, &_message, peerSendCb);              \
+        munit_assert_int(_rv, ==, 0);                                        \
+        for (_i = 0; _i < 10000 && !(_sent && _received); _i++) {            \
+            uv_run(&f->loop, UV_RUN_NOWAIT);                                 \
+            uv_run(&f->peer.loop, UV_RUN_NOWAIT);                            \
+        }                                                                    \
+        munit_assert_true(_sent);                                            \
+        munit_assert_true(_received);                                        \
     } while (0)
 
 /* Establish a connection and send an handshake using plain TCP. */
@@ -211,11 +278,15 @@ static void peerCloseCb(struct raft_io *io)
 
 /* Run the loop until a new message is received. Assert that the received
  * message matches the given one. */
-#define RECV(MESSAGE)                             \
-    do {                                          \
-        struct result _result = {MESSAGE, false}; \
-        f->io.data = &_result;                    \
-        LOOP_RUN_UNTIL(&_result.done);            \
+#define RECV(MESSAGE) RECV_N(MESSAGE, 1)
+
+/* Run the loop until N messages are received. Assert that all received
+ * messages match the given one. */
+#define RECV_N(MESSAGE, N)                           \
+    do {                                             \
+        struct result _result = {MESSAGE, false, N}; \
+        f->io.data = &_result;                       \
+        LOOP_RUN_UNTIL(&_result.done);               \
     } while (0)
 
 /******************************************************************************
@@ -302,6 +373,36 @@ TEST(recv, second, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Receive several messages that were written out at once by the peer, and
+ * that get parsed from the same read buffer. */
+TEST(recv, several, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+    struct raft_io_send reqs[3];
+    bool done[3] = {false, false, false};
+    unsigned i;
+    int rv;
+    message.type = RAFT_IO_REQUEST_VOTE;
+    message.request_vote.candidate_id = 2;
+    message.request_vote.last_log_index = 123;
+    message.request_vote.last_log_term = 2;
+    message.request_vote.disrupt_leader = false;
+    PEER_SEND(&message);
+    RECV(&message);
+    for (i = 0; i < 3; i++) {
+        reqs[i].data = &done[i];
+        rv = f->peer.io.send(&f->peer.io, &reqs[i], &message, peerSendCb);
+        munit_assert_int(rv, ==, 0);
+    }
+    for (i = 0; i < 10 && !done[2]; i++) {
+        uv_run(&f->peer.loop, UV_RUN_ONCE);
+    }
+    munit_assert_true(done[0] && done[1] && done[2]);
+    RECV_N(&message, 3);
+    return MUNIT_OK;
+}
+
 /* Receive a RequestVote result message. */
 TEST(recv, requestVoteResult, setUp, tearDown, 0, NULL)
 {
@@ -335,10 +436,271 @@ TEST(recv, appendEntries, setUp, tearDown, 0, NULL)
     message.type = RAFT_IO_APPEND_ENTRIES;
     message.append_entries.entries = entries;
     message.append_entries.n_entries = 2;
+    message.append_entries.quiesce = false;
+
+    PEER_SEND(&message);
+    RECV(&message);
+
+    return MUNIT_OK;
+}
+
+/* Receive the same AppendEntries message twice, the second time with its
+ * batch header being taken from the sender's cache. */
+TEST(recv, appendEntriesTwice, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry entries[2];
+    struct raft_message message;
+    uint8_t data1[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint8_t data2[16] = {8, 7, 6, 5, 4, 3, 2, 1, 1, 2, 3, 4, 5, 6, 7, 8};
+
+    entries[0].term = 1;
+    entries[0].type = RAFT_COMMAND;
+    entries[0].buf.base = data1;
+    entries[0].buf.len = sizeof data1;
+
+    entries[1].term = 2;
+    entries[1].type = RAFT_COMMAND;
+    entries[1].buf.base = data2;
+    entries[1].buf.len = sizeof data2;
+
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.term = 2;
+    message.append_entries.prev_log_index = 0;
+    message.append_entries.prev_log_term = 0;
+    message.append_entries.leader_commit = 0;
+    message.append_entries.entries = entries;
+    message.append_entries.n_entries = 2;
+    message.append_entries.quiesce = false;
+
+    PEER_SEND(&message);
+    RECV(&message);
+    PEER_SEND(&message);
+    RECV(&message);
+
+    return MUNIT_OK;
+}
+
+/* Receive messages sent over separate logical channels, each one using its own
+ * connection. */
+TEST(recv, channels, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct uv *uv = f->io.impl;
+    struct raft_entry entry;
+    struct raft_message message;
+    uint8_t buf[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    queue *head;
+    unsigned n = 0;
+
+    raft_uv_set_channels(&f->peer.io, true);
+
+    message.type = RAFT_IO_REQUEST_VOTE;
+    message.request_vote.candidate_id = 2;
+    message.request_vote.last_log_index = 123;
+    message.request_vote.last_log_term = 2;
+    message.request_vote.disrupt_leader = false;
+    PEER_SEND(&message);
+    RECV(&message);
+
+    entry.term = 1;
+    entry.type = RAFT_COMMAND;
+    entry.buf.base = buf;
+    entry.buf.len = sizeof buf;
+
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.term = 2;
+    message.append_entries.prev_log_index = 0;
+    message.append_entries.prev_log_term = 0;
+    message.append_entries.leader_commit = 0;
+    message.append_entries.entries = &entry;
+    message.append_entries.n_entries = 1;
+    message.append_entries.quiesce = false;
+    PEER_SEND(&message);
+    RECV(&message);
+
+    QUEUE_FOREACH(head, &uv->servers) { n++; }
+    munit_assert_int(n, ==, 2);
+
+    return MUNIT_OK;
+}
+
+/* Receive an AppendEntries message carrying the checksums of its batch. */
+TEST(recv, appendEntriesChecksums, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry entries[2];
+    struct raft_message message;
+    uint8_t data1[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint8_t data2[16] = {8, 7, 6, 5, 4, 3, 2, 1, 1, 2, 3, 4, 5, 6, 7, 8};
+
+    raft_uv_set_wire_checksums(&f->peer.io, true);
+
+    entries[0].term = 1;
+    entries[0].type = RAFT_COMMAND;
+    entries[0].buf.base = data1;
+    entries[0].buf.len = sizeof data1;
+
+    entries[1].term = 2;
+    entries[1].type = RAFT_COMMAND;
+    entries[1].buf.base = data2;
+    entries[1].buf.len = sizeof data2;
+
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.term = 2;
+    message.append_entries.prev_log_index = 0;
+    message.append_entries.prev_log_term = 0;
+    message.append_entries.leader_commit = 0;
+    message.append_entries.entries = entries;
+    message.append_entries.n_entries = 2;
+    message.append_entries.quiesce = false;
+
+    PEER_SEND(&message);
+    RECV(&message);
+
+    return MUNIT_OK;
+}
+
+/* Receive an AppendEntries message whose payload is larger than the read
+ * buffer, followed by a small one. */
+TEST(recv, appendEntriesLarge, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry entry;
+    struct raft_message message;
+    size_t i;
+
+    entry.type = RAFT_COMMAND;
+    entry.buf.len = 256 * 1024;
+    entry.buf.base = munit_malloc(entry.buf.len);
+    for (i = 0; i < entry.buf.len; i++) {
+        ((uint8_t *)entry.buf.base)[i] = (uint8_t)i;
+    }
+
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.entries = &entry;
+    message.append_entries.n_entries = 1;
+    message.append_entries.quiesce = false;
+
+    PEER_SEND(&message);
+    RECV(&message);
 
+    entry.buf.len = 24;
     PEER_SEND(&message);
     RECV(&message);
 
+    free(entry.buf.base);
+
+    return MUNIT_OK;
+}
+
+/* Receive an AppendEntries message whose entries were compressed, since we told
+ * the sender that we can decompress them. */
+TEST(recv, appendEntriesCompressed, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry entries[2];
+    struct raft_message message;
+    uint8_t data1[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint8_t data2[4096];
+    int rv;
+
+    rv = raft_uv_set_wire_compression(&f->peer.io, true, 1024);
+#ifndef LZ4_AVAILABLE
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    return MUNIT_SKIP;
+#endif
+    munit_assert_int(rv, ==, 0);
+    raft_uv_set_wire_checksums(&f->peer.io, true);
+
+    PEER_RECV_RESULT;
+    munit_assert_true(UvRecvPeerCapabilities(f->peer.io.impl, 1) &
+                      UV__CAPABILITY_COMPRESSION);
+
+    memset(data2, 'x', sizeof data2);
+
+    entries[0].term = 1;
+    entries[0].type = RAFT_COMMAND;
+    entries[0].buf.base = data1;
+    entries[0].buf.len = sizeof data1;
+
+    entries[1].term = 2;
+    entries[1].type = RAFT_COMMAND;
+    entries[1].buf.base = data2;
+    entries[1].buf.len = sizeof data2;
+
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.term = 2;
+    message.append_entries.prev_log_index = 0;
+    message.append_entries.prev_log_term = 0;
+    message.append_entries.leader_commit = 0;
+    message.append_entries.entries = entries;
+    message.append_entries.n_entries = 2;
+    message.append_entries.quiesce = false;
+
+    /* The compressed message stays well below a limit that the uncompressed
+     * one would reach. */
+    raft_uv_set_send_limits(&f->peer.io, 1024, sizeof data2 / 2, 3);
+    {
+        PEER_SEND_SUBMIT(&message);
+        munit_assert_false(f->peer.io.send_backlogged(&f->peer.io, 1));
+        PEER_SEND_WAIT;
+    }
+    RECV(&message);
+
+    /* Payloads below the threshold are sent as they are. */
+    message.append_entries.n_entries = 1;
+    message.append_entries.quiesce = false;
+    {
+        PEER_SEND_SUBMIT(&message);
+        PEER_SEND_WAIT;
+    }
+    RECV(&message);
+
+    return MUNIT_OK;
+}
+
+/* Payloads are not compressed until the receiver tells us that it can
+ * decompress them. */
+TEST(recv, appendEntriesCompressionNotAccepted, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry entry;
+    struct raft_message message;
+    uint8_t data1[4096];
+    int rv;
+
+    rv = raft_uv_set_wire_compression(&f->peer.io, true, 0);
+#ifndef LZ4_AVAILABLE
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    return MUNIT_SKIP;
+#endif
+    munit_assert_int(rv, ==, 0);
+
+    memset(data1, 'x', sizeof data1);
+
+    entry.term = 1;
+    entry.type = RAFT_COMMAND;
+    entry.buf.base = data1;
+    entry.buf.len = sizeof data1;
+
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.term = 2;
+    message.append_entries.prev_log_index = 0;
+    message.append_entries.prev_log_term = 0;
+    message.append_entries.leader_commit = 0;
+    message.append_entries.entries = &entry;
+    message.append_entries.n_entries = 1;
+    message.append_entries.quiesce = false;
+
+    raft_uv_set_send_limits(&f->peer.io, 1024, sizeof data1 / 2, 3);
+    {
+        PEER_SEND_SUBMIT(&message);
+        munit_assert_true(f->peer.io.send_backlogged(&f->peer.io, 1));
+        PEER_SEND_WAIT;
+    }
+    RECV(&message);
+
     return MUNIT_OK;
 }
 
@@ -350,11 +712,191 @@ TEST(recv, heartbeat, setUp, tearDown, 0, NULL)
     message.type = RAFT_IO_APPEND_ENTRIES;
     message.append_entries.entries = NULL;
     message.append_entries.n_entries = 0;
+    message.append_entries.quiesce = true;
     PEER_SEND(&message);
     RECV(&message);
     return MUNIT_OK;
 }
 
+/* Once we told the sender that we can decode compact headers, it stops sending
+ * regular ones. */
+TEST(recv, heartbeatCompact, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.term = 2;
+    message.append_entries.prev_log_index = 10;
+    message.append_entries.prev_log_term = 2;
+    message.append_entries.leader_commit = 10;
+    message.append_entries.entries = NULL;
+    message.append_entries.n_entries = 0;
+    message.append_entries.quiesce = true;
+
+    /* A regular heartbeat takes more than 64 bytes, a compact one less than
+     * 16. */
+    raft_uv_set_wire_compact(&f->peer.io, true);
+    raft_uv_set_send_limits(&f->peer.io, 1024, 16, 3);
+    {
+        PEER_SEND_SUBMIT(&message);
+        munit_assert_true(f->peer.io.send_backlogged(&f->peer.io, 1));
+        PEER_SEND_WAIT;
+    }
+    RECV(&message);
+
+    PEER_RECV_RESULT;
+    munit_assert_true(UvRecvPeerCapabilities(f->peer.io.impl, 1) &
+                      UV__CAPABILITY_COMPACT);
+
+    {
+        PEER_SEND_SUBMIT(&message);
+        munit_assert_false(f->peer.io.send_backlogged(&f->peer.io, 1));
+        PEER_SEND_WAIT;
+    }
+    RECV(&message);
+
+    return MUNIT_OK;
+}
+
+/* Compact headers are not sent unless enabled. */
+TEST(recv, heartbeatCompactDisabled, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.term = 2;
+    message.append_entries.prev_log_index = 10;
+    message.append_entries.prev_log_term = 2;
+    message.append_entries.leader_commit = 10;
+    message.append_entries.entries = NULL;
+    message.append_entries.n_entries = 0;
+    message.append_entries.quiesce = true;
+
+    raft_uv_set_send_limits(&f->peer.io, 1024, 16, 3);
+    PEER_SEND(&message);
+    RECV(&message);
+    PEER_RECV_RESULT;
+
+    {
+        PEER_SEND_SUBMIT(&message);
+        munit_assert_true(f->peer.io.send_backlogged(&f->peer.io, 1));
+        PEER_SEND_WAIT;
+    }
+    RECV(&message);
+
+    return MUNIT_OK;
+}
+
+/* Receive an AppendEntries message with a compact header, whose entry terms
+ * are delta-encoded. */
+TEST(recv, appendEntriesCompact, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry entries[3];
+    struct raft_message message;
+    uint8_t data1[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint8_t data2[16] = {8, 7, 6, 5, 4, 3, 2, 1, 1, 2, 3, 4, 5, 6, 7, 8};
+
+    raft_uv_set_wire_checksums(&f->peer.io, true);
+    PEER_RECV_RESULT;
+
+    entries[0].term = 3;
+    entries[0].type = RAFT_COMMAND;
+    entries[0].buf.base = data1;
+    entries[0].buf.len = sizeof data1;
+
+    entries[1].term = 3;
+    entries[1].type = RAFT_BARRIER;
+    entries[1].buf.base = NULL;
+    entries[1].buf.len = 0;
+
+    entries[2].term = 300;
+    entries[2].type = RAFT_COMMAND;
+    entries[2].buf.base = data2;
+    entries[2].buf.len = sizeof data2;
+
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.term = 300;
+    message.append_entries.prev_log_index = 1000;
+    message.append_entries.prev_log_term = 2;
+    message.append_entries.leader_commit = 999;
+    message.append_entries.entries = entries;
+    message.append_entries.n_entries = 3;
+    message.append_entries.quiesce = false;
+
+    PEER_SEND(&message);
+    RECV(&message);
+
+    return MUNIT_OK;
+}
+
+/* All message types can be sent with a compact header. */
+TEST(recv, compactMessages, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+    uint8_t snapshot_data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    int rv;
+
+    PEER_RECV_RESULT;
+
+    message.type = RAFT_IO_REQUEST_VOTE;
+    message.request_vote.term = 3;
+    message.request_vote.candidate_id = 2;
+    message.request_vote.last_log_index = 123;
+    message.request_vote.last_log_term = 2;
+    message.request_vote.disrupt_leader = true;
+    message.request_vote.pre_vote = false;
+    PEER_SEND(&message);
+    RECV(&message);
+
+    message.type = RAFT_IO_REQUEST_VOTE_RESULT;
+    message.request_vote_result.term = 3;
+    message.request_vote_result.vote_granted = true;
+    PEER_SEND(&message);
+    RECV(&message);
+
+    message.type = RAFT_IO_APPEND_ENTRIES_RESULT;
+    message.append_entries_result.term = 3;
+    message.append_entries_result.rejected = 122;
+    message.append_entries_result.last_log_index = 123;
+    message.append_entries_result.snapshot_index = 100;
+    PEER_SEND(&message);
+    RECV(&message);
+
+    message.type = RAFT_IO_INSTALL_SNAPSHOT;
+    message.install_snapshot.term = 2;
+    message.install_snapshot.last_index = 123;
+    message.install_snapshot.last_term = 1;
+    raft_configuration_init(&message.install_snapshot.conf);
+    rv = raft_configuration_add(&message.install_snapshot.conf, 1, "1",
+                                RAFT_VOTER);
+    munit_assert_int(rv, ==, 0);
+    message.install_snapshot.data.len = sizeof snapshot_data;
+    message.install_snapshot.data.base = snapshot_data;
+    message.install_snapshot.leader_id = 3;
+    PEER_SEND(&message);
+    RECV(&message);
+    raft_configuration_close(&message.install_snapshot.conf);
+
+    message.type = RAFT_IO_TIMEOUT_NOW;
+    message.timeout_now.term = 3;
+    message.timeout_now.last_log_index = 123;
+    message.timeout_now.last_log_term = 2;
+    PEER_SEND(&message);
+    RECV(&message);
+
+    message.type = RAFT_IO_DELEGATE_SNAPSHOT;
+    message.delegate_snapshot.term = 3;
+    message.delegate_snapshot.server_id = 2;
+    PEER_SEND(&message);
+    RECV(&message);
+
+    return MUNIT_OK;
+}
+
 /* Receive an AppendEntries result f->peer.message. */
 TEST(recv, appendEntriesResult, setUp, tearDown, 0, NULL)
 {
@@ -364,6 +906,7 @@ TEST(recv, appendEntriesResult, setUp, tearDown, 0, NULL)
     message.append_entries_result.term = 3;
     message.append_entries_result.rejected = 0;
     message.append_entries_result.last_log_index = 123;
+    message.append_entries_result.snapshot_index = 100;
     PEER_SEND(&message);
     RECV(&message);
     return MUNIT_OK;
@@ -387,6 +930,7 @@ TEST(recv, installSnapshot, setUp, tearDown, 0, NULL)
     munit_assert_int(rv, ==, 0);
     message.install_snapshot.data.len = sizeof snapshot_data;
     message.install_snapshot.data.base = snapshot_data;
+    message.install_snapshot.leader_id = 0;
 
     PEER_SEND(&message);
     RECV(&message);
@@ -396,6 +940,53 @@ TEST(recv, installSnapshot, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Receive an InstallSnapshot message whose data was compressed. */
+TEST(recv, installSnapshotCompressed, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+    uint8_t snapshot_data[8192];
+    size_t i;
+    int rv;
+
+    rv = raft_uv_set_wire_compression(&f->peer.io, true, 0);
+#ifndef LZ4_AVAILABLE
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    return MUNIT_SKIP;
+#endif
+    munit_assert_int(rv, ==, 0);
+
+    PEER_RECV_RESULT;
+
+    for (i = 0; i < sizeof snapshot_data; i++) {
+        snapshot_data[i] = (uint8_t)(i % 16);
+    }
+
+    message.type = RAFT_IO_INSTALL_SNAPSHOT;
+    message.install_snapshot.term = 2;
+    message.install_snapshot.last_index = 123;
+    message.install_snapshot.last_term = 1;
+    raft_configuration_init(&message.install_snapshot.conf);
+    rv = raft_configuration_add(&message.install_snapshot.conf, 1, "1",
+                                RAFT_VOTER);
+    munit_assert_int(rv, ==, 0);
+    message.install_snapshot.data.len = sizeof snapshot_data;
+    message.install_snapshot.data.base = snapshot_data;
+    message.install_snapshot.leader_id = 2;
+
+    raft_uv_set_send_limits(&f->peer.io, 1024, sizeof snapshot_data / 2, 3);
+    {
+        PEER_SEND_SUBMIT(&message);
+        munit_assert_false(f->peer.io.send_backlogged(&f->peer.io, 1));
+        PEER_SEND_WAIT;
+    }
+    RECV(&message);
+
+    raft_configuration_close(&message.install_snapshot.conf);
+
+    return MUNIT_OK;
+}
+
 /* Receive a TimeoutNow message. */
 TEST(recv, timeoutNow, setUp, tearDown, 0, NULL)
 {
@@ -410,6 +1001,47 @@ TEST(recv, timeoutNow, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Receive an InstallSnapshot message sent on behalf of the leader. */
+TEST(recv, installSnapshotDelegated, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+    uint8_t snapshot_data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    int rv;
+
+    message.type = RAFT_IO_INSTALL_SNAPSHOT;
+    message.install_snapshot.term = 2;
+    message.install_snapshot.last_index = 123;
+    message.install_snapshot.last_term = 1;
+    raft_configuration_init(&message.install_snapshot.conf);
+    rv = raft_configuration_add(&message.install_snapshot.conf, 1, "1",
+                                RAFT_VOTER);
+    munit_assert_int(rv, ==, 0);
+    message.install_snapshot.data.len = sizeof snapshot_data;
+    message.install_snapshot.data.base = snapshot_data;
+    message.install_snapshot.leader_id = 3;
+
+    PEER_SEND(&message);
+    RECV(&message);
+
+    raft_configuration_close(&message.install_snapshot.conf);
+
+    return MUNIT_OK;
+}
+
+/* Receive a DelegateSnapshot message. */
+TEST(recv, delegateSnapshot, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+    message.type = RAFT_IO_DELEGATE_SNAPSHOT;
+    message.delegate_snapshot.term = 3;
+    message.delegate_snapshot.server_id = 2;
+    PEER_SEND(&message);
+    RECV(&message);
+    return MUNIT_OK;
+}
+
 /* The handshake fails because of an unexpected protocon version. */
 TEST(recv, badProtocol, setUp, tearDown, 0, NULL)
 {
@@ -439,6 +1071,36 @@ TEST(recv, badSize, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* A message whose header length is too large causes the connection to be
+ * aborted, instead of trying to grow the read buffer to fit it once more data
+ * arrives. */
+TEST(recv, badLargeSize, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    uint8_t handshake[] = {
+        1,  0, 0, 0, 0, 0, 0, 0, /* Protocol */
+        1,  0, 0, 0, 0, 0, 0, 0, /* Server ID */
+        16, 0, 0, 0, 0, 0, 0, 0, /* Address length */
+        0,  0, 0, 0, 0, 0, 0, 0, /* First address word */
+        0,  0, 0, 0, 0, 0, 0, 0  /* Second address word */
+    };
+    uint8_t header[] = {
+        1,    0,    0,    0,    0,    0,    0,    0,   /* Message type */
+        0xe0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff /* Message size */
+    };
+    uint8_t more[8] = {0};
+    sprintf((char *)&handshake[24], "127.0.0.1:666");
+    TCP_CLIENT_CONNECT(9001);
+    TCP_CLIENT_SEND(handshake, sizeof handshake);
+    LOOP_RUN(1);
+    TCP_CLIENT_SEND(header, sizeof header);
+    LOOP_RUN(1);
+    TCP_CLIENT_SEND(more, sizeof more);
+    uv_run(&f->loop, UV_RUN_NOWAIT);
+    uv_run(&f->loop, UV_RUN_NOWAIT);
+    return MUNIT_OK;
+}
+
 /* A message with a bad type causes the connection to be aborted. */
 TEST(recv, badType, setUp, tearDown, 0, NULL)
 {
@@ -453,6 +1115,37 @@ TEST(recv, badType, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* The length in the preamble of a compact message can't exceed 64 bits. */
+TEST(recv, badCompactSize, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    uint8_t header[] = {
+        0x80 | 1,                                        /* Message type */
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, /* Message size */
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    };
+    PEER_HANDSHAKE;
+    TCP_CLIENT_SEND(header, sizeof header);
+    LOOP_RUN(2);
+    return MUNIT_OK;
+}
+
+/* A compact message whose header is truncated causes the connection to be
+ * aborted. */
+TEST(recv, badCompactHeader, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    uint8_t header[] = {
+        0x80 | RAFT_IO_APPEND_ENTRIES, /* Message type */
+        4,                             /* Message size */
+        1, 2, 3, 4,                    /* Term, index, term, commit */
+    };
+    PEER_HANDSHAKE;
+    TCP_CLIENT_SEND(header, sizeof header);
+    LOOP_RUN(2);
+    return MUNIT_OK;
+}
+
 /* The backend is closed just before accepting a new connection. */
 TEST(recv, closeBeforeAccept, setUp, tearDownDeps, 0, NULL)
 {
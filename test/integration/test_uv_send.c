@@ -163,6 +163,57 @@ TEST(send, parallel, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Submit a burst of send requests in the same loop iteration, which get
+ * coalesced into a single write. */
+TEST(send, coalesce, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    SEND(0);
+    SEND_SUBMIT(1 /* message */, 0 /* rv */, 0 /* status */);
+    SEND_SUBMIT(2 /* message */, 0 /* rv */, 0 /* status */);
+    SEND_SUBMIT(3 /* message */, 0 /* rv */, 0 /* status */);
+    SEND_SUBMIT(4 /* message */, 0 /* rv */, 0 /* status */);
+    SEND_WAIT(1);
+    munit_assert_true(_result2.done);
+    munit_assert_true(_result3.done);
+    munit_assert_true(_result4.done);
+    return MUNIT_OK;
+}
+
+/* Submit in the same loop iteration several messages whose total number of
+ * buffers exceeds the maximum that a single write can hold. */
+TEST(send, coalesceManyBuffers, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry entries[200];
+    unsigned i;
+    for (i = 0; i < 200; i++) {
+        entries[i].term = 1;
+        entries[i].type = RAFT_COMMAND;
+        entries[i].buf.base = raft_malloc(8);
+        entries[i].buf.len = 8;
+        entries[i].batch = NULL;
+    }
+    for (i = 0; i < 3; i++) {
+        MESSAGE(i)->type = RAFT_IO_APPEND_ENTRIES;
+        MESSAGE(i)->append_entries.term = 1;
+        MESSAGE(i)->append_entries.prev_log_index = 0;
+        MESSAGE(i)->append_entries.prev_log_term = 0;
+        MESSAGE(i)->append_entries.leader_commit = 0;
+        MESSAGE(i)->append_entries.entries = entries;
+        MESSAGE(i)->append_entries.n_entries = 200;
+    }
+    SEND(0);
+    SEND_SUBMIT(1 /* message */, 0 /* rv */, 0 /* status */);
+    SEND_SUBMIT(2 /* message */, 0 /* rv */, 0 /* status */);
+    SEND_WAIT(1);
+    SEND_WAIT(2);
+    for (i = 0; i < 200; i++) {
+        raft_free(entries[i].buf.base);
+    }
+    return MUNIT_OK;
+}
+
 /* Send a request vote result message. */
 TEST(send, voteResult, setUp, tearDown, 0, NULL)
 {
@@ -229,6 +280,7 @@ TEST(send, installSnapshot, setUp, tearDown, 0, NULL)
 
     p->data.len = 8;
     p->data.base = raft_malloc(p->data.len);
+    p->leader_id = 0;
 
     SEND(0);
 
@@ -302,12 +354,109 @@ TEST(send, badMessage, setUp, tearDown, 0, NULL)
 TEST(send, evictOldPending, setUp, tearDownDeps, 0, NULL)
 {
     struct fixture *f = data;
+    struct raft_uv_metrics metrics;
     TCP_SERVER_STOP;
     SEND_SUBMIT(0 /* message */, 0 /* rv */, RAFT_NOCONNECTION /* status */);
     SEND_SUBMIT(1 /* message */, 0 /* rv */, RAFT_CANCELED /* status */);
     SEND_SUBMIT(2 /* message */, 0 /* rv */, RAFT_CANCELED /* status */);
     SEND_SUBMIT(3 /* message */, 0 /* rv */, RAFT_CANCELED /* status */);
     SEND_WAIT(0);
+    raft_uv_get_metrics(&f->io, &metrics);
+    munit_assert_int(metrics.sends_evicted, ==, 1);
+    TEAR_DOWN_UV;
+    return MUNIT_OK;
+}
+
+/* A server is reported as backlogged while the size of the messages that were
+ * submitted but not yet written out reaches the configured limit. */
+TEST(send, backlogBytes, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_uv_set_send_limits(&f->io, 1024 /* messages */, 1 /* bytes */,
+                            3 /* pending */);
+    munit_assert_false(f->io.send_backlogged(&f->io, 1));
+    SEND_SUBMIT(0 /* message */, 0 /* rv */, 0 /* status */);
+    munit_assert_true(f->io.send_backlogged(&f->io, 1));
+    munit_assert_false(f->io.send_backlogged(&f->io, 2));
+    SEND_WAIT(0);
+    munit_assert_false(f->io.send_backlogged(&f->io, 1));
+    return MUNIT_OK;
+}
+
+/* A server is reported as backlogged while the number of messages that were
+ * submitted but not yet written out reaches the configured limit. */
+TEST(send, backlogMessages, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_uv_set_send_limits(&f->io, 2 /* messages */, 1024 /* bytes */,
+                            3 /* pending */);
+    SEND_SUBMIT(0 /* message */, 0 /* rv */, 0 /* status */);
+    munit_assert_false(f->io.send_backlogged(&f->io, 1));
+    SEND_SUBMIT(1 /* message */, 0 /* rv */, 0 /* status */);
+    munit_assert_true(f->io.send_backlogged(&f->io, 1));
+    SEND_WAIT(0);
+    SEND_WAIT(1);
+    munit_assert_false(f->io.send_backlogged(&f->io, 1));
+    return MUNIT_OK;
+}
+
+/* When sending over separate channels, only the backlog of the channel carrying
+ * AppendEntries messages is reported. */
+TEST(send, backlogLogChannel, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_uv_set_channels(&f->io, true);
+    raft_uv_set_send_limits(&f->io, 1024 /* messages */, 1 /* bytes */,
+                            3 /* pending */);
+    SEND_SUBMIT(0 /* message */, 0 /* rv */, 0 /* status */);
+    munit_assert_false(f->io.send_backlogged(&f->io, 1));
+    MESSAGE(1)->type = RAFT_IO_APPEND_ENTRIES;
+    MESSAGE(1)->append_entries.term = 1;
+    MESSAGE(1)->append_entries.prev_log_index = 0;
+    MESSAGE(1)->append_entries.prev_log_term = 0;
+    MESSAGE(1)->append_entries.leader_commit = 0;
+    MESSAGE(1)->append_entries.entries = NULL;
+    MESSAGE(1)->append_entries.n_entries = 0;
+    MESSAGE(1)->append_entries.quiesce = false;
+    SEND_SUBMIT(1 /* message */, 0 /* rv */, 0 /* status */);
+    munit_assert_true(f->io.send_backlogged(&f->io, 1));
+    SEND_WAIT(0);
+    SEND_WAIT(1);
+    munit_assert_false(f->io.send_backlogged(&f->io, 1));
+    return MUNIT_OK;
+}
+
+/* A server that can't be connected to is reported as backlogged once as many
+ * messages are pending as can be kept. */
+TEST(send, backlogNoConnection, setUp, tearDownDeps, 0, NULL)
+{
+    struct fixture *f = data;
+    TCP_SERVER_STOP;
+    SEND_SUBMIT(0 /* message */, 0 /* rv */, RAFT_CANCELED /* status */);
+    SEND_SUBMIT(1 /* message */, 0 /* rv */, RAFT_CANCELED /* status */);
+    munit_assert_false(f->io.send_backlogged(&f->io, 1));
+    SEND_SUBMIT(2 /* message */, 0 /* rv */, RAFT_CANCELED /* status */);
+    munit_assert_true(f->io.send_backlogged(&f->io, 1));
+    TEAR_DOWN_UV;
+    return MUNIT_OK;
+}
+
+/* The number of messages kept while a server can't be connected to can be
+ * changed. */
+TEST(send, backlogNoConnectionMaxPending, setUp, tearDownDeps, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_uv_metrics metrics;
+    raft_uv_set_send_limits(&f->io, 1024 /* messages */, 1024 /* bytes */,
+                            1 /* pending */);
+    TCP_SERVER_STOP;
+    SEND_SUBMIT(0 /* message */, 0 /* rv */, RAFT_NOCONNECTION /* status */);
+    munit_assert_true(f->io.send_backlogged(&f->io, 1));
+    SEND_SUBMIT(1 /* message */, 0 /* rv */, RAFT_CANCELED /* status */);
+    SEND_WAIT(0);
+    raft_uv_get_metrics(&f->io, &metrics);
+    munit_assert_int(metrics.sends_evicted, ==, 1);
+    munit_assert_true(f->io.send_backlogged(&f->io, 1));
     TEAR_DOWN_UV;
     return MUNIT_OK;
 }
@@ -345,7 +494,9 @@ TEST(send, reconnectAfterMultipleWriteErrors, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
-static char *oomHeapFaultDelay[] = {"0", "1", "2", "3", "4", NULL};
+/* Allocations 3 to 5 are made by the first connection attempt, whose failure
+ * is not reported to the caller. */
+static char *oomHeapFaultDelay[] = {"0", "1", "2", "6", "7", NULL};
 static char *oomHeapFaultRepeat[] = {"1", NULL};
 
 static MunitParameterEnum oomParams[] = {
@@ -380,6 +531,20 @@ TEST(send, oomAsync, setUp, tearDown, 0, oomAsyncParams)
     return MUNIT_OK;
 }
 
+/* The allocation of a write batch fails when flushing the queued requests: the
+ * oldest one fails, and the following ones get sent normally. */
+TEST(send, oomFlush, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    SEND(0);
+    SEND_SUBMIT(1 /* message */, 0 /* rv */, RAFT_NOMEM /* status */);
+    HeapFaultConfig(&f->heap, 0, 1);
+    HEAP_FAULT_ENABLE;
+    SEND_WAIT(1);
+    SEND(2);
+    return MUNIT_OK;
+}
+
 /* The backend gets closed while there is a pending write. */
 TEST(send, closeDuringWrite, setUp, tearDownDeps, 0, NULL)
 {
@@ -153,6 +153,18 @@ TEST(set_term, second, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* The time taken to store each metadata file is recorded in the metrics. */
+TEST(set_term, metrics, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_uv_metrics metrics;
+    SET_TERM(1);
+    SET_TERM(2);
+    raft_uv_get_metrics(&f->io, &metrics);
+    munit_assert_int(metrics.metadata_latency.count, ==, 2);
+    return MUNIT_OK;
+}
+
 /* The third time set_term() is called, the metadata1 file gets overwritten. */
 TEST(set_term, third, setUp, tearDown, 0, NULL)
 {
@@ -73,6 +73,7 @@ static void connectCbAssertResult(struct raft_uv_connect *req,
     struct result _result = {STATUS, false};                      \
     int _rv;                                                      \
     _req.data = &_result;                                         \
+    _req.channel = RAFT_UV_CHANNEL_CONTROL;                       \
     _rv = f->transport.connect(&f->transport, &_req, ID, ADDRESS, \
                                connectCbAssertResult);            \
     munit_assert_int(_rv, ==, RV)
@@ -19,6 +19,7 @@ struct fixture
     FIXTURE_TCP;
     struct raft_uv_transport transport;
     bool accepted;
+    unsigned channel;
     bool closed;
     struct
     {
@@ -48,12 +49,14 @@ static void closeCb(struct raft_uv_transport *transport)
 static void acceptCb(struct raft_uv_transport *t,
                      raft_id id,
                      const char *address,
+                     unsigned channel,
                      struct uv_stream_s *stream)
 {
     struct fixture *f = t->data;
     munit_assert_int(id, ==, PEER_ID);
     munit_assert_string_equal(address, PEER_ADDRESS);
     f->accepted = true;
+    f->channel = channel;
     uv_close((struct uv_handle_s *)stream, (uv_close_cb)raft_free);
 }
 
@@ -182,6 +185,7 @@ TEST(tcp_listen, first, setUp, tearDown, 0, NULL)
     PEER_CONNECT;
     PEER_HANDSHAKE;
     ACCEPT;
+    munit_assert_int(f->channel, ==, RAFT_UV_CHANNEL_CONTROL);
     return MUNIT_OK;
 }
 
@@ -197,6 +201,43 @@ TEST(tcp_listen, badProtocol, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* The client sends a handshake tagged with a logical channel. */
+TEST(tcp_listen, channel, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    uint8_t buf[sizeof f->handshake.buf + sizeof(uint64_t)];
+    void *cursor = buf;
+    bytePut64(&cursor, 2);
+    bytePut64(&cursor, PEER_ID);
+    bytePut64(&cursor, 16);
+    bytePut64(&cursor, RAFT_UV_CHANNEL_SNAPSHOT);
+    strcpy(cursor, PEER_ADDRESS);
+    PEER_CONNECT;
+    TCP_CLIENT_SEND(buf, sizeof buf);
+    ACCEPT;
+    munit_assert_int(f->channel, ==, RAFT_UV_CHANNEL_SNAPSHOT);
+    return MUNIT_OK;
+}
+
+/* The client sends a handshake tagged with an unknown logical channel. */
+TEST(tcp_listen, badChannel, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    uint8_t buf[sizeof f->handshake.buf + sizeof(uint64_t)];
+    void *cursor = buf;
+    bytePut64(&cursor, 2);
+    bytePut64(&cursor, PEER_ID);
+    bytePut64(&cursor, 16);
+    bytePut64(&cursor, RAFT_UV_N_CHANNELS);
+    strcpy(cursor, PEER_ADDRESS);
+    PEER_CONNECT;
+    TCP_CLIENT_SEND(buf, sizeof buf);
+    LOOP_RUN_UNTIL_CONNECTED;
+    LOOP_RUN_UNTIL_READ;
+    munit_assert_false(f->accepted);
+    return MUNIT_OK;
+}
+
 /* Parameters for sending a partial handshake */
 static char *partialHandshakeN[] = {"8", "16", "24", "32", NULL};
 
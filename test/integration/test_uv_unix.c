@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../../include/raft.h"
+#include "../../include/raft/uv.h"
+#include "../lib/dir.h"
+#include "../lib/heap.h"
+#include "../lib/loop.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Fixture with two raft_uv_transport objects using Unix domain sockets.
+ *
+ *****************************************************************************/
+
+struct fixture
+{
+    FIXTURE_DIR;
+    FIXTURE_HEAP;
+    FIXTURE_LOOP;
+    struct raft_uv_transport server; /* Listening transport */
+    struct raft_uv_transport client; /* Connecting transport */
+    char server_address[256];
+    char client_address[256];
+    bool accepted;
+    unsigned channel;
+    unsigned n_closed;
+};
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+struct result
+{
+    int status;
+    bool done;
+};
+
+static void closeCb(struct raft_uv_transport *transport)
+{
+    struct fixture *f = transport->data;
+    f->n_closed++;
+}
+
+static void acceptCb(struct raft_uv_transport *t,
+                     raft_id id,
+                     const char *address,
+                     unsigned channel,
+                     struct uv_stream_s *stream)
+{
+    struct fixture *f = t->data;
+    munit_assert_int(id, ==, 2);
+    munit_assert_string_equal(address, f->client_address);
+    f->accepted = true;
+    f->channel = channel;
+    uv_close((struct uv_handle_s *)stream, (uv_close_cb)raft_free);
+}
+
+static void connectCbAssertResult(struct raft_uv_connect *req,
+                                  struct uv_stream_s *stream,
+                                  int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    if (status == 0) {
+        uv_close((struct uv_handle_s *)stream, (uv_close_cb)raft_free);
+    }
+    result->done = true;
+}
+
+/* Submit a connect request over the given channel and wait for it to complete
+ * with the given status. */
+#define CONNECT(ADDRESS, CHANNEL, STATUS)                      \
+    {                                                          \
+        struct raft_uv_connect _req;                           \
+        struct result _result = {STATUS, false};               \
+        int _rv;                                               \
+        _req.data = &_result;                                  \
+        _req.channel = CHANNEL;                                \
+        _rv = f->client.connect(&f->client, &_req, 1, ADDRESS, \
+                                connectCbAssertResult);        \
+        munit_assert_int(_rv, ==, 0);                          \
+        LOOP_RUN_UNTIL(&_result.done);                         \
+    }
+
+/* Run the loop until the close callback of N transports has fired, then reset
+ * the count for the tear down. */
+#define LOOP_RUN_UNTIL_N_CLOSED(N)  \
+    do {                            \
+        while (f->n_closed < N) {   \
+            LOOP_RUN(1);            \
+        }                           \
+        f->n_closed = 0;            \
+    } while (0)
+
+/******************************************************************************
+ *
+ * Set up and tear down.
+ *
+ *****************************************************************************/
+
+static void *setUp(const MunitParameter params[], void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    int rv;
+    SET_UP_DIR;
+    SET_UP_HEAP;
+    SETUP_LOOP;
+    sprintf(f->server_address, "%s/server", f->dir);
+    sprintf(f->client_address, "%s/client", f->dir);
+    rv = raft_uv_unix_init(&f->server, &f->loop);
+    munit_assert_int(rv, ==, 0);
+    rv = raft_uv_unix_init(&f->client, &f->loop);
+    munit_assert_int(rv, ==, 0);
+    f->server.data = f;
+    f->client.data = f;
+    rv = f->server.init(&f->server, 1, f->server_address);
+    munit_assert_int(rv, ==, 0);
+    rv = f->client.init(&f->client, 2, f->client_address);
+    munit_assert_int(rv, ==, 0);
+    f->accepted = false;
+    f->n_closed = 0;
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    if (f == NULL) {
+        return;
+    }
+    f->server.close(&f->server, closeCb);
+    f->client.close(&f->client, closeCb);
+    while (f->n_closed < 2) {
+        LOOP_RUN(1);
+    }
+    raft_uv_unix_close(&f->client);
+    raft_uv_unix_close(&f->server);
+    TEAR_DOWN_LOOP;
+    TEAR_DOWN_HEAP;
+    TEAR_DOWN_DIR;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Unix domain socket transport
+ *
+ *****************************************************************************/
+
+SUITE(unix_socket)
+
+/* Connect to a listening transport, performing the handshake. */
+TEST(unix_socket, connect, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    int rv;
+    rv = f->server.listen(&f->server, acceptCb);
+    munit_assert_int(rv, ==, 0);
+    CONNECT(f->server_address, RAFT_UV_CHANNEL_CONTROL, 0);
+    LOOP_RUN_UNTIL(&f->accepted);
+    return MUNIT_OK;
+}
+
+/* Connect over a channel other than the control one. */
+TEST(unix_socket, connectChannel, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    int rv;
+    rv = f->server.listen(&f->server, acceptCb);
+    munit_assert_int(rv, ==, 0);
+    CONNECT(f->server_address, RAFT_UV_CHANNEL_LOG, 0);
+    LOOP_RUN_UNTIL(&f->accepted);
+    munit_assert_int(f->channel, ==, RAFT_UV_CHANNEL_LOG);
+    return MUNIT_OK;
+}
+
+/* A socket file left behind by a previous run gets replaced. */
+TEST(unix_socket, staleSocket, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct sockaddr_un addr;
+    int fd;
+    int rv;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    munit_assert_int(fd, >=, 0);
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, f->server_address);
+    rv = bind(fd, (const struct sockaddr *)&addr, sizeof addr);
+    munit_assert_int(rv, ==, 0);
+    close(fd);
+    rv = f->server.listen(&f->server, acceptCb);
+    munit_assert_int(rv, ==, 0);
+    CONNECT(f->server_address, RAFT_UV_CHANNEL_CONTROL, 0);
+    LOOP_RUN_UNTIL(&f->accepted);
+    return MUNIT_OK;
+}
+
+/* A file at the address which is not a socket is left alone. */
+TEST(unix_socket, notSocket, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct stat sb;
+    FILE *file;
+    char errmsg[512];
+    int rv;
+    file = fopen(f->server_address, "w");
+    munit_assert_ptr_not_null(file);
+    fclose(file);
+    rv = f->server.listen(&f->server, acceptCb);
+    munit_assert_int(rv, ==, RAFT_DUPLICATEADDRESS);
+    sprintf(errmsg, "%s exists and is not a socket", f->server_address);
+    munit_assert_string_equal(f->server.errmsg, errmsg);
+    rv = stat(f->server_address, &sb);
+    munit_assert_int(rv, ==, 0);
+    munit_assert_true(S_ISREG(sb.st_mode));
+    return MUNIT_OK;
+}
+
+/* Another transport is listening at the address. */
+TEST(unix_socket, inUse, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_uv_transport other;
+    char errmsg[512];
+    int rv;
+    rv = f->server.listen(&f->server, acceptCb);
+    munit_assert_int(rv, ==, 0);
+    rv = raft_uv_unix_init(&other, &f->loop);
+    munit_assert_int(rv, ==, 0);
+    other.data = f;
+    rv = other.init(&other, 3, f->server_address);
+    munit_assert_int(rv, ==, 0);
+    rv = other.listen(&other, acceptCb);
+    munit_assert_int(rv, ==, RAFT_DUPLICATEADDRESS);
+    sprintf(errmsg, "%s is in use", f->server_address);
+    munit_assert_string_equal(other.errmsg, errmsg);
+    other.close(&other, closeCb);
+    LOOP_RUN_UNTIL_N_CLOSED(1);
+    raft_uv_unix_close(&other);
+    CONNECT(f->server_address, RAFT_UV_CHANNEL_CONTROL, 0);
+    LOOP_RUN_UNTIL(&f->accepted);
+    return MUNIT_OK;
+}
+
+/* The socket file is removed when the transport gets closed. */
+TEST(unix_socket, removeOnClose, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_uv_transport other;
+    char address[256];
+    struct stat sb;
+    int rv;
+    sprintf(address, "%s/other", f->dir);
+    rv = raft_uv_unix_init(&other, &f->loop);
+    munit_assert_int(rv, ==, 0);
+    other.data = f;
+    rv = other.init(&other, 3, address);
+    munit_assert_int(rv, ==, 0);
+    rv = other.listen(&other, acceptCb);
+    munit_assert_int(rv, ==, 0);
+    rv = stat(address, &sb);
+    munit_assert_int(rv, ==, 0);
+    other.close(&other, closeCb);
+    LOOP_RUN_UNTIL_N_CLOSED(1);
+    raft_uv_unix_close(&other);
+    rv = stat(address, &sb);
+    munit_assert_int(rv, ==, -1);
+    return MUNIT_OK;
+}
+
+/* There's no socket file at the given address. */
+TEST(unix_socket, noListener, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CONNECT(f->server_address, RAFT_UV_CHANNEL_CONTROL, RAFT_NOCONNECTION);
+    munit_assert_string_equal(f->client.errmsg,
+                              "uv_pipe_connect(): no such file or directory");
+    return MUNIT_OK;
+}
+
+/* The address exceeds the maximum length of a socket path. */
+TEST(unix_socket, pathTooLong, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_uv_transport transport;
+    char address[512];
+    int rv;
+    memset(address, 'a', sizeof address - 1);
+    address[sizeof address - 1] = 0;
+    rv = raft_uv_unix_init(&transport, &f->loop);
+    munit_assert_int(rv, ==, 0);
+    rv = transport.init(&transport, 3, address);
+    munit_assert_int(rv, ==, RAFT_NAMETOOLONG);
+    munit_assert_string_equal(transport.errmsg, "socket path is too long");
+    raft_uv_unix_close(&transport);
+    return MUNIT_OK;
+}
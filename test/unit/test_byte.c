@@ -115,6 +115,56 @@ TEST(byteGet64Unaligned, success, NULL, NULL, 0, NULL)
     return MUNIT_OK;
 }
 
+/******************************************************************************
+ *
+ * byteVarint
+ *
+ *****************************************************************************/
+
+SUITE(byteVarint)
+
+TEST(byteVarint, roundTrip, NULL, NULL, 0, NULL)
+{
+    uint64_t values[] = {0, 1, 127, 128, 300, UINT32_MAX, UINT64_MAX};
+    uint8_t buf[10];
+    unsigned i;
+    for (i = 0; i < sizeof values / sizeof *values; i++) {
+        void *cursor1 = buf;
+        const void *cursor2 = buf;
+        uint64_t value;
+        bytePutVarint(&cursor1, values[i]);
+        munit_assert_ptr_equal(cursor1, buf + byteSizeofVarint(values[i]));
+        munit_assert_true(byteGetVarint(&cursor2, buf + sizeof buf, &value));
+        munit_assert_ptr_equal(cursor2, cursor1);
+        munit_assert_int(value, ==, values[i]);
+    }
+    munit_assert_int(byteSizeofVarint(127), ==, 1);
+    munit_assert_int(byteSizeofVarint(128), ==, 2);
+    munit_assert_int(byteSizeofVarint(UINT64_MAX), ==, 10);
+    return MUNIT_OK;
+}
+
+TEST(byteVarint, truncated, NULL, NULL, 0, NULL)
+{
+    uint8_t buf[2] = {0x80, 0x80};
+    const void *cursor = buf;
+    uint64_t value;
+    munit_assert_false(byteGetVarint(&cursor, buf + sizeof buf, &value));
+    return MUNIT_OK;
+}
+
+TEST(byteVarint, zigZag, NULL, NULL, 0, NULL)
+{
+    int64_t values[] = {0, -1, 1, -64, 64, INT64_MIN, INT64_MAX};
+    unsigned i;
+    munit_assert_int(byteZigZag(-1), ==, 1);
+    munit_assert_int(byteZigZag(1), ==, 2);
+    for (i = 0; i < sizeof values / sizeof *values; i++) {
+        munit_assert_int(byteUnZigZag(byteZigZag(values[i])), ==, values[i]);
+    }
+    return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * byteSha1
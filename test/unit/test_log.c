@@ -221,6 +221,82 @@ TEST(logNumEntries, offsetNotEmpty, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/******************************************************************************
+ *
+ * logNumBytes
+ *
+ *****************************************************************************/
+
+SUITE(logNumBytes)
+
+/* If the log is empty, the return value is zero. */
+TEST(logNumBytes, empty, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    munit_assert_int(logNumBytes(&f->log), ==, 0);
+    return MUNIT_OK;
+}
+
+/* The size of the payloads of appended entries is accounted. */
+TEST(logNumBytes, append, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND_MANY(1 /* term */, 3 /* n entries */);
+    munit_assert_int(logNumBytes(&f->log), ==, 3 * 8);
+    return MUNIT_OK;
+}
+
+/* Entries removed by snapshots and truncations are not accounted anymore. */
+TEST(logNumBytes, snapshotAndTruncate, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND_MANY(1 /* term */, 5 /* n entries */);
+    SNAPSHOT(3 /* last index */, 1 /* trailing */);
+    munit_assert_int(logNumBytes(&f->log), ==, 3 * 8);
+    TRUNCATE(5);
+    munit_assert_int(logNumBytes(&f->log), ==, 2 * 8);
+    RESTORE(6 /* last index */, 1 /* last term */);
+    munit_assert_int(logNumBytes(&f->log), ==, 0);
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * logNumBytesBetween
+ *
+ *****************************************************************************/
+
+SUITE(logNumBytesBetween)
+
+/* The size of a range of entries is computed from the running totals. */
+TEST(logNumBytesBetween, range, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND_MANY(1 /* term */, 3 /* n entries */);
+    munit_assert_int(logNumBytesBetween(&f->log, 1, 1), ==, 8);
+    munit_assert_int(logNumBytesBetween(&f->log, 2, 3), ==, 16);
+    munit_assert_int(logNumBytesBetween(&f->log, 1, 3), ==, 24);
+    return MUNIT_OK;
+}
+
+/* The running totals stay consistent when the log wraps, grows and gets
+ * truncated. */
+TEST(logNumBytesBetween, wrap, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND_MANY(1 /* term */, 5 /* n entries */);
+    SNAPSHOT(4 /* last index */, 1 /* trailing */);
+    APPEND_MANY(1 /* term */, 3 /* n entries */);
+    munit_assert_int(f->log.front, >, f->log.back);
+    munit_assert_int(logNumBytesBetween(&f->log, 4, 8), ==, 40);
+    APPEND_MANY(1 /* term */, 10 /* n entries */);
+    munit_assert_int(logNumBytesBetween(&f->log, 4, 18), ==, 120);
+    TRUNCATE(10 /* index */);
+    APPEND(2 /* term */);
+    munit_assert_int(logNumBytesBetween(&f->log, 9, 10), ==, 16);
+    return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * logLastIndex
@@ -706,6 +782,23 @@ TEST(logAcquire, two, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Acquired entries are accounted as shared until they are released. */
+TEST(logAcquire, shared, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry *entries;
+    unsigned n;
+    APPEND(1 /* term */);
+    APPEND(1 /* term */);
+    munit_assert_int(f->log.shared, ==, 0);
+    ACQUIRE(1 /* index */);
+    munit_assert_int(f->log.shared, ==, 16);
+    RELEASE(1 /* index */);
+    munit_assert_int(f->log.shared, ==, 0);
+    munit_assert_int(f->log.pinned, ==, 0);
+    return MUNIT_OK;
+}
+
 /* Acquire two log entries in a wrapped log. */
 TEST(logAcquire, wrap, setUp, tearDown, 0, NULL)
 {
@@ -936,6 +1029,31 @@ TEST(logTruncate, referenced, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Truncated entries that are still referenced are accounted as pinned until
+ * they are released. */
+TEST(logTruncate, pinned, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry *entries;
+    unsigned n;
+
+    APPEND(1 /* term */);
+    APPEND(1 /* term */);
+    ACQUIRE(1 /* index */);
+    munit_assert_int(f->log.shared, ==, 16);
+
+    TRUNCATE(2 /* index */);
+    munit_assert_int(f->log.bytes, ==, 8);
+    munit_assert_int(f->log.shared, ==, 8);
+    munit_assert_int(f->log.pinned, ==, 8);
+
+    RELEASE(1 /* index */);
+    munit_assert_int(f->log.shared, ==, 0);
+    munit_assert_int(f->log.pinned, ==, 0);
+
+    return MUNIT_OK;
+}
+
 /* Truncate all entries belonging to a batch. */
 TEST(logTruncate, batch, setUp, tearDown, 0, NULL)
 {
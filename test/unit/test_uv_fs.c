@@ -151,26 +151,26 @@ TEST(UvFsOpenFileForReading, noExists, DirSetUp, DirTearDown, 0, NULL)
 
 /* Allocate a file with the given parameters and assert that no error occurred.
  */
-#define ALLOCATE_FILE(DIR, FILENAME, SIZE)                           \
-    {                                                                \
-        uv_file fd_;                                                 \
-        char errmsg_;                                                \
-        int rv_;                                                     \
-        rv_ = UvFsAllocateFile(DIR, FILENAME, SIZE, &fd_, &errmsg_); \
-        munit_assert_int(rv_, ==, 0);                                \
-        munit_assert_int(UvOsClose(fd_), ==, 0);                     \
+#define ALLOCATE_FILE(DIR, FILENAME, SIZE)                                 \
+    {                                                                      \
+        uv_file fd_;                                                       \
+        char errmsg_;                                                      \
+        int rv_;                                                           \
+        rv_ = UvFsAllocateFile(DIR, FILENAME, SIZE, true, &fd_, &errmsg_); \
+        munit_assert_int(rv_, ==, 0);                                      \
+        munit_assert_int(UvOsClose(fd_), ==, 0);                           \
     }
 
 /* Assert that creating a file with the given parameters fails with the given
  * code and error message. */
-#define ALLOCATE_FILE_ERROR(DIR, FILENAME, SIZE, RV, ERRMSG)        \
-    {                                                               \
-        uv_file fd_;                                                \
-        char errmsg_[RAFT_ERRMSG_BUF_SIZE];                         \
-        int rv_;                                                    \
-        rv_ = UvFsAllocateFile(DIR, FILENAME, SIZE, &fd_, errmsg_); \
-        munit_assert_int(rv_, ==, RV);                              \
-        munit_assert_string_equal(errmsg_, ERRMSG);                 \
+#define ALLOCATE_FILE_ERROR(DIR, FILENAME, SIZE, RV, ERRMSG)              \
+    {                                                                     \
+        uv_file fd_;                                                      \
+        char errmsg_[RAFT_ERRMSG_BUF_SIZE];                               \
+        int rv_;                                                          \
+        rv_ = UvFsAllocateFile(DIR, FILENAME, SIZE, true, &fd_, errmsg_); \
+        munit_assert_int(rv_, ==, RV);                                    \
+        munit_assert_string_equal(errmsg_, ERRMSG);                       \
     }
 
 SUITE(UvFsAllocateFile)
@@ -0,0 +1,68 @@
+/* Decode a binary trace ring dumped to a file, or mapped from a file by the
+ * traced process, printing one line per recorded event. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/raft.h"
+
+/* Read the whole content of the given file into a newly allocated buffer. */
+static void *readFile(const char *path, size_t *size)
+{
+    FILE *f;
+    void *buf = NULL;
+    long len;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    if (fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 ||
+        fseek(f, 0, SEEK_SET) != 0) {
+        perror(path);
+        goto out;
+    }
+    buf = malloc(len > 0 ? (size_t)len : 1);
+    if (buf == NULL) {
+        fprintf(stderr, "%s: out of memory\n", path);
+        goto out;
+    }
+    if (fread(buf, 1, (size_t)len, f) != (size_t)len) {
+        fprintf(stderr, "%s: short read\n", path);
+        free(buf);
+        buf = NULL;
+        goto out;
+    }
+    *size = (size_t)len;
+
+out:
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char *argv[])
+{
+    void *buf;
+    size_t size;
+    int rv;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <trace-ring-file>\n", argv[0]);
+        return 2;
+    }
+
+    buf = readFile(argv[1], &size);
+    if (buf == NULL) {
+        return 1;
+    }
+
+    rv = raft_trace_ring_decode(buf, size, stdout);
+    free(buf);
+    if (rv != 0) {
+        fprintf(stderr, "%s: %s\n", argv[1], raft_strerror(rv));
+        return 1;
+    }
+
+    return 0;
+}